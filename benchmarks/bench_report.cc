@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "bench_report.h"
+
+#include "pdlfs-common/histogram.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <algorithm>
+
+namespace pdlfs {
+namespace ioclient {
+
+void MergeCounts(double duration, int ops, int errors, double* max_duration,
+                 int* total_ops, int* total_errors) {
+  MPI_Reduce(&duration, max_duration, 1, MPI_DOUBLE, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+  // All clients learn the error count so they can stop together
+  MPI_Allreduce(&errors, total_errors, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Reduce(&ops, total_ops, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+}
+
+void GatherLatencies(const std::vector<double>& latencies,
+                     std::vector<double>* result) {
+  int rank;
+  int size;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  int n = static_cast<int>(latencies.size());
+  std::vector<int> counts(size, 0);
+  MPI_Gather(&n, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+  std::vector<int> displs(size, 0);
+  int total = 0;
+  for (int i = 0; i < size; i++) {
+    displs[i] = total;
+    total += counts[i];
+  }
+  if (rank == 0) {
+    result->resize(total);
+  }
+  MPI_Gatherv(const_cast<double*>(n != 0 ? &latencies[0] : NULL), n,
+              MPI_DOUBLE, total != 0 ? &(*result)[0] : NULL, &counts[0],
+              &displs[0], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
+
+void PrintLatencies(const char* label, const std::vector<double>& latencies) {
+  Histogram hist;
+  hist.Clear();
+  for (size_t i = 0; i < latencies.size(); i++) {
+    hist.Add(latencies[i]);
+  }
+  printf(
+      "-- %s (us): avg %.1f, p50 %.1f, p99 %.1f, p99.9 %.1f, "
+      "max %.1f\n",
+      label, hist.Average(), hist.Median(), hist.Percentile(99),
+      hist.Percentile(99.9),
+      *std::max_element(latencies.begin(), latencies.end()));
+}
+
+}  // namespace ioclient
+}  // namespace pdlfs
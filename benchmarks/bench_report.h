@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <vector>
+
+namespace pdlfs {
+namespace ioclient {
+
+// Combine the local timing and counts of all clients. Rank 0 gets the
+// longest duration and the total number of ops. All clients get the total
+// number of errors. Must be called by all clients.
+void MergeCounts(double duration, int ops, int errors, double* max_duration,
+                 int* total_ops, int* total_errors);
+
+// Collect the latency samples of all clients at rank 0. Samples are stored
+// in *result at rank 0 and are left untouched at other ranks.
+// Must be called by all clients.
+void GatherLatencies(const std::vector<double>& latencies,
+                     std::vector<double>* result);
+
+// Print a one-line summary of a non-empty set of latency samples, in
+// microseconds, after a given label.
+void PrintLatencies(const char* label, const std::vector<double>& latencies);
+
+}  // namespace ioclient
+}  // namespace pdlfs
@@ -29,6 +29,8 @@ IOClient* IOClient::Factory(const IOClientOptions& raw_options) {
   }
   if (fs == "deltafs") {
     return IOClient::Deltafs(options);
+  } else if (fs == "plfsdir") {
+    return IOClient::Plfsdir(options);
   } else {
     return IOClient::Default(options);
   }
@@ -13,6 +13,10 @@
 
 #include "pdlfs-common/status.h"
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 namespace pdlfs {
 namespace ioclient {
 
@@ -43,6 +47,8 @@ class IOClient {
   static IOClient* Default(const IOClientOptions&);
   // Open a client backed by Deltafs
   static IOClient* Deltafs(const IOClientOptions&);
+  // Open a client that stores dirs as plfsdirs on the local FS
+  static IOClient* Plfsdir(const IOClientOptions&);
 
   IOClient() {}
   virtual ~IOClient();
@@ -59,6 +65,22 @@ class IOClient {
   virtual Status FlushEpoch(Dir* dir) = 0;
   virtual Status CloseDir(Dir* dir) = 0;
   virtual Status MakeDir(const std::string& path) = 0;
+  // List the names of all entries of a dir.
+  virtual Status ListDir(const std::string& path,
+                         std::vector<std::string>* names) = 0;
+
+  // Read operations. An epoch of -1 refers to all epochs. Clients that do
+  // not keep data by epoch return NotSupported for any other epoch.
+  // Read all data appended to a file during a given epoch.
+  virtual Status ReadAt(Dir* dir, const std::string& file, int epoch,
+                        std::string* data) = 0;
+  // Read all files of a dir that were appended to during a given epoch.
+  // Store the number of files and bytes read in *num_files and *num_bytes.
+  virtual Status ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                         uint64_t* num_bytes) = 0;
+  // Return the total number of bytes fetched from the underlying storage
+  // through a dir, which may exceed the number of bytes returned by reads.
+  virtual uint64_t BytesRead(Dir* dir) = 0;
 
  private:
   // No copying allowed
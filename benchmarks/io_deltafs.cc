@@ -58,9 +58,12 @@ class DeltafsClient : public IOClient {
   virtual ~DeltafsClient() {}
 
   struct DeltafsDir : public Dir {
-    explicit DeltafsDir(int fd) : fd(fd) {}
+    DeltafsDir(int fd, const std::string& path)
+        : fd(fd), path(path), bytes_read(0) {}
     virtual ~DeltafsDir() {}
     int fd;
+    std::string path;  // Used to list the dir during scans
+    uint64_t bytes_read;
   };
 
   static inline DeltafsDir* ToDeltafsDir(Dir* dir) {
@@ -76,12 +79,19 @@ class DeltafsClient : public IOClient {
   virtual Status NewFile(const std::string& path);
   virtual Status DelFile(const std::string& path);
   virtual Status MakeDir(const std::string& path);
+  virtual Status ListDir(const std::string& path,
+                         std::vector<std::string>* names);
   virtual Status GetAttr(const std::string& path);
   virtual Status OpenDir(const std::string& path, Dir**);
   virtual Status FlushEpoch(Dir* dir);
   virtual Status CloseDir(Dir* dir);
   virtual Status AppendAt(Dir* dir, const std::string& file, const char* data,
                           size_t size);
+  virtual Status ReadAt(Dir* dir, const std::string& file, int epoch,
+                        std::string* data);
+  virtual Status ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                         uint64_t* num_bytes);
+  virtual uint64_t BytesRead(Dir* dir);
 
   virtual Status Dispose();
   virtual Status Init();
@@ -164,6 +174,28 @@ Status DeltafsClient::MakeDir(const std::string& path) {
   return s;
 }
 
+static int AddName(const char* name, void* arg) {
+  reinterpret_cast<std::vector<std::string>*>(arg)->push_back(name);
+  return 0;
+}
+
+Status DeltafsClient::ListDir(const std::string& path,
+                              std::vector<std::string>* names) {
+  const char* p = path.c_str();
+#if VERBOSE >= 10
+  if (kVVerbose) printf("deltafs_listdir %s...\n", p);
+#endif
+  Status s;
+  int r = deltafs_listdir(p, AddName, names);
+  if (r != 0) {
+    s = IOError(path);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
 Status DeltafsClient::GetAttr(const std::string& path) {
   const char* p = path.c_str();
 #if VERBOSE >= 10
@@ -197,7 +229,7 @@ Status DeltafsClient::OpenDir(const std::string& path, Dir** dirptr) {
   if (fd == -1) {
     s = IOError(path);
   } else {
-    *dirptr = new DeltafsDir(fd);
+    *dirptr = new DeltafsDir(fd, path);
   }
 #if VERBOSE >= 10
   if (kVVerbose) print(s);
@@ -268,6 +300,87 @@ Status DeltafsClient::AppendAt(Dir* dir, const std::string& file,
   return s;
 }
 
+// Deltafs does not expose epochs through its file API. Only reads of all
+// epochs are supported.
+Status DeltafsClient::ReadAt(Dir* dir, const std::string& file, int epoch,
+                             std::string* data) {
+  Status s;
+  DeltafsDir* const d = ToDeltafsDir(dir);
+  char tmp[25];
+  snprintf(tmp, sizeof(tmp), "dir#%d + ", d->fd);
+  std::string path = tmp;
+  path += file;
+#if VERBOSE >= 10
+  const char* p = path.c_str();
+  if (kVVerbose) printf("deltafs_read %s...\n", p);
+#endif
+  data->clear();
+  if (epoch != -1) {
+    return Status::NotSupported(Slice());
+  }
+  int fd = deltafs_openat(d->fd, file.c_str(), O_RDONLY, 0);
+  if (fd == -1) {
+    s = IOError(path);
+  } else {
+    // A read of a plfs file always returns the file from its beginning, so
+    // we read it with a single large read.
+    std::vector<char> buf(1 << 20);
+    while (true) {
+      ssize_t n = deltafs_read(fd, &buf[0], buf.size());
+      if (n > 0) {
+        data->append(&buf[0], n);
+        d->bytes_read += n;
+      } else if (n != 0) {
+        s = IOError(path);
+      }
+      if (n <= 0 || FLAGS_plfsdir != PLFSDIR_DISABLED) {
+        break;
+      }
+    }
+    deltafs_close(fd);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+// Files are found by listing the dir and are then read one by one.
+Status DeltafsClient::ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                              uint64_t* num_bytes) {
+  DeltafsDir* const d = ToDeltafsDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("scan dir#%d...\n", d->fd);
+#endif
+  *num_files = *num_bytes = 0;
+  if (epoch != -1) {
+    return Status::NotSupported(Slice());
+  }
+  std::vector<std::string> names;
+  Status s = ListDir(d->path, &names);
+  std::string data;
+  for (size_t i = 0; s.ok() && i < names.size(); i++) {
+    if (names[i] == "." || names[i] == "..") {
+      continue;
+    }
+    s = ReadAt(dir, names[i], epoch, &data);
+    if (s.ok()) {
+      *num_files += 1;
+      *num_bytes += data.size();
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+// Deltafs does not report its own I/O so only bytes returned are counted
+uint64_t DeltafsClient::BytesRead(Dir* dir) {
+  DeltafsDir* const d = ToDeltafsDir(dir);
+  return d->bytes_read;
+}
+
 static void MaybeSetVerboseLevel() {
 #if defined(PDLFS_GLOG)
   const char* env = getenv("DELTAFS_Verbose");
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "io_client.h"
+
+#include "deltafs/deltafs_api.h"
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/strutil.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pdlfs {
+namespace ioclient {
+
+static Status IOError(const std::string& target) {
+  if (errno != 0) {
+    return Status::IOError(target, strerror(errno));
+  } else {
+    return Status::IOError(target);
+  }
+}
+
+static Status Mkdir(const std::string& path) {
+  if (access(path.c_str(), F_OK) != 0) {
+    int r = mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+    if (r != 0 && errno != EEXIST) {
+      return IOError(path);
+    }
+  }
+
+  return Status::OK();
+}
+
+// Be very verbose
+static const bool kVVerbose = false;
+// Be verbose
+static const bool kVerbose = true;
+
+// IOClient implementation that stores each dir as a plfsdir on the local FS
+// through the light-weight plfsdir api. Each client writes its own part of
+// a dir and reads the parts of all clients. Files are stored by the hash of
+// their names so they cannot be created, removed, or stat'ed on their own.
+// A dir is opened for writing on its first append and for reading on its
+// first read. The two cannot be mixed on a single dir handle.
+class PlfsdirClient : public IOClient {
+ public:
+  explicit PlfsdirClient(const IOClientOptions& options)
+      : rank_(options.rank), comm_sz_(options.comm_sz) {}
+  virtual ~PlfsdirClient() {}
+
+  struct PlfsDir : public Dir {
+    explicit PlfsDir(const std::string& name)
+        : name(name), writer(NULL), epoch(0) {}
+    virtual ~PlfsDir() {}
+    std::string name;
+    deltafs_plfsdir_t* writer;
+    int epoch;  // Current write epoch
+    // Readers of the parts written by all clients
+    std::vector<deltafs_plfsdir_t*> readers;
+  };
+
+  static inline PlfsDir* ToPlfsDir(Dir* dir) {
+    assert(dir != NULL);
+#ifndef NDEBUG
+    return dynamic_cast<PlfsDir*>(dir);
+#else
+    return static_cast<PlfsDir*>(dir);
+#endif
+  }
+
+  // Common FS operations
+  virtual Status NewFile(const std::string& path);
+  virtual Status DelFile(const std::string& path);
+  virtual Status MakeDir(const std::string& path);
+  virtual Status ListDir(const std::string& path,
+                         std::vector<std::string>* names);
+  virtual Status GetAttr(const std::string& path);
+  virtual Status OpenDir(const std::string& path, Dir**);
+  virtual Status CloseDir(Dir* dir);
+  virtual Status AppendAt(Dir* dir, const std::string& file, const char* data,
+                          size_t size);
+  virtual Status ReadAt(Dir* dir, const std::string& file, int epoch,
+                        std::string* data);
+  virtual Status ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                         uint64_t* num_bytes);
+  virtual uint64_t BytesRead(Dir* dir);
+
+  virtual Status FlushEpoch(Dir* dir);
+  virtual Status Dispose();
+  virtual Status Init();
+
+ private:
+  friend class IOClient;
+  Status OpenWriter(PlfsDir* d);
+  Status OpenReaders(PlfsDir* d);
+  std::string mp_;        // Mount point
+  std::string dir_conf_;  // Options for opening plfsdirs
+  int rank_;
+  int comm_sz_;
+};
+
+// Convenient method for printing status lines
+static inline void print(const Status& s) {
+  printf("> %s\n", s.ToString().c_str());
+}
+
+Status PlfsdirClient::Init() { return Mkdir(mp_); }
+
+Status PlfsdirClient::Dispose() {
+  // Do nothing
+  return Status::OK();
+}
+
+Status PlfsdirClient::NewFile(const std::string& path) {
+  return Status::NotSupported(path);
+}
+
+Status PlfsdirClient::DelFile(const std::string& path) {
+  return Status::NotSupported(path);
+}
+
+Status PlfsdirClient::GetAttr(const std::string& path) {
+  return Status::NotSupported(path);
+}
+
+Status PlfsdirClient::ListDir(const std::string& path,
+                              std::vector<std::string>* names) {
+  return Status::NotSupported(path);
+}
+
+Status PlfsdirClient::MakeDir(const std::string& path) {
+  std::string dirname = mp_ + path;
+#if VERBOSE >= 10
+  if (kVVerbose) printf("mkdir %s...\n", dirname.c_str());
+#endif
+  Status s;
+  if (mkdir(dirname.c_str(), ACCESSPERMS & ~S_IWOTH) != 0) {
+    s = IOError(dirname);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PlfsdirClient::OpenDir(const std::string& path, Dir** dirptr) {
+  *dirptr = new PlfsDir(mp_ + path);
+  return Status::OK();
+}
+
+Status PlfsdirClient::OpenWriter(PlfsDir* d) {
+  assert(d->writer == NULL);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_open %s (w)...\n", d->name.c_str());
+#endif
+  Status s;
+  deltafs_plfsdir_t* h = deltafs_plfsdir_create_handle(
+      dir_conf_.c_str(), O_WRONLY, DELTAFS_PLFSDIR_DEFAULT);
+  if (h == NULL) {
+    s = IOError(d->name);
+  } else {
+    deltafs_plfsdir_set_rank(h, rank_);
+    if (deltafs_plfsdir_open(h, d->name.c_str()) != 0) {
+      s = IOError(d->name);
+      deltafs_plfsdir_free_handle(h);
+    } else {
+      d->writer = h;
+      // Catch up with epochs that ended before the first append
+      for (int e = 0; s.ok() && e < d->epoch; e++) {
+        if (deltafs_plfsdir_epoch_flush(h, e) != 0) {
+          s = IOError(d->name);
+        }
+      }
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PlfsdirClient::OpenReaders(PlfsDir* d) {
+  assert(d->readers.empty());
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_open %s (r)...\n", d->name.c_str());
+#endif
+  Status s;
+  for (int r = 0; s.ok() && r < comm_sz_; r++) {
+    deltafs_plfsdir_t* h = deltafs_plfsdir_create_handle(
+        dir_conf_.c_str(), O_RDONLY, DELTAFS_PLFSDIR_DEFAULT);
+    if (h == NULL) {
+      s = IOError(d->name);
+    } else {
+      deltafs_plfsdir_set_rank(h, r);
+      if (deltafs_plfsdir_open(h, d->name.c_str()) != 0) {
+        s = IOError(d->name);
+        deltafs_plfsdir_free_handle(h);
+      } else {
+        d->readers.push_back(h);
+      }
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PlfsdirClient::CloseDir(Dir* dir) {
+  Status s;
+  PlfsDir* d = ToPlfsDir(dir);
+  if (d != NULL) {
+    if (d->writer != NULL) {
+      if (deltafs_plfsdir_finish(d->writer) != 0) {
+        s = IOError(d->name);
+      }
+      deltafs_plfsdir_free_handle(d->writer);
+    }
+    for (size_t i = 0; i < d->readers.size(); i++) {
+      deltafs_plfsdir_free_handle(d->readers[i]);
+    }
+    delete d;
+  }
+  return s;
+}
+
+Status PlfsdirClient::FlushEpoch(Dir* dir) {
+  Status s;
+  PlfsDir* d = ToPlfsDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_epoch_flush %s...\n", d->name.c_str());
+#endif
+  if (d->writer != NULL) {
+    if (deltafs_plfsdir_epoch_flush(d->writer, d->epoch) != 0) {
+      s = IOError(d->name);
+    }
+  }
+  if (s.ok()) {
+    d->epoch++;
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PlfsdirClient::AppendAt(Dir* dir, const std::string& file,
+                               const char* data, size_t size) {
+  Status s;
+  PlfsDir* d = ToPlfsDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_append %s...\n", file.c_str());
+#endif
+  if (!d->readers.empty()) {
+    s = Status::AssertionFailed("Dir opened for reading", d->name);
+  } else if (d->writer == NULL) {
+    s = OpenWriter(d);
+  }
+  if (s.ok()) {
+    ssize_t n =
+        deltafs_plfsdir_append(d->writer, file.c_str(), d->epoch, data, size);
+    if (n < 0 || static_cast<size_t>(n) != size) {
+      s = IOError(file);
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PlfsdirClient::ReadAt(Dir* dir, const std::string& file, int epoch,
+                             std::string* data) {
+  Status s;
+  PlfsDir* d = ToPlfsDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_read %s...\n", file.c_str());
+#endif
+  data->clear();
+  if (d->writer != NULL) {
+    s = Status::AssertionFailed("Dir opened for writing", d->name);
+  } else if (d->readers.empty()) {
+    s = OpenReaders(d);
+  }
+  // A file may have been written by any client so we look at all parts
+  for (size_t i = 0; s.ok() && i < d->readers.size(); i++) {
+    size_t n = 0;
+    errno = 0;
+    void* buf = deltafs_plfsdir_read(d->readers[i], file.c_str(), epoch, &n,
+                                     NULL, NULL);
+    if (buf != NULL) {
+      data->append(static_cast<char*>(buf), n);
+      free(buf);
+    } else if (errno != 0) {
+      s = IOError(file);
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+namespace {
+struct ScanState {
+  uint64_t num_bytes;
+};
+
+int ScanSaver(void* arg, const char* key, size_t keylen, const char* value,
+              size_t sz) {
+  reinterpret_cast<ScanState*>(arg)->num_bytes += sz;
+  return 0;
+}
+}  // namespace
+
+Status PlfsdirClient::ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                              uint64_t* num_bytes) {
+  Status s;
+  PlfsDir* d = ToPlfsDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("plfsdir_scan %s...\n", d->name.c_str());
+#endif
+  *num_files = *num_bytes = 0;
+  if (d->writer != NULL) {
+    s = Status::AssertionFailed("Dir opened for writing", d->name);
+  } else if (d->readers.empty()) {
+    s = OpenReaders(d);
+  }
+  for (size_t i = 0; s.ok() && i < d->readers.size(); i++) {
+    ScanState state;
+    state.num_bytes = 0;
+    ssize_t n = deltafs_plfsdir_scan(d->readers[i], epoch, ScanSaver, &state);
+    if (n < 0) {
+      s = IOError(d->name);
+    } else {
+      *num_files += n;
+      *num_bytes += state.num_bytes;
+    }
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+uint64_t PlfsdirClient::BytesRead(Dir* dir) {
+  PlfsDir* d = ToPlfsDir(dir);
+  uint64_t result = 0;
+  for (size_t i = 0; i < d->readers.size(); i++) {
+    long long n = deltafs_plfsdir_get_integer_property(d->readers[i],
+                                                       "io.total_bytes_read");
+    if (n > 0) {
+      result += n;
+    }
+  }
+  return result;
+}
+
+// Fetch the mount point and the plfsdir options from the given configuration
+// string, such as "mount_point=/tmp/ioclient;dir_options=lg_parts=2"
+static void ParseConf(const IOClientOptions& options, std::string* mp,
+                      std::string* dir_conf) {
+  *mp = "/tmp/ioclient";  // Allow falling back to the default mount point
+  std::vector<std::string> confs;
+  SplitString(&confs, options.conf_str.c_str());
+  for (size_t i = 0; i < confs.size(); i++) {
+    Slice input = confs[i];
+    if (input.starts_with("mount_point=")) {
+      input.remove_prefix(Slice("mount_point=").size());
+      *mp = input.ToString();
+    } else if (input.starts_with("dir_options=")) {
+      input.remove_prefix(Slice("dir_options=").size());
+      *dir_conf = input.ToString();
+    }
+  }
+#if VERBOSE >= 2
+  if (options.rank == 0) {
+    if (kVerbose) {
+      printf("mount_point -> %s\n", mp->c_str());
+      printf("dir_options -> %s\n", dir_conf->c_str());
+    }
+  }
+#endif
+}
+
+IOClient* IOClient::Plfsdir(const IOClientOptions& options) {
+  PlfsdirClient* cli = new PlfsdirClient(options);
+  ParseConf(options, &cli->mp_, &cli->dir_conf_);
+  return cli;
+}
+
+}  // namespace ioclient
+}  // namespace pdlfs
@@ -15,9 +15,11 @@
 #include "pdlfs-common/strutil.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -51,13 +53,14 @@ static const bool kVerbose = true;
 // IOClient implementation that uses local FS as its backend file system.
 class PosixClient : public IOClient {
  public:
-  explicit PosixClient() : mp_size_(0) {}
+  explicit PosixClient() {}
   virtual ~PosixClient() {}
 
   struct PosixDir : public Dir {
-    explicit PosixDir(int fd) : fd(fd) {}
+    explicit PosixDir(int fd) : fd(fd), bytes_read(0) {}
     virtual ~PosixDir() {}
     int fd;
+    uint64_t bytes_read;
   };
 
   static inline PosixDir* ToPosixDir(Dir* dir) {
@@ -73,11 +76,18 @@ class PosixClient : public IOClient {
   virtual Status NewFile(const std::string& path);
   virtual Status DelFile(const std::string& path);
   virtual Status MakeDir(const std::string& path);
+  virtual Status ListDir(const std::string& path,
+                         std::vector<std::string>* names);
   virtual Status GetAttr(const std::string& path);
   virtual Status OpenDir(const std::string& path, Dir**);
   virtual Status CloseDir(Dir* dir);
   virtual Status AppendAt(Dir* dir, const std::string& file, const char* data,
                           size_t size);
+  virtual Status ReadAt(Dir* dir, const std::string& file, int epoch,
+                        std::string* data);
+  virtual Status ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                         uint64_t* num_bytes);
+  virtual uint64_t BytesRead(Dir* dir);
 
   virtual Status FlushEpoch(Dir* dir);
   virtual Status Dispose();
@@ -86,8 +96,10 @@ class PosixClient : public IOClient {
  private:
   friend class IOClient;
   void SetMountPoint(const std::string& mp);
-  std::string path_buf_;  // Buffer space for generating file paths
-  size_t mp_size_;        // Length of the mount point
+  Status ReadFile(PosixDir* d, const char* filename, std::string* data);
+  // Paths are generated in local buffers so that a client can be shared by
+  // multiple threads
+  std::string mp_;  // Mount point
 };
 
 // Convenient method for printing status lines
@@ -96,10 +108,8 @@ static inline void print(const Status& s) {
 }
 
 Status PosixClient::Init() {
-  assert(mp_size_ != 0);                 // Mount point is non-empty
-  assert(path_buf_.size() >= mp_size_);  // Mount point is valid
-  path_buf_.resize(mp_size_);
-  return Mkdir(path_buf_);
+  assert(!mp_.empty());  // Mount point is non-empty
+  return Mkdir(mp_);
 }
 
 Status PosixClient::Dispose() {
@@ -113,15 +123,14 @@ Status PosixClient::FlushEpoch(Dir* dir) {
 }
 
 Status PosixClient::NewFile(const std::string& path) {
-  path_buf_.resize(mp_size_);
-  path_buf_.append(path);
-  const char* filename = path_buf_.c_str();
+  const std::string path_buf = mp_ + path;
+  const char* filename = path_buf.c_str();
 #if VERBOSE >= 10
   if (kVVerbose) printf("mknod %s...\n", filename);
 #endif
   Status s;
   if (mknod(filename, DEFFILEMODE, S_IFREG) != 0) {
-    s = IOError(path_buf_);
+    s = IOError(path_buf);
   } else {
     // Do nothing
   }
@@ -132,15 +141,14 @@ Status PosixClient::NewFile(const std::string& path) {
 }
 
 Status PosixClient::DelFile(const std::string& path) {
-  path_buf_.resize(mp_size_);
-  path_buf_.append(path);
-  const char* filename = path_buf_.c_str();
+  const std::string path_buf = mp_ + path;
+  const char* filename = path_buf.c_str();
 #if VERBOSE >= 10
   if (kVVerbose) printf("unlink %s...\n", filename);
 #endif
   Status s;
   if (unlink(filename) != 0) {
-    s = IOError(path_buf_);
+    s = IOError(path_buf);
   } else {
     // Do nothing
   }
@@ -151,15 +159,14 @@ Status PosixClient::DelFile(const std::string& path) {
 }
 
 Status PosixClient::MakeDir(const std::string& path) {
-  path_buf_.resize(mp_size_);
-  path_buf_.append(path);
-  const char* dirname = path_buf_.c_str();
+  const std::string path_buf = mp_ + path;
+  const char* dirname = path_buf.c_str();
 #if VERBOSE >= 10
   if (kVVerbose) printf("mkdir %s...\n", dirname);
 #endif
   Status s;
   if (mkdir(dirname, ACCESSPERMS & ~S_IWOTH) != 0) {
-    s = IOError(path_buf_);
+    s = IOError(path_buf);
   } else {
     // Do nothing
   }
@@ -169,17 +176,43 @@ Status PosixClient::MakeDir(const std::string& path) {
   return s;
 }
 
+Status PosixClient::ListDir(const std::string& path,
+                            std::vector<std::string>* names) {
+  const std::string path_buf = mp_ + path;
+  const char* dirname = path_buf.c_str();
+#if VERBOSE >= 10
+  if (kVVerbose) printf("readdir %s...\n", dirname);
+#endif
+  Status s;
+  DIR* dirp = opendir(dirname);
+  if (dirp == NULL) {
+    s = IOError(path_buf);
+  } else {
+    struct dirent* entry;
+    while ((entry = readdir(dirp)) != NULL) {
+      const char* const name = entry->d_name;
+      if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+        names->push_back(name);
+      }
+    }
+    closedir(dirp);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
 Status PosixClient::GetAttr(const std::string& path) {
-  path_buf_.resize(mp_size_);
-  path_buf_.append(path);
-  const char* nodename = path_buf_.c_str();
+  const std::string path_buf = mp_ + path;
+  const char* nodename = path_buf.c_str();
 #if VERBOSE >= 10
   if (kVVerbose) printf("stat %s...\n", nodename);
 #endif
   Status s;
   struct stat statbuf;
   if (stat(nodename, &statbuf) != 0) {
-    s = IOError(path_buf_);
+    s = IOError(path_buf);
   } else {
     // Do nothing
   }
@@ -190,16 +223,15 @@ Status PosixClient::GetAttr(const std::string& path) {
 }
 
 Status PosixClient::OpenDir(const std::string& path, Dir** dirptr) {
-  path_buf_.resize(mp_size_);
-  path_buf_.append(path);
-  const char* dirname = path_buf_.c_str();
+  const std::string path_buf = mp_ + path;
+  const char* dirname = path_buf.c_str();
 #if VERBOSE >= 10
   if (kVVerbose) printf("open %s...\n", dirname);
 #endif
   Status s;
   int fd = open(dirname, O_DIRECTORY | O_RDONLY);
   if (fd == -1) {
-    s = IOError(path_buf_);
+    s = IOError(path_buf);
   } else {
     *dirptr = new PosixDir(fd);
   }
@@ -243,12 +275,107 @@ Status PosixClient::AppendAt(Dir* dir, const std::string& file,
   return s;
 }
 
+Status PosixClient::ReadFile(PosixDir* d, const char* filename,
+                             std::string* data) {
+  Status s;
+  int fd = openat(d->fd, filename, O_RDONLY);
+  if (fd == -1) {
+    s = IOError(filename);
+  } else {
+    char buf[4096];
+    while (true) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n > 0) {
+        data->append(buf, n);
+        d->bytes_read += n;
+      } else {
+        if (n != 0) {
+          s = IOError(filename);
+        }
+        break;
+      }
+    }
+    close(fd);
+  }
+  return s;
+}
+
+// The local FS does not keep data by epoch. Only reads of all epochs are
+// supported.
+Status PosixClient::ReadAt(Dir* dir, const std::string& file, int epoch,
+                           std::string* data) {
+  const char* filename = file.c_str();
+  PosixDir* d = ToPosixDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("read %s...\n", filename);
+#endif
+  Status s;
+  data->clear();
+  if (epoch != -1) {
+    s = Status::NotSupported(Slice());
+  } else {
+    s = ReadFile(d, filename, data);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+Status PosixClient::ScanDir(Dir* dir, int epoch, uint64_t* num_files,
+                            uint64_t* num_bytes) {
+  PosixDir* d = ToPosixDir(dir);
+#if VERBOSE >= 10
+  if (kVVerbose) printf("scan dir#%d...\n", d->fd);
+#endif
+  Status s;
+  *num_files = *num_bytes = 0;
+  if (epoch != -1) {
+    return Status::NotSupported(Slice());
+  }
+  // closedir() closes the fd given to fdopendir() so we give it a copy
+  int fd = dup(d->fd);
+  DIR* dirp = fd != -1 ? fdopendir(fd) : NULL;
+  if (dirp == NULL) {
+    s = IOError("dir");
+    if (fd != -1) {
+      close(fd);
+    }
+  } else {
+    rewinddir(dirp);
+    std::string data;
+    struct dirent* entry;
+    while (s.ok() && (entry = readdir(dirp)) != NULL) {
+      const char* const name = entry->d_name;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        continue;
+      }
+      data.clear();
+      s = ReadFile(d, name, &data);
+      if (s.ok()) {
+        *num_files += 1;
+        *num_bytes += data.size();
+      }
+    }
+    closedir(dirp);
+  }
+#if VERBOSE >= 10
+  if (kVVerbose) print(s);
+#endif
+  return s;
+}
+
+// All bytes are read on behalf of the caller
+uint64_t PosixClient::BytesRead(Dir* dir) {
+  PosixDir* d = ToPosixDir(dir);
+  return d->bytes_read;
+}
+
 // REQUIRES: mp is a valid absolute file system path
 void PosixClient::SetMountPoint(const std::string& mp) {
   assert(mp.size() != 0);
   assert(mp[0] == '/');
-  mp_size_ = mp.size();
-  path_buf_ = mp;
+  mp_ = mp;
 }
 
 // Fetch the mount point from the given configuration string
@@ -279,7 +406,6 @@ static std::string MP(const IOClientOptions& options) {
 IOClient* IOClient::Default(const IOClientOptions& options) {
   PosixClient* cli = new PosixClient;
   cli->SetMountPoint(MP(options));
-  cli->path_buf_.reserve(256);
   return cli;
 }
 
@@ -10,19 +10,34 @@
  */
 
 #include <getopt.h>
+#include <math.h>
 #include <mpi.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/hash.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/strutil.h"
 
 // Abstract FS interface
 #include "../io_client.h"
+// Report helpers shared by all benchmarks
+#include "../bench_report.h"
 
 namespace pdlfs {
 
+// Metadata operations issued by the benchmark
+enum LDbenchOp { kCreate, kStat, kReaddir, kUnlink, kNumOps };
+
+static const char* const kOpNames[kNumOps] = {"create", "stat", "readdir",
+                                              "unlink"};
+
 // REQUIRES: callers must explicitly initialize all fields
 struct LDbenchOptions : public ioclient::IOClientOptions {
   // Total number of dirs to create (among all clients)
@@ -40,6 +55,19 @@ struct LDbenchOptions : public ioclient::IOClientOptions {
   bool skip_reads;
   // True to skip the deletion phase.
   bool skip_deletes;
+  // Number of threads per client. All threads share the client's io client.
+  int num_threads;
+  // Relative weights of the operations of the mixed phase, which runs
+  // between the read phase and the deletion phase. The mixed phase is
+  // skipped if all weights are 0.
+  int mix[kNumOps];
+  // Total number of operations of the mixed phase (among all clients)
+  int num_mix_ops;
+  // Target rate of the mixed phase in ops per second per client.
+  // Operations arrive at exponentially distributed intervals whether or
+  // not earlier operations have finished, and their latencies are measured
+  // from their arrival. Set to 0 to issue operations back to back.
+  double arrival_rate;
 };
 
 // REQUIRES: callers must explicitly initialize all fields
@@ -49,14 +77,18 @@ struct LDbenchReport {
   int ops;
   // Total number of errors
   int errors;
+  // Latency of each operation in microseconds, by operation type
+  std::vector<double> latencies[kNumOps];
 };
 
 // A simple benchmark that bulk inserts a large number of empty files
-// into one or more directories.
+// into one or more directories. Each client runs one or more threads.
+// Files are spread over all threads of all clients.
 class LDbench {  // LD stands for large directory
  public:
   LDbench(const LDbenchOptions& options) : options_(options) {
     io_ = ioclient::IOClient::Factory(options_);
+    env_ = Env::Default();
   }
 
   ~LDbench() {
@@ -99,6 +131,18 @@ class LDbench {  // LD stands for large directory
     }
   }
 
+  Status Readdir(int dir_no) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "/d_%d", dir_no);
+    std::vector<std::string> names;
+    Status s = io_->ListDir(tmp, &names);
+    if (options_.ignore_errors) {
+      return Status::OK();
+    } else {
+      return s;
+    }
+  }
+
   Status Delete(int dir_no, int f) {
     char tmp[256];
     snprintf(tmp, sizeof(tmp), "/d_%d/f_%d", dir_no, f);
@@ -155,74 +199,97 @@ class LDbench {  // LD stands for large directory
   // Collectively create files under parent directories.
   // Return a status report with local timing and error counts.
   LDbenchReport BulkCreates() {
-    double start = MPI_Wtime();
-    LDbenchReport report;
-    report.errors = 0;
-    report.ops = 0;
-    Status s;
-    if (!options_.skip_inserts) {
-      for (int f = options_.rank; f < options_.num_files;) {
-        int dir_no = Dir(f) % options_.num_dirs;
-        s = Mknod(dir_no, f);
-        f += options_.comm_sz;
-        if (!s.ok()) {
-          report.errors++;
-          break;
-        } else {
-          report.ops++;
-        }
-      }
-    }
-
-    report.duration = MPI_Wtime() - start;
-    return report;
+    return RunThreads(options_.skip_inserts ? kNumOps : kCreate);
   }
 
   // Collectively touch all created files.
   // Return a status report with local timing and error counts.
   LDbenchReport Touch() {
-    double start = MPI_Wtime();
-    LDbenchReport report;
-    report.errors = 0;
-    report.ops = 0;
-    Status s;
-    if (!options_.skip_reads) {
-      for (int f = options_.rank; f < options_.num_files;) {
-        int dir_no = Dir(f) % options_.num_dirs;
-        s = Fstat(dir_no, f);
-        f += options_.comm_sz;
-        if (!s.ok()) {
-          report.errors++;
-          break;
-        } else {
-          report.ops++;
-        }
-      }
-    }
-
-    report.duration = MPI_Wtime() - start;
-    return report;
+    return RunThreads(options_.skip_reads ? kNumOps : kStat);
   }
 
   // Collectively remove all created files.
   // Return a status report with local timing and error counts.
   LDbenchReport BulkRemoves() {
+    return RunThreads(options_.skip_deletes ? kNumOps : kUnlink);
+  }
+
+  // Collectively run a mix of creates, stats, readdirs, and unlinks.
+  // Stats target the files created by the insertion phase. Unlinks remove
+  // files created earlier by the same thread during this phase and become
+  // creates when there are no such files. Files left by this phase are
+  // removed at its end without being timed.
+  // Return a status report with local timing and error counts.
+  LDbenchReport MixedOps() { return RunThreads(-1); }
+
+  bool HasMixedOps() const {
+    for (int i = 0; i < kNumOps; i++) {
+      if (options_.mix[i] != 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  struct ThreadState {
+    LDbench* bench;
+    // The operation of a bulk phase, kNumOps for none, or -1 for the mixed
+    // phase
+    int op;
+    // Index of the thread among all threads of all clients
+    int id;
+    LDbenchReport report;
+  };
+
+  static void* ThreadBody(void* arg) {
+    ThreadState* const t = reinterpret_cast<ThreadState*>(arg);
+    if (t->op == -1) {
+      t->bench->DoMixedOps(t);
+    } else if (t->op != kNumOps) {
+      t->bench->DoBulkOps(t);
+    }
+    return NULL;
+  }
+
+  // Run a phase on all threads of the client and merge their results.
+  LDbenchReport RunThreads(int op) {
     double start = MPI_Wtime();
+    const int n = std::max(1, options_.num_threads);
+    std::vector<ThreadState> states(n);
+    std::vector<pthread_t> threads(n);
+    std::vector<bool> started(n, false);
+    for (int i = 0; i < n; i++) {
+      states[i].bench = this;
+      states[i].op = op;
+      states[i].id = options_.rank * n + i;
+      states[i].report.errors = 0;
+      states[i].report.ops = 0;
+      states[i].report.duration = 0;
+    }
+    for (int i = 1; i < n; i++) {
+      started[i] =
+          pthread_create(&threads[i], NULL, ThreadBody, &states[i]) == 0;
+    }
+    ThreadBody(&states[0]);
+    for (int i = 1; i < n; i++) {
+      if (started[i]) {
+        pthread_join(threads[i], NULL);
+      } else {
+        ThreadBody(&states[i]);  // Run inline if the thread failed to start
+      }
+    }
+
     LDbenchReport report;
     report.errors = 0;
     report.ops = 0;
-    Status s;
-    if (!options_.skip_deletes) {
-      for (int f = options_.rank; f < options_.num_files;) {
-        int dir_no = Dir(f) % options_.num_dirs;
-        s = Delete(dir_no, f);
-        f += options_.comm_sz;
-        if (!s.ok()) {
-          report.errors++;
-          break;
-        } else {
-          report.ops++;
-        }
+    for (int i = 0; i < n; i++) {
+      report.errors += states[i].report.errors;
+      report.ops += states[i].report.ops;
+      for (int j = 0; j < kNumOps; j++) {
+        std::vector<double>* const lat = &states[i].report.latencies[j];
+        report.latencies[j].insert(report.latencies[j].end(), lat->begin(),
+                                   lat->end());
       }
     }
 
@@ -230,21 +297,118 @@ class LDbench {  // LD stands for large directory
     return report;
   }
 
- private:
+  int NumClients() const {
+    return options_.comm_sz * std::max(1, options_.num_threads);
+  }
+
+  Status Do(int op, int f) {
+    const int dir_no = Dir(f) % options_.num_dirs;
+    switch (op) {
+      case kCreate:
+        return Mknod(dir_no, f);
+      case kStat:
+        return Fstat(dir_no, f);
+      case kReaddir:
+        return Readdir(dir_no);
+      case kUnlink:
+        return Delete(dir_no, f);
+      default:
+        return Status::InvalidArgument("bad op");
+    }
+  }
+
+  void DoBulkOps(ThreadState* t) {
+    LDbenchReport* const report = &t->report;
+    for (int f = t->id; f < options_.num_files; f += NumClients()) {
+      const uint64_t start = env_->NowMicros();
+      Status s = Do(t->op, f);
+      report->latencies[t->op].push_back(env_->NowMicros() - start);
+      if (!s.ok()) {
+        report->errors++;
+        break;
+      } else {
+        report->ops++;
+      }
+    }
+  }
+
+  void DoMixedOps(ThreadState* t) {
+    LDbenchReport* const report = &t->report;
+    Random rnd(301 + t->id);
+    int total_weight = 0;
+    for (int i = 0; i < kNumOps; i++) {
+      total_weight += options_.mix[i];
+    }
+    const double rate =
+        options_.arrival_rate / std::max(1, options_.num_threads);
+    std::vector<int> created;
+    // New files are numbered after those of the insertion phase
+    int next_file = options_.num_files + t->id;
+    uint64_t arrival = env_->NowMicros();
+    for (int i = t->id; i < options_.num_mix_ops; i += NumClients()) {
+      uint64_t start = env_->NowMicros();
+      if (rate > 0) {
+        const double u = (rnd.Next() + 1.0) / 2147483648.0;  // (0, 1]
+        arrival += static_cast<uint64_t>(-log(u) / rate * 1000000);
+        if (start < arrival) {
+          env_->SleepForMicroseconds(static_cast<int>(arrival - start));
+        }
+        start = arrival;
+      }
+      int op = 0;
+      for (int w = rnd.Uniform(total_weight); w >= options_.mix[op]; op++) {
+        w -= options_.mix[op];
+      }
+      if (op == kUnlink && created.empty()) {
+        op = kCreate;
+      } else if (op == kStat && options_.num_files == 0) {
+        op = kCreate;
+      }
+      int f = 0;
+      if (op == kCreate) {
+        f = next_file;
+        next_file += NumClients();
+      } else if (op == kStat) {
+        f = rnd.Uniform(options_.num_files);
+      } else if (op == kReaddir) {
+        f = static_cast<int>(rnd.Next());  // Maps to a random dir
+      } else {
+        f = created.back();
+      }
+      Status s = Do(op, f);
+      report->latencies[op].push_back(env_->NowMicros() - start);
+      if (!s.ok()) {
+        report->errors++;
+        break;
+      } else {
+        report->ops++;
+        if (op == kCreate) {
+          created.push_back(f);
+        } else if (op == kUnlink) {
+          created.pop_back();
+        }
+      }
+    }
+    for (size_t i = 0; i < created.size(); i++) {
+      Do(kUnlink, created[i]);
+    }
+  }
+
   const LDbenchOptions options_;
   ioclient::IOClient* io_;
+  Env* env_;
 };
 
 }  // namespace pdlfs
 
 static pdlfs::LDbenchReport Merge(const pdlfs::LDbenchReport& report) {
   pdlfs::LDbenchReport result;
-
-  MPI_Reduce(&report.duration, &result.duration, 1, MPI_DOUBLE, MPI_MAX, 0,
-             MPI_COMM_WORLD);
-  MPI_Reduce(&report.errors, &result.errors, 1, MPI_INT, MPI_SUM, 0,
-             MPI_COMM_WORLD);
-  MPI_Reduce(&report.ops, &result.ops, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+  pdlfs::ioclient::MergeCounts(report.duration, report.ops, report.errors,
+                               &result.duration, &result.ops, &result.errors);
+  for (int i = 0; i < pdlfs::kNumOps; i++) {
+    pdlfs::ioclient::GatherLatencies(report.latencies[i],
+                                     &result.latencies[i]);
+  }
 
   return result;
 }
@@ -253,6 +417,15 @@ static void Print(const pdlfs::LDbenchReport& report) {
   printf("-- Performed %d ops in %.3f seconds: %d succ, %d fail\n",
          report.ops + report.errors, report.duration, report.ops,
          report.errors);
+  char label[50];
+  for (int i = 0; i < pdlfs::kNumOps; i++) {
+    const std::vector<double>& lat = report.latencies[i];
+    if (!lat.empty()) {
+      snprintf(label, sizeof(label), "%-7s x %zu", pdlfs::kOpNames[i],
+               lat.size());
+      pdlfs::ioclient::PrintLatencies(label, lat);
+    }
+  }
 }
 
 static void Print(const char* msg) {
@@ -276,11 +449,46 @@ static void Help(const char* prog, FILE* out) {
           "  --num-files=n          :  "
           "Total number of files to create\n"
           "  --num-dirs=n           :  "
-          "Total number of dirs to create\n\n"
+          "Total number of dirs to create\n"
+          "  --threads=n            :  "
+          "Number of threads per client\n"
+          "  --mix=op:w,...         :  "
+          "Weights of create, stat, readdir, and unlink in the mixed phase\n"
+          "  --num-mix-ops=n        :  "
+          "Total number of operations of the mixed phase\n"
+          "  --rate=n               :  "
+          "Arrival rate of the mixed phase in ops/s per client "
+          "(open loop)\n\n"
           "Deltafs benchmark\n",
           prog);
 }
 
+// Parse an op mix such as "create:5,stat:90,unlink:5".
+// Return false if the input is malformed.
+static bool ParseMix(const char* input, int* mix) {
+  for (int i = 0; i < pdlfs::kNumOps; i++) {
+    mix[i] = 0;
+  }
+  std::vector<std::string> items;
+  pdlfs::SplitString(&items, input, ',');
+  for (size_t i = 0; i < items.size(); i++) {
+    std::vector<std::string> kv;
+    pdlfs::SplitString(&kv, items[i].c_str(), ':', 1);
+    if (kv.size() != 2) {
+      return false;
+    }
+    int op = 0;
+    while (op < pdlfs::kNumOps && kv[0] != pdlfs::kOpNames[op]) {
+      op++;
+    }
+    if (op == pdlfs::kNumOps || atoi(kv[1].c_str()) < 0) {
+      return false;
+    }
+    mix[op] = atoi(kv[1].c_str());
+  }
+  return true;
+}
+
 static pdlfs::LDbenchOptions ParseOptions(int argc, char** argv) {
   pdlfs::LDbenchOptions result;
   result.rank = 0;
@@ -292,6 +500,12 @@ static pdlfs::LDbenchOptions ParseOptions(int argc, char** argv) {
   result.skip_deletes = false;
   result.num_files = 16;
   result.num_dirs = 1;
+  result.num_threads = 1;
+  for (int i = 0; i < pdlfs::kNumOps; i++) {
+    result.mix[i] = 0;
+  }
+  result.num_mix_ops = 0;
+  result.arrival_rate = 0;
   result.argv = NULL;
   result.argc = 0;
 
@@ -304,6 +518,10 @@ static pdlfs::LDbenchOptions ParseOptions(int argc, char** argv) {
     optinfo.push_back({"skip-deletes", 0, NULL, 'd'});
     optinfo.push_back({"num-files", 1, NULL, 'n'});
     optinfo.push_back({"num-dirs", 1, NULL, 'm'});
+    optinfo.push_back({"threads", 1, NULL, 't'});
+    optinfo.push_back({"mix", 1, NULL, 'x'});
+    optinfo.push_back({"num-mix-ops", 1, NULL, 'o'});
+    optinfo.push_back({"rate", 1, NULL, 'R'});
     optinfo.push_back({"help", 0, NULL, 'H'});
     optinfo.push_back({NULL, 0, NULL, 0});
 
@@ -333,6 +551,21 @@ static pdlfs::LDbenchOptions ParseOptions(int argc, char** argv) {
           case 'm':
             result.num_dirs = atoi(optarg);
             break;
+          case 't':
+            result.num_threads = atoi(optarg);
+            break;
+          case 'x':
+            if (!ParseMix(optarg, result.mix)) {
+              Help(argv[0], stderr);
+              exit(EXIT_FAILURE);
+            }
+            break;
+          case 'o':
+            result.num_mix_ops = atoi(optarg);
+            break;
+          case 'R':
+            result.arrival_rate = atof(optarg);
+            break;
           case 'H':
           case 'h':
             Help(argv[0], stdout);
@@ -421,6 +654,22 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (report.errors == 0 && bench.HasMixedOps()) {
+    if (rank == 0) {
+      Print("Mixed operations...");
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    report = Merge(bench.MixedOps());
+    if (rank == 0) {
+      Print(report);
+    }
+  } else if (report.errors != 0) {
+    if (rank == 0) {
+      Print("Abort");
+    }
+    goto end;
+  }
+
   if (report.errors == 0) {
     if (rank == 0) {
       Print("Bulk removes...");
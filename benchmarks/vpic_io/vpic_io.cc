@@ -21,6 +21,8 @@
 
 // Abstract FS interface
 #include "../io_client.h"
+// Report helpers shared by all benchmarks
+#include "../bench_report.h"
 
 namespace pdlfs {
 
@@ -39,6 +41,14 @@ struct VPICbenchOptions : public ioclient::IOClientOptions {
   int x, y, z;
   // Number of particles per cell
   int ppc;
+  // Skip the dumps and query the particles of a previous run
+  bool read_only;
+  // Number of random particle point queries per client
+  int num_queries;
+  // Number of particle trajectory queries per client
+  int num_trajectories;
+  // Total number of full-epoch scans, spread over all clients
+  int num_scans;
 };
 
 // REQUIRES: callers are required to initialize all fields
@@ -53,12 +63,38 @@ struct VPICbenchReport {
   int errors;
 };
 
+// REQUIRES: callers are required to initialize all fields
+struct VPICqueryReport : public VPICbenchReport {
+  // Latency of each query in microseconds
+  std::vector<double> latencies;
+  // Total number of particle bytes returned by queries
+  unsigned long long bytes_returned;
+  // Total number of bytes fetched from the underlying storage
+  unsigned long long bytes_read;
+};
+
+enum VPICqueryType {
+  // Read a random particle at a random dump
+  kPointQuery,
+  // Read a random particle at all dumps
+  kTrajectoryQuery,
+  // Read all particles of a dump
+  kEpochScan
+};
+
 // A simple benchmark that simulates the write pattern of a VPIC app
-// with a one-file-per-particle input deck.
+// with a one-file-per-particle input deck, followed by the queries used to
+// analyze the particles: point queries, trajectory queries, and full-epoch
+// scans. Dump i is stored as epoch i.
 class VPICbench {
  public:
   VPICbench(const VPICbenchOptions& options)
-      : dump_seq_(0), options_(options), rnd_(options.seed), dir_(NULL) {
+      : dump_seq_(0),
+        epochs_supported_(true),
+        options_(options),
+        dir_(NULL),
+        rnd_(options.seed),
+        query_rnd_(options.seed + options.rank) {
     io_ = ioclient::IOClient::Factory(options_);
   }
 
@@ -84,8 +120,12 @@ class VPICbench {
     }
   }
 
+  // Each dump after the first starts a new epoch
   Status MkStep(int step_id) {
-    Status s = io_->FlushEpoch(dir_);
+    Status s;
+    if (step_id != 0) {
+      s = io_->FlushEpoch(dir_);
+    }
     if (options_.ignore_errors) {
       return Status::OK();
     } else {
@@ -97,7 +137,7 @@ class VPICbench {
     Status s;
     char tmp[256];
     snprintf(tmp, sizeof(tmp), "p_%lld", particle_id);
-    char data[32];  // possibly eight 32-bit float numbers
+    char data[kParticleSize];  // possibly eight 32-bit float numbers
     {
       char* p = data;
       for (int i = 0; i < sizeof(data) / 8; i++) {
@@ -118,6 +158,66 @@ class VPICbench {
     }
   }
 
+  // Read a particle at a given dump. Clients that do not keep data by epoch
+  // read the particle at all dumps, from which the requested dump is
+  // extracted. Every dump appends one record to every particle.
+  Status ReadParticle(uint64_t particle_id, int step_id, std::string* data) {
+    Status s;
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "p_%lld", (long long)particle_id);
+    if (epochs_supported_) {
+      s = io_->ReadAt(dir_, tmp, step_id, data);
+      if (s.IsNotSupported()) {
+        epochs_supported_ = false;
+      }
+    }
+    if (!epochs_supported_) {
+      s = io_->ReadAt(dir_, tmp, -1, data);
+      if (s.ok()) {
+        const size_t off = size_t(step_id) * kParticleSize;
+        if (data->size() >= off + kParticleSize) {
+          *data = data->substr(off, kParticleSize);
+        } else {
+          data->clear();
+        }
+      }
+    }
+    if (s.ok() && data->empty()) {
+      s = Status::NotFound(tmp);
+    }
+    return s;
+  }
+
+  Status ReadTrajectory(uint64_t particle_id, std::string* data) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "p_%lld", (long long)particle_id);
+    Status s = io_->ReadAt(dir_, tmp, -1, data);
+    if (s.ok() && data->empty()) {
+      s = Status::NotFound(tmp);
+    }
+    return s;
+  }
+
+  // Read all particles of a dump. Clients that do not keep data by epoch
+  // read all dumps, of which a single record per particle is returned.
+  Status ScanStep(int step_id, uint64_t* bytes) {
+    Status s;
+    uint64_t num_files;
+    if (epochs_supported_) {
+      s = io_->ScanDir(dir_, step_id, &num_files, bytes);
+      if (s.IsNotSupported()) {
+        epochs_supported_ = false;
+      }
+    }
+    if (!epochs_supported_) {
+      s = io_->ScanDir(dir_, -1, &num_files, bytes);
+      if (s.ok()) {
+        *bytes = num_files * kParticleSize;
+      }
+    }
+    return s;
+  }
+
   uint64_t NumberParticles() {
     uint64_t result = options_.ppc;
     result *= options_.x;
@@ -134,6 +234,7 @@ class VPICbench {
 
   // Initialize io client.  Create a directory for particle dumps.
   // If in relaxed consistency mode, every client will create a directory.
+  // No directory is created in read-only mode.
   // Return a status report with local timing and error counts.
   VPICbenchReport Prepare() {
     double start = MPI_Wtime();
@@ -143,7 +244,9 @@ class VPICbench {
     Status s = io_->Init();
     if (s.ok()) {
       report.ops++;
-      if (options_.rank == 0 || options_.relaxed_consistency) {
+      if (options_.read_only) {
+        // Skip
+      } else if (options_.rank == 0 || options_.relaxed_consistency) {
         s = Mkroot();
         if (!s.ok()) {
           report.errors++;
@@ -199,12 +302,129 @@ class VPICbench {
     return report;
   }
 
+  // Close the directory so that all dumps are persisted.
+  // Return a status report with local timing and error counts.
+  VPICbenchReport Close() {
+    double start = MPI_Wtime();
+    VPICbenchReport report;
+    report.errors = 0;
+    report.ops = 0;
+    Status s;
+    if (dir_ != NULL) {
+      s = io_->CloseDir(dir_);
+      dir_ = NULL;
+      if (!s.ok()) {
+        report.errors++;
+      } else {
+        report.ops++;
+      }
+    }
+
+    report.duration = MPI_Wtime() - start;
+    if (!s.ok()) {
+      report.message = s.ToString();
+    }
+    return report;
+  }
+
+  // Open the directory for queries. Every client opens the directory.
+  // Return a status report with local timing and error counts.
+  VPICbenchReport Reopen() {
+    double start = MPI_Wtime();
+    VPICbenchReport report;
+    report.errors = 0;
+    report.ops = 0;
+    Status s = io_->OpenDir("/particles", &dir_);
+    if (!s.ok()) {
+      dir_ = NULL;
+      report.errors++;
+    } else {
+      report.ops++;
+    }
+
+    report.duration = MPI_Wtime() - start;
+    if (!s.ok()) {
+      report.message = s.ToString();
+    }
+    return report;
+  }
+
+  // Run a given type of queries against the directory. Every client issues
+  // its own point and trajectory queries. Scans are spread over all clients
+  // in a round-robin fashion with the i-th scan reading dump i % num_dumps.
+  // Return a status report with local timing, error counts, query latencies,
+  // and the number of bytes read from storage and returned to the caller.
+  VPICqueryReport Query(VPICqueryType type) {
+    double start = MPI_Wtime();
+    VPICqueryReport report;
+    report.errors = 0;
+    report.ops = 0;
+    report.bytes_returned = 0;
+    report.bytes_read = 0;
+    Status s;
+    if (dir_ == NULL) {
+      s = Status::AssertionFailed("dir not opened");
+      report.errors++;
+    } else {
+      const uint64_t bytes_read = io_->BytesRead(dir_);
+      const uint64_t num_particles = NumberParticles();
+      int n = options_.num_scans;
+      if (type == kPointQuery) {
+        n = options_.num_queries;
+      } else if (type == kTrajectoryQuery) {
+        n = options_.num_trajectories;
+      }
+      std::string data;
+      for (int i = 0; i < n; i++) {
+        if (type == kEpochScan && i % options_.comm_sz != options_.rank) {
+          continue;
+        }
+        uint64_t bytes = 0;
+        const double query_start = MPI_Wtime();
+        if (type == kPointQuery) {
+          uint64_t particle_id = query_rnd_.Next64() % num_particles;
+          int step_id = query_rnd_.Uniform(options_.num_dumps);
+          s = ReadParticle(particle_id, step_id, &data);
+          bytes = data.size();
+        } else if (type == kTrajectoryQuery) {
+          uint64_t particle_id = query_rnd_.Next64() % num_particles;
+          s = ReadTrajectory(particle_id, &data);
+          bytes = data.size();
+        } else {
+          s = ScanStep(i % options_.num_dumps, &bytes);
+        }
+        report.latencies.push_back((MPI_Wtime() - query_start) * 1000000);
+        if (!s.ok()) {
+          report.errors++;
+          if (!options_.ignore_errors) {
+            break;
+          }
+        } else {
+          report.bytes_returned += bytes;
+          report.ops++;
+        }
+      }
+      report.bytes_read = io_->BytesRead(dir_) - bytes_read;
+    }
+
+    report.duration = MPI_Wtime() - start;
+    if (!s.ok()) {
+      report.message = s.ToString();
+    }
+    return report;
+  }
+
  private:
+  // Size of each particle record
+  static const size_t kParticleSize = 32;
   int dump_seq_;
+  // False if the io client does not keep data by epoch
+  bool epochs_supported_;
   const VPICbenchOptions options_;
   ioclient::IOClient* io_;
   ioclient::Dir* dir_;
   Random rnd_;
+  Random query_rnd_;
 };
 
 }  // namespace pdlfs
@@ -215,12 +435,23 @@ static pdlfs::VPICbenchReport Merge(const pdlfs::VPICbenchReport& report) {
   }
 
   pdlfs::VPICbenchReport result;
+  pdlfs::ioclient::MergeCounts(report.duration, report.ops, report.errors,
+                               &result.duration, &result.ops, &result.errors);
+
+  return result;
+}
+
+static pdlfs::VPICqueryReport Merge(const pdlfs::VPICqueryReport& report) {
+  pdlfs::VPICqueryReport result;
+  static_cast<pdlfs::VPICbenchReport&>(result) =
+      Merge(static_cast<const pdlfs::VPICbenchReport&>(report));
+
+  MPI_Reduce(&report.bytes_returned, &result.bytes_returned, 1,
+             MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&report.bytes_read, &result.bytes_read, 1,
+             MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
 
-  MPI_Reduce(&report.duration, &result.duration, 1, MPI_DOUBLE, MPI_MAX, 0,
-             MPI_COMM_WORLD);
-  MPI_Reduce(&report.errors, &result.errors, 1, MPI_INT, MPI_SUM, 0,
-             MPI_COMM_WORLD);
-  MPI_Reduce(&report.ops, &result.ops, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+  pdlfs::ioclient::GatherLatencies(report.latencies, &result.latencies);
 
   return result;
 }
@@ -231,6 +462,20 @@ static void Print(const pdlfs::VPICbenchReport& report) {
          report.errors);
 }
 
+static void Print(const pdlfs::VPICqueryReport& report) {
+  Print(static_cast<const pdlfs::VPICbenchReport&>(report));
+  if (!report.latencies.empty()) {
+    pdlfs::ioclient::PrintLatencies("Latency", report.latencies);
+  }
+  // I/O amplification is the number of bytes read from storage divided by
+  // the number of bytes returned by queries
+  printf("-- I/O amplification: %.2f (%llu bytes read, %llu returned)\n",
+         report.bytes_returned != 0
+             ? 1.0 * report.bytes_read / report.bytes_returned
+             : 0.0,
+         report.bytes_read, report.bytes_returned);
+}
+
 static void Print(const char* msg) {
   // Usually only called by rank 0
   printf("== %s\n", msg);
@@ -239,10 +484,12 @@ static void Print(const char* msg) {
 static void Help(const char* prog, FILE* out) {
   fprintf(out,
           "%s [options] <io_type> <io_conf>\n\n"
-          "Supported IO types: deltafs, posix\n\n"
+          "Supported IO types: deltafs, plfsdir, posix\n\n"
           "Deltafs IO confs:\n\n"
           "  \"DELTAFS_Verbose?10|DELTAFS_LogToStderr?true|"
           "DELTAFS_PLFSDir?write\"\n\n"
+          "Plfsdir IO confs:\n\n"
+          "  \"mount_point=/tmp/ioclient;dir_options=lg_parts=0\"\n\n"
           "Posix IO confs:\n\n"
           "  \"mount_point=/tmp/ioclient\"\n\n"
           "Options:\n\n"
@@ -257,7 +504,15 @@ static void Help(const char* prog, FILE* out) {
           "  --ppc=n                :  "
           "Number of particles per grid cell (default: 2)\n"
           "  --x/y/z=n              :  "
-          "3d grid dimensions (default: 2)\n\n"
+          "3d grid dimensions (default: 2)\n"
+          "  --read-only            :  "
+          "Skip the dumps and query an existing run (default: false)\n"
+          "  --queries=n            :  "
+          "Random particle point queries per client (default: 0)\n"
+          "  --trajectories=n       :  "
+          "Particle trajectory queries per client (default: 0)\n"
+          "  --scans=n              :  "
+          "Total number of full-dump scans (default: 0)\n\n"
           "Deltafs VPIC IO benchmark\n",
           prog);
 }
@@ -272,6 +527,10 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
   result.ignore_errors = false;
   result.x = result.y = result.z = 2;
   result.ppc = 2;
+  result.read_only = false;
+  result.num_queries = 0;
+  result.num_trajectories = 0;
+  result.num_scans = 0;
   result.argv = NULL;
   result.argc = 0;
 
@@ -285,6 +544,10 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
     optinfo.push_back({"x", 1, NULL, 'x'});
     optinfo.push_back({"y", 1, NULL, 'y'});
     optinfo.push_back({"z", 1, NULL, 'z'});
+    optinfo.push_back({"read-only", 0, NULL, 'R'});
+    optinfo.push_back({"queries", 1, NULL, 'q'});
+    optinfo.push_back({"trajectories", 1, NULL, 't'});
+    optinfo.push_back({"scans", 1, NULL, 'S'});
     optinfo.push_back({"help", 0, NULL, 'H'});
     optinfo.push_back({NULL, 0, NULL, 0});
 
@@ -317,6 +580,18 @@ static pdlfs::VPICbenchOptions ParseOptions(int argc, char** argv) {
           case 'z':
             result.z = atoi(optarg);
             break;
+          case 'R':
+            result.read_only = true;
+            break;
+          case 'q':
+            result.num_queries = atoi(optarg);
+            break;
+          case 't':
+            result.num_trajectories = atoi(optarg);
+            break;
+          case 'S':
+            result.num_scans = atoi(optarg);
+            break;
           case 'H':
           case 'h':
             Help(argv[0], stdout);
@@ -355,7 +630,7 @@ int main(int argc, char** argv) {
   options.comm_sz = size;
   pdlfs::VPICbench bench(options);
   pdlfs::VPICbenchReport report;
-  int num_dumps = options.num_dumps;
+  int num_dumps = options.read_only ? 0 : options.num_dumps;
   report.errors = 0;
 
   if (report.errors == 0) {
@@ -392,6 +667,58 @@ int main(int argc, char** argv) {
     }
   }
 
+  if (options.num_queries != 0 || options.num_trajectories != 0 ||
+      options.num_scans != 0) {
+    if (report.errors == 0) {
+      if (rank == 0) {
+        Print("Close ... ");
+      }
+      MPI_Barrier(MPI_COMM_WORLD);
+      report = Merge(bench.Close());
+      if (rank == 0) {
+        Print(report);
+      }
+    }
+    if (report.errors == 0) {
+      if (rank == 0) {
+        Print("Reopen ... ");
+      }
+      MPI_Barrier(MPI_COMM_WORLD);
+      report = Merge(bench.Reopen());
+      if (rank == 0) {
+        Print(report);
+      }
+    }
+    const struct {
+      const char* name;
+      pdlfs::VPICqueryType type;
+      int n;
+    } kQueries[] = {{"Point queries ... ", pdlfs::kPointQuery,
+                     options.num_queries},
+                    {"Trajectory queries ... ", pdlfs::kTrajectoryQuery,
+                     options.num_trajectories},
+                    {"Scans ... ", pdlfs::kEpochScan, options.num_scans}};
+    for (size_t i = 0; i < sizeof(kQueries) / sizeof(kQueries[0]); i++) {
+      if (report.errors == 0 && kQueries[i].n != 0) {
+        if (rank == 0) {
+          Print(kQueries[i].name);
+        }
+        MPI_Barrier(MPI_COMM_WORLD);
+        pdlfs::VPICqueryReport query_report =
+            Merge(bench.Query(kQueries[i].type));
+        if (rank == 0) {
+          Print(query_report);
+        }
+        report = query_report;
+      }
+    }
+    if (report.errors != 0) {
+      if (rank == 0) {
+        Print("Abort");
+      }
+    }
+  }
+
 end:
   MPI_Finalize();
   return 0;
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/env.h"
+
+namespace pdlfs {
+
+// Return a new Env that keeps all files and directories in memory. Files are
+// lost when the Env is deleted. Calls not related to files and directories,
+// such as Schedule() and NowMicros(), are forwarded to *base, which must
+// remain alive while the returned Env is in use. The result should be deleted
+// when it is no longer needed, after all files opened through it are closed.
+extern Env* NewMemEnv(Env* base);
+
+// Performance model of an emulated storage system, such as a parallel file
+// system or a burst buffer. Delays are added on top of those of the
+// underlying Env.
+struct EmulatedStorageOptions {
+  EmulatedStorageOptions();
+
+  // Fixed delay of each metadata operation, such as opening, deleting, or
+  // renaming a file, or listing a directory.
+  // Default: 0
+  uint64_t metadata_micros;
+
+  // Fixed delay of each read.
+  // Default: 0
+  uint64_t read_micros;
+
+  // Fixed delay of each write.
+  // Default: 0
+  uint64_t write_micros;
+
+  // Fixed delay of each sync.
+  // Default: 0
+  uint64_t sync_micros;
+
+  // Max read bandwidth in bytes per second. Shared by all files. Reads
+  // queue behind each other when the bandwidth is exhausted. Set to 0 to
+  // disable the limit.
+  // Default: 0
+  uint64_t read_bytes_per_second;
+
+  // Max write bandwidth in bytes per second. Shared by all files.
+  // Set to 0 to disable the limit.
+  // Default: 0
+  uint64_t write_bytes_per_second;
+
+  // Max random extra delay added to each delayed operation. Extra delays
+  // are uniformly distributed and drawn from a seeded random sequence.
+  // Default: 0
+  uint64_t jitter_micros;
+
+  // Seed of the random sequence of extra delays.
+  // Default: 301
+  uint32_t seed;
+};
+
+// Parse options from a string such as "read_micros=500&read_bw=1g".
+// Supported keys are metadata_micros, read_micros, write_micros,
+// sync_micros, read_bw, write_bw, jitter_micros, and seed. Unknown keys are
+// ignored. Return false if a value cannot be parsed.
+extern bool ParseEmulatedStorageOptions(const char* conf,
+                                        EmulatedStorageOptions* options);
+
+// Return a new Env that forwards all calls to *base but sleeps before
+// completing file and directory operations according to a given performance
+// model. Combined with an in-memory Env, storage performance becomes
+// independent of the host. If owns_base is true, *base is deleted along
+// with the returned Env. The result should be deleted when it is no longer
+// needed.
+extern Env* NewEmulatedStorageEnv(Env* base,
+                                  const EmulatedStorageOptions& options,
+                                  bool owns_base);
+
+}  // namespace pdlfs
@@ -159,6 +159,11 @@ struct DBOptions {
   // worth switching to kNoCompression.  Even if the input data is
   // incompressible, the kSnappyCompression implementation will
   // efficiently detect that and will switch to uncompressed mode.
+  //
+  // kZstdCompression and kLZ4Compression are also available if compiled
+  // in. Zstd trades speed for a higher compression ratio while LZ4 favors
+  // decompression speed. Blocks are stored uncompressed if the requested
+  // compression is not supported by the build.
   CompressionType compression;
 
   // If non-NULL, use the specified filter policy to reduce disk reads.
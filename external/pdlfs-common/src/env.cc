@@ -17,6 +17,7 @@
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/env_lazy.h"
+#include "pdlfs-common/env_mem.h"
 #include "pdlfs-common/logging.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/port.h"
@@ -96,6 +97,18 @@ Env* Env::Open(const char* name, const char* conf, bool* is_system) {
     return port::PosixGetDirectIOEnv();
   }
 #endif
+  if (env_name == "mem") {
+    Env* env = NewMemEnv(Env::Default());
+    if (!env_conf.empty()) {  // Emulate a storage system on top of memory
+      EmulatedStorageOptions options;
+      if (!ParseEmulatedStorageOptions(env_conf.c_str(), &options)) {
+        delete env;
+        return NULL;
+      }
+      env = NewEmulatedStorageEnv(env, options, true);
+    }
+    return env;
+  }
   if (env_name.empty()) {
     Warn(__LOG_ARGS__, "Open env without specifying a name...");
   }
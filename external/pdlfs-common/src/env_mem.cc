@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "pdlfs-common/env_mem.h"
+
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/status.h"
+#include "pdlfs-common/strutil.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace {
+
+// Contents of a file. Shared by the Env and all open handles of the file
+// so a file deleted while open remains readable through its open handles.
+class FileState {
+ public:
+  FileState() : refs_(0) {}
+
+  void Ref() {
+    MutexLock ml(&refs_mu_);
+    refs_++;
+  }
+
+  void Unref() {
+    bool do_delete = false;
+    {
+      MutexLock ml(&refs_mu_);
+      assert(refs_ > 0);
+      refs_--;
+      do_delete = refs_ == 0;
+    }
+    if (do_delete) {
+      delete this;
+    }
+  }
+
+  uint64_t Size() const {
+    MutexLock ml(&mu_);
+    return data_.size();
+  }
+
+  void Truncate() {
+    MutexLock ml(&mu_);
+    data_.clear();
+  }
+
+  void Append(const Slice& data) {
+    MutexLock ml(&mu_);
+    data_.append(data.data(), data.size());
+  }
+
+  Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const {
+    MutexLock ml(&mu_);
+    if (offset > data_.size()) {
+      *result = Slice();
+      return Status::InvalidArgument("Offset greater than file size");
+    }
+    const size_t avail = data_.size() - static_cast<size_t>(offset);
+    if (n > avail) {
+      n = avail;
+    }
+    if (n != 0) {
+      memcpy(scratch, data_.data() + offset, n);
+    }
+    *result = Slice(scratch, n);
+    return Status::OK();
+  }
+
+ private:
+  ~FileState() {}
+
+  port::Mutex refs_mu_;
+  int refs_;
+
+  mutable port::Mutex mu_;
+  std::string data_;
+
+  // No copying allowed
+  void operator=(const FileState&);
+  FileState(const FileState&);
+};
+
+class MemSequentialFile : public SequentialFile {
+ public:
+  explicit MemSequentialFile(FileState* file) : file_(file), pos_(0) {
+    file_->Ref();
+  }
+
+  virtual ~MemSequentialFile() { file_->Unref(); }
+
+  virtual Status Read(size_t n, Slice* result, char* scratch) {
+    Status s = file_->Read(pos_, n, result, scratch);
+    if (s.ok()) {
+      pos_ += result->size();
+    }
+    return s;
+  }
+
+  virtual Status Skip(uint64_t n) {
+    const uint64_t size = file_->Size();
+    if (pos_ > size) {
+      return Status::IOError("pos_ > file_->Size()");
+    }
+    const uint64_t avail = size - pos_;
+    if (n > avail) {
+      n = avail;
+    }
+    pos_ += n;
+    return Status::OK();
+  }
+
+ private:
+  FileState* file_;
+  uint64_t pos_;
+};
+
+class MemRandomAccessFile : public RandomAccessFile {
+ public:
+  explicit MemRandomAccessFile(FileState* file) : file_(file) { file_->Ref(); }
+
+  virtual ~MemRandomAccessFile() { file_->Unref(); }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    return file_->Read(offset, n, result, scratch);
+  }
+
+ private:
+  FileState* file_;
+};
+
+class MemWritableFile : public WritableFile {
+ public:
+  explicit MemWritableFile(FileState* file) : file_(file) { file_->Ref(); }
+
+  virtual ~MemWritableFile() { file_->Unref(); }
+
+  virtual Status Append(const Slice& data) {
+    file_->Append(data);
+    return Status::OK();
+  }
+
+  virtual Status Close() { return Status::OK(); }
+  virtual Status Flush() { return Status::OK(); }
+  virtual Status Sync() { return Status::OK(); }
+
+ private:
+  FileState* file_;
+};
+
+class MemFileLock : public FileLock {
+ public:
+  explicit MemFileLock(const std::string& fname) : fname_(fname) {}
+  virtual ~MemFileLock() {}
+  const std::string fname_;
+};
+
+// Directory names are stored without any trailing slash. A file belongs to a
+// directory if its name is the directory name followed by a slash and a name
+// without further slashes.
+class MemEnv : public EnvWrapper {
+ public:
+  explicit MemEnv(Env* base) : EnvWrapper(base) {}
+
+  virtual ~MemEnv() {
+    for (FileMap::iterator it = files_.begin(); it != files_.end(); ++it) {
+      it->second->Unref();
+    }
+  }
+
+  virtual Status NewSequentialFile(const char* fname, SequentialFile** r) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(fname);
+    if (it == files_.end()) {
+      *r = NULL;
+      return Status::NotFound(fname);
+    }
+    *r = new MemSequentialFile(it->second);
+    return Status::OK();
+  }
+
+  virtual Status NewRandomAccessFile(const char* fname, RandomAccessFile** r) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(fname);
+    if (it == files_.end()) {
+      *r = NULL;
+      return Status::NotFound(fname);
+    }
+    *r = new MemRandomAccessFile(it->second);
+    return Status::OK();
+  }
+
+  virtual Status NewWritableFile(const char* fname, WritableFile** r) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(fname);
+    FileState* file;
+    if (it != files_.end()) {
+      file = it->second;
+      file->Truncate();
+    } else {
+      file = new FileState;
+      file->Ref();
+      files_[fname] = file;
+    }
+    *r = new MemWritableFile(file);
+    return Status::OK();
+  }
+
+  virtual bool FileExists(const char* fname) {
+    MutexLock ml(&mu_);
+    return files_.count(fname) != 0 || dirs_.count(DirName(fname)) != 0;
+  }
+
+  virtual Status GetChildren(const char* dir, std::vector<std::string>* r) {
+    MutexLock ml(&mu_);
+    r->clear();
+    const std::string prefix = DirName(dir) + "/";
+    for (FileMap::iterator it = files_.lower_bound(prefix);
+         it != files_.end() && Slice(it->first).starts_with(prefix); ++it) {
+      const std::string name = it->first.substr(prefix.size());
+      if (name.find('/') == std::string::npos) {
+        r->push_back(name);
+      }
+    }
+    for (DirSet::iterator it = dirs_.lower_bound(prefix);
+         it != dirs_.end() && Slice(*it).starts_with(prefix); ++it) {
+      const std::string name = it->substr(prefix.size());
+      if (name.find('/') == std::string::npos) {
+        r->push_back(name);
+      }
+    }
+    return Status::OK();
+  }
+
+  virtual Status DeleteFile(const char* fname) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(fname);
+    if (it == files_.end()) {
+      return Status::NotFound(fname);
+    }
+    it->second->Unref();
+    files_.erase(it);
+    return Status::OK();
+  }
+
+  virtual Status CreateDir(const char* dir) {
+    MutexLock ml(&mu_);
+    if (!dirs_.insert(DirName(dir)).second) {
+      return Status::AlreadyExists(dir);
+    }
+    return Status::OK();
+  }
+
+  virtual Status AttachDir(const char* dir) {
+    MutexLock ml(&mu_);
+    if (dirs_.count(DirName(dir)) == 0) {
+      return Status::NotFound(dir);
+    }
+    return Status::OK();
+  }
+
+  virtual Status DeleteDir(const char* dir) {
+    MutexLock ml(&mu_);
+    if (dirs_.erase(DirName(dir)) == 0) {
+      return Status::NotFound(dir);
+    }
+    return Status::OK();
+  }
+
+  virtual Status DetachDir(const char* dir) {
+    return Status::NotSupported(Slice());
+  }
+
+  virtual Status GetFileSize(const char* fname, uint64_t* size) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(fname);
+    if (it == files_.end()) {
+      return Status::NotFound(fname);
+    }
+    *size = it->second->Size();
+    return Status::OK();
+  }
+
+  virtual Status CopyFile(const char* src, const char* dst) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(src);
+    if (it == files_.end()) {
+      return Status::NotFound(src);
+    }
+    FileState* const from = it->second;
+    const uint64_t size = from->Size();
+    std::string buf(static_cast<size_t>(size), 0);
+    Slice contents;
+    Status s = from->Read(0, buf.size(), &contents, &buf[0]);
+    if (s.ok()) {
+      FileState* const to = new FileState;
+      to->Ref();
+      to->Append(contents);
+      RemoveFile(dst);
+      files_[dst] = to;
+    }
+    return s;
+  }
+
+  virtual Status RenameFile(const char* src, const char* dst) {
+    MutexLock ml(&mu_);
+    FileMap::iterator it = files_.find(src);
+    if (it == files_.end()) {
+      return Status::NotFound(src);
+    }
+    FileState* const file = it->second;
+    files_.erase(it);
+    RemoveFile(dst);
+    files_[dst] = file;
+    return Status::OK();
+  }
+
+  virtual Status LockFile(const char* fname, FileLock** lock) {
+    MutexLock ml(&mu_);
+    if (!locks_.insert(fname).second) {
+      *lock = NULL;
+      return Status::IOError("Lock already held", fname);
+    }
+    if (files_.count(fname) == 0) {
+      FileState* const file = new FileState;
+      file->Ref();
+      files_[fname] = file;
+    }
+    *lock = new MemFileLock(fname);
+    return Status::OK();
+  }
+
+  virtual Status UnlockFile(FileLock* lock) {
+    MemFileLock* const l = static_cast<MemFileLock*>(lock);
+    {
+      MutexLock ml(&mu_);
+      locks_.erase(l->fname_);
+    }
+    delete l;
+    return Status::OK();
+  }
+
+ private:
+  static std::string DirName(const char* dir) {
+    std::string result = dir;
+    while (result.size() > 1 && result[result.size() - 1] == '/') {
+      result.resize(result.size() - 1);
+    }
+    return result;
+  }
+
+  void RemoveFile(const std::string& fname) {
+    mu_.AssertHeld();
+    FileMap::iterator it = files_.find(fname);
+    if (it != files_.end()) {
+      it->second->Unref();
+      files_.erase(it);
+    }
+  }
+
+  typedef std::map<std::string, FileState*> FileMap;
+  typedef std::set<std::string> DirSet;
+  port::Mutex mu_;
+  FileMap files_;
+  DirSet dirs_;
+  std::set<std::string> locks_;
+};
+
+// A channel models a shared link of limited bandwidth. Transfers through a
+// channel are served one at a time in the order they arrive.
+struct Channel {
+  explicit Channel(uint64_t bytes_per_second)
+      : bytes_per_second(bytes_per_second), next_free_micros(0) {}
+  const uint64_t bytes_per_second;
+  uint64_t next_free_micros;
+};
+
+class EmulatedStorageEnv : public EnvWrapper {
+ public:
+  EmulatedStorageEnv(Env* base, const EmulatedStorageOptions& options,
+                     bool owns_base)
+      : EnvWrapper(base),
+        options_(options),
+        owns_base_(owns_base),
+        rnd_(options.seed),
+        reads_(options.read_bytes_per_second),
+        writes_(options.write_bytes_per_second) {}
+
+  virtual ~EmulatedStorageEnv() {
+    if (owns_base_) {
+      delete target();
+    }
+  }
+
+  // Sleep for a fixed delay plus a random extra delay, followed by the time
+  // needed to move n bytes through a channel. A channel of NULL means no
+  // bandwidth limit.
+  void Delay(uint64_t micros, uint64_t n, Channel* ch) {
+    uint64_t now = target()->NowMicros();
+    uint64_t deadline;
+    {
+      MutexLock ml(&mu_);
+      if (options_.jitter_micros != 0) {
+        micros += rnd_.Next64() % (options_.jitter_micros + 1);
+      }
+      deadline = now + micros;
+      if (ch != NULL && ch->bytes_per_second != 0 && n != 0) {
+        if (deadline < ch->next_free_micros) {
+          deadline = ch->next_free_micros;
+        }
+        deadline += n * 1000 * 1000 / ch->bytes_per_second;
+        ch->next_free_micros = deadline;
+      }
+    }
+    while (now < deadline) {
+      uint64_t remaining = deadline - now;
+      if (remaining > 1000 * 1000) {
+        remaining = 1000 * 1000;
+      }
+      target()->SleepForMicroseconds(static_cast<int>(remaining));
+      now = target()->NowMicros();
+    }
+  }
+
+  void MetadataDelay() {
+    if (options_.metadata_micros != 0 || options_.jitter_micros != 0) {
+      Delay(options_.metadata_micros, 0, NULL);
+    }
+  }
+
+  void ReadDelay(uint64_t n) { Delay(options_.read_micros, n, &reads_); }
+  void WriteDelay(uint64_t n) { Delay(options_.write_micros, n, &writes_); }
+  void SyncDelay() { Delay(options_.sync_micros, 0, NULL); }
+
+  virtual Status NewSequentialFile(const char* fname, SequentialFile** r);
+  virtual Status NewRandomAccessFile(const char* fname, RandomAccessFile** r);
+  virtual Status NewWritableFile(const char* fname, WritableFile** r);
+
+  virtual bool FileExists(const char* fname) {
+    MetadataDelay();
+    return target()->FileExists(fname);
+  }
+
+  virtual Status GetChildren(const char* dir, std::vector<std::string>* r) {
+    MetadataDelay();
+    return target()->GetChildren(dir, r);
+  }
+
+  virtual Status DeleteFile(const char* fname) {
+    MetadataDelay();
+    return target()->DeleteFile(fname);
+  }
+
+  virtual Status CreateDir(const char* dir) {
+    MetadataDelay();
+    return target()->CreateDir(dir);
+  }
+
+  virtual Status AttachDir(const char* dir) {
+    MetadataDelay();
+    return target()->AttachDir(dir);
+  }
+
+  virtual Status DeleteDir(const char* dir) {
+    MetadataDelay();
+    return target()->DeleteDir(dir);
+  }
+
+  virtual Status DetachDir(const char* dir) {
+    MetadataDelay();
+    return target()->DetachDir(dir);
+  }
+
+  virtual Status GetFileSize(const char* fname, uint64_t* size) {
+    MetadataDelay();
+    return target()->GetFileSize(fname, size);
+  }
+
+  // A copy reads and writes the entire file
+  virtual Status CopyFile(const char* src, const char* dst) {
+    MetadataDelay();
+    uint64_t size = 0;
+    Status s = target()->GetFileSize(src, &size);
+    if (s.ok()) {
+      ReadDelay(size);
+      WriteDelay(size);
+      s = target()->CopyFile(src, dst);
+    }
+    return s;
+  }
+
+  virtual Status RenameFile(const char* src, const char* dst) {
+    MetadataDelay();
+    return target()->RenameFile(src, dst);
+  }
+
+ private:
+  const EmulatedStorageOptions options_;
+  const bool owns_base_;
+  port::Mutex mu_;
+  Random rnd_;
+  Channel reads_;
+  Channel writes_;
+};
+
+class EmulatedSequentialFile : public SequentialFile {
+ public:
+  EmulatedSequentialFile(EmulatedStorageEnv* env, SequentialFile* base)
+      : env_(env), base_(base) {}
+  virtual ~EmulatedSequentialFile() { delete base_; }
+
+  virtual Status Read(size_t n, Slice* result, char* scratch) {
+    Status s = base_->Read(n, result, scratch);
+    env_->ReadDelay(s.ok() ? result->size() : 0);
+    return s;
+  }
+
+  virtual Status Skip(uint64_t n) { return base_->Skip(n); }
+
+ private:
+  EmulatedStorageEnv* const env_;
+  SequentialFile* const base_;
+};
+
+class EmulatedRandomAccessFile : public RandomAccessFile {
+ public:
+  EmulatedRandomAccessFile(EmulatedStorageEnv* env, RandomAccessFile* base)
+      : env_(env), base_(base) {}
+  virtual ~EmulatedRandomAccessFile() { delete base_; }
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const {
+    Status s = base_->Read(offset, n, result, scratch);
+    env_->ReadDelay(s.ok() ? result->size() : 0);
+    return s;
+  }
+
+ private:
+  EmulatedStorageEnv* const env_;
+  RandomAccessFile* const base_;
+};
+
+class EmulatedWritableFile : public WritableFile {
+ public:
+  EmulatedWritableFile(EmulatedStorageEnv* env, WritableFile* base)
+      : env_(env), base_(base) {}
+  virtual ~EmulatedWritableFile() { delete base_; }
+
+  virtual Status Append(const Slice& data) {
+    env_->WriteDelay(data.size());
+    return base_->Append(data);
+  }
+
+  virtual Status Sync() {
+    env_->SyncDelay();
+    return base_->Sync();
+  }
+
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Close() { return base_->Close(); }
+
+ private:
+  EmulatedStorageEnv* const env_;
+  WritableFile* const base_;
+};
+
+Status EmulatedStorageEnv::NewSequentialFile(const char* fname,
+                                             SequentialFile** r) {
+  MetadataDelay();
+  SequentialFile* file;
+  Status s = target()->NewSequentialFile(fname, &file);
+  if (s.ok()) {
+    *r = new EmulatedSequentialFile(this, file);
+  } else {
+    *r = NULL;
+  }
+  return s;
+}
+
+Status EmulatedStorageEnv::NewRandomAccessFile(const char* fname,
+                                               RandomAccessFile** r) {
+  MetadataDelay();
+  RandomAccessFile* file;
+  Status s = target()->NewRandomAccessFile(fname, &file);
+  if (s.ok()) {
+    *r = new EmulatedRandomAccessFile(this, file);
+  } else {
+    *r = NULL;
+  }
+  return s;
+}
+
+Status EmulatedStorageEnv::NewWritableFile(const char* fname,
+                                           WritableFile** r) {
+  MetadataDelay();
+  WritableFile* file;
+  Status s = target()->NewWritableFile(fname, &file);
+  if (s.ok()) {
+    *r = new EmulatedWritableFile(this, file);
+  } else {
+    *r = NULL;
+  }
+  return s;
+}
+
+}  // namespace
+
+Env* NewMemEnv(Env* base) { return new MemEnv(base); }
+
+EmulatedStorageOptions::EmulatedStorageOptions()
+    : metadata_micros(0),
+      read_micros(0),
+      write_micros(0),
+      sync_micros(0),
+      read_bytes_per_second(0),
+      write_bytes_per_second(0),
+      jitter_micros(0),
+      seed(301) {}
+
+bool ParseEmulatedStorageOptions(const char* conf,
+                                 EmulatedStorageOptions* options) {
+  std::vector<std::string> conf_segments;
+  size_t n = SplitString(&conf_segments, conf, '&');  // k1=v1 & k2=v2
+  std::vector<std::string> conf_pair;
+  for (size_t i = 0; i < n; i++) {
+    conf_pair.resize(0);
+    SplitString(&conf_pair, conf_segments[i].c_str(), '=', 1);
+    if (conf_pair.size() != 2) {
+      continue;
+    }
+    const std::string& key = conf_pair[0];
+    uint64_t num;
+    if (!ParsePrettyNumber(conf_pair[1], &num)) {
+      return false;
+    } else if (key == "metadata_micros") {
+      options->metadata_micros = num;
+    } else if (key == "read_micros") {
+      options->read_micros = num;
+    } else if (key == "write_micros") {
+      options->write_micros = num;
+    } else if (key == "sync_micros") {
+      options->sync_micros = num;
+    } else if (key == "read_bw") {
+      options->read_bytes_per_second = num;
+    } else if (key == "write_bw") {
+      options->write_bytes_per_second = num;
+    } else if (key == "jitter_micros") {
+      options->jitter_micros = num;
+    } else if (key == "seed") {
+      options->seed = static_cast<uint32_t>(num);
+    }
+  }
+  return true;
+}
+
+Env* NewEmulatedStorageEnv(Env* base, const EmulatedStorageOptions& options,
+                           bool owns_base) {
+  return new EmulatedStorageEnv(base, options, owns_base);
+}
+
+}  // namespace pdlfs
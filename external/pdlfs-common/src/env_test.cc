@@ -15,6 +15,7 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/env_mem.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
@@ -108,6 +109,91 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+class EnvMemTest {
+ public:
+  EnvMemTest() : env_(NewMemEnv(Env::Default())) {}
+  ~EnvMemTest() { delete env_; }
+
+  Env* env_;
+};
+
+TEST(EnvMemTest, ReadWrite) {
+  ASSERT_OK(env_->CreateDir("/dir"));
+  ASSERT_TRUE(!env_->CreateDir("/dir").ok());
+  ASSERT_TRUE(!env_->FileExists("/dir/f"));
+  WritableFile* wf;
+  ASSERT_OK(env_->NewWritableFile("/dir/f", &wf));
+  ASSERT_OK(wf->Append("hello "));
+  RandomAccessFile* rf;
+  ASSERT_OK(env_->NewRandomAccessFile("/dir/f", &rf));
+  ASSERT_OK(wf->Append("world"));
+  ASSERT_OK(wf->Close());
+  delete wf;
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize("/dir/f", &size));
+  ASSERT_EQ(size, 11);
+  char scratch[100];
+  Slice result;
+  ASSERT_OK(rf->Read(6, 100, &result, scratch));
+  ASSERT_EQ(result.ToString(), "world");
+  ASSERT_OK(env_->DeleteFile("/dir/f"));
+  ASSERT_TRUE(!env_->FileExists("/dir/f"));
+  // Open handles still see the data of deleted files
+  ASSERT_OK(rf->Read(0, 5, &result, scratch));
+  ASSERT_EQ(result.ToString(), "hello");
+  delete rf;
+  SequentialFile* sf;
+  ASSERT_TRUE(env_->NewSequentialFile("/dir/f", &sf).IsNotFound());
+}
+
+TEST(EnvMemTest, Children) {
+  ASSERT_OK(env_->CreateDir("/a"));
+  ASSERT_OK(env_->CreateDir("/a/b"));
+  ASSERT_OK(WriteStringToFile(env_, "1", "/a/x"));
+  ASSERT_OK(WriteStringToFile(env_, "2", "/a/b/y"));
+  ASSERT_OK(WriteStringToFile(env_, "3", "/ab"));
+  std::vector<std::string> names;
+  ASSERT_OK(env_->GetChildren("/a/", &names));
+  ASSERT_EQ(names.size(), 2);
+  ASSERT_EQ(names[0], "x");
+  ASSERT_EQ(names[1], "b");
+  ASSERT_OK(env_->RenameFile("/a/x", "/a/b/z"));
+  ASSERT_OK(env_->CopyFile("/a/b/z", "/a/b/y"));
+  std::string data;
+  ASSERT_OK(ReadFileToString(env_, "/a/b/y", &data));
+  ASSERT_EQ(data, "1");
+  ASSERT_OK(env_->GetChildren("/a", &names));
+  ASSERT_EQ(names.size(), 1);
+  FileLock* lock;
+  ASSERT_OK(env_->LockFile("/a/LOCK", &lock));
+  FileLock* lock2;
+  ASSERT_TRUE(!env_->LockFile("/a/LOCK", &lock2).ok());
+  ASSERT_OK(env_->UnlockFile(lock));
+}
+
+TEST(EnvMemTest, Emulation) {
+  EmulatedStorageOptions options;
+  ASSERT_TRUE(ParseEmulatedStorageOptions(
+      "read_micros=20000&write_bw=1m&jitter_micros=1000", &options));
+  ASSERT_EQ(options.read_micros, 20000);
+  ASSERT_EQ(options.write_bytes_per_second, 1 << 20);
+  ASSERT_TRUE(!ParseEmulatedStorageOptions("read_micros=x", &options));
+  Env* const env = NewEmulatedStorageEnv(env_, options, false);
+  Env* const clock = Env::Default();
+  uint64_t start = clock->NowMicros();
+  // 100KB at 1MB/s should take no less than 97ms
+  ASSERT_OK(WriteStringToFile(env, std::string(100 << 10, 'x'), "/f"));
+  ASSERT_GE(clock->NowMicros() - start, 97000);
+  start = clock->NowMicros();
+  std::string data;
+  ASSERT_OK(ReadFileToString(env, "/f", &data));
+  ASSERT_GE(clock->NowMicros() - start, 20000);
+  ASSERT_EQ(data.size(), 100 << 10);
+  delete env;
+  // Files live in the wrapped Env
+  ASSERT_TRUE(env_->FileExists("/f"));
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
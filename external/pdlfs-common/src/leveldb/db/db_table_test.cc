@@ -811,14 +811,23 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 610000, 612000));
 }
 
-static bool SnappyCompressionSupported() {
+static bool CompressionSupported(CompressionType type) {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
-  return port::Snappy_Compress(in.data(), in.size(), &out);
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Compress(in.data(), in.size(), &out);
+    case kZstdCompression:
+      return port::Zstd_Compress(in.data(), in.size(), &out);
+    case kLZ4Compression:
+      return port::Lz4_Compress(in.data(), in.size(), &out);
+    default:
+      return false;
+  }
 }
 
-TEST(TableTest, ApproximateOffsetOfCompressed) {
-  if (!SnappyCompressionSupported()) {
+static void TestApproximateOffsetOfCompressed(CompressionType type) {
+  if (!CompressionSupported(type)) {
     fprintf(stderr, "skipping compression tests\n");
     return;
   }
@@ -832,9 +841,9 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   c.Add("k04", test::CompressibleString(&rnd, 0.25, 10000, &tmp));
   std::vector<std::string> keys;
   KVMap kvmap;
-  Options options;
+  DBOptions options;
   options.block_size = 1024;
-  options.compression = kSnappyCompression;
+  options.compression = type;
   c.Finish(options, &keys, &kvmap);
 
   // Expected upper and lower bounds of space used by compressible strings.
@@ -851,6 +860,31 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("k04"), min_z, max_z));
   // Have now emitted two large compressible strings, so adjust expected offset.
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
+
+  // Compressed blocks must read back intact.
+  Iterator* iter = c.NewIterator();
+  iter->SeekToFirst();
+  for (KVMap::const_iterator it = kvmap.begin(); it != kvmap.end(); ++it) {
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value().ToString(), it->second);
+    iter->Next();
+  }
+  ASSERT_TRUE(!iter->Valid());
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+TEST(TableTest, ApproximateOffsetOfCompressed) {
+  TestApproximateOffsetOfCompressed(kSnappyCompression);
+}
+
+TEST(TableTest, ApproximateOffsetOfZstdCompressed) {
+  TestApproximateOffsetOfCompressed(kZstdCompression);
+}
+
+TEST(TableTest, ApproximateOffsetOfLZ4Compressed) {
+  TestApproximateOffsetOfCompressed(kLZ4Compression);
 }
 
 }  // namespace pdlfs
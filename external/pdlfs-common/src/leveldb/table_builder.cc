@@ -200,15 +200,26 @@ void TableBuilder::WriteBlock(const Slice& block_contents,
       raw_block_contents = block_contents;
       break;
 
-    case kSnappyCompression: {
+    case kSnappyCompression:
+    case kZstdCompression:
+    case kLZ4Compression: {
       std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(block_contents.data(), block_contents.size(),
-                                compressed) &&
-          compressed->size() <
-              block_contents.size() - (block_contents.size() / 8u)) {
+      bool ok;
+      if (type == kSnappyCompression) {
+        ok = port::Snappy_Compress(block_contents.data(),
+                                   block_contents.size(), compressed);
+      } else if (type == kZstdCompression) {
+        ok = port::Zstd_Compress(block_contents.data(), block_contents.size(),
+                                 compressed);
+      } else {
+        ok = port::Lz4_Compress(block_contents.data(), block_contents.size(),
+                                compressed);
+      }
+      if (ok && compressed->size() <
+                    block_contents.size() - (block_contents.size() / 8u)) {
         raw_block_contents = *compressed;
       } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
+        // Compression not supported, or compressed less than 12.5%, so just
         // store uncompressed form
         raw_block_contents = block_contents;
         type = kNoCompression;
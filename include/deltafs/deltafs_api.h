@@ -131,7 +131,18 @@ int deltafs_plfsdir_set_rank(deltafs_plfsdir_t* __dir, int __rank);
 int deltafs_plfsdir_force_leveldb_fmt(deltafs_plfsdir_t* __dir, int __flag);
 int deltafs_plfsdir_enable_io_measurement(deltafs_plfsdir_t* __dir, int __flag);
 int deltafs_plfsdir_set_fixed_kv(deltafs_plfsdir_t* __dir, int __flag);
+/* Write background events of a plfsdir writer, such as memtable compactions
+   and writer stalls, to a binary trace file on local storage. */
+int deltafs_plfsdir_set_event_trace(deltafs_plfsdir_t* __dir,
+                                    const char* __fname);
 int deltafs_plfsdir_set_side_io_buf_size(deltafs_plfsdir_t* __dir, size_t __sz);
+/* Set the number of side I/O write buffers. Up to __n - 1 full buffers may be
+   written in the background while new data is buffered. Default is 2. */
+int deltafs_plfsdir_set_side_io_num_bufs(deltafs_plfsdir_t* __dir, size_t __n);
+/* Set the read-ahead window size for sequential side I/O reads. The next
+   window is prefetched in the background. Set to 0 to disable read-ahead. */
+int deltafs_plfsdir_set_side_io_readahead(deltafs_plfsdir_t* __dir,
+                                          size_t __sz);
 int deltafs_plfsdir_set_side_filter_size(deltafs_plfsdir_t* __dir, size_t __sz);
 /* Error printer type */
 typedef void (*deltafs_printer_t)(const char* __err, void* __arg);
@@ -141,10 +152,17 @@ int deltafs_plfsdir_set_err_printer(deltafs_plfsdir_t* __dir,
 /* Return the total number of configured memtable partitions. */
 int deltafs_plfsdir_get_memparts(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_destroy(deltafs_plfsdir_t* __dir, const char* __name);
+/* Merge all epochs of the plfsdir at __src into a new plfsdir at __dst that
+   keeps a single sorted run per partition. The merged dir may be opened for
+   reading like any other dir. Must be called on a handle not yet opened. */
+int deltafs_plfsdir_merge(deltafs_plfsdir_t* __dir, const char* __src,
+                          const char* __dst);
 int deltafs_plfsdir_open(deltafs_plfsdir_t* __dir, const char* __name);
 int deltafs_plfsdir_filter_open(deltafs_plfsdir_t* __dir, const char* __name);
 int deltafs_plfsdir_filter_put(deltafs_plfsdir_t* __dir, const char* __key,
                                size_t __keylen, int __rank);
+/* Finalize the side filter of the current epoch and start a new one.
+   Each epoch's filter is sized by deltafs_plfsdir_set_side_filter_size(). */
 int deltafs_plfsdir_filter_flush(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_filter_finish(deltafs_plfsdir_t* __dir);
 int deltafs_plfsdir_io_open(deltafs_plfsdir_t* __dir, const char* __name);
@@ -178,6 +196,16 @@ char* deltafs_plfsdir_get(deltafs_plfsdir_t* __dir, const char* __key,
 void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
                            int __epoch, size_t* __sz, size_t* __table_seeks,
                            size_t* __seeks);
+/* Retrieve data for a batch of __n keys at a specific epoch, or all epochs
+   if __epoch is -1. Each key found is reported to *saver along with its
+   position in the batch. Return -1 on errors. Otherwise, return the number
+   of keys found. */
+ssize_t deltafs_plfsdir_multiget(deltafs_plfsdir_t* __dir, const char** __keys,
+                                 const size_t* __keylens, size_t __n,
+                                 int __epoch,
+                                 int (*saver)(void* arg, size_t __i,
+                                              const char* __value, size_t sz),
+                                 void* arg);
 /* Scan directory contents at a specific epoch, or all
    epochs if __epoch is -1. Report results to *saver. Return -1 on errors.
    Otherwise, return the total number of entries scanned. */
@@ -191,8 +219,28 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
 ssize_t deltafs_plfsdir_count(deltafs_plfsdir_t* __dir, int __epoch);
 ssize_t deltafs_plfsdir_io_pread(deltafs_plfsdir_t* __dir, void* __buf,
                                  size_t __sz, off_t __off);
+/* Perform a batch of __n reads against the side I/O channel. The i-th read
+   fetches __sizes[i] bytes at __offs[i] into __bufs[i] and stores the number
+   of bytes read in __lens[i]. Reads are served concurrently when a thread
+   pool is set. Return -1 on errors, or 0 on success. */
+int deltafs_plfsdir_io_preadv(deltafs_plfsdir_t* __dir, void** __bufs,
+                              const size_t* __sizes, const off_t* __offs,
+                              size_t __n, size_t* __lens);
+/* Query the side filters of all epochs. Returns a malloc()ed array of
+   distinct ranks that may have the key. Stores the length of the array
+   in *__sz. The result should be deleted by free(). */
 int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
                                 size_t __keylen, size_t* __sz);
+/* Query the side filters of all epochs for a batch of __n keys. Each
+   distinct rank that may have a key is reported to *saver along with the
+   key's position in the batch. Return -1 on errors. Otherwise, return the
+   number of keys that may exist. */
+ssize_t deltafs_plfsdir_filter_multiget(deltafs_plfsdir_t* __dir,
+                                        const char** __keys,
+                                        const size_t* __keylens, size_t __n,
+                                        int (*saver)(void* arg, size_t __i,
+                                                     int __rank),
+                                        void* arg);
 /* Returns NULL if not found. A malloc()ed array otherwise.
    The result should be deleted by free(). */
 char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir, const char* __key);
@@ -200,6 +248,17 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir, const char* __key);
    Used when the property is known to be an integer. */
 long long deltafs_plfsdir_get_integer_property(deltafs_plfsdir_t* __dir,
                                                const char* __key);
+/* Metrics formats */
+#define DELTAFS_PLFSDIR_METRICS_JSON 0
+#define DELTAFS_PLFSDIR_METRICS_PROMETHEUS 1
+/* Returns NULL on errors. A malloc()ed snapshot of all counters of an opened
+   plfsdir otherwise, formatted as either a JSON object or Prometheus text.
+   The result should be deleted by free(). */
+char* deltafs_plfsdir_dump_metrics(deltafs_plfsdir_t* __dir, int __format);
+/* Returns NULL on errors. A malloc()ed human-readable summary of an event
+   trace written by a plfsdir writer otherwise. The result should be deleted
+   by free(). */
+char* deltafs_plfsdir_trace_summary(const char* __fname);
 int deltafs_plfsdir_epoch_flush(deltafs_plfsdir_t* __dir, int __epoch);
 int deltafs_plfsdir_flush(deltafs_plfsdir_t* __dir, int __epoch);
 int deltafs_plfsdir_sync(deltafs_plfsdir_t* __dir);
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "deltafs/deltafs_api.h"
+#include "deltafs/deltafs_config.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Merge all epochs of a finished plfsdir into a new plfsdir that keeps a
+// single sorted run per partition so that reads spanning many epochs only
+// need to probe one run. Partitions are merged in parallel using a thread
+// pool.
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " <src> <dst> [<conf> [<num_threads>]]";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  if (argc < 3 || argc > 5) {
+    fprintf(stderr,
+            "Usage: %s <src> <dst> [<conf> [<num_threads>]]\n\n"
+            "conf: plfsdir options such as \"memtable_size=64m&bf_bits_per_key"
+            "=10\"\n"
+            "num_threads: number of threads for merging partitions "
+            "(default: 4)\n",
+            argv[0]);
+    return -1;
+  }
+  struct ErrorPrinter {
+    static void Print(const char* err, void* arg) {
+      fprintf(stderr, "plfsdir: %s\n", err);
+    }
+  };
+  const char* const conf = argc > 3 ? argv[3] : "";
+  const int num_threads = argc > 4 ? atoi(argv[4]) : 4;
+  deltafs_tp_t* tp = NULL;
+  if (num_threads > 0) {
+    tp = deltafs_tp_init(num_threads);
+  }
+  deltafs_plfsdir_t* dir =
+      deltafs_plfsdir_create_handle(conf, O_RDONLY, DELTAFS_PLFSDIR_DEFAULT);
+  if (dir == NULL) {
+    fprintf(stderr, "merge: cannot create dir handle: %s\n", strerror(errno));
+    return -1;
+  }
+  deltafs_plfsdir_set_err_printer(dir, ErrorPrinter::Print, NULL);
+  if (tp != NULL) {
+    deltafs_plfsdir_set_thread_pool(dir, tp);
+  }
+  int r = deltafs_plfsdir_merge(dir, argv[1], argv[2]);
+  if (r != 0) {
+    fprintf(stderr, "merge: cannot merge dir '%s' into '%s': %s\n", argv[1],
+            argv[2], strerror(errno));
+  } else {
+    fprintf(stdout, "Merged '%s' into '%s'\n", argv[1], argv[2]);
+  }
+
+  deltafs_plfsdir_free_handle(dir);
+  if (tp != NULL) {
+    deltafs_tp_close(tp);
+  }
+  return r;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "deltafs/deltafs_api.h"
+#include "deltafs/deltafs_config.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#if defined(PDLFS_GFLAGS)
+#include <gflags/gflags.h>
+#endif
+
+#if defined(PDLFS_GLOG)
+#include <glog/logging.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// Open a plfsdir whose writer may have died before finishing the directory and
+// report the epochs and keys that can be recovered from it. Index logs of all
+// partitions are replayed in parallel using a thread pool.
+int main(int argc, char* argv[]) {
+#if defined(PDLFS_GLOG)
+  FLAGS_logtostderr = true;
+#endif
+#if defined(PDLFS_GFLAGS)
+  std::string usage("Sample usage: ");
+  usage += argv[0];
+  usage += " <dir> [<conf> [<num_threads>]]";
+  google::SetUsageMessage(usage);
+  google::SetVersionString(PDLFS_COMMON_VERSION);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+#endif
+#if defined(PDLFS_GLOG)
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+#endif
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr,
+            "Usage: %s <dir> [<conf> [<num_threads>]]\n\n"
+            "conf: plfsdir options such as \"lg_parts=2&skip_checksums=1\"\n"
+            "  lg_parts is required if the dir info file is missing\n"
+            "num_threads: number of threads for replaying index logs "
+            "(default: 4)\n",
+            argv[0]);
+    return -1;
+  }
+  struct ErrorPrinter {
+    static void Print(const char* err, void* arg) {
+      fprintf(stderr, "plfsdir: %s\n", err);
+    }
+  };
+  std::string conf = argc > 2 ? argv[2] : "";
+  if (!conf.empty()) conf += "&";
+  conf += "recover_partial_logs=true";
+  const int num_threads = argc > 3 ? atoi(argv[3]) : 4;
+  deltafs_tp_t* tp = NULL;
+  if (num_threads > 0) {
+    tp = deltafs_tp_init(num_threads);
+  }
+  deltafs_plfsdir_t* dir = deltafs_plfsdir_create_handle(
+      conf.c_str(), O_RDONLY, DELTAFS_PLFSDIR_DEFAULT);
+  if (dir == NULL) {
+    fprintf(stderr, "recover: cannot create dir handle: %s\n",
+            strerror(errno));
+    return -1;
+  }
+  deltafs_plfsdir_set_err_printer(dir, ErrorPrinter::Print, NULL);
+  if (tp != NULL) {
+    deltafs_plfsdir_set_thread_pool(dir, tp);
+  }
+  int r = deltafs_plfsdir_open(dir, argv[1]);
+  if (r != 0) {
+    fprintf(stderr, "recover: cannot open dir '%s': %s\n", argv[1],
+            strerror(errno));
+  } else {
+    const long long num_epochs =
+        deltafs_plfsdir_get_integer_property(dir, "num_epochs");
+    long long total = 0;
+    for (long long epoch = 0; epoch < num_epochs; epoch++) {
+      ssize_t n = deltafs_plfsdir_count(dir, static_cast<int>(epoch));
+      if (n < 0) {
+        fprintf(stderr, "recover: cannot count epoch %lld: %s\n", epoch,
+                strerror(errno));
+        r = -1;
+        break;
+      }
+      fprintf(stdout, "Epoch %lld: %lld keys\n", epoch,
+              static_cast<long long>(n));
+      total += n;
+    }
+    fprintf(stdout, "Recovered %lld epochs, %lld keys\n", num_epochs, total);
+  }
+
+  deltafs_plfsdir_free_handle(dir);
+  if (tp != NULL) {
+    deltafs_tp_close(tp);
+  }
+  return r;
+}
@@ -17,6 +17,8 @@
 
 #include "plfsio/v1/bufio.h"
 #include "plfsio/v1/cuckoo.h"
+#include "plfsio/v1/events.h"
+#include "plfsio/v1/filterio.h"
 #include "plfsio/v1/pdb.h"
 #include "plfsio/v1/types.h"
 #include "plfsio/v1/v1.h"
@@ -39,7 +41,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #ifndef EHOSTUNREACH
 #define EHOSTUNREACH ENODEV
@@ -664,6 +668,10 @@ IMPORT(DirOptions);
 IMPORT(DirWriter);
 IMPORT(DirReader);
 IMPORT(DirMode);
+IMPORT(EventTraceListener);
+
+IMPORT(FilterReader);
+IMPORT(FilterWriter);
 
 IMPORT(BufferedBlockReader);
 IMPORT(BufferedBlockWriter);
@@ -1095,14 +1103,20 @@ struct deltafs_plfsdir {
   pdlfs::RandomAccessFile* blk_src_;
   BufferedBlockReader* blk_reader_;
   pdlfs::WritableFile* cuckoo_dst_;
+  FilterWriter* cuckoo_writer_;
   Cuckoo* cuckoo_;
-  std::string* cuckoo_data_;
+  uint32_t cuckoo_epoch_;  // Next epoch number to write
+  // Number of keys inserted since the last epoch flush
+  uint32_t cuckoo_keys_;
+  std::vector<std::string>* cuckoo_data_;  // One filter per epoch
   pdlfs::WritableFile* io_dst;
   DirectWriter* io_writer;
   DirWriter* writer;
   pdlfs::RandomAccessFile* io_src;
   DirectReader* io_reader;
   DirReader* reader;
+  char* trace_fname;  // Event trace file, or NULL if not tracing
+  EventTraceListener* listener;
   bool unordered;  // If the unordered mode should be used
   // If the multi-map mode should be used
   bool multi;
@@ -1112,6 +1126,8 @@ struct deltafs_plfsdir {
   bool ft_opened;
   bool io_opened;  // If side io has been opened
   size_t side_io_buf_size;
+  size_t side_io_readahead;  // 0 if read-ahead is disabled
+  size_t side_io_num_bufs;
   size_t side_ft_size;
   DirOptions* io_options;
   deltafs_printer_t printer;  // Error printer
@@ -1133,6 +1149,7 @@ deltafs_plfsdir_t* deltafs_plfsdir_create_handle(const char* __conf, int __mode,
     dir->db_drain_compactions = true;
     dir->io_options = new DirOptions(ParseOptions(__conf));
     dir->side_io_buf_size = 2 << 20;
+    dir->side_io_num_bufs = 2;
     dir->mode = __mode;
     dir->is_env_pfs = true;
     dir->enable_io_measurement = true;
@@ -1267,6 +1284,18 @@ int deltafs_plfsdir_enable_io_measurement(deltafs_plfsdir_t* __dir,
   }
 }
 
+int deltafs_plfsdir_set_event_trace(deltafs_plfsdir_t* __dir,
+                                    const char* __fname) {
+  if (__dir && !__dir->opened && __fname && __fname[0]) {
+    free(__dir->trace_fname);
+    __dir->trace_fname = strdup(__fname);
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_plfsdir_set_side_io_buf_size(deltafs_plfsdir_t* __dir,
                                          size_t __sz) {
   if (__dir && !__dir->opened) {
@@ -1281,6 +1310,28 @@ int deltafs_plfsdir_set_side_io_buf_size(deltafs_plfsdir_t* __dir,
   }
 }
 
+int deltafs_plfsdir_set_side_io_num_bufs(deltafs_plfsdir_t* __dir,
+                                         size_t __n) {
+  if (__dir && !__dir->opened && __n >= 2) {
+    __dir->side_io_num_bufs = __n;
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
+int deltafs_plfsdir_set_side_io_readahead(deltafs_plfsdir_t* __dir,
+                                          size_t __sz) {
+  if (__dir && !__dir->opened) {
+    __dir->side_io_readahead = __sz;
+    return 0;
+  } else {
+    SetErrno(BadArgs());
+    return -1;
+  }
+}
+
 int deltafs_plfsdir_set_side_filter_size(deltafs_plfsdir_t* __dir,
                                          size_t __sz) {
   if (__dir && !__dir->opened) {
@@ -1549,6 +1600,15 @@ pdlfs::Status OpenDir(deltafs_plfsdir_t* dir, const std::string& name) {
     DirWriter* writer;
     dir->io_options->compaction_pool = dir->pool;
     dir->io_options->measure_writes = false;
+    if (dir->trace_fname != NULL) {
+      // Traces always go to local storage
+      s = EventTraceListener::Open(pdlfs::Env::Default(), dir->trace_fname,
+                                   &dir->listener);
+      if (!s.ok()) {
+        return s;
+      }
+      dir->io_options->listener = dir->listener;
+    }
     s = DirWriter::Open(*dir->io_options, name, &writer);
     if (s.ok()) {
       dir->writer = writer;
@@ -1574,24 +1634,80 @@ std::string SideFilterName(const std::string& parent, int rank) {
   return parent + "/" + tmp;
 }
 
-pdlfs::Status ReadFilter(pdlfs::Env* env, pdlfs::SequentialFile* file,
-                         std::string* data) {
-  pdlfs::Status s;
+// Shared state for loading per-epoch side filters in parallel.
+struct FilterLoadContext {
+  pdlfs::port::Mutex* mu;
+  pdlfs::port::CondVar* cv;
+  FilterReader* reader;
+  std::vector<std::string>* filters;
+  uint32_t num_open_reads;  // Protected by *mu
+  pdlfs::Status status;     // Protected by *mu
+};
+
+struct FilterLoadItem {
+  FilterLoadContext* ctx;
+  uint32_t i;
+};
+
+// Fetch the i-th filter into its reserved slot. Each call uses its own slot
+// as scratch so concurrent calls do not interfere with each other.
+void LoadFilter(FilterLoadContext* ctx, uint32_t i) {
+  std::string* const dst = &(*ctx->filters)[i];
+  pdlfs::Slice contents;
+  uint32_t ignored_epoch;
+  pdlfs::Status s = ctx->reader->ReadAt(i, &ignored_epoch, &contents, dst);
+  if (s.ok() && contents.data() != dst->data()) {
+    dst->assign(contents.data(), contents.size());
+  }
+  pdlfs::MutexLock ml(ctx->mu);
+  if (ctx->status.ok() && !s.ok()) {
+    ctx->status = s;
+  }
+  assert(ctx->num_open_reads > 0);
+  ctx->num_open_reads--;
+  ctx->cv->SignalAll();
+}
+
+void BGLoadFilter(void* arg) {
+  FilterLoadItem* const item = reinterpret_cast<FilterLoadItem*>(arg);
+  LoadFilter(item->ctx, item->i);
+}
+
+// Read all per-epoch filters of a side filter file into memory. Filters are
+// fetched in parallel when a thread pool is given.
+pdlfs::Status ReadFilters(pdlfs::ThreadPool* pool, pdlfs::RandomAccessFile* src,
+                          uint64_t src_sz, std::vector<std::string>* data) {
+  FilterReader reader(src, src_sz);
+  uint32_t n = 0;
+  pdlfs::Status s = reader.NumFilters(&n);
+  if (!s.ok()) {
+    return s;
+  }
   data->clear();
-  char* space = new char[8 << 20];
-  while (true) {
-    pdlfs::Slice fragment;
-    s = file->Read(8 << 20, &fragment, space);
-    if (!s.ok()) {
-      break;
-    }
-    data->append(fragment.data(), fragment.size());
-    if (fragment.empty()) {
-      break;
+  data->resize(n);
+  pdlfs::port::Mutex mu;
+  pdlfs::port::CondVar cv(&mu);
+  FilterLoadContext ctx;
+  ctx.mu = &mu;
+  ctx.cv = &cv;
+  ctx.reader = &reader;
+  ctx.filters = data;
+  ctx.num_open_reads = n;
+  std::vector<FilterLoadItem> items(n);
+  for (uint32_t i = 0; i < n; i++) {
+    items[i].ctx = &ctx;
+    items[i].i = i;
+    if (pool != NULL && n > 1) {
+      pool->Schedule(BGLoadFilter, &items[i]);
+    } else {
+      LoadFilter(&ctx, i);
     }
   }
-  delete[] space;
-  return s;
+  pdlfs::MutexLock ml(&mu);
+  while (ctx.num_open_reads > 0) {
+    cv.Wait();
+  }
+  return ctx.status;
 }
 
 // Open a side filter for a given plfsdir.
@@ -1610,14 +1726,20 @@ pdlfs::Status OpenSideFt(deltafs_plfsdir_t* dir, const std::string& name) {
     if (s.ok()) {
       dir->cuckoo_ = new Cuckoo(*dir->io_options, 0);
       dir->cuckoo_->Reset(dir->side_ft_size);
+      dir->cuckoo_writer_ = new FilterWriter(dst);
       dir->cuckoo_dst_ = dst;
     }
   } else if (dir->mode == O_RDONLY) {
-    pdlfs::SequentialFile* src;
-    s = env->NewSequentialFile(SideFilterName(name, r).c_str(), &src);
+    const std::string fname = SideFilterName(name, r);
+    pdlfs::RandomAccessFile* src;
+    uint64_t src_sz;
+    s = env->GetFileSize(fname.c_str(), &src_sz);
+    if (s.ok()) {
+      s = env->NewRandomAccessFile(fname.c_str(), &src);
+    }
     if (s.ok()) {
-      dir->cuckoo_data_ = new std::string;
-      s = ReadFilter(env, src, dir->cuckoo_data_);
+      dir->cuckoo_data_ = new std::vector<std::string>;
+      s = ReadFilters(dir->pool, src, src_sz, dir->cuckoo_data_);
       delete src;
     }
   } else {
@@ -1647,15 +1769,17 @@ pdlfs::Status OpenSideIo(deltafs_plfsdir_t* dir, const std::string& name) {
     pdlfs::WritableFile* io_file;
     s = env->NewWritableFile(SideName(name, r).c_str(), &io_file);
     if (s.ok()) {
-      dir->io_writer =
-          new DirectWriter(*dir->io_options, io_file, dir->side_io_buf_size);
+      dir->io_writer = new DirectWriter(*dir->io_options, io_file,
+                                        dir->side_io_buf_size,
+                                        dir->side_io_num_bufs);
       dir->io_dst = io_file;
     }
   } else if (dir->mode == O_RDONLY) {
     pdlfs::RandomAccessFile* io_file;
     s = env->NewRandomAccessFile(SideName(name, r).c_str(), &io_file);
     if (s.ok()) {
-      dir->io_reader = new DirectReader(*dir->io_options, io_file);
+      dir->io_reader = new DirectReader(*dir->io_options, io_file,
+                                        dir->side_io_readahead);
       dir->io_src = io_file;
     }
   } else {
@@ -1665,6 +1789,20 @@ pdlfs::Status OpenSideIo(deltafs_plfsdir_t* dir, const std::string& name) {
   return s;
 }
 
+// Finalize the filter of the current epoch and write it to the side filter
+// file. The in-memory filter is then reset for the next epoch.
+// REQUIRES: the side filter has been opened for writing.
+pdlfs::Status FlushSideFt(deltafs_plfsdir_t* dir) {
+  pdlfs::Slice ft = dir->cuckoo_->Finish();
+  pdlfs::Status s = dir->cuckoo_writer_->EpochFlush(dir->cuckoo_epoch_, ft);
+  if (s.ok()) {
+    dir->cuckoo_->Reset(dir->side_ft_size);
+    dir->cuckoo_epoch_++;
+    dir->cuckoo_keys_ = 0;
+  }
+  return s;
+}
+
 int DirError(deltafs_plfsdir_t* dir, const pdlfs::Status& s) {
   if (dir != NULL && dir->printer != NULL) {
     dir->printer(s.ToString().c_str(), dir->printer_arg);
@@ -1958,6 +2096,7 @@ int deltafs_plfsdir_filter_put(deltafs_plfsdir_t* __dir, const char* __key,
   } else {
     pdlfs::Slice k(__key, __keylen);
     __dir->cuckoo_->AddKey(k, __rank);
+    __dir->cuckoo_keys_++;
   }
 
   if (!s.ok()) {
@@ -1975,7 +2114,7 @@ int deltafs_plfsdir_filter_flush(deltafs_plfsdir_t* __dir) {
   } else if (__dir->mode != O_WRONLY) {
     s = BadArgs();
   } else {
-    // TODO
+    s = FlushSideFt(__dir);
   }
 
   if (!s.ok()) {
@@ -1993,14 +2132,14 @@ int deltafs_plfsdir_filter_finish(deltafs_plfsdir_t* __dir) {
   } else if (__dir->mode != O_WRONLY) {
     s = BadArgs();
   } else {
-    pdlfs::Slice ft = __dir->cuckoo_->Finish();
-    pdlfs::WritableFile* const f = __dir->cuckoo_dst_;
-    s = f->Append(ft);
+    if (__dir->cuckoo_keys_ != 0) {
+      s = FlushSideFt(__dir);
+    }
     if (s.ok()) {
-      s = f->Sync();
+      s = __dir->cuckoo_writer_->Finish();
     }
 
-    f->Close();
+    __dir->cuckoo_dst_->Close();
   }
 
   if (!s.ok()) {
@@ -2153,6 +2292,17 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir,
         uint64_t tsk = __dir->io_env->TotalRandomSeeks();
         return MakeChar(tsk);
       }
+    } else if (k.starts_with("latency.")) {
+      std::string val;
+      if (__dir->writer != NULL) {
+        if (__dir->writer->GetProperty(k, &val)) {
+          return strdup(val.c_str());
+        }
+      } else if (__dir->reader != NULL) {
+        if (__dir->reader->GetProperty(k, &val)) {
+          return strdup(val.c_str());
+        }
+      }
     } else if (__dir->writer != NULL) {
       if (k == "total_user_data") {
         uint64_t vsz = __dir->writer->TEST_value_bytes();
@@ -2184,12 +2334,63 @@ char* deltafs_plfsdir_get_property(deltafs_plfsdir_t* __dir,
         return MakeChar(tbs);
       }
     } else if (__dir->reader != NULL) {
-      // TODO
+      if (k == "num_epochs") {
+        uint32_t eps;
+        if (__dir->reader->GetNumEpochs(&eps).ok()) {
+          return MakeChar(eps);
+        }
+      }
     }
     return NULL;
   }
 }
 
+char* deltafs_plfsdir_dump_metrics(deltafs_plfsdir_t* __dir, int __format) {
+  if (!IsDirOpened(__dir)) {
+    SetErrno(BadArgs());
+    return NULL;
+  } else if (__format != DELTAFS_PLFSDIR_METRICS_JSON &&
+             __format != DELTAFS_PLFSDIR_METRICS_PROMETHEUS) {
+    SetErrno(BadArgs());
+    return NULL;
+  }
+  pdlfs::plfsio::DirMetrics metrics;
+  if (__dir->writer != NULL) {
+    __dir->writer->GetMetrics(&metrics);
+  } else if (__dir->reader != NULL) {
+    __dir->reader->GetMetrics(&metrics);
+  }
+  if (__dir->io_env != NULL) {
+    DirEnvWrapper* const env = __dir->io_env;
+    metrics.Add("io_total_read_open", env->TotalFilesOpenedForRead());
+    metrics.Add("io_total_bytes_read", env->TotalBytesRead());
+    metrics.Add("io_total_write_open", env->TotalFilesOpenedForWrite());
+    metrics.Add("io_total_bytes_written", env->TotalBytesWritten());
+    metrics.Add("io_total_seeks", env->TotalRandomSeeks());
+  }
+  const int rank = __dir->io_options->rank;
+  if (__format == DELTAFS_PLFSDIR_METRICS_JSON) {
+    return strdup(metrics.ToJson(rank).c_str());
+  } else {
+    return strdup(metrics.ToPrometheus(rank).c_str());
+  }
+}
+
+char* deltafs_plfsdir_trace_summary(const char* __fname) {
+  if (__fname == NULL || __fname[0] == 0) {
+    SetErrno(BadArgs());
+    return NULL;
+  }
+  std::vector<pdlfs::plfsio::EventRecord> records;
+  pdlfs::Status s = pdlfs::plfsio::ReadEventTrace(pdlfs::Env::Default(),
+                                                  __fname, &records);
+  if (!s.ok()) {
+    SetErrno(s);
+    return NULL;
+  }
+  return strdup(pdlfs::plfsio::SummarizeEventTrace(records).c_str());
+}
+
 long long deltafs_plfsdir_get_integer_property(deltafs_plfsdir_t* __dir,
                                                const char* __key) {
   char* val = deltafs_plfsdir_get_property(__dir, __key);
@@ -2297,6 +2498,59 @@ void* deltafs_plfsdir_read(deltafs_plfsdir_t* __dir, const char* __fname,
   }
 }
 
+ssize_t deltafs_plfsdir_multiget(deltafs_plfsdir_t* __dir, const char** __keys,
+                                 const size_t* __keylens, size_t __n,
+                                 int __epoch,
+                                 int (*saver)(void* arg, size_t __i,
+                                              const char* __value, size_t sz),
+                                 void* arg) {
+  pdlfs::Status s;
+  size_t n = 0;
+
+  if (!IsDirOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__n != 0 && (!__keys || !__keylens)) {
+    s = BadArgs();
+  } else {
+    std::vector<pdlfs::Slice> keys(__n);
+    std::vector<std::string> results(__n);
+    for (size_t i = 0; i < __n; i++) {
+      keys[i] = pdlfs::Slice(__keys[i], __keylens[i]);
+    }
+    if (__n == 0) {
+      // Empty batch
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
+      DirReader::ReadOp op;
+      op.SetEpoch(__epoch);
+      for (size_t i = 0; s.ok() && i < __n; i++) {
+        s = __dir->reader->Read(op, keys[i], &results[i]);
+      }
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+      s = __dir->blk_reader_->MultiGet(&keys[0], __n, &results[0]);
+    } else {
+      for (size_t i = 0; s.ok() && i < __n; i++) {
+        s = DbGet(__dir, keys[i], &results[i]);
+      }
+    }
+    for (size_t i = 0; s.ok() && i < __n; i++) {
+      if (!results[i].empty()) {
+        n++;
+        if (saver(arg, i, results[i].data(), results[i].size()) == -1) {
+          break;  // User does not want to continue
+        }
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return n;
+  }
+}
+
 namespace {
 
 struct ScanState {
@@ -2333,6 +2587,8 @@ ssize_t deltafs_plfsdir_scan(deltafs_plfsdir_t* __dir, int __epoch,
     op.n = &n;
     if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
       s = __dir->reader->Scan(op, ScanSaver, &state);
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+      s = __dir->blk_reader_->Scan(ScanSaver, &state, &n);
     } else {
       // Not implemented
     }
@@ -2358,6 +2614,8 @@ ssize_t deltafs_plfsdir_count(deltafs_plfsdir_t* __dir, int __epoch) {
     op.SetEpoch(__epoch);
     if (__dir->io_engine == DELTAFS_PLFSDIR_DEFAULT) {
       s = __dir->reader->Count(op, &n);
+    } else if (__dir->io_engine == DELTAFS_PLFSDIR_PLAINDB) {
+      s = __dir->blk_reader_->Count(&n);
     } else {
       // Not implemented
     }
@@ -2398,6 +2656,41 @@ ssize_t deltafs_plfsdir_io_pread(deltafs_plfsdir_t* __dir, void* __buf,
   }
 }
 
+int deltafs_plfsdir_io_preadv(deltafs_plfsdir_t* __dir, void** __bufs,
+                              const size_t* __sizes, const off_t* __offs,
+                              size_t __n, size_t* __lens) {
+  pdlfs::Status s;
+
+  if (!IsSideIoOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__n != 0 && (!__bufs || !__sizes || !__offs || !__lens)) {
+    s = BadArgs();
+  } else if (__n != 0) {
+    std::vector<uint64_t> offsets(__offs, __offs + __n);
+    std::vector<char*> scratches(__n);
+    std::vector<pdlfs::Slice> results(__n);
+    for (size_t i = 0; i < __n; i++) {
+      scratches[i] = static_cast<char*>(__bufs[i]);
+    }
+    s = __dir->io_reader->ReadV(&offsets[0], __sizes, __n, &results[0],
+                                &scratches[0]);
+    for (size_t i = 0; s.ok() && i < __n; i++) {
+      __lens[i] = results[i].size();
+      if (__lens[i] != 0 && results[i].data() != scratches[i]) {
+        memcpy(__bufs[i], results[i].data(), __lens[i]);
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
                                 size_t __keylen, size_t* __sz) {
   pdlfs::Status s;
@@ -2410,7 +2703,12 @@ int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
     s = BadArgs();
   } else {
     pdlfs::Slice k(__key, __keylen);
-    pdlfs::plfsio::CuckooValues(k, *__dir->cuckoo_data_, &values);
+    const std::vector<std::string>& fts = *__dir->cuckoo_data_;
+    for (size_t i = 0; i < fts.size(); i++) {
+      pdlfs::plfsio::CuckooValues(k, fts[i], &values);
+    }
+    std::sort(values.begin(), values.end());
+    values.erase(std::unique(values.begin(), values.end()), values.end());
     result = static_cast<int*>(malloc(sizeof(int) * values.size()));
     for (size_t i = 0; i < values.size(); i++) {
       result[i] = values[i];
@@ -2428,6 +2726,66 @@ int* deltafs_plfsdir_filter_get(deltafs_plfsdir_t* __dir, const char* __key,
   }
 }
 
+// Each filter is first probed for the entire batch at once. Values are only
+// retrieved for keys that may be in the filter.
+ssize_t deltafs_plfsdir_filter_multiget(deltafs_plfsdir_t* __dir,
+                                        const char** __keys,
+                                        const size_t* __keylens, size_t __n,
+                                        int (*saver)(void* arg, size_t __i,
+                                                     int __rank),
+                                        void* arg) {
+  pdlfs::Status s;
+  size_t n = 0;
+
+  if (!IsSideFtOpened(__dir)) {
+    s = BadArgs();
+  } else if (__dir->mode != O_RDONLY) {
+    s = BadArgs();
+  } else if (__n != 0 && (!__keys || !__keylens)) {
+    s = BadArgs();
+  } else if (__n != 0) {
+    std::vector<pdlfs::Slice> keys(__n);
+    std::vector<std::vector<uint32_t> > values(__n);
+    for (size_t i = 0; i < __n; i++) {
+      keys[i] = pdlfs::Slice(__keys[i], __keylens[i]);
+    }
+    bool* const may_match = new bool[__n];
+    const std::vector<std::string>& fts = *__dir->cuckoo_data_;
+    for (size_t j = 0; j < fts.size(); j++) {
+      pdlfs::plfsio::CuckooKeyMayMatchBatch(&keys[0], __n, fts[j], may_match);
+      for (size_t i = 0; i < __n; i++) {
+        if (may_match[i]) {
+          pdlfs::plfsio::CuckooValues(keys[i], fts[j], &values[i]);
+        }
+      }
+    }
+    delete[] may_match;
+    for (size_t i = 0; i < __n; i++) {
+      std::vector<uint32_t>* const v = &values[i];
+      if (v->empty()) continue;
+      std::sort(v->begin(), v->end());
+      v->erase(std::unique(v->begin(), v->end()), v->end());
+      n++;
+      bool stop = false;
+      for (size_t j = 0; j < v->size(); j++) {
+        if (saver(arg, i, static_cast<int>((*v)[j])) == -1) {
+          stop = true;  // User does not want to continue
+          break;
+        }
+      }
+      if (stop) {
+        break;
+      }
+    }
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return n;
+  }
+}
+
 int deltafs_plfsdir_destroy(deltafs_plfsdir_t* __dir, const char* __name) {
   pdlfs::Status s;
 
@@ -2446,6 +2804,34 @@ int deltafs_plfsdir_destroy(deltafs_plfsdir_t* __dir, const char* __name) {
   }
 }
 
+int deltafs_plfsdir_merge(deltafs_plfsdir_t* __dir, const char* __src,
+                          const char* __dst) {
+  pdlfs::Status s;
+
+  if (!__dir) {
+    s = BadArgs();
+  } else if (__dir->opened) {
+    s = BadArgs();
+  } else if (!__src || !__dst) {
+    s = BadArgs();
+  } else {
+    DirOptions options = *__dir->io_options;
+    options.allow_env_threads = false;
+    options.is_env_pfs = __dir->is_env_pfs;
+    options.env = __dir->env;
+    // Partitions are merged using the handle's thread pool
+    options.reader_pool = __dir->pool;
+    options.compaction_pool = NULL;
+    s = pdlfs::plfsio::MergeDir(__src, __dst, options);
+  }
+
+  if (!s.ok()) {
+    return DirError(__dir, s);
+  } else {
+    return 0;
+  }
+}
+
 int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir) {
   if (!__dir) return 0;
 
@@ -2453,10 +2839,13 @@ int deltafs_plfsdir_free_handle(deltafs_plfsdir_t* __dir) {
   delete __dir->db_filter;
   delete __dir->writer;
   delete __dir->reader;
+  delete __dir->listener;
+  free(__dir->trace_fname);
   delete __dir->blk_writer_;
   delete __dir->blk_dst_;
   delete __dir->blk_reader_;
   delete __dir->blk_src_;
+  delete __dir->cuckoo_writer_;
   delete __dir->cuckoo_;
   delete __dir->cuckoo_dst_;
   delete __dir->cuckoo_data_;
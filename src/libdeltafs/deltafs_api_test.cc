@@ -24,6 +24,7 @@
 #include <stdio.h>
 
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace pdlfs {
@@ -116,6 +117,59 @@ class PlfsDirTest {
     return tmp;
   }
 
+  static int SaveValue(void* arg, size_t i, const char* value, size_t sz) {
+    std::vector<std::string>* const r =
+        reinterpret_cast<std::vector<std::string>*>(arg);
+    (*r)[i] = std::string(value, sz);
+    return 0;
+  }
+
+  static int SaveRank(void* arg, size_t i, int rank) {
+    reinterpret_cast<std::vector<std::pair<size_t, int> >*>(arg)->push_back(
+        std::make_pair(i, rank));
+    return 0;
+  }
+
+  // Return the values of a batch of keys, separated by spaces.
+  // Keys not found are represented by "-".
+  std::string MultiGet(const std::vector<std::string>& keys) {
+    if (wdir_ != NULL) Finish();
+    if (rdir_ == NULL) OpenReader(kDefEngine);
+    std::vector<const char*> k;
+    std::vector<size_t> l;
+    for (size_t i = 0; i < keys.size(); i++) {
+      k.push_back(keys[i].data());
+      l.push_back(keys[i].size());
+    }
+    std::vector<std::string> r(keys.size(), "-");
+    ssize_t n = deltafs_plfsdir_multiget(rdir_, &k[0], &l[0], keys.size(), -1,
+                                         SaveValue, &r);
+    ASSERT_TRUE(n >= 0);
+    std::string tmp;
+    for (size_t i = 0; i < r.size(); i++) {
+      if (i != 0) tmp += " ";
+      tmp += r[i];
+    }
+    return tmp;
+  }
+
+  static int AppendKv(void* arg, const char* key, size_t keylen,
+                      const char* value, size_t sz) {
+    std::string* const r = reinterpret_cast<std::string*>(arg);
+    r->append(key, keylen);
+    r->append(value, sz);
+    return 0;
+  }
+
+  std::string Scan() {
+    if (wdir_ != NULL) Finish();
+    if (rdir_ == NULL) OpenReader(kDefEngine);
+    std::string tmp;
+    ssize_t n = deltafs_plfsdir_scan(rdir_, -1, AppendKv, &tmp);
+    ASSERT_TRUE(n >= 0);
+    return tmp;
+  }
+
   std::string IoRead(uint64_t off, size_t sz) {
     if (wdir_ != NULL) Finish();
     if (rdir_ == NULL) OpenReader(kDefEngine);
@@ -127,6 +181,27 @@ class PlfsDirTest {
     return tmp;
   }
 
+  // Return the results of a batch of side I/O reads, separated by spaces.
+  std::string IoReadV(const std::vector<off_t>& offs, size_t sz) {
+    if (wdir_ != NULL) Finish();
+    if (rdir_ == NULL) OpenReader(kDefEngine);
+    const size_t n = offs.size();
+    std::vector<std::string> bufs(n, std::string(sz, 0));
+    std::vector<void*> b;
+    for (size_t i = 0; i < n; i++) b.push_back(&bufs[i][0]);
+    std::vector<size_t> sizes(n, sz);
+    std::vector<size_t> lens(n);
+    int r = deltafs_plfsdir_io_preadv(rdir_, &b[0], &sizes[0], &offs[0], n,
+                                      &lens[0]);
+    ASSERT_TRUE(r == 0);
+    std::string tmp;
+    for (size_t i = 0; i < n; i++) {
+      if (i != 0) tmp += " ";
+      tmp += bufs[i].substr(0, lens[i]);
+    }
+    return tmp;
+  }
+
   std::string dirname_;
   std::string dirconf_;
   enum { kDefEngine = DELTAFS_PLFSDIR_DEFAULT };
@@ -164,6 +239,46 @@ TEST(PlfsDirTest, SingleEpoch) {
   ASSERT_EQ(Get("k4"), "v4");
   ASSERT_EQ(Get("k5"), "v5");
   ASSERT_EQ(Get("k6"), "v6");
+  std::vector<std::string> keys;
+  keys.push_back("k2");
+  keys.push_back("k7");
+  keys.push_back("k5");
+  ASSERT_EQ(MultiGet(keys), "v2 - v5");
+  std::vector<off_t> offs;
+  offs.push_back(4);
+  offs.push_back(0);
+  offs.push_back(2);
+  ASSERT_EQ(IoReadV(offs, 2), "yz ab cx");
+}
+
+TEST(PlfsDirTest, Metrics) {
+  dirconf_ = "measure_latencies=true";
+  Put("k1", "v1");
+  Put("k2", "v2");
+  FinishEpoch();
+  char* json = deltafs_plfsdir_dump_metrics(wdir_, DELTAFS_PLFSDIR_METRICS_JSON);
+  ASSERT_TRUE(json != NULL);
+  std::string val = json;
+  free(json);
+  ASSERT_TRUE(val.find("{\"rank\":0,\"dir\":{\"epoch\":1,") == 0);
+  ASSERT_TRUE(val.find("\"num_keys\":") != std::string::npos);
+  ASSERT_TRUE(val.find("\"io_total_bytes_written\":") != std::string::npos);
+  char* text =
+      deltafs_plfsdir_dump_metrics(wdir_, DELTAFS_PLFSDIR_METRICS_PROMETHEUS);
+  ASSERT_TRUE(text != NULL);
+  val = text;
+  free(text);
+  ASSERT_TRUE(val.find("plfsdir_num_parts{rank=\"0\"} 1\n") !=
+              std::string::npos);
+  ASSERT_TRUE(val.find("plfsdir_num_keys{rank=\"0\",part=\"0\"} 2\n") !=
+              std::string::npos);
+  ASSERT_TRUE(deltafs_plfsdir_dump_metrics(wdir_, 42) == NULL);
+  ASSERT_EQ(Get("k1"), "v1");
+  json = deltafs_plfsdir_dump_metrics(rdir_, DELTAFS_PLFSDIR_METRICS_JSON);
+  ASSERT_TRUE(json != NULL);
+  val = json;
+  free(json);
+  ASSERT_TRUE(val.find("\"latency_data_read_count\":1") != std::string::npos);
 }
 
 TEST(PlfsDirTest, PdbEmpty) {
@@ -200,6 +315,67 @@ TEST(PlfsDirTest, PdbRw) {
   ASSERT_EQ(Get("k4"), "v4");
   ASSERT_EQ(Get("k5"), "v5");
   ASSERT_EQ(Get("k6"), "v6");
+  std::vector<std::string> keys;
+  keys.push_back("k6");
+  keys.push_back("k0");
+  keys.push_back("k1");
+  keys.push_back("k4");
+  ASSERT_EQ(MultiGet(keys), "v6 - v1 v4");
+  ASSERT_EQ(Scan(), "k1v1k2v2k3v3k4v4k5v5k6v6");
+  ASSERT_EQ(deltafs_plfsdir_count(rdir_, -1), 6);
+}
+
+TEST(PlfsDirTest, SideFilter) {
+  OpenWriter(DELTAFS_PLFSDIR_PLAINDB);
+  deltafs_plfsdir_set_side_filter_size(wdir_, 16);
+  ASSERT_TRUE(deltafs_plfsdir_filter_open(wdir_, dirname_.c_str()) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_put(wdir_, "k1", 2, 1) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_put(wdir_, "k2", 2, 2) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_flush(wdir_) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_put(wdir_, "k1", 2, 3) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_flush(wdir_) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_put(wdir_, "k1", 2, 1) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_put(wdir_, "k3", 2, 4) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_finish(wdir_) == 0);
+  FinishEpoch();
+  Finish();
+  // Use a thread pool so that per-epoch filters are loaded in parallel
+  deltafs_tp_t* tp = deltafs_tp_init(2);
+  const char* c = dirconf_.c_str();
+  rdir_ = deltafs_plfsdir_create_handle(c, O_RDONLY, DELTAFS_PLFSDIR_PLAINDB);
+  ASSERT_TRUE(rdir_ != NULL);
+  ASSERT_TRUE(deltafs_plfsdir_set_thread_pool(rdir_, tp) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_open(rdir_, dirname_.c_str()) == 0);
+  ASSERT_TRUE(deltafs_plfsdir_filter_open(rdir_, dirname_.c_str()) == 0);
+  size_t sz = 0;
+  int* r = deltafs_plfsdir_filter_get(rdir_, "k1", 2, &sz);
+  ASSERT_EQ(sz, 2);
+  ASSERT_EQ(r[0], 1);
+  ASSERT_EQ(r[1], 3);
+  free(r);
+  r = deltafs_plfsdir_filter_get(rdir_, "k2", 2, &sz);
+  ASSERT_EQ(sz, 1);
+  ASSERT_EQ(r[0], 2);
+  free(r);
+  r = deltafs_plfsdir_filter_get(rdir_, "k3", 2, &sz);
+  ASSERT_EQ(sz, 1);
+  ASSERT_EQ(r[0], 4);
+  free(r);
+  // Batched queries report the same ranks as single-key queries
+  const char* keys[] = {"k3", "k1", "k2"};
+  const size_t keylens[] = {2, 2, 2};
+  std::vector<std::pair<size_t, int> > ranks;
+  ASSERT_EQ(deltafs_plfsdir_filter_multiget(rdir_, keys, keylens, 3,
+                                            SaveRank, &ranks),
+            3);
+  ASSERT_EQ(ranks.size(), 4);
+  ASSERT_TRUE(ranks[0] == std::make_pair(size_t(0), 4));
+  ASSERT_TRUE(ranks[1] == std::make_pair(size_t(1), 1));
+  ASSERT_TRUE(ranks[2] == std::make_pair(size_t(1), 3));
+  ASSERT_TRUE(ranks[3] == std::make_pair(size_t(2), 2));
+  deltafs_plfsdir_free_handle(rdir_);
+  rdir_ = NULL;
+  deltafs_tp_close(tp);
 }
 
 class PlfsWiscBench {
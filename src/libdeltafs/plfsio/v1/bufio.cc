@@ -12,24 +12,32 @@
 #include "bufio.h"
 #include "types.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 
 DirectWriter::DirectWriter(const DirOptions& options, WritableFile* dst,
-                           size_t buf_size)
+                           size_t buf_size, size_t n)
     : DoubleBuffering(&mu_, &bg_cv_),
       options_(options),
       dst_(dst),  // Not owned by us
       bg_cv_(&mu_),
       buf_threshold_(buf_size),
-      buf_reserv_(buf_size) {
+      buf_reserv_(buf_size),
+      strs_(std::max<size_t>(2, n)) {  // We need at least two buffers
   // Reserve memory for our write buffers
-  str0_.reserve(buf_reserv_);
-  str1_.reserve(buf_reserv_);
+  for (size_t i = 0; i < strs_.size(); i++) {
+    strs_[i].reserve(buf_reserv_);
+    if (i != 0) {  // strs_[0] will act as membuf_
+      bufs_.push_back(&strs_[i]);
+    }
+  }
 
-  // One compaction at a time
-  bufs_.push_back(&str1_);
-  membuf_ = &str0_;
+  membuf_ = &strs_[0];
 }
 
 // Wait for all outstanding compactions to clear.
@@ -44,9 +52,33 @@ DirectWriter::~DirectWriter() {
 // REQUIRES: Finish() has NOT been called.
 Status DirectWriter::Append(const Slice& dat) {
   MutexLock ml(&mu_);
+  if (dat.size() > buf_threshold_) {
+    return WriteThrough(dat);  // Would never fit into a write buffer
+  }
   return __Add<DirectWriter>(dat, Slice(), false);
 }
 
+// Write data directly to dst_ after draining all write buffers. mu_ is held
+// throughout the write so no other data may be scheduled before it.
+// REQUIRES: Finish() has NOT been called.
+// REQUIRES: mu_ has been LOCKed.
+Status DirectWriter::WriteThrough(const Slice& dat) {
+  mu_.AssertHeld();
+  Status status = __Flush<DirectWriter>(true);
+  if (status.ok()) {
+    WaitForAny();  // Wait until !num_bg_compactions_
+    status = bg_status_;
+  }
+  if (status.ok()) {
+    status = dst_->Append(dat);
+    if (status.ok()) {
+      status = dst_->Flush();
+    }
+    bg_status_ = status;  // Errors are remembered as in compactions
+  }
+  return status;
+}
+
 // Force a compaction but do not wait for the compaction to clear.
 // REQUIRES: Finish() has NOT been called.
 Status DirectWriter::Flush() {
@@ -68,19 +100,29 @@ Status DirectWriter::Wait() {
   return __Wait();
 }
 
+// Obtain write pipeline statistics.
+PipelineStats DirectWriter::GetStats() {
+  MutexLock ml(&mu_);
+  PipelineStats stats;
+  __GetStats(&stats);
+  return stats;
+}
+
 // Finalize the writer. Expected to be called ONLY once.
 Status DirectWriter::Finish() {
   MutexLock ml(&mu_);
   return __Finish<DirectWriter>();
 }
 
+// Buffers are written in compac_seq order.
 // REQUIRES: mu_ has been LOCKed.
-Status DirectWriter::Compact(uint32_t ignored, void* const immbuf) {
+Status DirectWriter::Compact(uint32_t const compac_seq, void* const immbuf) {
   mu_.AssertHeld();
   assert(dst_);
   std::string* const s = static_cast<std::string*>(immbuf);
   // Skip empty buffers
   if (s->empty()) return Status::OK();
+  WaitForTurn(compac_seq);
   mu_.Unlock();  // Unlock during I/O operations
   Status status = dst_->Append(*s);
   // Does not sync data to storage.
@@ -106,17 +148,20 @@ Status DirectWriter::SyncBackend(bool close) {
 namespace {  // State for each compaction
 struct State {
   DirectWriter* writer;
+  uint32_t compac_seq;
   void* immbuf;
 };
 }  // namespace
 
 // REQUIRES: mu_ has been LOCKed.
-void DirectWriter::ScheduleCompaction(uint32_t ignored, void* const immbuf) {
+void DirectWriter::ScheduleCompaction(uint32_t const compac_seq,
+                                      void* const immbuf) {
   mu_.AssertHeld();
 
   assert(num_bg_compactions_);
 
   State* const s = new State;
+  s->compac_seq = compac_seq;
   s->immbuf = immbuf;
   s->writer = this;
 
@@ -125,7 +170,7 @@ void DirectWriter::ScheduleCompaction(uint32_t ignored, void* const immbuf) {
   } else if (options_.allow_env_threads) {
     Env::Default()->Schedule(DirectWriter::BGWork, s);
   } else {
-    DoCompaction<DirectWriter>(-1, immbuf);
+    DoCompaction<DirectWriter>(compac_seq, immbuf);
     delete s;
   }
 }
@@ -133,17 +178,237 @@ void DirectWriter::ScheduleCompaction(uint32_t ignored, void* const immbuf) {
 void DirectWriter::BGWork(void* arg) {
   State* const s = reinterpret_cast<State*>(arg);
   MutexLock ml(&s->writer->mu_);
-  s->writer->DoCompaction<DirectWriter>(-1, s->immbuf);
+  s->writer->DoCompaction<DirectWriter>(s->compac_seq, s->immbuf);
   delete s;
 }
 
-DirectReader::DirectReader(const DirOptions& options, RandomAccessFile* src)
-    : options_(options), src_(src) {  // src_ is not owned by us
+DirectReader::DirectReader(const DirOptions& options, RandomAccessFile* src,
+                           size_t readahead)
+    : options_(options),
+      src_(src),  // src_ is not owned by us
+      readahead_(readahead),
+      cv_(&mu_),
+      last_end_(0),
+      cur_(&windows_[0]),
+      next_(&windows_[1]) {}
+
+// Wait for all outstanding prefetches to clear.
+DirectReader::~DirectReader() {
+  MutexLock ml(&mu_);
+  while (windows_[0].busy || windows_[1].busy) {
+    cv_.Wait();
+  }
+}
+
+// Return true iff [offset, offset + n) can be served by a window. This
+// includes the case where the window reaches the end of the file.
+// REQUIRES: mu_ has been LOCKed.
+bool DirectReader::Covers(const Window* w, uint64_t offset, size_t n) const {
+  if (!w->valid || !w->status.ok() || offset < w->offset) {
+    return false;
+  }
+  const uint64_t end = w->offset + w->data.size();
+  if (offset + n <= end) {
+    return true;
+  } else {
+    return w->data.size() < readahead_ && offset <= end;
+  }
+}
+
+// Return true iff a previous attempt to fill a window at or before offset
+// failed, so a new fill would likely fail again.
+// REQUIRES: mu_ has been LOCKed.
+bool DirectReader::Failed(const Window* w, uint64_t offset) const {
+  return !w->busy && w->valid && !w->status.ok() && offset >= w->offset &&
+         offset < w->offset + readahead_;
 }
-// Directly read data from the source.
+
+// Fill a window with data starting at a specific offset. mu_ is unlocked
+// during the read.
+// REQUIRES: w->busy has been set by the caller.
+// REQUIRES: mu_ has been LOCKed.
+void DirectReader::Fill(Window* w, uint64_t offset) {
+  mu_.AssertHeld();
+  assert(w->busy);
+  w->offset = offset;
+  w->valid = false;
+  mu_.Unlock();
+  if (w->buf.size() < readahead_) {
+    w->buf.resize(readahead_);
+  }
+  Slice data;
+  Status status = src_->Read(offset, readahead_, &data, &w->buf[0]);
+  mu_.Lock();
+  w->data = data;
+  w->status = status;
+  w->valid = true;
+  w->busy = false;
+  cv_.SignalAll();
+}
+
+namespace {  // State for each prefetch
+struct Prefetch {
+  DirectReader* reader;
+  void* window;
+  uint64_t offset;
+};
+}  // namespace
+
+// Start fetching the data that follows the current window into the next
+// window, unless it is already there or we have reached the end of the file.
+// Prefetches are only issued when there are background threads to run them.
+// REQUIRES: mu_ has been LOCKed.
+void DirectReader::MaybeSchedulePrefetch() {
+  mu_.AssertHeld();
+  if (!cur_->valid || !cur_->status.ok() || cur_->data.size() < readahead_) {
+    return;
+  }
+  const uint64_t offset = cur_->offset + cur_->data.size();
+  if (next_->busy || (next_->valid && next_->offset == offset)) {
+    return;
+  }
+  if (!options_.reader_pool && !options_.allow_env_threads) {
+    return;
+  }
+
+  Prefetch* const p = new Prefetch;
+  p->reader = this;
+  p->window = next_;
+  p->offset = offset;
+  next_->busy = true;
+  if (options_.reader_pool) {
+    options_.reader_pool->Schedule(DirectReader::BGFill, p);
+  } else {
+    Env::Default()->Schedule(DirectReader::BGFill, p);
+  }
+}
+
+void DirectReader::BGFill(void* arg) {
+  Prefetch* const p = reinterpret_cast<Prefetch*>(arg);
+  MutexLock ml(&p->reader->mu_);
+  p->reader->Fill(static_cast<Window*>(p->window), p->offset);
+  delete p;
+}
+
+// Read data from the source. Sequential reads are served through the
+// read-ahead windows.
 Status DirectReader::Read(uint64_t off, size_t n, Slice* result,
-                          char* scratch) const {
-  return src_->Read(off, n, result, scratch);
+                          char* scratch) {
+  if (readahead_ == 0 || n >= readahead_) {
+    return src_->Read(off, n, result, scratch);
+  }
+
+  MutexLock ml(&mu_);
+  const bool sequential = (off == last_end_);
+  last_end_ = off + n;
+  // The window serving the read. Windows may be swapped by other reads
+  // whenever mu_ is released, so the window is not always cur_.
+  const Window* w = NULL;
+  while (w == NULL) {
+    if (Covers(cur_, off, n)) {
+      w = cur_;
+    } else if (next_->busy && off >= next_->offset &&
+               off < next_->offset + readahead_) {
+      cv_.Wait();  // Wait for the prefetch to complete
+    } else if (Covers(next_, off, n)) {
+      std::swap(cur_, next_);
+    } else if (!sequential || Failed(cur_, off)) {
+      mu_.Unlock();  // Bypass the windows
+      Status status = src_->Read(off, n, result, scratch);
+      mu_.Lock();
+      return status;
+    } else if (cur_->busy) {
+      cv_.Wait();  // Another read is filling the current window
+    } else {
+      Window* const f = cur_;
+      f->busy = true;
+      Fill(f, off);
+      // Data past the end of the file is not available. The window may
+      // also extend beyond the end of the file, which some files treat as
+      // an error. Retry with the original read in that case.
+      if (Covers(f, off, n)) {
+        w = f;
+      }
+    }
+  }
+
+  const uint64_t end = w->offset + w->data.size();
+  const size_t m = off < end ? std::min<uint64_t>(n, end - off) : 0;
+  if (m != 0) {
+    memcpy(scratch, w->data.data() + (off - w->offset), m);
+  }
+  *result = Slice(scratch, m);
+  if (sequential) {
+    MaybeSchedulePrefetch();
+  }
+  return Status::OK();
+}
+
+namespace {  // State shared by all reads of a ReadV() call
+struct ReadVContext {
+  port::Mutex* mu;
+  port::CondVar* cv;
+  RandomAccessFile* src;
+  size_t num_pending;
+  Status status;  // The first error encountered
+};
+
+struct ReadVItem {
+  ReadVContext* ctx;
+  uint64_t offset;
+  size_t n;
+  Slice* result;
+  char* scratch;
+};
+
+void ReadVItemRun(void* arg) {
+  ReadVItem* const item = reinterpret_cast<ReadVItem*>(arg);
+  ReadVContext* const ctx = item->ctx;
+  Status status =
+      ctx->src->Read(item->offset, item->n, item->result, item->scratch);
+  MutexLock ml(ctx->mu);
+  if (ctx->status.ok() && !status.ok()) {
+    ctx->status = status;
+  }
+  assert(ctx->num_pending != 0);
+  ctx->num_pending--;
+  ctx->cv->SignalAll();
+}
+}  // namespace
+
+// Serve a batch of reads. Reads are scheduled on the reader pool if one is
+// given. Otherwise, they are served in order.
+Status DirectReader::ReadV(const uint64_t* offsets, const size_t* sizes,
+                           size_t n, Slice* results, char** scratches) {
+  port::Mutex mu;
+  port::CondVar cv(&mu);
+  ReadVContext ctx;
+  ctx.mu = &mu;
+  ctx.cv = &cv;
+  ctx.src = src_;
+  ctx.num_pending = n;
+  std::vector<ReadVItem> items(n);
+  for (size_t i = 0; i < n; i++) {
+    items[i].ctx = &ctx;
+    items[i].offset = offsets[i];
+    items[i].n = sizes[i];
+    items[i].result = &results[i];
+    items[i].scratch = scratches[i];
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (options_.reader_pool && i + 1 < n) {
+      options_.reader_pool->Schedule(ReadVItemRun, &items[i]);
+    } else {
+      ReadVItemRun(&items[i]);  // The last read is served by us
+    }
+  }
+
+  MutexLock ml(&mu);
+  while (ctx.num_pending != 0) {
+    cv.Wait();
+  }
+  return ctx.status;
 }
 
 }  // namespace plfsio
@@ -14,6 +14,7 @@
 #include "doublebuf.h"
 
 #include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -24,17 +25,16 @@ struct DirOptions;
 
 // Directly write data into a directory.
 // That is, data is written to a log file without any indexing.
+// Up to n - 1 full write buffers may be outstanding for compaction.
 class DirectWriter : public DoubleBuffering {
  public:
-  // Deadlock when the write size is greater than the write buffer size.
-  // This is because the current version of the code will flush buffer if the
-  // buffer is not large enough to accept the incoming write. If the write size
-  // itself is larger than the buffer size, the current code is going to keep
-  // flushing buffers and never stop. Is this a problem? Likely not.
-  DirectWriter(const DirOptions& opts, WritableFile* dst, size_t buf_size);
+  DirectWriter(const DirOptions& opts, WritableFile* dst, size_t buf_size,
+               size_t n = 2);
 
   // REQUIRES: Finish() has NOT been called.
-  // Insert data into the writer.
+  // Insert data into the writer. Writes larger than the write buffer are
+  // passed directly to the destination file without being copied once all
+  // previously buffered data has been written.
   Status Append(const Slice& data);
   // Wait until there is no outstanding compactions.
   Status Wait();
@@ -42,6 +42,8 @@ class DirectWriter : public DoubleBuffering {
   Status Flush();
   // Sync data to storage.
   Status Sync();
+  // Obtain write pipeline statistics.
+  PipelineStats GetStats();
 
   // Finalize the writer.
   Status Finish();
@@ -58,6 +60,7 @@ class DirectWriter : public DoubleBuffering {
   size_t buf_reserv_;
 
   friend class DoubleBuffering;
+  Status WriteThrough(const Slice& data);
   Status Compact(uint32_t seq, void* buf);
   Status SyncBackend(bool close = false);
   void ScheduleCompaction(uint32_t seq, void* buf);
@@ -77,19 +80,55 @@ class DirectWriter : public DoubleBuffering {
   }
   static void BGWork(void*);
 
-  std::string str0_;
-  std::string str1_;
+  std::vector<std::string> strs_;  // Write buffers
 };
 
-// A simple wrapper on top of a RandomAccessFile.
+// A simple wrapper on top of a RandomAccessFile. If a read-ahead size is
+// given, sequential reads are served from a read-ahead window and the next
+// window is prefetched in the background, using options.reader_pool if set.
+// Non-sequential reads and reads not smaller than the window bypass it.
 class DirectReader {
  public:
-  DirectReader(const DirOptions& options, RandomAccessFile* src);
-  Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const;
+  DirectReader(const DirOptions& options, RandomAccessFile* src,
+               size_t readahead = 0);
+  ~DirectReader();
+
+  Status Read(uint64_t offset, size_t n, Slice* result, char* scratch);
+
+  // Perform a batch of n reads. The i-th read fetches sizes[i] bytes at
+  // offsets[i] and stores the result in results[i] using scratches[i].
+  // Reads are served concurrently if options.reader_pool is set.
+  // Return the first error encountered, if any.
+  Status ReadV(const uint64_t* offsets, const size_t* sizes, size_t n,
+               Slice* results, char** scratches);
 
  private:
+  struct Window {  // A read-ahead window
+    Window() : offset(0), busy(false), valid(false) {}
+    uint64_t offset;
+    std::string buf;
+    Slice data;
+    Status status;
+    bool busy;   // If a background fill is in progress
+    bool valid;  // If data is ready
+  };
+
+  bool Covers(const Window* w, uint64_t offset, size_t n) const;
+  bool Failed(const Window* w, uint64_t offset) const;
+  void Fill(Window* w, uint64_t offset);
+  void MaybeSchedulePrefetch();
+  static void BGFill(void*);
+
   const DirOptions& options_;
   RandomAccessFile* const src_;
+  const size_t readahead_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  // State below is protected by mu_
+  uint64_t last_end_;  // End offset of the previous read
+  Window windows_[2];
+  Window* cur_;
+  Window* next_;
 
   // No copying allowed
   void operator=(const DirectReader& dr);
@@ -13,9 +13,14 @@
 #include "types.h"
 
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #if __cplusplus >= 201103
 #define OVERRIDE override
 #else
@@ -64,8 +69,273 @@ class EmulatedEnv : public EnvWrapper {
   const uint64_t bytes_per_sec_;
 };
 
+// A file implementation that delays every read so that concurrent readers
+// get a chance to run while a read is in progress.
+class SlowRandomAccessFile : public RandomAccessFile {
+ public:
+  explicit SlowRandomAccessFile(RandomAccessFile* base) : base_(base) {}
+
+  virtual ~SlowRandomAccessFile() {}
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const OVERRIDE {
+    Env::Default()->SleepForMicroseconds(100);
+    return base_->Read(offset, n, result, scratch);
+  }
+
+ private:
+  RandomAccessFile* const base_;
+};
+
 }  // namespace
 
+class DirectWriterTest {
+ public:
+  DirectWriterTest() : pool_(NULL) {
+    fname_ = test::TmpDir() + "/bufio_test.bin";
+    env_ = Env::Default();
+  }
+
+  ~DirectWriterTest() {  //
+    delete pool_;
+  }
+
+  // Append a mix of small and large writes and check that they are stored
+  // in order.
+  void MixedAppends(size_t buf_size, size_t n = 2) {
+    WritableFile* dst;
+    ASSERT_OK(env_->NewWritableFile(fname_.c_str(), &dst));
+    DirectWriter* writer = new DirectWriter(options_, dst, buf_size, n);
+    std::string expected;
+    Random rnd(301);
+    for (int i = 0; i < 200; i++) {
+      size_t n = rnd.OneIn(4) ? buf_size + rnd.Uniform(4 * buf_size)
+                              : rnd.Uniform(buf_size / 4);
+      std::string data(n, static_cast<char>('a' + i % 26));
+      ASSERT_OK(writer->Append(data));
+      expected += data;
+      if (rnd.OneIn(20)) {
+        ASSERT_OK(writer->Flush());
+      }
+    }
+    ASSERT_OK(writer->Finish());
+    stats_ = writer->GetStats();
+    delete writer;
+    delete dst;
+    std::string contents;
+    ASSERT_OK(ReadFileToString(env_, fname_.c_str(), &contents));
+    ASSERT_EQ(contents.size(), expected.size());
+    ASSERT_TRUE(contents == expected);
+  }
+
+  DirOptions options_;
+  PipelineStats stats_;
+  ThreadPool* pool_;
+  std::string fname_;
+  Env* env_;
+};
+
+TEST(DirectWriterTest, LargeAppends) {
+  options_.allow_env_threads = false;
+  MixedAppends(4096);
+}
+
+TEST(DirectWriterTest, BackgroundLargeAppends) {
+  pool_ = ThreadPool::NewFixed(2);
+  options_.compaction_pool = pool_;
+  MixedAppends(4096);
+}
+
+TEST(DirectWriterTest, MultiBuffers) {
+  pool_ = ThreadPool::NewFixed(4);
+  options_.compaction_pool = pool_;
+  MixedAppends(4096, 8);
+  ASSERT_TRUE(stats_.compactions != 0);
+  ASSERT_TRUE(stats_.compaction_micros >= stats_.max_compaction_micros);
+}
+
+class DirectReaderTest {
+ public:
+  DirectReaderTest() : pool_(NULL) {
+    fname_ = test::TmpDir() + "/bufio_test.bin";
+    env_ = Env::Default();
+    Random rnd(301);
+    test::RandomString(&rnd, 100 << 10, &contents_);
+    ASSERT_OK(WriteStringToFile(env_, contents_, fname_.c_str()));
+    ASSERT_OK(env_->NewRandomAccessFile(fname_.c_str(), &src_));
+  }
+
+  ~DirectReaderTest() {
+    delete src_;
+    delete pool_;
+  }
+
+  // Reading past the end of the file may be an error, so all reads below
+  // are kept within the file.
+  size_t Clip(uint64_t off, size_t n) const {
+    return std::min<uint64_t>(n, contents_.size() - off);
+  }
+
+  // Read the entire file sequentially using small reads of varying sizes.
+  void SequentialReads(size_t readahead) {
+    DirectReader reader(options_, src_, readahead);
+    Random rnd(301);
+    std::string scratch(4096, 0);
+    uint64_t off = 0;
+    while (off < contents_.size()) {
+      size_t n = Clip(off, 1 + rnd.Uniform(scratch.size()));
+      Slice result;
+      ASSERT_OK(reader.Read(off, n, &result, &scratch[0]));
+      ASSERT_EQ(result.ToString(), contents_.substr(off, n));
+      off += n;
+    }
+  }
+
+  // Mix sequential runs with reads at random offsets.
+  void RandomReads(size_t readahead) {
+    DirectReader reader(options_, src_, readahead);
+    Random rnd(301);
+    std::string scratch(2 * readahead + 1, 0);
+    uint64_t off = 0;
+    for (int i = 0; i < 1000; i++) {
+      if (off >= contents_.size() || rnd.OneIn(10))
+        off = rnd.Uniform(contents_.size());
+      size_t n = Clip(off, 1 + rnd.Uniform(scratch.size()));
+      Slice result;
+      ASSERT_OK(reader.Read(off, n, &result, &scratch[0]));
+      ASSERT_EQ(result.ToString(), contents_.substr(off, n));
+      off += n;
+    }
+  }
+
+  void VectoredReads() {
+    DirectReader reader(options_, src_);
+    Random rnd(301);
+    const size_t k = 64;
+    std::vector<uint64_t> offsets(k);
+    std::vector<size_t> sizes(k);
+    std::vector<std::string> bufs(k);
+    std::vector<char*> scratches(k);
+    std::vector<Slice> results(k);
+    for (size_t i = 0; i < k; i++) {
+      offsets[i] = rnd.Uniform(contents_.size());
+      sizes[i] = Clip(offsets[i], rnd.Uniform(8192));
+      bufs[i].resize(sizes[i] + 1);
+      scratches[i] = &bufs[i][0];
+    }
+    ASSERT_OK(reader.ReadV(&offsets[0], &sizes[0], k, &results[0],
+                           &scratches[0]));
+    for (size_t i = 0; i < k; i++) {
+      ASSERT_EQ(results[i].ToString(), contents_.substr(offsets[i], sizes[i]));
+    }
+  }
+
+  struct ConcurrentState {
+    ConcurrentState(DirectReader* r, const std::string* c)
+        : reader(r), contents(c), cv(&mu), next_off(0), num_running(0) {}
+    DirectReader* reader;
+    const std::string* contents;
+    port::Mutex mu;
+    port::CondVar cv;
+    uint64_t next_off;  // Next read to hand out
+    int num_running;
+  };
+
+  // Keep taking the next read off the shared cursor and check its result.
+  // Reads are handed out in file order so they mostly look sequential to
+  // the reader. Every few reads are issued through ReadV() instead.
+  static void ConcurrentReader(void* arg) {
+    ConcurrentState* const state = reinterpret_cast<ConcurrentState*>(arg);
+    const std::string& contents = *state->contents;
+    std::string scratch(4096, 0);
+    Random rnd(reinterpret_cast<uintptr_t>(&scratch) & 0xFFFF);
+    for (uint32_t i = 0;; i++) {
+      size_t n = 1 + rnd.Uniform(scratch.size());
+      uint64_t off;
+      {
+        MutexLock ml(&state->mu);
+        off = state->next_off;
+        if (off >= contents.size()) break;
+        n = std::min<uint64_t>(n, contents.size() - off);
+        state->next_off += n;
+      }
+      Slice result;
+      if (i % 8 == 7) {
+        char* ptr = &scratch[0];
+        ASSERT_OK(state->reader->ReadV(&off, &n, 1, &result, &ptr));
+      } else {
+        ASSERT_OK(state->reader->Read(off, n, &result, &scratch[0]));
+      }
+      ASSERT_EQ(result.ToString(), contents.substr(off, n));
+    }
+    MutexLock ml(&state->mu);
+    state->num_running--;
+    state->cv.SignalAll();
+  }
+
+  // Read the entire file many times using concurrent threads that share a
+  // single reader.
+  void ConcurrentReads(size_t readahead, int num_threads) {
+    SlowRandomAccessFile src(src_);
+    DirectReader reader(options_, &src, readahead);
+    ConcurrentState state(&reader, &contents_);
+    for (int r = 0; r < 20; r++) {
+      MutexLock ml(&state.mu);
+      state.next_off = 0;
+      state.num_running = num_threads;
+      for (int i = 0; i < num_threads; i++) {
+        env_->StartThread(ConcurrentReader, &state);
+      }
+      while (state.num_running != 0) {
+        state.cv.Wait();
+      }
+    }
+  }
+
+  DirOptions options_;
+  ThreadPool* pool_;
+  RandomAccessFile* src_;
+  std::string contents_;
+  std::string fname_;
+  Env* env_;
+};
+
+TEST(DirectReaderTest, NoReadAhead) {
+  SequentialReads(0);
+  RandomReads(0);
+}
+
+TEST(DirectReaderTest, ReadAhead) {
+  options_.allow_env_threads = false;
+  SequentialReads(16 << 10);
+  RandomReads(16 << 10);
+}
+
+TEST(DirectReaderTest, BackgroundReadAhead) {
+  pool_ = ThreadPool::NewFixed(2);
+  options_.reader_pool = pool_;
+  SequentialReads(16 << 10);
+  SequentialReads(7 << 10);
+  RandomReads(16 << 10);
+}
+
+TEST(DirectReaderTest, ConcurrentReads) {
+  options_.allow_env_threads = false;
+  ConcurrentReads(16 << 10, 4);
+  pool_ = ThreadPool::NewFixed(4);
+  options_.reader_pool = pool_;
+  ConcurrentReads(16 << 10, 4);
+  ConcurrentReads(7 << 10, 8);
+}
+
+TEST(DirectReaderTest, ReadV) {
+  options_.allow_env_threads = false;
+  VectoredReads();
+  pool_ = ThreadPool::NewFixed(4);
+  options_.reader_pool = pool_;
+  VectoredReads();
+}
+
 // Measure implementation's bandwidth utilization under
 // different configurations.
 class BufBench {
@@ -89,6 +359,9 @@ class BufBench {
     mkeys_ = GetOption("MI_KEYS", 4);
     bytes_per_sec_ = GetOption("BYTES_PER_SEC", 6000000);
     buf_size_ = GetOption("BUF_SIZE", 2 << 20);
+    num_bufs_ = GetOption("NUM_BUFS", 2);
+    // Insert a write of 2 x BUF_SIZE bytes every LARGE_EVERY writes
+    large_every_ = GetOption("LARGE_EVERY", 0);
     thread_pool_ = ThreadPool::NewFixed(2, true /* eager init */);
     options_.compaction_pool = thread_pool_;
   }
@@ -105,37 +378,54 @@ class BufBench {
     ASSERT_OK(env->NewWritableFile("test.bin", &dst));
     options_.allow_env_threads = false;
     options_.value_size = 56;
-    writer = new DirectWriter(options_, dst, buf_size_);
+    writer = new DirectWriter(options_, dst, buf_size_, num_bufs_);
     const uint64_t start = env->NowMicros();
     std::string kv(options_.key_size + options_.value_size, '\0');
+    std::string large(2 * buf_size_, '\0');
     const size_t num_keys = static_cast<size_t>(mkeys_) << 20;
+    uint64_t bytes = 0;
     size_t i = 0;
     for (; i < num_keys; i++) {
       if ((i & 0x7FFFu) == 0) {
         fprintf(stderr, "\r%.2f%%", 100.0 * i / num_keys);
       }
+      if (large_every_ != 0 && i % large_every_ == 0) {
+        ASSERT_OK(writer->Append(large));
+        bytes += large.size();
+      }
       ASSERT_OK(writer->Append(kv));
+      bytes += kv.size();
     }
     fprintf(stderr, "\r100.00%%");
     fprintf(stderr, "\n");
     ASSERT_OK(writer->Finish());
     uint64_t dura = env->NowMicros() - start;
-    Report(dura);
+    Report(bytes, dura, writer->GetStats());
 
     delete writer;
     delete dst;
     delete env;
   }
 
-  void Report(uint64_t dura) {
-    const double k = 1000.0, ki = 1024.0;
-    const double d = options_.key_size + options_.value_size;
+  void Report(uint64_t bytes, uint64_t dura, const PipelineStats& stats) {
+    const double k = 1000.0;
     fprintf(stderr, "-----------------------------------------\n");
     fprintf(stderr, "     Total dura: %.0f sec\n", 1.0 * dura / k / k);
     fprintf(stderr, "          Speed: %.0f bytes per sec\n",
-            d * mkeys_ * ki * ki * k * k / dura);
+            bytes * k * k / dura);
     fprintf(stderr, "           Util: %.2f%%\n",
-            100 * d * mkeys_ * ki * ki * k * k / dura / bytes_per_sec_);
+            100 * bytes * k * k / dura / bytes_per_sec_);
+    fprintf(stderr, "     Write wait: %.3f sec (%llu waits)\n",
+            1.0 * stats.prepare_wait_micros / k / k,
+            static_cast<unsigned long long>(stats.prepare_waits));
+    fprintf(stderr, "    Compactions: %llu\n",
+            static_cast<unsigned long long>(stats.compactions));
+    if (stats.compactions != 0) {
+      fprintf(stderr, "  Avg compac lat: %.3f ms\n",
+              1.0 * stats.compaction_micros / stats.compactions / k);
+      fprintf(stderr, "  Max compac lat: %.3f ms\n",
+              1.0 * stats.max_compaction_micros / k);
+    }
   }
 
  private:
@@ -143,6 +433,8 @@ class BufBench {
   DirOptions options_;
   uint64_t bytes_per_sec_;
   size_t buf_size_;
+  int num_bufs_;
+  int large_every_;
   int mkeys_;
 };
 
@@ -12,7 +12,15 @@
 #include "builder.h"
 #include "recov.h"
 
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+
 #include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -31,7 +39,8 @@ DirOutputStats::DirOutputStats()
       final_filter_size(0),
       filter_size(0),
       value_size(0),
-      key_size(0) {}
+      key_size(0),
+      data_write_micros(0) {}
 
 DirBuilder::DirBuilder(const DirOptions& options, DirOutputStats* stats)
     : options_(options),
@@ -50,6 +59,68 @@ void ArrayBlockBuilder::Add(const Slice& key, const Slice& value) {
   ++n_;
 }
 
+namespace {
+struct FixedKeyLess {  // Order fixed-sized entries by their keys
+  FixedKeyLess(const char* base, size_t key_size)
+      : base(base), key_size(key_size) {}
+  bool operator()(uint32_t a, uint32_t b) const {
+    return memcmp(base + a, base + b, key_size) < 0;
+  }
+  const char* base;
+  size_t key_size;
+};
+
+// Flag set in the key size of a block trailer when the block stores its keys
+// as a separate column.
+const uint32_t kKeyColumnFlag = 1u << 31;
+
+inline uint64_t DecodeBigEndian64(const char* p) {
+  uint64_t result = 0;
+  for (int i = 0; i < 8; i++) {
+    result = (result << 8) | static_cast<unsigned char>(p[i]);
+  }
+  return result;
+}
+
+inline void EncodeBigEndian64(char* dst, uint64_t value) {
+  for (int i = 7; i >= 0; i--) {
+    dst[i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+// Each 8-byte word of a key is stored as a little-endian integer whose value
+// is the big-endian interpretation of the word, so integer order matches the
+// bytewise order of the keys.
+void EncodeKeyColumnEntry(char* dst, const char* key, size_t key_size) {
+  for (size_t i = 0; i < key_size; i += 8) {
+    EncodeFixed64(dst + i, DecodeBigEndian64(key + i));
+  }
+}
+}  // namespace
+
+void ArrayBlockBuilder::Sort() {
+  assert(!finished_);
+  const size_t entry_size = key_size_ + value_size_;
+  if (n_ < 2 || entry_size == 0) {
+    return;
+  }
+  // Sort entry offsets first so each entry is moved only once
+  std::vector<uint32_t> offsets(n_);
+  for (size_t i = 0; i < n_; i++) {
+    offsets[i] = static_cast<uint32_t>(i * entry_size);
+  }
+  char* const base = &buffer_[buffer_start_];
+  std::stable_sort(offsets.begin(), offsets.end(),
+                   FixedKeyLess(base, key_size_));
+  std::string tmp;
+  tmp.reserve(n_ * entry_size);
+  for (size_t i = 0; i < n_; i++) {
+    tmp.append(base + offsets[i], entry_size);
+  }
+  memcpy(base, tmp.data(), tmp.size());
+}
+
 void ArrayBlockBuilder::Reset() {
   AbstractBlockBuilder::Reset();
   n_ = 0;
@@ -58,9 +129,23 @@ void ArrayBlockBuilder::Reset() {
 Slice ArrayBlockBuilder::Finish(CompressionType compression,
                                 bool force_compression) {
   assert(!finished_);
+  if (key_column_ && n_ != 0) {
+    // Move keys to the front of the block and values after them
+    const size_t entry_size = key_size_ + value_size_;
+    std::string tmp(n_ * entry_size, 0);
+    char* const keys = &tmp[0];
+    char* const values = keys + n_ * key_size_;
+    char* const base = &buffer_[buffer_start_];
+    for (size_t i = 0; i < n_; i++) {
+      const char* const entry = base + i * entry_size;
+      EncodeKeyColumnEntry(keys + i * key_size_, entry, key_size_);
+      memcpy(values + i * value_size_, entry + key_size_, value_size_);
+    }
+    memcpy(base, tmp.data(), tmp.size());
+  }
   // Remember key value sizes for later retrieval
   PutFixed32(&buffer_, value_size_);
-  PutFixed32(&buffer_, key_size_);
+  PutFixed32(&buffer_, key_column_ ? key_size_ | kKeyColumnFlag : key_size_);
   return AbstractBlockBuilder::Finish(compression, force_compression);
 }
 
@@ -79,16 +164,13 @@ ArrayBlock::ArrayBlock(const BlockContents& contents)
       owned_(contents.heap_allocated),
       value_size_(0),
       key_size_(0),
-      limit_(0) {
+      limit_(0),
+      key_column_(false) {
   if (size_ < 2 * sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    value_size_ = DecodeFixed32(data_ + size_ - 2 * sizeof(uint32_t));
-    key_size_ = DecodeFixed32(data_ + size_ - sizeof(uint32_t));
-    if (key_size_ == 0) {
-      // Keys cannot be empty
-      size_ = 0;
-    }
+  } else if (!DecodeTrailer(data_ + size_ - 2 * sizeof(uint32_t), &value_size_,
+                            &key_size_, &key_column_)) {
+    size_ = 0;
   }
 
   if (size_ == 0) {
@@ -100,6 +182,21 @@ ArrayBlock::ArrayBlock(const BlockContents& contents)
   limit_ = max_entries * (key_size_ + value_size_);
 }
 
+bool ArrayBlock::DecodeTrailer(const char* trailer, uint32_t* value_size,
+                               uint32_t* key_size, bool* key_column) {
+  *value_size = DecodeFixed32(trailer);
+  *key_size = DecodeFixed32(trailer + sizeof(uint32_t));
+  *key_column = (*key_size & kKeyColumnFlag) != 0;
+  *key_size &= ~kKeyColumnFlag;
+  if (*key_size == 0) {
+    return false;  // Keys cannot be empty
+  } else if (*key_column && *key_size != 8 && *key_size != 16) {
+    return false;
+  } else {
+    return true;
+  }
+}
+
 ArrayBlock::~ArrayBlock() {
   if (owned_) {
     delete[] data_;
@@ -209,12 +306,188 @@ class ArrayBlock::Iter : public Iterator {
   }
 };
 
+namespace {
+// An 8-byte key stored in a key column.
+struct ColumnKey64 {
+  typedef uint64_t Key;
+  enum { kSize = 8 };
+  static Key Load(const char* p) { return DecodeFixed64(p); }
+  static bool Less(const Key& a, const Key& b) { return a < b; }
+  static bool Equal(const Key& a, const Key& b) { return a == b; }
+  static void ToBytes(const Key& k, char* dst) { EncodeBigEndian64(dst, k); }
+  static Key FromBytes(const char* src) { return DecodeBigEndian64(src); }
+};
+
+// A 16-byte key stored in a key column.
+struct ColumnKey128 {
+  struct Key {
+    uint64_t hi;
+    uint64_t lo;
+  };
+  enum { kSize = 16 };
+  static Key Load(const char* p) {
+    Key k;
+    k.hi = DecodeFixed64(p);
+    k.lo = DecodeFixed64(p + 8);
+    return k;
+  }
+  static bool Less(const Key& a, const Key& b) {
+    return (a.hi < b.hi) | ((a.hi == b.hi) & (a.lo < b.lo));
+  }
+  static bool Equal(const Key& a, const Key& b) {
+    return (a.hi == b.hi) & (a.lo == b.lo);
+  }
+  static void ToBytes(const Key& k, char* dst) {
+    EncodeBigEndian64(dst, k.hi);
+    EncodeBigEndian64(dst + 8, k.lo);
+  }
+  static Key FromBytes(const char* src) {
+    Key k;
+    k.hi = DecodeBigEndian64(src);
+    k.lo = DecodeBigEndian64(src + 8);
+    return k;
+  }
+};
+}  // namespace
+
+// Iterate over a block whose keys are stored as a separate column of integers.
+// Seek() narrows the search range with a branch-free binary search and then
+// counts the remaining keys that are smaller than the target. The final count
+// runs over adjacent integers without branches so that the compiler may
+// vectorize it. Templated on the key width so all key comparisons are integer
+// comparisons.
+template <typename K>
+class ArrayBlock::KeyColumnIter : public Iterator {
+ private:
+  typedef typename K::Key Key;
+  const Comparator* const comparator_;
+  const char* const keys_;    // Key column
+  const char* const values_;  // Value column
+  const uint32_t num_entries_;
+  const uint32_t value_size_;
+  // Index of current entry.  >= num_entries_ if !Valid
+  uint32_t current_;
+  mutable char key_buf_[K::kSize];
+
+  Status status_;
+
+  Key KeyAt(uint32_t i) const { return K::Load(keys_ + i * K::kSize); }
+
+  // Return the number of keys that are smaller than target, or that are not
+  // greater than target if inclusive is true.
+  // REQUIRES: keys are ordered.
+  template <bool inclusive>
+  uint32_t Rank(const Key& target) const {
+    static const uint32_t kScanWidth = 16;
+    uint32_t base = 0;
+    uint32_t n = num_entries_;
+    while (n > kScanWidth) {
+      const uint32_t half = n / 2;
+      const Key k = KeyAt(base + half);
+      const bool smaller = inclusive ? !K::Less(target, k) : K::Less(k, target);
+      base = smaller ? base + half : base;
+      n -= half;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      const Key k = KeyAt(base + i);
+      count += inclusive ? !K::Less(target, k) : K::Less(k, target);
+    }
+    return base + count;
+  }
+
+ public:
+  KeyColumnIter(const Comparator* comparator, const char* data,
+                uint32_t num_entries, uint32_t value_size)
+      : comparator_(comparator),
+        keys_(data),
+        values_(data + num_entries * K::kSize),
+        num_entries_(num_entries),
+        value_size_(value_size),
+        current_(num_entries) {}
+
+  virtual ~KeyColumnIter() {}
+  virtual bool Valid() const { return current_ < num_entries_; }
+  virtual Status status() const { return status_; }
+  virtual Slice key() const {
+    assert(Valid());
+    K::ToBytes(KeyAt(current_), key_buf_);
+    return Slice(key_buf_, K::kSize);
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return Slice(values_ + current_ * value_size_, value_size_);
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    current_++;
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    if (current_ != 0) {
+      current_--;
+    } else {
+      // No more entries
+      current_ = num_entries_;
+    }
+  }
+
+  virtual void SeekToFirst() { current_ = 0; }
+
+  virtual void SeekToLast() {
+    current_ = num_entries_ != 0 ? num_entries_ - 1 : 0;
+  }
+
+  // If comparator_ is not NULL, keys are considered ordered and we position at
+  // the first key that is not less than the target. Otherwise, linear search is
+  // used to find an exact match.
+  virtual void Seek(const Slice& target) {
+    if (comparator_ != NULL) {
+      assert(comparator_ == BytewiseComparator());
+      char tmp[K::kSize];
+      memset(tmp, 0, sizeof(tmp));
+      memcpy(tmp, target.data(), std::min(target.size(), sizeof(tmp)));
+      Key t = K::FromBytes(tmp);
+      if (target.size() <= sizeof(tmp)) {
+        // A shorter target is padded with zeros, which sorts it at or before
+        // any key that it prefixes
+        current_ = Rank<false>(t);
+      } else {
+        // Keys prefixing a longer target are smaller than the target
+        current_ = Rank<true>(t);
+      }
+    } else {
+      current_ = num_entries_;
+      if (target.size() == K::kSize) {
+        const Key t = K::FromBytes(target.data());
+        for (uint32_t i = 0; i < num_entries_; i++) {
+          if (K::Equal(KeyAt(i), t)) {
+            current_ = i;
+            return;
+          }
+        }
+      }
+    }
+  }
+};
+
 // Return an iterator to the block contents. The result should be deleted when
 // no longer needed.
 Iterator* ArrayBlock::NewIterator(const Comparator* comparator) {
   if (size_ < 2 * sizeof(uint32_t)) {
     return NewErrorIterator(
         Status::Corruption("Cannot understand block contents"));
+  } else if (limit_ != 0 && key_column_) {
+    const uint32_t n = limit_ / (key_size_ + value_size_);
+    if (key_size_ == 8) {
+      return new KeyColumnIter<ColumnKey64>(comparator, data_, n, value_size_);
+    } else {
+      return new KeyColumnIter<ColumnKey128>(comparator, data_, n,
+                                             value_size_);
+    }
   } else if (limit_ != 0) {
     return new Iter(comparator, data_, limit_, value_size_, key_size_);
   } else {
@@ -222,6 +495,150 @@ Iterator* ArrayBlock::NewIterator(const Comparator* comparator) {
   }
 }
 
+namespace {
+// Put a trailer at the end of a finished data block and pad it according to
+// options. Return the final block contents.
+Slice FinalizeDataBlock(const DirOptions& options, AbstractBlockBuilder* block,
+                        size_t block_size) {
+  if (options.block_padding) {
+    // Target size for the final block contents after padding
+    size_t padding_target = options.block_size - BlockHandle::kMaxEncodedLength;
+    while (padding_target < block_size + kBlockTrailerSize)
+      padding_target += options.block_size;
+    return block->Finalize(!options.skip_checksums,
+                           static_cast<uint32_t>(padding_target),
+                           static_cast<char>(0xff));
+  } else {
+    return block->Finalize(!options.skip_checksums);
+  }
+}
+}  // namespace
+
+struct BlockCompressor::Block {
+  Block() : builder(NULL), size(0) {}
+  AbstractBlockBuilder builder;  // Holds raw and then final block contents
+  Slice final_contents;
+  size_t size;  // Compressed size without the trailer and padding
+};
+
+struct BlockCompressor::Rep {
+  explicit Rep(const DirOptions& options)
+      : options(options), cv(&mu), refs(1), running(0) {}
+  const DirOptions& options;
+  port::Mutex mu;
+  port::CondVar cv;
+  // Blocks not yet picked up by anyone
+  std::deque<Block*> queue;
+  int refs;     // One for the compressor and one for each scheduled pool task
+  int running;  // Number of blocks being compressed by pool threads
+};
+
+BlockCompressor::BlockCompressor(const DirOptions& options, ThreadPool* pool)
+    : pool_(pool), rep_(new Rep(options)), num_blocks_(0), raw_size_(0) {}
+
+BlockCompressor::~BlockCompressor() {
+  rep_->mu.Lock();
+  rep_->queue.clear();
+  // Blocks being compressed by pool threads may not be deleted until done
+  while (rep_->running != 0) {
+    rep_->cv.Wait();
+  }
+  // Pending pool tasks will find the queue empty
+  const bool last_ref = --rep_->refs == 0;
+  rep_->mu.Unlock();
+  if (last_ref) {
+    delete rep_;
+  }
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    delete blocks_[i];
+  }
+}
+
+void BlockCompressor::Compress(const DirOptions& options, Block* b) {
+  Slice contents =
+      b->builder.Finish(options.compression, options.force_compression);
+  b->size = contents.size();
+  b->final_contents = FinalizeDataBlock(options, &b->builder, b->size);
+}
+
+// Each pool task compresses the oldest block not yet picked up by others.
+// A task may find no such blocks left if they have all been compressed by
+// the owner of the compressor or by earlier tasks.
+void BlockCompressor::BGWork(void* arg) {
+  Rep* const rep = reinterpret_cast<Rep*>(arg);
+  rep->mu.Lock();
+  if (!rep->queue.empty()) {
+    Block* const b = rep->queue.front();
+    rep->queue.pop_front();
+    rep->running++;
+    rep->mu.Unlock();
+    Compress(rep->options, b);
+    rep->mu.Lock();
+    assert(rep->running > 0);
+    rep->running--;
+    if (rep->running == 0) {
+      rep->cv.SignalAll();
+    }
+  }
+  const bool last_ref = --rep->refs == 0;
+  rep->mu.Unlock();
+  if (last_ref) {
+    delete rep;
+  }
+}
+
+void BlockCompressor::Add(const Slice& raw_contents) {
+  if (num_blocks_ == blocks_.size()) {
+    blocks_.push_back(new Block);
+  }
+  Block* const b = blocks_[num_blocks_++];
+  b->builder.Reset();
+  b->builder.buffer_store()->assign(raw_contents.data(), raw_contents.size());
+  raw_size_ += raw_contents.size();
+  MutexLock ml(&rep_->mu);
+  rep_->queue.push_back(b);
+  rep_->refs++;
+  pool_->Schedule(BGWork, rep_);
+}
+
+void BlockCompressor::Finish() {
+  MutexLock ml(&rep_->mu);
+  // Compress blocks that have not been picked up by the pool
+  while (!rep_->queue.empty()) {
+    Block* const b = rep_->queue.front();
+    rep_->queue.pop_front();
+    rep_->mu.Unlock();
+    Compress(rep_->options, b);
+    rep_->mu.Lock();
+  }
+  while (rep_->running != 0) {
+    rep_->cv.Wait();
+  }
+}
+
+size_t BlockCompressor::block_size(size_t i) const {
+  assert(i < num_blocks_);
+  return blocks_[i]->size;
+}
+
+Slice BlockCompressor::final_contents(size_t i) const {
+  assert(i < num_blocks_);
+  return blocks_[i]->final_contents;
+}
+
+void BlockCompressor::Reset() {
+  num_blocks_ = 0;
+  raw_size_ = 0;
+}
+
+size_t BlockCompressor::memory_usage() const {
+  size_t result = 0;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    result += blocks_[i]->builder.memory_usage();
+  }
+  return result;
+}
+
 template <typename T>
 SeqDirBuilder<T>::SeqDirBuilder(const DirOptions& options,
                                 DirOutputStats* stats, LogSink* data,
@@ -232,6 +649,8 @@ SeqDirBuilder<T>::SeqDirBuilder(const DirOptions& options,
       pending_restart_(false),
       pending_commit_(false),
       data_block_(new T(options)),
+      separate_values_(options.format == kDirFmtV2),
+      compressor_(NULL),
       indx_block_(1),
       epok_block_(1),
       root_block_(1),
@@ -266,6 +685,11 @@ SeqDirBuilder<T>::SeqDirBuilder(const DirOptions& options,
     data_block_->buffer_store()->reserve(options_.block_batch_size);
   data_block_->buffer_store()->clear();
   pending_restart_ = true;
+
+  if (options_.compression != kNoCompression &&
+      options_.compaction_pool != NULL && !separate_values_) {
+    compressor_ = new BlockCompressor(options_, options_.compaction_pool);
+  }
 }
 
 template <typename T>
@@ -273,6 +697,7 @@ SeqDirBuilder<T>::~SeqDirBuilder() {
   indx_sink_->Unref();
   data_sink_->Unref();
   delete indx_writter_;
+  delete compressor_;
   delete data_block_;
 }
 
@@ -285,6 +710,7 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
   if (!ok()) return;
   if (num_tabls_ == 0) {  // Empty epoch
     // Empty epochs are skipped. But we need to remember their existence.
+    epok_base_stats_ = *compac_stats_;
     num_eps_ = ep_seq + 1;
     return;
   }
@@ -319,6 +745,8 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
 
   stone.set_handle(epok_block_handle);
   stone.set_id(num_eps_);
+  stone.set_num_tables(num_tabls_);
+  stone.set_num_ents(num_entries_);
   std::string epoch_stone;
   stone.EncodeTo(&epoch_stone);
   status_ = indx_writter_->SealEpoch(epoch_stone);
@@ -330,6 +758,21 @@ void SeqDirBuilder<T>::FinishEpoch(uint32_t ep_seq) {
   pending_data_flush_ = data_offset_;
 
   if (ok()) {
+    EpochStats ep_stats;
+    ep_stats.epoch = num_eps_;
+    ep_stats.num_keys = num_entries_;
+    ep_stats.num_tables = num_tabls_;
+    ep_stats.key_bytes = compac_stats_->key_size - epok_base_stats_.key_size;
+    ep_stats.value_bytes =
+        compac_stats_->value_size - epok_base_stats_.value_size;
+    ep_stats.data_bytes =
+        compac_stats_->final_data_size - epok_base_stats_.final_data_size;
+    ep_stats.min_key.swap(epok_smallest_key_);
+    ep_stats.max_key.swap(epok_largest_key_);
+    ep_stats_.push_back(ep_stats);
+    epok_smallest_key_.clear();
+    epok_largest_key_.clear();
+    epok_base_stats_ = *compac_stats_;
     num_eps_ = ep_seq + 1;  // Flush up-to the requested epoch seq
 #ifndef NDEBUG
     // Keys are only required to be unique within an epoch
@@ -352,6 +795,9 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
     BytewiseComparator()->FindShortSuccessor(&last_key_);
     PutLengthPrefixedSlice(&uncommitted_indexes_, last_key_);
     last_data_info_.EncodeTo(&uncommitted_indexes_);
+    if (separate_values_) {
+      last_value_info_.EncodeTo(&uncommitted_indexes_);
+    }
     pending_indx_entry_ = false;
     num_uncommitted_indx_++;
   }
@@ -402,6 +848,12 @@ void SeqDirBuilder<T>::EndTable(const Slice& filter_contents,
   assert(!pending_meta_entry_);
   pending_meta_entry_ = true;
 
+  if (epok_smallest_key_.empty() || smallest_key_ < epok_smallest_key_) {
+    epok_smallest_key_ = smallest_key_;
+  }
+  if (largest_key_ > epok_largest_key_) {
+    epok_largest_key_ = largest_key_;
+  }
   last_tabl_info_.set_smallest_key(smallest_key_);
   BytewiseComparator()->FindShortSuccessor(&largest_key_);
   last_tabl_info_.set_largest_key(largest_key_);
@@ -421,11 +873,34 @@ template <typename T>
 void SeqDirBuilder<T>::Commit() {
   assert(!finished_);  // Finish() has not been called
   // Skip empty commit
-  if (data_block_->buffer_store()->empty()) return;
+  if (compressor_ != NULL) {
+    if (compressor_->num_blocks() == 0) return;
+  } else if (data_block_->buffer_store()->empty()) {
+    return;
+  }
   if (!ok()) return;  // Abort
 
   assert(num_uncommitted_data_ == num_uncommitted_indx_);
   std::string* const buffer = data_block_->buffer_store();
+  // Final handles of blocks compressed in parallel. Uncommitted indexes
+  // refer to these blocks by their ordinal numbers.
+  std::vector<BlockHandle> handles;
+  if (compressor_ != NULL) {
+    compressor_->Finish();
+    buffer->clear();
+    handles.resize(compressor_->num_blocks());
+    for (size_t i = 0; i < handles.size(); i++) {
+      // Pre-reserve enough space for the leading block handle
+      buffer->resize(buffer->size() + BlockHandle::kMaxEncodedLength, 0);
+      Slice final_block_contents = compressor_->final_contents(i);
+      handles[i].set_offset(buffer->size());
+      handles[i].set_size(compressor_->block_size(i));
+      buffer->append(final_block_contents.data(), final_block_contents.size());
+      compac_stats_->final_data_size += final_block_contents.size();
+      compac_stats_->data_size += compressor_->block_size(i);
+    }
+    compressor_->Reset();
+  }
 
   Slice key;
   data_sink_->Lock();
@@ -440,9 +915,17 @@ void SeqDirBuilder<T>::Commit() {
   Slice input = uncommitted_indexes_;
   std::string handle_encoding;
   BlockHandle handle;
+  BlockHandle value_handle;
   while (!input.empty()) {
     if (GetLengthPrefixedSlice(&input, &key)) {
       handle.DecodeFrom(&input);
+      if (separate_values_) {
+        value_handle.DecodeFrom(&input);
+      }
+      if (compressor_ != NULL) {
+        assert(handle.offset() < handles.size());
+        handle = handles[handle.offset()];
+      }
       const uint64_t offset = handle.offset();
       handle.set_offset(base + offset);  // Finalize the block offset
       handle_encoding.clear();
@@ -460,6 +943,11 @@ void SeqDirBuilder<T>::Commit() {
                    options_.block_size ==
                0);  // Verify block alignment
       }
+      // Index entries of v2 key blocks also locate their value blocks
+      if (separate_values_) {
+        value_handle.set_offset(base + value_handle.offset());
+        value_handle.EncodeTo(&handle_encoding);
+      }
       indx_block_.Add(key, handle_encoding);
       num_index_committed++;
     } else {
@@ -468,7 +956,9 @@ void SeqDirBuilder<T>::Commit() {
   }
 
   assert(num_index_committed == num_uncommitted_indx_);
+  const uint64_t write_start = Env::Default()->NowMicros();
   status_ = data_sink_->Lwrite(*buffer);
+  compac_stats_->data_write_micros += Env::Default()->NowMicros() - write_start;
   data_offset_ = base + buffer->size();
   data_sink_->Unlock();
   if (!ok()) return;  // Abort
@@ -491,28 +981,39 @@ void SeqDirBuilder<T>::EndBlock() {
   //   block handle   block contents  block trailer  block padding
   //                | <---------- final block contents ----------> |
   //                          (LevelDb compatible layout)
+  if (compressor_ != NULL) {
+    // Hand the raw block over to the compressor. Its final location is
+    // determined at commit time. Until then, the block is referred to by its
+    // ordinal number within the current batch.
+    compressor_->Add(data_block_->Finish());
+    data_block_->buffer_store()->clear();
+    compac_stats_->total_num_blocks_++;
+    pending_restart_ = true;
+    last_data_info_.set_size(0);
+    last_data_info_.set_offset(compressor_->num_blocks() - 1);
+    assert(!pending_indx_entry_);
+    pending_indx_entry_ = true;
+    num_uncommitted_data_++;
+    return;
+  }
+
   Slice block_contents =
       data_block_->Finish(options_.compression, options_.force_compression);
   const size_t block_size = block_contents.size();
-  Slice final_block_contents;  // With the trailer and any inserted padding
-  if (options_.block_padding) {
-    // Target size for the final block contents after padding
-    size_t padding_target =
-        options_.block_size - BlockHandle::kMaxEncodedLength;
-    while (padding_target < block_size + kBlockTrailerSize)
-      padding_target += options_.block_size;
-    final_block_contents = data_block_->Finalize(
-        !options_.skip_checksums, static_cast<uint32_t>(padding_target),
-        static_cast<char>(0xff));
-  } else {
-    final_block_contents = data_block_->Finalize(!options_.skip_checksums);
-  }
+  // With the trailer and any inserted padding. In the v2 format, padding is
+  // inserted after the value block instead.
+  Slice final_block_contents =
+      separate_values_ ? data_block_->Finalize(!options_.skip_checksums)
+                       : FinalizeDataBlock(options_, data_block_, block_size);
 
   const size_t final_block_size = final_block_contents.size();
   const uint64_t block_offset =
       data_block_->buffer_store()->size() - final_block_size;
   compac_stats_->final_data_size += final_block_size;
   compac_stats_->data_size += block_size;
+  if (separate_values_) {
+    EndValueBlock(block_offset);
+  }
 
   if (ok()) {
     compac_stats_->total_num_blocks_++;
@@ -525,6 +1026,39 @@ void SeqDirBuilder<T>::EndBlock() {
   }
 }
 
+template <typename T>
+void SeqDirBuilder<T>::EndValueBlock(uint64_t block_offset) {
+  assert(separate_values_);
+  std::string* const buffer = data_block_->buffer_store();
+  const size_t value_block_offset = buffer->size();
+  buffer->append(value_block_);
+  char trailer[kBlockTrailerSize];
+  trailer[0] = kNoCompression;
+  if (!options_.skip_checksums) {
+    uint32_t crc = crc32c::Value(value_block_.data(), value_block_.size());
+    crc = crc32c::Extend(crc, trailer, 1);  // Extend crc to cover block type
+    EncodeFixed32(trailer + 1, crc32c::Mask(crc));
+  } else {
+    EncodeFixed32(trailer + 1, 0);
+  }
+  buffer->append(trailer, sizeof(trailer));
+  if (options_.block_padding) {
+    // Pad the leading block handle, the key block, and the value block
+    // together to a multiple of the block size
+    const size_t start = block_offset - BlockHandle::kMaxEncodedLength;
+    size_t padding_target = options_.block_size;
+    while (padding_target < buffer->size() - start)
+      padding_target += options_.block_size;
+    buffer->resize(start + padding_target, static_cast<char>(0xff));
+  }
+
+  compac_stats_->final_data_size += buffer->size() - value_block_offset;
+  compac_stats_->data_size += value_block_.size();
+  last_value_info_.set_offset(value_block_offset);
+  last_value_info_.set_size(value_block_.size());
+  value_block_.clear();
+}
+
 template <typename T>
 void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
   assert(!finished_);       // Finish() has not been called
@@ -561,6 +1095,9 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
     BytewiseComparator()->FindShortestSeparator(&last_key_, key);
     PutLengthPrefixedSlice(&uncommitted_indexes_, last_key_);
     last_data_info_.EncodeTo(&uncommitted_indexes_);
+    if (separate_values_) {
+      last_value_info_.EncodeTo(&uncommitted_indexes_);
+    }
     pending_indx_entry_ = false;
     num_uncommitted_indx_++;
   }
@@ -593,19 +1130,35 @@ void SeqDirBuilder<T>::Add(const Slice& key, const Slice& value) {
   }
 #endif
 
-  data_block_->Add(key, value);
+  if (separate_values_) {
+    value_locator_.clear();
+    PutValueLocator(&value_locator_, static_cast<uint32_t>(value_block_.size()),
+                    static_cast<uint32_t>(value.size()));
+    value_block_.append(value.data(), value.size());
+    data_block_->Add(key, value_locator_);
+  } else {
+    data_block_->Add(key, value);
+  }
   compac_stats_->total_num_keys_++;
   num_entries_++;  // Num key-value entries within an epoch
   if (IsKeyUnOrdered(options_.mode)) {
     return;  // Force one block per table
   }
-  if (data_block_->CurrentSizeEstimate() + kBlockTrailerSize +
-          BlockHandle::kMaxEncodedLength >=
-      block_threshold_) {
+  size_t estimated_block_size = data_block_->CurrentSizeEstimate() +
+                                kBlockTrailerSize +
+                                BlockHandle::kMaxEncodedLength;
+  if (separate_values_) {  // Key and value blocks are sized together
+    estimated_block_size += value_block_.size() + kBlockTrailerSize;
+  }
+  if (estimated_block_size >= block_threshold_) {
     EndBlock();
     // Schedule buffer commit if it is about to full
-    if (data_block_->buffer_store()->size() + options_.block_size >
-        options_.block_batch_size) {
+    size_t buffered_size = data_block_->buffer_store()->size();
+    if (compressor_ != NULL) {  // Blocks pending compression
+      buffered_size = compressor_->raw_size() +
+                      compressor_->num_blocks() * BlockHandle::kMaxEncodedLength;
+    }
+    if (buffered_size + options_.block_size > options_.block_batch_size) {
       pending_commit_ = true;
     }
   }
@@ -652,6 +1205,8 @@ void SeqDirBuilder<T>::Finish(uint32_t ep_seq) {
 template <typename T>
 size_t SeqDirBuilder<T>::memory_usage() const {
   size_t result = data_block_->memory_usage();
+  result += value_block_.capacity();
+  if (compressor_ != NULL) result += compressor_->memory_usage();
   result += root_block_.memory_usage();
   result += epok_block_.memory_usage();
   result += indx_block_.memory_usage();
@@ -663,6 +1218,9 @@ size_t SeqDirBuilder<T>::memory_usage() const {
 // Directly return the builder instance. This call won't fail.
 DirBuilder* DirBuilder::Open(const DirOptions& options, DirOutputStats* stats,
                              LogSink* data, LogSink* indx) {
+  if (options.format == kDirFmtV2) {  // Key blocks are always LevelDb blocks
+    return new SeqDirBuilder<>(options, stats, data, indx);
+  }
   if (!options.leveldb_compatible) {
     if (options.fixed_kv_length) {
       return new SeqDirBuilder<ArrayBlockBuilder>(options, stats, data, indx);
@@ -704,6 +1262,9 @@ Iterator* OpenDirBlock  // Use options to determine the block format to use
   if (IsKeyUnOrdered(options.mode)) {
     comparator = NULL;
   }
+  if (options.format == kDirFmtV2) {
+    return OpenBlock(comparator, contents);
+  }
   if (!options.leveldb_compatible) {
     if (options.fixed_kv_length) return OpenArrayBlock(comparator, contents);
     // XXX: should we provide our own block format
@@ -16,6 +16,7 @@
 #include "types.h"
 
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
@@ -47,6 +48,11 @@ static inline bool IsKeyUnOrdered(DirMode mode) {
   return (mode & 0x10) == 0x10;
 }
 
+// Return true iff directory values are prefixed with the epochs they were
+// originally written in. Such directories store all their keys in a single
+// physical epoch and filter values by their epochs when queried.
+static inline bool IsEpochTagged(DirMode mode) { return (mode & 0x20) == 0x20; }
+
 // A versatile block builder that uses the LevelDB's SST block format.
 // In this format, keys will be prefix-compressed. Both keys and values can have
 // variable length. Each block can be seen as a sorted search tree.
@@ -62,7 +68,9 @@ class SortedStringBlockBuilder : public BlockBuilder {
 
 // A simple block builder that stores data in write order.
 // In this format, key-value pairs are stored as-is. Both keys and values are
-// fixed sized. Each block can be seen as a simple array.
+// fixed sized. Each block can be seen as a simple array. If "key_column" is
+// set and keys are 8 or 16 bytes, keys are instead stored as a column of
+// integers followed by a column of values.
 class ArrayBlockBuilder : public AbstractBlockBuilder {
  public:
   explicit ArrayBlockBuilder(const DirOptions& options,
@@ -70,6 +78,8 @@ class ArrayBlockBuilder : public AbstractBlockBuilder {
       : AbstractBlockBuilder(BytewiseComparator()),
         value_size_(options.value_size),
         key_size_(options.key_size),
+        key_column_(options.key_column &&
+                    (options.key_size == 8 || options.key_size == 16)),
         n_(0) {
     if (force_unordered || IsKeyUnOrdered(options.mode)) {
       cmp_ = NULL;
@@ -79,6 +89,12 @@ class ArrayBlockBuilder : public AbstractBlockBuilder {
   // REQUIRES: Finish() has not been called since the previous Reset().
   void Add(const Slice& key, const Slice& value);
 
+  // Sort all inserted entries by key. Entries with equal keys keep their
+  // insertion order. Once sorted, the block may be searched using binary
+  // search.
+  // REQUIRES: Finish() has not been called since the previous Reset().
+  void Sort();
+
   // Finish building the block and return a slice that refers to the block
   // contents.
   Slice Finish(CompressionType compression = kNoCompression,
@@ -95,6 +111,7 @@ class ArrayBlockBuilder : public AbstractBlockBuilder {
  private:
   size_t value_size_;
   size_t key_size_;
+  bool key_column_;  // Store keys separately from values
   size_t n_;
 };
 
@@ -105,6 +122,11 @@ class ArrayBlock {
 
   ~ArrayBlock();
 
+  // Decode the key and value sizes from the 8-byte trailer of a block.
+  // Return false if the trailer does not describe a valid block.
+  static bool DecodeTrailer(const char* trailer, uint32_t* value_size,
+                            uint32_t* key_size, bool* key_column);
+
   Iterator* NewIterator(const Comparator* comparator);
 
  private:
@@ -113,9 +135,12 @@ class ArrayBlock {
   bool owned_;  // If data_[] is owned by us
   uint32_t value_size_;
   uint32_t key_size_;
-  uint32_t limit_;  // Limit of valid contents
+  uint32_t limit_;   // Limit of valid contents
+  bool key_column_;  // If keys are stored as a separate column
 
   class Iter;
+  template <typename K>
+  class KeyColumnIter;
 };
 
 // Open an iterator on top of a given data block. The returned the iterator
@@ -151,6 +176,9 @@ struct DirOutputStats {  // All final sizes include padding and block trailers
   // Total size of user data compacted
   size_t value_size;
   size_t key_size;
+
+  // Total time, in microseconds, spent writing data blocks to the data log
+  uint64_t data_write_micros;
 };
 
 // Directory builder interface.
@@ -196,12 +224,71 @@ class DirBuilder {
   // Total number of epochs generated
   uint32_t num_eps_;
 
+  // Summary stats of all non-empty epochs generated
+  std::vector<EpochStats> ep_stats_;
+
  private:
   // No copying allowed
   void operator=(const DirBuilder& db);
   DirBuilder(const DirBuilder&);
 };
 
+// Compress and finalize data blocks on a thread pool while keeping track of
+// their original order. Blocks that have not been picked up by the pool by the
+// time they are needed are compressed by the caller, so waiting for blocks
+// never depends on the availability of pool threads. This matters when the
+// caller itself runs on the same pool. Not thread-safe: a compressor is
+// owned by a single builder.
+class BlockCompressor {
+ public:
+  BlockCompressor(const DirOptions& options, ThreadPool* pool);
+  ~BlockCompressor();
+
+  // Schedule a copy of the given raw block contents for compression.
+  void Add(const Slice& raw_contents);
+
+  // Wait until all scheduled blocks are compressed and finalized.
+  void Finish();
+
+  // Return the compressed size of the i-th block. Trailer and padding
+  // are not included.
+  // REQUIRES: Finish() has been called.
+  size_t block_size(size_t i) const;
+
+  // Return the final contents of the i-th block with its trailer and
+  // any inserted padding.
+  // REQUIRES: Finish() has been called.
+  Slice final_contents(size_t i) const;
+
+  // Return the number of blocks scheduled since the last Reset().
+  size_t num_blocks() const { return num_blocks_; }
+
+  // Return the total raw size of blocks scheduled since the last Reset().
+  size_t raw_size() const { return raw_size_; }
+
+  // Drop all blocks. Block buffers are kept for reuse.
+  // REQUIRES: Finish() has been called.
+  void Reset();
+
+  // Report memory usage.
+  size_t memory_usage() const;
+
+ private:
+  struct Block;
+  struct Rep;  // Shared with pool threads
+  static void Compress(const DirOptions& options, Block* b);
+  static void BGWork(void* arg);
+  ThreadPool* const pool_;
+  Rep* rep_;
+  std::vector<Block*> blocks_;
+  size_t num_blocks_;
+  size_t raw_size_;
+
+  // No copying allowed
+  void operator=(const BlockCompressor& bc);
+  BlockCompressor(const BlockCompressor&);
+};
+
 class SortedStringBlockBuilder;
 class ArrayBlockBuilder;
 class LogWriter;
@@ -240,6 +327,11 @@ class SeqDirBuilder : public DirBuilder {
   // REQUIRES: Finish() has not been called.
   void EndBlock();
 
+  // Append the value block paired with the key block just finished at
+  // "block_offset" of the block buffer.
+  // REQUIRES: the directory is in the v2 format.
+  void EndValueBlock(uint64_t block_offset);
+
   // Flush buffered data blocks and finalize their indexes.
   // REQUIRES: Finish() has not been called.
   void Commit();
@@ -250,6 +342,11 @@ class SeqDirBuilder : public DirBuilder {
 
   std::string smallest_key_;
   std::string largest_key_;
+  // Smallest and largest keys of the current epoch
+  std::string epok_smallest_key_;
+  std::string epok_largest_key_;
+  // Output stats at the start of the current epoch
+  DirOutputStats epok_base_stats_;
   std::string last_key_;
   uint32_t num_uncommitted_indx_;  // Number of uncommitted index entries
   uint32_t num_uncommitted_data_;  // Number of uncommitted data blocks
@@ -257,11 +354,19 @@ class SeqDirBuilder : public DirBuilder {
   bool pending_commit_;  // Request to commit buffered data and indexes
   size_t block_threshold_;
   T* data_block_;
+  // Values are stored separately from keys in the v2 format
+  bool separate_values_;
+  std::string value_block_;
+  std::string value_locator_;
+  // Compress data blocks in parallel when both compression and a compaction
+  // pool are configured. Otherwise, NULL and blocks are compressed inline.
+  BlockCompressor* compressor_;
   BlockBuilder indx_block_;  // Locate the data blocks within a table
   BlockBuilder epok_block_;  // Locate the tables within an epoch
   BlockBuilder root_block_;  // Locate each epoch
   bool pending_indx_entry_;
   BlockHandle last_data_info_;
+  BlockHandle last_value_info_;
   bool pending_meta_entry_;
   TableHandle last_tabl_info_;
   bool pending_root_entry_;
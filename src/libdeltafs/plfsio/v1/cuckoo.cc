@@ -12,7 +12,11 @@
 #include "cuckoo.h"
 #include "types.h"
 
+#include "pdlfs-common/port.h"
+
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 #include <map>
 
 namespace pdlfs {
@@ -29,6 +33,46 @@ struct CuckooBucket {  // Fixed 4 items per bucket
 
 #undef PACKED
 
+// Test all 4 slots of a cuckoo bucket against a fingerprint at once. Buckets
+// no larger than 64 bits are loaded into a single word and compared using
+// SWAR (SIMD within a register) arithmetic. Larger buckets are decoded in one
+// pass and compared without branching on individual slots.
+template <size_t k, size_t v, bool swar = (4 * (k + v) <= 64)>
+struct CuckooBucketMatcher {
+  static bool Match(const CuckooBucket<k, v>* b, uint32_t fp) {
+    const uint32_t f0 = static_cast<uint32_t>(b->x0_ >> v);
+    const uint32_t f1 = static_cast<uint32_t>(b->x1_ >> v);
+    const uint32_t f2 = static_cast<uint32_t>(b->x2_ >> v);
+    const uint32_t f3 = static_cast<uint32_t>(b->x3_ >> v);
+    return ((f0 == fp) | (f1 == fp) | (f2 == fp) | (f3 == fp)) != 0;
+  }
+};
+
+template <size_t k, size_t v>
+struct CuckooBucketMatcher<k, v, true> {
+  enum { w = k + v };  // Bits per slot
+
+  static inline uint64_t Broadcast(uint64_t x) {  // Copy x to all 4 slots
+    return x | (x << w) | (x << (2 * w)) | (x << (3 * w));
+  }
+
+  static bool Match(const CuckooBucket<k, v>* b, uint32_t fp) {
+    if (!port::kLittleEndian) {  // Bit-fields are laid out differently
+      return CuckooBucketMatcher<k, v, false>::Match(b, fp);
+    }
+    uint64_t x = 0;
+    memcpy(&x, b, sizeof(CuckooBucket<k, v>));
+    const uint64_t keys = Broadcast(((1ull << k) - 1) << v);
+    // A slot becomes zero iff its fingerprint matches the input
+    const uint64_t t = (x ^ Broadcast(uint64_t(fp) << v)) & keys;
+    const uint64_t lo = Broadcast(1ull);
+    const uint64_t hi = Broadcast(1ull << (w - 1));
+    // Borrows only travel beyond a zero slot so the lowest zero slot is
+    // always correctly detected
+    return ((t - lo) & ~t & hi) != 0;
+  }
+};
+
 template <size_t k = 16, size_t v = 16>
 struct CuckooReader {
   explicit CuckooReader(const Slice& input)
@@ -61,6 +105,17 @@ struct CuckooReader {
       return x;
   };
 
+  // Return true iff any slot of bucket i holds fingerprint fp.
+  bool Match(size_t i, uint32_t fp) const {
+    assert(i < num_buckets_);
+    return CuckooBucketMatcher<k, v>::Match(&b_[i], fp);
+  }
+
+  void Prefetch(size_t i) const {
+    assert(i < num_buckets_);
+    __builtin_prefetch(&b_[i]);
+  }
+
   const CuckooBucket<k, v>* const b_;
   const uint32_t num_buckets_;
 };
@@ -170,7 +225,6 @@ CuckooBlock<k, v>::CuckooBlock(const DirOptions& options,
                                size_t bytes_to_reserve)
     : max_cuckoo_moves_(options.cuckoo_max_moves),
       finished_(true),  // Reset(num_keys) must be called before inserts
-      rnd_(options.cuckoo_seed),
       rep_(NULL) {
   rep_ = new Rep(options.cuckoo_frac);
   if (bytes_to_reserve != 0) {
@@ -295,6 +349,67 @@ void CuckooBlock<k, v>::AddKey(const Slice& key, uint32_t value) {
   AddTo(ha, fp, value, rep_);
 }
 
+template <size_t k, size_t v>
+void CuckooBlock<k, v>::AddKeys(const Slice* keys, const uint32_t* values,
+                                size_t n) {
+  assert(!finished_);
+  // Group keys by the region of the table their primary buckets fall into
+  // using a counting sort. Keys are then inserted region by region, each of
+  // which is small enough to stay in cache.
+  const size_t mask = rep_->num_buckets_ - 1;
+  size_t shift = 0;  // Use at most 4096 regions
+  while ((rep_->num_buckets_ >> shift) > 4096) {
+    shift++;
+  }
+  std::vector<uint64_t> hashes(n);
+  std::vector<size_t> counts((rep_->num_buckets_ >> shift) + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    hashes[i] = CuckooHash(keys[i]);
+    counts[((hashes[i] & mask) >> shift) + 1]++;
+  }
+  for (size_t r = 1; r < counts.size(); r++) {
+    counts[r] += counts[r - 1];
+  }
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[counts[(hashes[i] & mask) >> shift]++] = i;
+  }
+  // First, sweep the table once to place keys in their primary buckets.
+  // Keys whose primary buckets are already full are deferred.
+  size_t num_deferred = 0;
+  for (size_t i = 0; i < n; i++) {
+    const size_t idx = order[i];
+    const uint32_t fp = CuckooFingerprint(hashes[idx], k);
+    const size_t b = hashes[idx] & mask;
+    size_t j = 4;  // Keys are deferred if the main table is already full
+    if (!rep_->full_) {
+      for (j = 0; j < 4; j++) {
+        if (rep_->key(b, j) == 0) {
+          rep_->Write(b, j, fp, values != NULL ? values[idx] : 0);
+          break;
+        } else if (rep_->key(b, j) == fp) {  // Let AddTo() handle duplicates
+          j = 4;
+          break;
+        }
+      }
+    }
+    if (j == 4) {
+      order[num_deferred++] = idx;
+    }
+  }
+  // Then insert all deferred keys through regular cuckoo displacements
+  for (size_t i = 0; i < num_deferred; i++) {
+    const size_t idx = order[i];
+    const uint32_t value = values != NULL ? values[idx] : 0;
+    // If the main table is full, stage the key at an overflow space
+    if (rep_->full_) {
+      AddMore(keys[idx], value);
+    } else {
+      AddTo(hashes[idx], CuckooFingerprint(hashes[idx], k), value, rep_);
+    }
+  }
+}
+
 template <size_t k, size_t v>
 bool CuckooBlock<k, v>::Exists(uint64_t ha, uint32_t fp, const Rep* r) {
   assert(r->num_buckets_ != 0);
@@ -320,49 +435,92 @@ bool CuckooBlock<k, v>::Exists(uint64_t ha, uint32_t fp, const Rep* r) {
   return false;
 }
 
+// Return true iff bucket "b" is visited by the path ending at "node".
+template <size_t k, size_t v>
+bool CuckooBlock<k, v>::OnPath(size_t node, size_t b) const {
+  for (int n = static_cast<int>(node); n != -1; n = path_[n].parent) {
+    if (path_[n].bucket == b) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Insert "fp" into one of its two candidate buckets. When both buckets are
+// full, we perform a breadth-first search over the graph of possible
+// displacements to find a shortest path that leads to an empty slot, and then
+// move keys along the path backwards so that no key is ever evicted into a
+// full bucket. At most max_cuckoo_moves_ buckets are explored. If no path is
+// found, the table is marked as full and "fp" becomes the table's victim.
 template <size_t k, size_t v>
 void CuckooBlock<k, v>::AddTo(uint64_t ha, uint32_t fp, uint32_t data, Rep* r) {
   assert(!r->full_);
-  size_t i = ha & (r->num_buckets_ - 1);
+  const size_t mask = r->num_buckets_ - 1;
+  const size_t i1 = ha & mask;
+  const size_t i2 = CuckooAlt(i1, fp) & mask;
+  if (v != 0) {
+    data &= (1ull << v) - 1;
+  }
 
-  // Our goal is to put "fp" into bucket "i"
-  for (int moves = 0; moves < max_cuckoo_moves_; moves++) {
+  // Our goal is to put "fp" into bucket "i1" or bucket "i2"
+  size_t empty_i = 0, empty_j = 4;
+  for (size_t b = 0; b < 2; b++) {
+    const size_t i = b == 0 ? i1 : i2;
     for (size_t j = 0; j < 4; j++) {
       std::pair<uint32_t, uint32_t> kv = r->pair(i, j);
-      if (kv.first == 0) {  // Direct insert if cell is empty
-        r->Write(i, j, fp, data);
-        return;
+      if (kv.first == 0) {
+        if (empty_j == 4) {  // Remember the first empty cell
+          empty_i = i;
+          empty_j = j;
+        }
       } else if (kv.first == fp) {  // Fingerprint matches the input
-        // If v is disabled we are done
-        if (v == 0) {
+        // If v is disabled we are done. Otherwise we are done only if
+        // data happens to match as well
+        if (v == 0 || kv.second == data) {
           return;
         }
-        // Otherwise we are done only if data
-        // happens to match as well
-        if (kv.second == (data & ((1ull << v) - 1))) {
+      }
+    }
+  }
+  if (empty_j != 4) {  // Direct insert if a cell is empty
+    r->Write(empty_i, empty_j, fp, data);
+    return;
+  }
+
+  path_.clear();
+  path_.push_back(PathNode(i1, -1, 0));
+  if (i2 != i1) path_.push_back(PathNode(i2, -1, 0));
+  const size_t max_nodes = static_cast<size_t>(std::max(max_cuckoo_moves_, 2));
+  for (size_t n = 0; n < path_.size(); n++) {
+    const size_t i = path_[n].bucket;
+    for (size_t j = 0; j < 4; j++) {
+      const size_t alt = CuckooAlt(i, r->key(i, j)) & mask;
+      for (size_t e = 0; e < 4; e++) {
+        if (r->key(alt, e) == 0) {  // Found an empty cell
+          std::pair<uint32_t, uint32_t> kv = r->pair(i, j);
+          r->Write(alt, e, kv.first, kv.second);
+          // Shift keys along the path to free up a cell at its root
+          int node = static_cast<int>(n);
+          size_t slot = j;
+          while (path_[node].parent != -1) {
+            const PathNode& p = path_[path_[node].parent];
+            kv = r->pair(p.bucket, path_[node].slot);
+            r->Write(path_[node].bucket, slot, kv.first, kv.second);
+            slot = path_[node].slot;
+            node = path_[node].parent;
+          }
+          r->Write(path_[node].bucket, slot, fp, data);
           return;
         }
       }
+      if (path_.size() < max_nodes && !OnPath(n, alt)) {
+        path_.push_back(PathNode(alt, static_cast<int>(n), j));
+      }
     }
-    if (moves != 0) {  // Kick out a victim so we can put "fp" in
-      const size_t victim = rnd_.Next() & 3;
-      std::pair<uint32_t, uint32_t> kv = r->pair(i, victim);
-#ifndef NDEBUG
-      if (v != 0)
-        assert(kv.first != 0 && !(kv.first == fp && kv.second == data));
-      else
-        assert(kv.first != 0 && !(kv.first == fp));
-#endif
-      r->Write(i, victim, fp, data);
-      data = kv.second;
-      fp = kv.first;
-    }
-
-    i = CuckooAlt(i, fp) & (r->num_buckets_ - 1);
   }
 
   r->full_ = true;  // Full, no more inserts
-  r->victim_index_ = i;
+  r->victim_index_ = i1;
   r->victim_data_ = data;
   r->victim_fp_ = fp;
 }
@@ -372,6 +530,11 @@ size_t CuckooBlock<k, v>::num_victims() const {
   return key_sizes_.size();
 }
 
+template <size_t k, size_t v>
+size_t CuckooBlock<k, v>::num_tables() const {
+  return 1 + morereps_.size();
+}
+
 template <size_t k, size_t v>
 size_t CuckooBlock<k, v>::TEST_BytesPerCuckooBucket() const {
   return static_cast<size_t>(sizeof(CuckooBucket<k, v>));
@@ -432,7 +595,7 @@ class CuckooKeyTester {
       }
 
       Slice cuckoo_table(tail - table_size, table_size);
-      if (Fetch(ha, fp, num_buckets, cuckoo_table, values)) {
+      if (Fetch(ha, fp, cuckoo_table, values)) {
         if (v == 0 || !values) {
           return true;
         }
@@ -446,12 +609,110 @@ class CuckooKeyTester {
     }
   }
 
+  // Test a batch of keys against the filter. Tables are located only once
+  // for the entire batch. Hashes are computed upfront and the candidate
+  // buckets of a group of keys are prefetched before any of them is probed.
+  void operator()(const Slice* keys, size_t n, const Slice& input,
+                  bool* results) {
+    std::vector<Slice> tables;
+    if (!LocateTables(input, &tables)) {
+      std::fill(results, results + n, true);
+      return;
+    }
+
+    std::vector<uint64_t> hashes(n);
+    for (size_t i = 0; i < n; i++) {
+      hashes[i] = CuckooHash(keys[i]);
+      results[i] = false;
+    }
+
+    static const size_t kGroupSize = 16;
+    size_t i1[kGroupSize], i2[kGroupSize];
+    for (size_t t = 0; t < tables.size(); t++) {
+      const Slice& table = tables[t];
+      const char* const tail = table.data() + table.size();
+      const uint32_t num_buckets = DecodeFixed32(tail - 16);
+      const uint32_t victim_index = DecodeFixed32(tail - 12);
+      const uint32_t victim_fp = DecodeFixed32(tail - 4);
+      Slice cuckoo_buckets = table;
+      cuckoo_buckets.remove_suffix(16);  // Remove the 16-byte header
+      const CuckooReader<k, v> reader(cuckoo_buckets);
+      for (size_t g = 0; g < n; g += kGroupSize) {
+        const size_t m = std::min(kGroupSize, n - g);
+        for (size_t j = 0; j < m; j++) {
+          if (!results[g + j]) {
+            const uint64_t ha = hashes[g + j];
+            const uint32_t fp = CuckooFingerprint(ha, k);
+            i1[j] = ha & (num_buckets - 1);
+            i2[j] = CuckooAlt(i1[j], fp) & (num_buckets - 1);
+            reader.Prefetch(i1[j]);
+            reader.Prefetch(i2[j]);
+          }
+        }
+        for (size_t j = 0; j < m; j++) {
+          if (!results[g + j]) {
+            const uint32_t fp = CuckooFingerprint(hashes[g + j], k);
+            if (victim_fp == fp &&
+                (victim_index == i1[j] || victim_index == i2[j])) {
+              results[g + j] = true;
+            } else {
+              results[g + j] =
+                  reader.Match(i1[j], fp) || reader.Match(i2[j], fp);
+            }
+          }
+        }
+      }
+    }
+  }
+
  private:
-  static bool Fetch(uint64_t ha, uint32_t fp, uint32_t num_buckets,
-                    const Slice& input, std::vector<uint32_t>* values) {
+  // Locate all cuckoo tables within the given filter input, starting from
+  // the main table. Return true if all tables indicated by the filter's footer
+  // are found, or false if the input is empty or prematurely ended.
+  static bool LocateTables(const Slice& input, std::vector<Slice>* tables) {
+    const char* tail = input.data() + input.size();
+    if (input.size() < 12) return false;  // Not enough data for a header
+#ifndef NDEBUG
+    size_t valbits = DecodeFixed32(tail - 8);
+    assert(valbits == v);
+    size_t keybits = DecodeFixed32(tail - 4);
+    assert(keybits == k);
+#endif
+    uint32_t num_tables = DecodeFixed32(tail - 12);
+    if (num_tables == 0) {  // No tables found
+      return false;
+    }
+
+    tables->reserve(num_tables);
+    size_t remaining_size = input.size();
+    size_t table_size = 12;  // The 12-byte header to be removed
+    for (; num_tables != 0; num_tables--) {
+      assert(remaining_size >= table_size);
+      remaining_size -= table_size;
+      if (remaining_size < 16) {  // Not enough data for a table header
+        return false;
+      }
+
+      tail -= table_size;
+      uint32_t num_buckets = DecodeFixed32(tail - 16);
+      table_size = num_buckets * sizeof(CuckooBucket<k, v>) + 16;
+      if (num_buckets == 0) {  // An empty table has no use
+        return false;
+      } else if (remaining_size < table_size) {  // Premature end of table
+        return false;
+      }
+
+      tables->push_back(Slice(tail - table_size, table_size));
+    }
+
+    return true;
+  }
+
+  static bool Fetch(uint64_t ha, uint32_t fp, const Slice& input,
+                    std::vector<uint32_t>* values) {
     const char* const tail = input.data() + input.size();
     assert(input.size() >= 16);
-
+    uint32_t num_buckets = DecodeFixed32(tail - 16);
     assert(num_buckets != 0);
     size_t i1 = ha & (num_buckets - 1);
     size_t i2 = CuckooAlt(i1, fp) & (num_buckets - 1);
@@ -471,30 +732,29 @@ class CuckooKeyTester {
     Slice cuckoo_buckets = input;
     cuckoo_buckets.remove_suffix(16);  // Remove the 16-byte header
     const CuckooReader<k, v> reader(cuckoo_buckets);
+    if (v == 0 || !values) {  // Test all slots of both buckets at once
+      return reader.Match(i1, fp) || reader.Match(i2, fp);
+    }
+
+    // Test all locations to gather all values
+    const bool m1 = reader.Match(i1, fp);
+    const bool m2 = reader.Match(i2, fp);
     for (size_t j = 0; j < 4; j++) {
-      if (v != 0 && values) {  // Test all locations to gather all values
+      if (m1) {
         std::pair<uint32_t, uint32_t> kv1 = reader.pair(i1, j);
         if (kv1.first == fp) {
           values->push_back(kv1.second);
         }
+      }
+      if (m2) {
         std::pair<uint32_t, uint32_t> kv2 = reader.pair(i2, j);
         if (kv2.first == fp) {
           values->push_back(kv2.second);
         }
-      } else {  // Immediately return on first match
-        if (reader.key(i1, j) == fp) {
-          return true;
-        } else if (reader.key(i2, j) == fp) {
-          return true;
-        }
       }
     }
 
-    if (v != 0 && values) {
-      return !values->empty();
-    } else {
-      return false;
-    }
+    return !values->empty();
   }
 };
 
@@ -609,5 +869,84 @@ bool CuckooValues(const Slice& key, const Slice& input,
   }
 }
 
+void CuckooKeyMayMatchBatch(const Slice* keys, size_t num_keys,
+                            const Slice& input, bool* results) {
+  const size_t len = input.size();
+  if (len < 8) {  // Not enough data for a header, consider it to be a match
+    std::fill(results, results + num_keys, true);
+    return;
+  }
+
+  const char* const tail = input.data() + input.size();
+  size_t valbits = DecodeFixed32(tail - 8);
+  size_t keybits = DecodeFixed32(tail - 4);
+#define KCASE(n, v)                                          \
+  case n:                                                    \
+    CuckooKeyTester<n, v>()(keys, num_keys, input, results); \
+    return
+#define VCASE(k, n)                                          \
+  case n:                                                    \
+    CuckooKeyTester<k, n>()(keys, num_keys, input, results); \
+    return
+  if (valbits == 32) {
+    switch (int(keybits)) {
+      KCASE(28, 32);
+      KCASE(26, 32);
+      KCASE(24, 32);
+      KCASE(22, 32);
+      KCASE(20, 32);
+      KCASE(18, 32);
+      KCASE(16, 32);
+      KCASE(14, 32);
+      default:
+        break;
+    }
+  } else if (valbits == 0) {
+    switch (int(keybits)) {
+      KCASE(28, 0);
+      KCASE(26, 0);
+      KCASE(24, 0);
+      KCASE(22, 0);
+      KCASE(20, 0);
+      KCASE(18, 0);
+      KCASE(16, 0);
+      KCASE(14, 0);
+      default:
+        break;
+    }
+  } else if (keybits == 8) {
+    switch (int(valbits)) {
+      VCASE(8, 24);
+      VCASE(8, 22);
+      VCASE(8, 20);
+      VCASE(8, 18);
+      VCASE(8, 16);
+      VCASE(8, 14);
+      VCASE(8, 12);
+      VCASE(8, 10);
+      default:
+        break;
+    }
+  } else if (keybits == 4) {
+    switch (int(valbits)) {
+      VCASE(4, 24);
+      VCASE(4, 22);
+      VCASE(4, 20);
+      VCASE(4, 18);
+      VCASE(4, 16);
+      VCASE(4, 14);
+      VCASE(4, 12);
+      VCASE(4, 10);
+      default:
+        break;
+    }
+  }
+#undef VCASE
+#undef KCASE
+
+  // Unknown filter configuration, consider all keys to be a match
+  std::fill(results, results + num_keys, true);
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -12,7 +12,6 @@
 #pragma once
 
 #include "pdlfs-common/coding.h"
-#include "pdlfs-common/random.h"
 #include "pdlfs-common/slice.h"
 #include "pdlfs-common/xxhash.h"
 
@@ -49,6 +48,12 @@ extern bool CuckooKeyMayMatch(const Slice& key, const Slice& input);
 // Retrieve the values to a specific key
 extern bool CuckooValues(const Slice& key, const Slice& input,
                          std::vector<uint32_t>*);
+// Test a batch of n keys against the given filter. Set results[i] to false iff
+// keys[i] is absent from the filter. Much faster than testing keys one by one
+// as filter headers are decoded only once and candidate buckets are
+// prefetched ahead of being probed.
+extern void CuckooKeyMayMatchBatch(const Slice* keys, size_t n,
+                                   const Slice& input, bool* results);
 
 // A simple cuckoo hash filter implementation.
 template <size_t k, size_t v = 0>
@@ -73,6 +78,14 @@ class CuckooBlock {
   // REQUIRES: Finish() has NOT been called.
   bool TEST_AddKey(const Slice& key, uint32_t value = 0);
 
+  // Insert a batch of n keys into the cuckoo filter. Keys are inserted in the
+  // order of their primary buckets rather than their input order. This
+  // improves memory locality when building large tables.
+  // Set values to NULL to insert all keys with a value of 0.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has NOT been called.
+  void AddKeys(const Slice* keys, const uint32_t* values, size_t n);
+
   // Finalize the filter and return its contents.
   Slice Finish();
 
@@ -80,6 +93,9 @@ class CuckooBlock {
   std::string TEST_Finish();
 
   size_t num_victims() const;  // #keys not inserted to the main table
+  // Total number of tables, including all auxiliary tables.
+  // REQUIRES: Finish() has been called.
+  size_t num_tables() const;
 
   size_t TEST_BytesPerCuckooBucket() const;
   size_t TEST_NumCuckooTables() const;
@@ -91,7 +107,6 @@ class CuckooBlock {
   std::string keys_;
   const int max_cuckoo_moves_;
   bool finished_;  // If Finish() has been called
-  Random rnd_;
 
   void MaybeBuildMoreTables();
   void AddMore(const Slice& key, uint32_t value);
@@ -100,6 +115,14 @@ class CuckooBlock {
   CuckooBlock(const CuckooBlock&);
   void AddTo(uint64_t ha, uint32_t fp, uint32_t data, Rep* rep);
   bool Exists(uint64_t ha, uint32_t fp, const Rep* rep);
+  struct PathNode {  // A bucket visited by a displacement search
+    PathNode(size_t b, int p, size_t s) : bucket(b), parent(p), slot(s) {}
+    size_t bucket;
+    int parent;   // Index of the parent node, or -1 for a root node
+    size_t slot;  // The slot in the parent bucket that leads to this bucket
+  };
+  bool OnPath(size_t node, size_t b) const;
+  std::vector<PathNode> path_;  // Reused across insertions
   std::vector<Rep*> morereps_;  // Auxiliary tables
   // The main table
   Rep* rep_;
@@ -16,6 +16,7 @@
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
+#include <algorithm>
 #include <set>
 
 namespace pdlfs {
@@ -126,6 +127,37 @@ TEST(CuckooFtTest, AddAndMatch) {
   }
 }
 
+TEST(CuckooFtTest, BatchMatch) {
+  for (uint32_t ki = 1; ki <= 1024; ki *= 2) {
+    uint32_t num_keys = ki << 10;
+    Reset(num_keys);
+    uint32_t k = 0;
+    for (; k < num_keys; k++) {
+      if (!AddKey(k)) {
+        break;
+      }
+    }
+    Finish();
+    // Query both inserted and absent keys
+    std::vector<Slice> keys(2 * num_keys);
+    std::string buf(4 * keys.size(), 0);
+    uint32_t j = 0;
+    for (; j < keys.size(); j++) {
+      EncodeFixed32(&buf[4 * j], j);
+      keys[j] = Slice(&buf[4 * j], 4);
+    }
+    bool* results = new bool[keys.size()];
+    CuckooKeyMayMatchBatch(&keys[0], keys.size(), data_, results);
+    for (j = 0; j < keys.size(); j++) {
+      ASSERT_EQ(results[j], KeyMayMatch(j));
+      if (j < k) {
+        ASSERT_TRUE(results[j]);
+      }
+    }
+    delete[] results;
+  }
+}
+
 class CuckooAuxTest : public CuckooFtTest {
  public:
   void AddKey(uint32_t k) {
@@ -156,6 +188,75 @@ TEST(CuckooAuxTest, AuxiliaryTables) {
   }
 }
 
+TEST(CuckooAuxTest, BatchAuxiliaryTables) {
+  for (uint32_t ki = 1; ki <= 1024; ki *= 4) {
+    uint32_t num_keys = ki << 10;
+    Reset(num_keys);
+    uint32_t k = 0;
+    for (; k < num_keys; k++) {
+      AddKey(k);
+    }
+    Finish();
+    std::vector<Slice> keys(num_keys);
+    std::string buf(4 * keys.size(), 0);
+    uint32_t j = 0;
+    for (; j < keys.size(); j++) {
+      EncodeFixed32(&buf[4 * j], j);
+      keys[j] = Slice(&buf[4 * j], 4);
+    }
+    bool* results = new bool[keys.size()];
+    CuckooKeyMayMatchBatch(&keys[0], keys.size(), data_, results);
+    for (j = 0; j < keys.size(); j++) {
+      ASSERT_TRUE(results[j]);
+    }
+    delete[] results;
+  }
+}
+
+// Keys should fit in the main table when the table is filled up to the
+// target occupation rate.
+TEST(CuckooAuxTest, TargetOccupancy) {
+  for (uint32_t ki = 1; ki <= 1024; ki *= 4) {
+    const uint32_t num_keys = static_cast<uint32_t>(0.95 * (ki << 10));
+    Reset(num_keys);
+    uint32_t k = 0;
+    for (; k < num_keys; k++) {
+      AddKey(k);
+    }
+    Finish();
+    fprintf(stderr, "%4u Ki keys: %.2f%% util, %d victims, %d tables\n", ki,
+            100.0 * num_keys / cf_->TEST_NumBuckets() / 4,
+            int(cf_->num_victims()), int(cf_->num_tables()));
+    ASSERT_EQ(cf_->num_victims(), 0);
+    ASSERT_EQ(cf_->num_tables(), 1);
+    uint32_t j = 0;
+    for (; j < k; j++) {
+      ASSERT_TRUE(KeyMayMatch(j));
+    }
+  }
+}
+
+TEST(CuckooAuxTest, BulkAdd) {
+  for (uint32_t ki = 1; ki <= 1024; ki *= 4) {
+    const uint32_t num_keys = static_cast<uint32_t>(0.95 * (ki << 10));
+    Reset(num_keys);
+    std::vector<Slice> keys(num_keys);
+    std::string buf(4 * keys.size(), 0);
+    uint32_t j = 0;
+    for (; j < keys.size(); j++) {
+      EncodeFixed32(&buf[4 * j], j);
+      keys[j] = Slice(&buf[4 * j], 4);
+    }
+    cf_->AddKeys(&keys[0], NULL, keys.size());
+    Finish();
+    ASSERT_EQ(cf_->num_victims(), 0);
+    ASSERT_EQ(cf_->num_tables(), 1);
+    for (j = 0; j < keys.size(); j++) {
+      ASSERT_TRUE(KeyMayMatch(j));
+    }
+  }
+}
+
 class CuckooKvTest : public CuckooTest {
  public:
   CuckooKvTest() {
@@ -267,6 +368,36 @@ TEST(CuckooKvTest, KvAddAndGet) {
   }
 }
 
+TEST(CuckooKvTest, KvBatchMatch) {
+  for (uint32_t ki = 1; ki <= 1024; ki *= 2) {
+    uint32_t num_keys = ki << 10;
+    Reset(num_keys);
+    uint32_t k = 0;
+    for (; k < num_keys; k++) {
+      if (!AddKey(k)) {
+        break;
+      }
+    }
+    Finish();
+    std::vector<Slice> keys(2 * num_keys);
+    std::string buf(4 * keys.size(), 0);
+    uint32_t j = 0;
+    for (; j < keys.size(); j++) {
+      EncodeFixed32(&buf[4 * j], j);
+      keys[j] = Slice(&buf[4 * j], 4);
+    }
+    bool* results = new bool[keys.size()];
+    CuckooKeyMayMatchBatch(&keys[0], keys.size(), data_, results);
+    for (j = 0; j < keys.size(); j++) {
+      ASSERT_EQ(results[j], KeyMayMatch(j));
+      if (j < k) {
+        ASSERT_TRUE(results[j]);
+      }
+    }
+    delete[] results;
+  }
+}
+
 class CuckooKvAuxTest : public CuckooKvTest {
  public:
   void AddKey(uint32_t k) {
@@ -304,6 +435,35 @@ TEST(CuckooKvAuxTest, KvAuxiliaryTables) {
   }
 }
 
+TEST(CuckooKvAuxTest, KvBatchAuxiliaryTables) {
+  const uint32_t num_keys = 8 << 10;
+  Reset(num_keys / 8);  // Main table overflows after the first few batches
+  std::vector<Slice> keys(num_keys);
+  std::vector<uint32_t> vals(num_keys);
+  std::string buf(4 * keys.size(), 0);
+  uint32_t j = 0;
+  for (; j < num_keys; j++) {
+    EncodeFixed32(&buf[4 * j], j);
+    keys[j] = Slice(&buf[4 * j], 4);
+    vals[j] = j;
+  }
+  for (j = 0; j < num_keys; j += 100) {
+    const size_t n = std::min<size_t>(100, num_keys - j);
+    cf_->AddKeys(&keys[j], &vals[j], n);
+  }
+  Finish();
+  ASSERT_TRUE(cf_->num_tables() > 1);
+  std::vector<uint32_t> values;
+  std::set<uint32_t> set;
+  for (j = 0; j < num_keys; j++) {
+    ASSERT_TRUE(GetValues(j, &values));
+    set.insert(values.begin(), values.end());
+    ASSERT_TRUE(set.count(j) != 0);
+    values.resize(0);
+    set.clear();
+  }
+}
+
 // Evaluate false positive rate under different filter configurations.
 class PlfsFalsePositiveBench {
  protected:
@@ -392,6 +552,7 @@ class PlfsCuckoBench : protected PlfsFalsePositiveBench {
  public:
   PlfsCuckoBench() {
     use_auxtables_ = GetOption("CUCKOO_ENABLE_AUX", 1);
+    use_bulk_ = GetOption("CUCKOO_BULK_BUILD", 0);
     keybits_ = GetOption("CUCKOO_KEY_BITS", 12);
     nlg_ = GetOption("LG_KEYS", 20);
     assert(nlg_ < 30);
@@ -408,16 +569,30 @@ class PlfsCuckoBench : protected PlfsFalsePositiveBench {
     const uint32_t num_keys = 1u << nlg_;
     ft.Reset(num_keys);
     uint32_t i = 0;
-    for (; i < num_keys; i++) {
-      EncodeFixed32(tmp, i);
-      if (use_auxtables_) {
-        ft.AddKey(key);
-      } else if (!ft.TEST_AddKey(key)) {
-        break;
+    const uint64_t start = Env::Default()->NowMicros();
+    if (use_bulk_) {
+      std::vector<Slice> keys(num_keys);
+      std::string buf(4 * keys.size(), 0);
+      for (; i < num_keys; i++) {
+        EncodeFixed32(&buf[4 * i], i);
+        keys[i] = Slice(&buf[4 * i], 4);
+      }
+      ft.AddKeys(&keys[0], NULL, keys.size());
+    } else {
+      for (; i < num_keys; i++) {
+        EncodeFixed32(tmp, i);
+        if (use_auxtables_) {
+          ft.AddKey(key);
+        } else if (!ft.TEST_AddKey(key)) {
+          break;
+        }
       }
     }
     *dst = ft.TEST_Finish();
+    build_micros_ = Env::Default()->NowMicros() - start;
     *num_buckets = ft.TEST_NumBuckets();
+    num_victims_ = ft.num_victims();
+    num_tables_ = ft.num_tables();
     return i;
   }
 
@@ -465,10 +640,18 @@ class PlfsCuckoBench : protected PlfsFalsePositiveBench {
             1.0 * num_buckets / ki, 4.0 * num_buckets / ki / ki);
     fprintf(stderr, "                Util: %.2f%%\n",
             100.0 * n / num_buckets / 4);
+    fprintf(stderr, "             Victims: %d\n", int(num_victims_));
+    fprintf(stderr, "              Tables: %d\n", int(num_tables_));
+    fprintf(stderr, "          Build time: %.3f s\n", build_micros_ / 1e6);
   }
 
   // If aux tables should be used
   int use_auxtables_;
+  // If keys should be inserted as a single batch
+  int use_bulk_;
+  size_t num_victims_;
+  size_t num_tables_;
+  uint64_t build_micros_;
 };
 
 // Evaluate the accuracy of a cuckoo filter
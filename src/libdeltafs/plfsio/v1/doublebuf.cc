@@ -14,6 +14,13 @@
 namespace pdlfs {
 namespace plfsio {
 
+PipelineStats::PipelineStats()
+    : prepare_waits(0),
+      prepare_wait_micros(0),
+      compactions(0),
+      compaction_micros(0),
+      max_compaction_micros(0) {}
+
 DoubleBuffering::DoubleBuffering(port::Mutex* mu, port::CondVar* cv)
     : mu_(mu),
       bg_cv_(cv),
@@ -40,6 +47,24 @@ void DoubleBuffering::WaitFor(uint32_t compac_seq) {
   }
 }
 
+// Wait until all compactions scheduled before a certain compaction have
+// completed. Unlike WaitFor(), background errors do not end the wait so that
+// compactions continue to complete in order.
+// REQUIRES: mu_ has been LOCKed.
+void DoubleBuffering::WaitForTurn(uint32_t compac_seq) {
+  mu_->AssertHeld();
+  assert(num_compac_completed_ < compac_seq);
+  while (compac_seq != num_compac_completed_ + 1) {
+    bg_cv_->Wait();
+  }
+}
+
+// REQUIRES: mu_ has been LOCKed.
+void DoubleBuffering::__GetStats(PipelineStats* stats) const {
+  mu_->AssertHeld();
+  *stats = stats_;
+}
+
 // Wait until there is no outstanding compactions.
 // REQUIRES: mu_ has been LOCKed.
 void DoubleBuffering::WaitForAny() {
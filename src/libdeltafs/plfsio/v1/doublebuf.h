@@ -23,10 +23,35 @@
 namespace pdlfs {
 namespace plfsio {
 
+// Statistics on a write pipeline. All times are in microseconds.
+struct PipelineStats {
+  PipelineStats();
+
+  // Total number of times a writer waited for a free write buffer
+  uint64_t prepare_waits;
+  // Total time writers spent waiting for a free write buffer
+  uint64_t prepare_wait_micros;
+  // Total number of compactions completed
+  uint64_t compactions;
+  // Total time between compactions being scheduled and completed
+  uint64_t compaction_micros;
+  // Max time between a compaction being scheduled and completed
+  uint64_t max_compaction_micros;
+};
+
+// A write pipeline with one mutable write buffer and a FIFO of immutable
+// buffers being compacted. Derived classes decide the number of buffers by
+// adding free buffers to bufs_. Compactions may run concurrently, but they
+// complete in the order they are scheduled. Derived classes that must write
+// in order call WaitForTurn() before writing.
 class DoubleBuffering {
  public:
   DoubleBuffering(port::Mutex* mu, port::CondVar* cv);
 
+  // Obtain pipeline statistics.
+  // REQUIRES: mu_ has been LOCKed.
+  void __GetStats(PipelineStats* stats) const;
+
   // Append data into the buffer. Return OK on success, or a non-OK status on
   // errors. REQUIRES: __Finish() has NOT been called.
   template <typename T>
@@ -67,6 +92,7 @@ class DoubleBuffering {
   Status Prepare(uint32_t* compac_seq, bool force = true, bool nowait = false,
                  const Slice& k = Slice(), const Slice& v = Slice());
   void WaitFor(uint32_t compac_seq);
+  void WaitForTurn(uint32_t compac_seq);
   void WaitForAny();
   template <typename T>
   void TryScheduleCompaction(uint32_t* compac_seq, void*);
@@ -79,8 +105,15 @@ class DoubleBuffering {
   bool finished_;  // If Finish() has been called
   uint32_t num_bg_compactions_;
   Status bg_status_;
-  std::deque<void*> bufs_;
+  std::deque<void*> bufs_;  // Free buffers
   void* membuf_;
+  struct ImmBuf {  // A buffer scheduled for compaction
+    void* buf;
+    uint64_t scheduled_micros;
+  };
+  // Buffers being compacted in compac_seq order
+  std::deque<ImmBuf> immbufs_;
+  PipelineStats stats_;
 };
 
 #define __this static_cast<T*>(this)
@@ -193,6 +226,7 @@ template <typename T>
 Status DoubleBuffering::Prepare(uint32_t* seq, bool force, bool nowait,
                                 const Slice& k, const Slice& v) {
   mu_->AssertHeld();
+  bool waited = false;
   Status status;
   while (true) {
     assert(membuf_);
@@ -209,7 +243,13 @@ Status DoubleBuffering::Prepare(uint32_t* seq, bool force, bool nowait,
       membuf_ = bufs_.back();
       bufs_.pop_back();
     } else if (!nowait) {
+      const uint64_t start = Env::Default()->NowMicros();
       bg_cv_->Wait();  // Wait for background compactions to finish
+      stats_.prepare_wait_micros += Env::Default()->NowMicros() - start;
+      if (!waited) {
+        stats_.prepare_waits++;
+        waited = true;
+      }
     } else {
       status = Status::TryAgain("");
       break;
@@ -227,6 +267,10 @@ void DoubleBuffering::TryScheduleCompaction(uint32_t* compac_seq,
 
   *compac_seq = ++num_compac_scheduled_;
   ++num_bg_compactions_;
+  ImmBuf imm;
+  imm.buf = immbuf;
+  imm.scheduled_micros = Env::Default()->NowMicros();
+  immbufs_.push_back(imm);
 
   if (__this->IsEmpty(immbuf) && *compac_seq == num_compac_completed_ + 1) {
     // Buffer is empty so compaction should be quick. As such we directly
@@ -237,25 +281,32 @@ void DoubleBuffering::TryScheduleCompaction(uint32_t* compac_seq,
   }
 }
 
+// Compact a buffer and then wait for all previous compactions to complete
+// so that compactions always complete in order.
 // REQUIRES: mu_ has been LOCKed.
 template <typename T>
 void DoubleBuffering::DoCompaction(uint32_t seq, void* immbuf) {
   mu_->AssertHeld();
   assert(immbuf);
   Status status = __this->Compact(seq, immbuf);
+  WaitForTurn(seq);
+  assert(!immbufs_.empty() && immbufs_.front().buf == immbuf);
+  const uint64_t micros =
+      Env::Default()->NowMicros() - immbufs_.front().scheduled_micros;
+  immbufs_.pop_front();
+  stats_.compactions++;
+  stats_.compaction_micros += micros;
+  if (micros > stats_.max_compaction_micros) {
+    stats_.max_compaction_micros = micros;
+  }
   ++num_compac_completed_;
-  assert(bg_status_.ok());
-  bg_status_ = status;
+  if (bg_status_.ok()) {  // Keep the first error
+    bg_status_ = status;
+  }
   __this->Clear(immbuf);
   bufs_.push_back(immbuf);
   assert(num_bg_compactions_ > 0);
   --num_bg_compactions_;
-#if 0
-  // Compaction done. New buffer space available.
-  // Try scheduling another.
-  uint32_t ignored_compac_seq;
-  Prepare<T>(&ignored_compac_seq, false /* !force */);
-#endif
   bg_cv_->SignalAll();
 }
 
@@ -11,10 +11,317 @@
 
 #include "events.h"
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/strutil.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
 namespace pdlfs {
 namespace plfsio {
 
 EventListener::~EventListener() {}
 
+namespace {
+const char kTraceMagic[] = "plfsevtr";
+const size_t kTraceMagicLength = 8;
+const uint32_t kTraceVersion = 1;
+const size_t kTraceHeaderSize = kTraceMagicLength + 4;
+const size_t kTraceRecordSize = 72;
+const size_t kTraceBufferSize = 64 << 10;
+
+void EncodeRecord(std::string* dst, const EventRecord& record) {
+  PutFixed32(dst, static_cast<uint32_t>(record.type));
+  PutFixed32(dst, record.part);
+  PutFixed64(dst, record.micros);
+  PutFixed32(dst, record.epoch);
+  PutFixed32(dst, 0);  // Reserved
+  for (int i = 0; i < 6; i++) {
+    PutFixed64(dst, record.args[i]);
+  }
+}
+
+void DecodeRecord(const char* src, EventRecord* record) {
+  record->type = static_cast<EventType>(DecodeFixed32(src));
+  record->part = DecodeFixed32(src + 4);
+  record->micros = DecodeFixed64(src + 8);
+  record->epoch = DecodeFixed32(src + 16);
+  for (int i = 0; i < 6; i++) {
+    record->args[i] = DecodeFixed64(src + 24 + 8 * i);
+  }
+}
+
+}  // namespace
+
+Status EventTraceListener::Open(Env* env, const std::string& fname,
+                                EventTraceListener** result) {
+  *result = NULL;
+  WritableFile* file;
+  Status status = env->NewWritableFile(fname.c_str(), &file);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::string header(kTraceMagic, kTraceMagicLength);
+  PutFixed32(&header, kTraceVersion);
+  status = file->Append(header);
+  if (!status.ok()) {
+    file->Close();
+    delete file;
+    return status;
+  }
+
+  *result = new EventTraceListener(file);
+  return status;
+}
+
+EventTraceListener::EventTraceListener(WritableFile* file) : file_(file) {
+  buf_.reserve(kTraceBufferSize + kTraceRecordSize);
+}
+
+EventTraceListener::~EventTraceListener() {
+  Flush();
+  file_->Close();
+  delete file_;
+}
+
+Status EventTraceListener::FlushBuffer() {
+  mu_.AssertHeld();
+  if (status_.ok() && !buf_.empty()) {
+    status_ = file_->Append(buf_);
+  }
+  buf_.clear();
+  return status_;
+}
+
+Status EventTraceListener::Flush() {
+  MutexLock ml(&mu_);
+  Status status = FlushBuffer();
+  if (status.ok()) {
+    status = file_->Flush();
+    status_ = status;
+  }
+  return status;
+}
+
+void EventTraceListener::AppendRecord(const EventRecord& record) {
+  MutexLock ml(&mu_);
+  EncodeRecord(&buf_, record);
+  if (buf_.size() >= kTraceBufferSize) {
+    FlushBuffer();
+  }
+}
+
+void EventTraceListener::OnEvent(EventType type, void* event) {
+  EventRecord record;
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  switch (type) {
+    case kCompactionStart:
+    case kCompactionEnd: {
+      CompactionEvent* e = static_cast<CompactionEvent*>(event);
+      record.part = static_cast<uint32_t>(e->part);
+      record.micros = e->micros;
+      if (type == kCompactionEnd) {
+        record.epoch = e->epoch;
+        record.args[0] = e->num_keys;
+        record.args[1] = e->num_bytes;
+        record.args[2] = e->queue_micros;
+        record.args[3] = e->sort_micros;
+        record.args[4] = e->build_micros;
+        record.args[5] = e->io_micros;
+      }
+      break;
+    }
+    case kIoStart:
+    case kIoEnd: {
+      IoEvent* e = static_cast<IoEvent*>(event);
+      record.micros = e->micros;
+      break;
+    }
+    case kEpochSeal: {
+      EpochEvent* e = static_cast<EpochEvent*>(event);
+      record.part = static_cast<uint32_t>(e->part);
+      record.micros = e->micros;
+      record.epoch = e->epoch;
+      break;
+    }
+    case kLogRotation: {
+      LogRotationEvent* e = static_cast<LogRotationEvent*>(event);
+      record.micros = e->micros;
+      record.epoch = e->index;
+      break;
+    }
+    case kWriterStall: {
+      StallEvent* e = static_cast<StallEvent*>(event);
+      record.part = static_cast<uint32_t>(e->part);
+      record.micros = e->micros;
+      record.args[0] = e->stall_micros;
+      break;
+    }
+    default:
+      return;  // Ignore unknown events
+  }
+
+  AppendRecord(record);
+}
+
+Status ReadEventTrace(Env* env, const std::string& fname,
+                      std::vector<EventRecord>* records) {
+  std::string contents;
+  Status status = ReadFileToString(env, fname.c_str(), &contents);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (contents.size() < kTraceHeaderSize ||
+      memcmp(contents.data(), kTraceMagic, kTraceMagicLength) != 0) {
+    return Status::Corruption("Not an event trace", fname);
+  } else if (DecodeFixed32(contents.data() + kTraceMagicLength) !=
+             kTraceVersion) {
+    return Status::NotSupported("Unknown event trace version", fname);
+  }
+
+  // A trailing partial record is left by a writer that did not exit cleanly
+  // and is ignored
+  const char* p = contents.data() + kTraceHeaderSize;
+  const char* const limit = contents.data() + contents.size();
+  while (limit - p >= static_cast<ptrdiff_t>(kTraceRecordSize)) {
+    EventRecord record;
+    DecodeRecord(p, &record);
+    records->push_back(record);
+    p += kTraceRecordSize;
+  }
+
+  return status;
+}
+
+namespace {
+
+void AppendHistogram(std::string* result, const char* name,
+                     const Histogram& hist, uint64_t max) {
+  char tmp[200];
+  snprintf(tmp, sizeof(tmp),
+           "  %-6s (us): avg %.0f, p50 %.0f, p99 %.0f, max %llu\n", name,
+           hist.Average(), hist.Median(), hist.Percentile(99),
+           static_cast<unsigned long long>(max));
+  result->append(tmp);
+}
+
+}  // namespace
+
+std::string SummarizeEventTrace(const std::vector<EventRecord>& records) {
+  std::string result;
+  char tmp[200];
+  if (records.empty()) {
+    result.append("No events\n");
+    return result;
+  }
+
+  uint64_t first = records[0].micros;
+  uint64_t last = records[0].micros;
+  uint64_t num_compactions = 0;
+  uint64_t num_keys = 0;
+  uint64_t num_bytes = 0;
+  enum { kQueue, kSort, kBuild, kIo, kNumPhases };
+  static const char* const kPhaseNames[kNumPhases] = {"queue", "sort",
+                                                      "build", "io"};
+  Histogram phases[kNumPhases];
+  uint64_t phase_max[kNumPhases];
+  for (int i = 0; i < kNumPhases; i++) {
+    phases[i].Clear();
+    phase_max[i] = 0;
+  }
+  std::vector<uint64_t> compactions_per_part;
+  uint64_t num_epoch_seals = 0;
+  uint32_t max_epoch = 0;
+  uint64_t num_rotations = 0;
+  uint64_t num_stalls = 0;
+  uint64_t stall_micros = 0;
+  uint64_t max_stall_micros = 0;
+  uint64_t num_ios = 0;
+
+  for (size_t i = 0; i < records.size(); i++) {
+    const EventRecord& r = records[i];
+    first = std::min(first, r.micros);
+    last = std::max(last, r.micros);
+    switch (r.type) {
+      case kCompactionEnd:
+        num_compactions++;
+        num_keys += r.args[0];
+        num_bytes += r.args[1];
+        for (int j = 0; j < kNumPhases; j++) {
+          phases[j].Add(static_cast<double>(r.args[2 + j]));
+          phase_max[j] = std::max(phase_max[j], r.args[2 + j]);
+        }
+        if (r.part >= compactions_per_part.size()) {
+          compactions_per_part.resize(r.part + 1, 0);
+        }
+        compactions_per_part[r.part]++;
+        break;
+      case kEpochSeal:
+        num_epoch_seals++;
+        max_epoch = std::max(max_epoch, r.epoch);
+        break;
+      case kLogRotation:
+        num_rotations++;
+        break;
+      case kWriterStall:
+        num_stalls++;
+        stall_micros += r.args[0];
+        max_stall_micros = std::max(max_stall_micros, r.args[0]);
+        break;
+      case kIoEnd:
+        num_ios++;
+        break;
+      default:
+        break;
+    }
+  }
+
+  snprintf(tmp, sizeof(tmp), "Events: %llu over %.3f s\n",
+           static_cast<unsigned long long>(records.size()),
+           1.0 * (last - first) / 1000.0 / 1000.0);
+  result.append(tmp);
+  snprintf(tmp, sizeof(tmp), "Compactions: %llu (%llu keys, %s)\n",
+           static_cast<unsigned long long>(num_compactions),
+           static_cast<unsigned long long>(num_keys),
+           PrettySize(num_bytes).c_str());
+  result.append(tmp);
+  if (num_compactions != 0) {
+    for (int i = 0; i < kNumPhases; i++) {
+      AppendHistogram(&result, kPhaseNames[i], phases[i], phase_max[i]);
+    }
+    result.append("  per partition:");
+    for (size_t i = 0; i < compactions_per_part.size(); i++) {
+      snprintf(tmp, sizeof(tmp), " %llu",
+               static_cast<unsigned long long>(compactions_per_part[i]));
+      result.append(tmp);
+    }
+    result.append("\n");
+  }
+  snprintf(tmp, sizeof(tmp), "Epoch seals: %llu (last epoch %u)\n",
+           static_cast<unsigned long long>(num_epoch_seals),
+           static_cast<unsigned>(max_epoch));
+  result.append(tmp);
+  snprintf(tmp, sizeof(tmp), "Log rotations: %llu\n",
+           static_cast<unsigned long long>(num_rotations));
+  result.append(tmp);
+  snprintf(tmp, sizeof(tmp), "Writer stalls: %llu (total %.3f s, max %llu us)\n",
+           static_cast<unsigned long long>(num_stalls),
+           1.0 * stall_micros / 1000.0 / 1000.0,
+           static_cast<unsigned long long>(max_stall_micros));
+  result.append(tmp);
+  if (num_ios != 0) {
+    snprintf(tmp, sizeof(tmp), "I/O operations: %llu\n",
+             static_cast<unsigned long long>(num_ios));
+    result.append(tmp);
+  }
+  return result;
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -11,13 +11,29 @@
 
 #pragma once
 
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/status.h"
+
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace plfsio {
 
-enum EventType { kCompactionStart, kCompactionEnd, kIoStart, kIoEnd };
+// New event types are only appended so existing listeners that ignore types
+// they do not know keep working.
+enum EventType {
+  kCompactionStart,
+  kCompactionEnd,
+  kIoStart,
+  kIoEnd,
+  kEpochSeal,
+  kLogRotation,
+  kWriterStall
+};
 
 struct CompactionEvent {
   EventType type;  // Event type
@@ -26,6 +42,24 @@ struct CompactionEvent {
 
   // Current time micros
   uint64_t micros;
+
+  // The following are only set for kCompactionEnd
+
+  uint32_t epoch;  // Epoch the compacted memtable belongs to
+
+  // Number of keys and bytes in the compacted memtable
+  uint64_t num_keys;
+  uint64_t num_bytes;
+
+  // Time from the memtable being scheduled for compaction to the compaction
+  // actually starting
+  uint64_t queue_micros;
+  // Time sorting the memtable
+  uint64_t sort_micros;
+  // Time building blocks and filters, excluding data log writes
+  uint64_t build_micros;
+  // Time writing data blocks to the data log
+  uint64_t io_micros;
 };
 
 struct IoEvent {
@@ -35,6 +69,44 @@ struct IoEvent {
   uint64_t micros;
 };
 
+// Fired after a memtable partition has sealed an epoch.
+struct EpochEvent {
+  EventType type;  // Event type
+
+  size_t part;  // Memtable partition index
+
+  // Current time micros
+  uint64_t micros;
+
+  uint32_t epoch;  // The epoch just sealed
+};
+
+// Fired after data logs have been rotated at the end of an epoch.
+struct LogRotationEvent {
+  EventType type;  // Event type
+
+  // Current time micros
+  uint64_t micros;
+
+  uint32_t index;  // Index of the new log
+};
+
+// Fired after a writer has been blocked waiting for write buffer space.
+struct StallEvent {
+  EventType type;  // Event type
+
+  size_t part;  // Memtable partition index
+
+  // Current time micros
+  uint64_t micros;
+
+  // Time the writer was blocked
+  uint64_t stall_micros;
+};
+
+// Listeners may be invoked concurrently from foreground and background
+// threads. Stall events are delivered while the directory holds internal
+// locks so listeners must not call back into the directory.
 class EventListener {
  public:
   EventListener() {}
@@ -43,5 +115,59 @@ class EventListener {
   virtual void OnEvent(EventType type, void* event) = 0;
 };
 
+// A decoded event trace record. Fields not used by an event type are 0.
+// For kCompactionEnd, args[] holds num_keys, num_bytes, queue_micros,
+// sort_micros, build_micros, and io_micros. For kEpochSeal, epoch is the
+// sealed epoch. For kLogRotation, epoch is the new log index. For
+// kWriterStall, args[0] is stall_micros.
+struct EventRecord {
+  EventType type;
+  uint32_t part;
+  uint64_t micros;
+  uint32_t epoch;
+  uint64_t args[6];
+};
+
+// A listener writing every event it receives to a file as a fixed-size
+// binary record. The file starts with an 8-byte magic number and a fixed32
+// format version, followed by 72-byte little-endian records. Records are
+// buffered in memory and written in large chunks. Implementation is
+// thread-safe.
+class EventTraceListener : public EventListener {
+ public:
+  // Create a trace file at a given path and return a listener writing to it.
+  static Status Open(Env* env, const std::string& fname,
+                     EventTraceListener** result);
+
+  // Flush and close the trace file.
+  virtual ~EventTraceListener();
+
+  virtual void OnEvent(EventType type, void* event);
+
+  // Write all buffered records to the trace file.
+  Status Flush();
+
+ private:
+  explicit EventTraceListener(WritableFile* file);
+  void AppendRecord(const EventRecord& record);
+  Status FlushBuffer();
+
+  port::Mutex mu_;
+  WritableFile* file_;
+  std::string buf_;
+  Status status_;  // First write error, if any
+
+  // No copying allowed
+  void operator=(const EventTraceListener& l);
+  EventTraceListener(const EventTraceListener&);
+};
+
+// Read all records from a trace file written by an EventTraceListener.
+extern Status ReadEventTrace(Env* env, const std::string& fname,
+                             std::vector<EventRecord>* records);
+
+// Return a human-readable summary of a list of trace records.
+extern std::string SummarizeEventTrace(const std::vector<EventRecord>& records);
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -55,6 +55,25 @@ unsigned char LeftMostBit(uint32_t i) {
 #endif
   return result;
 }
+
+// Return the multiplier for computing x % d via FastMod().
+inline uint64_t FastModMultiplier(uint32_t d) {
+  return d != 0 ? ~static_cast<uint64_t>(0) / d + 1 : 0;
+}
+
+// Return x % d without a division instruction, where m is the multiplier for d
+// as returned by FastModMultiplier(d). Exact for all 32-bit x and d. See
+// "Faster Remainder by Direct Computation" (Lemire et al., 2019).
+inline uint32_t FastMod(uint32_t x, uint64_t m, uint32_t d) {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 uint128;  // Silence -Wpedantic
+  const uint64_t lowbits = m * x;
+  return static_cast<uint32_t>((static_cast<uint128>(lowbits) * d) >> 64);
+#else
+  (void)m;
+  return x % d;
+#endif
+}
 }  // namespace
 
 BloomBlock::BloomBlock(const DirOptions& options, size_t bytes_to_reserve)
@@ -67,6 +86,7 @@ BloomBlock::BloomBlock(const DirOptions& options, size_t bytes_to_reserve)
   }
   finished_ = true;  // Pending further initialization
   bits_ = 0;
+  bits_m_ = 0;
 }
 
 BloomBlock::~BloomBlock() {}
@@ -90,6 +110,7 @@ void BloomBlock::Reset(uint32_t num_keys) {
   space_.push_back(static_cast<char>(k_));
   // Finalize # bits
   bits_ = bytes * 8;
+  bits_m_ = FastModMultiplier(bits_);
 }
 
 void BloomBlock::AddKey(const Slice& key) {
@@ -99,12 +120,43 @@ void BloomBlock::AddKey(const Slice& key) {
   uint32_t h1 = hx;
   uint32_t h2 = hx >> 32;
   for (size_t j = 0; j < k_; j++) {
-    const uint32_t b = h1 % bits_;
+    const uint32_t b = FastMod(h1, bits_m_, bits_);
     space_[b / 8] |= (1 << (b % 8));
     h1 += h2;
   }
 }
 
+void BloomBlock::AddKeys(const Slice* keys, size_t n) {
+  assert(!finished_);  // Finish() has not been called
+  uint64_t hashes[256];
+  while (n != 0) {
+    const size_t m = std::min(n, sizeof(hashes) / sizeof(hashes[0]));
+    // Pass 1: hash a batch of keys into a contiguous array.
+    // The loop carries no dependencies on the filter bitmap.
+    for (size_t i = 0; i < m; i++) {
+      hashes[i] = BloomHash(keys[i]);
+    }
+    // Pass 2: set filter bits
+    AddHashes(hashes, m);
+    keys += m;
+    n -= m;
+  }
+}
+
+void BloomBlock::AddHashes(const uint64_t* hashes, size_t n) {
+  assert(!finished_);  // Finish() has not been called
+  char* const array = &space_[0];
+  for (size_t i = 0; i < n; i++) {
+    uint32_t h1 = hashes[i];
+    uint32_t h2 = hashes[i] >> 32;
+    for (size_t j = 0; j < k_; j++) {
+      const uint32_t b = FastMod(h1, bits_m_, bits_);
+      array[b / 8] |= (1 << (b % 8));
+      h1 += h2;
+    }
+  }
+}
+
 std::string BloomBlock::TEST_Finish() {
   Finish();
   return space_;
@@ -133,11 +185,12 @@ bool BloomKeyMayMatch(const Slice& key, const Slice& input) {
     return true;
   }
 
+  const uint64_t m = FastModMultiplier(bits);
   const uint64_t hx = BloomHash(key);
   uint32_t h1 = hx;
   uint32_t h2 = hx >> 32;
   for (size_t j = 0; j < k; j++) {
-    const uint32_t b = h1 % bits;
+    const uint32_t b = FastMod(h1, m, bits);
     if ((array[b / 8] & (1 << (b % 8))) == 0) {
       return false;
     }
@@ -57,6 +57,20 @@ class BloomBlock {
   // REQUIRES: Finish() has not been called.
   void AddKey(const Slice& key);
 
+  // Insert a batch of keys into the bloom filter. All keys are hashed
+  // first before any filter bits are set, which is faster than calling
+  // AddKey() for each key. Results are identical to AddKey().
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddKeys(const Slice* keys, size_t n);
+
+  // Insert a batch of keys that have already been hashed by BloomHash().
+  // This allows keys to be hashed as they are written and the filter to be
+  // built later without revisiting the keys.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddHashes(const uint64_t* hashes, size_t n);
+
   // Finalize the filter and return its contents.
   Slice Finish();
 
@@ -78,6 +92,8 @@ class BloomBlock {
   std::string space_;
   // Size of the underlying bitmap in bits
   uint32_t bits_;
+  // Precomputed for fast modulo by bits_
+  uint64_t bits_m_;
   // Number of hash functions
   uint32_t k_;
 };
@@ -127,6 +143,13 @@ class BitmapBlock {
   // REQUIRES: Finish() has not been called.
   void AddKey(const Slice& key);
 
+  // Insert a batch of keys into the bitmap filter.
+  // REQUIRES: Reset(num_keys) has been called.
+  // REQUIRES: Finish() has not been called.
+  void AddKeys(const Slice* keys, size_t n) {
+    for (size_t i = 0; i < n; i++) AddKey(keys[i]);
+  }
+
   // Finalize the block data and return its contents.
   Slice Finish();
 
@@ -163,6 +186,8 @@ class EmptyFilterBlock {
   void Reset(uint32_t num_keys) {}
   // Insert a key into the filter. Does nothing.
   void AddKey(const Slice& key) {}
+  // Insert a batch of keys into the filter. Does nothing.
+  void AddKeys(const Slice* keys, size_t n) {}
   // Finalize filter contents.
   Slice Finish() { return Slice(); }
 
@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <set>
+#include <string>
 #include <vector>
 
 namespace pdlfs {
@@ -146,6 +147,40 @@ TEST(BloomFilterTest, BloomFormat) {
   }
 }
 
+TEST(BloomFilterTest, BatchAdd) {
+  Random rnd(301);
+  const uint32_t num_keys = 10000;
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    char tmp[4];
+    EncodeFixed32(tmp, rnd.Next());
+    keys.push_back(std::string(tmp, sizeof(tmp)));
+  }
+  std::vector<Slice> slices(keys.begin(), keys.end());
+  BloomBlock ft1(options_, 0);
+  ft1.Reset(num_keys);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    ft1.AddKey(slices[i]);
+  }
+  BloomBlock ft2(options_, 0);
+  ft2.Reset(num_keys);
+  ft2.AddKeys(&slices[0], 7);  // An odd-sized batch
+  ft2.AddKeys(&slices[7], num_keys - 7);
+  std::vector<uint64_t> hashes;
+  for (uint32_t i = 0; i < num_keys; i++) {
+    hashes.push_back(BloomHash(slices[i]));
+  }
+  BloomBlock ft3(options_, 0);
+  ft3.Reset(num_keys);
+  ft3.AddHashes(&hashes[0], num_keys);
+  std::string contents = ft1.TEST_Finish();
+  ASSERT_EQ(contents, ft2.TEST_Finish());
+  ASSERT_EQ(contents, ft3.TEST_Finish());
+  for (uint32_t i = 0; i < num_keys; i++) {
+    ASSERT_TRUE(BloomKeyMayMatch(slices[i], contents));
+  }
+}
+
 typedef FilterTest<BitmapBlock<UncompressedFormat>, BitmapKeyMustMatch>
     UncompressedBitmapFilterTest;
 TEST(UncompressedBitmapFilterTest, UncompressedFormat) {
@@ -270,7 +305,9 @@ class PlfsFilterBench {
 
  public:
   explicit PlfsFilterBench(size_t key_bits = 24)
-      : num_tables_(GetOption("TABLE_NUM", 64)), key_bits_(key_bits) {
+      : num_tables_(GetOption("TABLE_NUM", 64)),
+        batch_add_(GetOption("BATCH_ADD", 1)),
+        key_bits_(key_bits) {
     options_.bf_bits_per_key = GetOption("BF_BITS", 10);
     options_.bm_fmt = static_cast<BitmapFormat>(BitmapFormatFromType<T>());
     options_.bm_key_bits = key_bits_;
@@ -297,13 +334,28 @@ class PlfsFilterBench {
 #endif
 
   Slice BuildFilter(size_t num_keys, std::vector<uint32_t>::iterator& it) {
-    char tmp[4];
-    Slice key(tmp, sizeof(tmp));
     ft_->Reset(num_keys);
-    for (size_t i = 0; i < num_keys; i++) {
-      EncodeFixed32(tmp, *it);
-      ft_->AddKey(key);
-      ++it;
+    if (batch_add_) {
+      char tmp[4 * 256];
+      Slice keys[256];
+      for (size_t i = 0; i < num_keys;) {
+        size_t n = std::min(num_keys - i, sizeof(keys) / sizeof(keys[0]));
+        for (size_t j = 0; j < n; j++) {
+          EncodeFixed32(tmp + 4 * j, *it);
+          keys[j] = Slice(tmp + 4 * j, 4);
+          ++it;
+        }
+        ft_->AddKeys(keys, n);
+        i += n;
+      }
+    } else {
+      char tmp[4];
+      Slice key(tmp, sizeof(tmp));
+      for (size_t i = 0; i < num_keys; i++) {
+        EncodeFixed32(tmp, *it);
+        ft_->AddKey(key);
+        ++it;
+      }
     }
     return ft_->Finish();
   }
@@ -345,6 +397,10 @@ class PlfsFilterBench {
             8.0 * size / (num_keys * num_tables_));
     fprintf(stderr, "       Memory Use: %.2f MiB\n",
             1.0 * ft_->memory_usage() / ki / ki);
+#if defined(PDLFS_OS_LINUX)
+    fprintf(stderr, "       Throughput: %.3f Mkeys/s\n",
+            1.0 * num_keys * num_tables_ / dura);
+#endif
 
 #if defined(PDLFS_PLATFORM_POSIX)
     struct rusage usage;
@@ -369,6 +425,7 @@ class PlfsFilterBench {
 
  protected:
   const size_t num_tables_;  // Num tables per epoch
+  const int batch_add_;       // Insert keys in batches via AddKeys()
   const size_t key_bits_;
   std::vector<uint32_t> keys_;
   DirOptions options_;
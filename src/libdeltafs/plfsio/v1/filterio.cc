@@ -137,6 +137,42 @@ Status FilterReader::Read(uint32_t const ep, Slice* const result,
   return status;
 }
 
+Status FilterReader::NumFilters(uint32_t* const result) {
+  Status status = MaybeLoadCache();
+  if (status.ok()) {
+    *result = n_;
+  }
+  return status;
+}
+
+// Retrieve the i-th filter without searching the indexes. Return OK on
+// success, or a non-OK status on errors.
+Status FilterReader::ReadAt(uint32_t const i, uint32_t* const epoch,
+                            Slice* const result, std::string* scratch) {
+  assert(cache_status_.ok() && !indexes_.empty());
+  assert(i < n_);
+  const size_t start = 12 * static_cast<size_t>(i);
+  *epoch = DecodeFixed32(&indexes_[start]);
+  const uint64_t offset = DecodeFixed64(&indexes_[start + 4]);
+  // The next entry is either the next filter or the footer
+  const uint64_t limit = DecodeFixed64(&indexes_[start + 16]);
+  if (limit < offset) {
+    return Status::Corruption("Bad filter indexes");
+  }
+  scratch->resize(limit - offset);
+  if (limit == offset) {
+    *result = Slice();
+    return Status::OK();
+  }
+  Status status = src_->Read(offset, limit - offset, result, &(*scratch)[0]);
+  if (status.ok()) {
+    if (result->size() != limit - offset) {
+      status = Status::IOError("Read ret partial data");
+    }
+  }
+  return status;
+}
+
 uint32_t FilterReader::TEST_NumEpochs() {
   Status status = MaybeLoadCache();
   if (status.ok()) return n_;
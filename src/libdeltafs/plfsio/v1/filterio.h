@@ -45,6 +45,16 @@ class FilterReader {
 
   Status Read(uint32_t epoch, Slice* result, std::string* scratch);
 
+  // Store the total number of filters in *result.
+  // Once this returns OK, ReadAt() may be called concurrently by multiple
+  // threads as long as each thread uses its own scratch space.
+  Status NumFilters(uint32_t* result);
+
+  // Retrieve the i-th filter stored in the log along with its epoch number.
+  // REQUIRES: NumFilters() has returned OK and i is less than the count.
+  Status ReadAt(uint32_t i, uint32_t* epoch, Slice* result,
+                std::string* scratch);
+
   uint32_t TEST_NumEpochs();
 
  private:
@@ -162,6 +162,14 @@ class FilterIoTest {
     return result.ToString();
   }
 
+  std::string GetAt(uint32_t i, uint32_t* epoch) {
+    if (!reader_) OpenReader();
+    std::string scratch;
+    Slice result;
+    ASSERT_OK(reader_->ReadAt(i, epoch, &result, &scratch));
+    return result.ToString();
+  }
+
   RandomAccessFile* src_;
   uint64_t src_sz_;
   FilterReader* reader_;
@@ -204,6 +212,24 @@ TEST(FilterIoTest, MoreReadWrite) {
   }
 }
 
+TEST(FilterIoTest, ReadAt) {
+  Put(2, "222");
+  Put(5, "");
+  Put(7, "77777");
+  Finish();
+  uint32_t n = 0;
+  OpenReader();
+  ASSERT_OK(reader_->NumFilters(&n));
+  ASSERT_EQ(n, 3);
+  uint32_t epoch;
+  ASSERT_EQ(GetAt(0, &epoch), "222");
+  ASSERT_EQ(epoch, 2);
+  ASSERT_EQ(GetAt(1, &epoch), Slice());
+  ASSERT_EQ(epoch, 5);
+  ASSERT_EQ(GetAt(2, &epoch), "77777");
+  ASSERT_EQ(epoch, 7);
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
 
@@ -27,6 +27,8 @@ std::string DirModeName(DirMode mode) {
       return "M/M";
     case kDmMultiMapUnordered:
       return "M/U";
+    case kDmMergedEpochs:
+      return "M/E";
     case kDmUniqueUnordered:
       return "U/U";
     case kDmUniqueDrop:
@@ -38,6 +40,102 @@ std::string DirModeName(DirMode mode) {
   }
 }
 
+std::string DirFormatName(DirFormat format) {
+  switch (format) {
+    case kDirFmtV1:
+      return "v1";
+    case kDirFmtV2:
+      return "v2";
+    default:
+      return "Unknown";
+  }
+}
+
+void PutValueLocator(std::string* dst, uint32_t offset, uint32_t size) {
+  PutVarint32(dst, offset);
+  PutVarint32(dst, size);
+}
+
+bool GetValueLocator(Slice* input, uint32_t* offset, uint32_t* size) {
+  return GetVarint32(input, offset) && GetVarint32(input, size);
+}
+
+namespace {
+const size_t kDirStatsTrailerSize = 16;  // Size, crc, and magic
+
+bool GetEpochStats(Slice* input, EpochStats* stats) {
+  Slice min_key;
+  Slice max_key;
+  if (GetVarint32(input, &stats->epoch) && GetVarint32(input, &stats->part) &&
+      GetVarint64(input, &stats->num_keys) &&
+      GetVarint32(input, &stats->num_tables) &&
+      GetVarint64(input, &stats->key_bytes) &&
+      GetVarint64(input, &stats->value_bytes) &&
+      GetVarint64(input, &stats->data_bytes) &&
+      GetLengthPrefixedSlice(input, &min_key) &&
+      GetLengthPrefixedSlice(input, &max_key)) {
+    stats->min_key = min_key.ToString();
+    stats->max_key = max_key.ToString();
+    return true;
+  } else {
+    return false;
+  }
+}
+
+}  // namespace
+
+void PutDirStats(std::string* dst, const std::vector<EpochStats>& stats) {
+  const size_t start = dst->size();
+  PutVarint32(dst, static_cast<uint32_t>(stats.size()));
+  for (size_t i = 0; i < stats.size(); i++) {
+    const EpochStats& s = stats[i];
+    PutVarint32(dst, s.epoch);
+    PutVarint32(dst, s.part);
+    PutVarint64(dst, s.num_keys);
+    PutVarint32(dst, s.num_tables);
+    PutVarint64(dst, s.key_bytes);
+    PutVarint64(dst, s.value_bytes);
+    PutVarint64(dst, s.data_bytes);
+    PutLengthPrefixedSlice(dst, s.min_key);
+    PutLengthPrefixedSlice(dst, s.max_key);
+  }
+  const size_t size = dst->size() - start;
+  const uint32_t crc = crc32c::Value(dst->data() + start, size);
+  PutFixed32(dst, static_cast<uint32_t>(size));
+  PutFixed32(dst, crc32c::Mask(crc));
+  PutFixed64(dst, kDirStatsMagicNumber);
+}
+
+Status GetDirStats(const Slice& input, std::vector<EpochStats>* stats) {
+  if (input.size() < kDirStatsTrailerSize ||
+      DecodeFixed64(input.data() + input.size() - 8) != kDirStatsMagicNumber) {
+    return Status::NotFound("No dir stats");
+  }
+  const char* const trailer =
+      input.data() + input.size() - kDirStatsTrailerSize;
+  const size_t size = DecodeFixed32(trailer);
+  if (size > input.size() - kDirStatsTrailerSize) {
+    return Status::Corruption("Truncated dir stats");
+  }
+  Slice contents(trailer - size, size);
+  const uint32_t crc = crc32c::Unmask(DecodeFixed32(trailer + 4));
+  if (crc32c::Value(contents.data(), contents.size()) != crc) {
+    return Status::Corruption("Dir stats checksum mismatch");
+  }
+  uint32_t n;
+  if (!GetVarint32(&contents, &n)) {
+    return Status::Corruption("Bad dir stats");
+  }
+  stats->resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    if (!GetEpochStats(&contents, &(*stats)[i])) {
+      stats->clear();
+      return Status::Corruption("Bad dir stats");
+    }
+  }
+  return Status::OK();
+}
+
 Status ParseEpochKey(const Slice& input, uint32_t* epoch, uint32_t* table) {
   int parsed_epoch;
   int parsed_table;
@@ -125,6 +223,11 @@ void EpochStone::EncodeTo(std::string* dst) const {
   assert(id_ != ~static_cast<uint32_t>(0));
   handle_.EncodeTo(dst);
   PutVarint32(dst, id_);
+  if (num_tables_ != ~static_cast<uint32_t>(0)) {
+    assert(num_ents_ != ~static_cast<uint32_t>(0));
+    PutVarint32(dst, num_tables_);
+    PutVarint32(dst, num_ents_);
+  }
 }
 
 Status EpochStone::DecodeFrom(Slice* input) {
@@ -132,6 +235,12 @@ Status EpochStone::DecodeFrom(Slice* input) {
   if (result.ok()) {
     if (!GetVarint32(input, &id_)) {
       return Status::Corruption("Bad epoch seal");
+    } else if (input->empty()) {  // Written by an older writer
+      num_tables_ = num_ents_ = ~static_cast<uint32_t>(0);
+      return Status::OK();
+    } else if (!GetVarint32(input, &num_tables_) ||
+               !GetVarint32(input, &num_ents_)) {
+      return Status::Corruption("Bad epoch seal");
     } else {
       return Status::OK();
     }
@@ -152,6 +261,7 @@ DirOptions ApplyFooter(const DirOptions& options, const Footer& footer) {
   result.skip_checksums = footer.skip_checksums();
   result.filter = static_cast<FilterType>(footer.filter_type());
   result.mode = static_cast<DirMode>(footer.mode());
+  result.format = static_cast<DirFormat>(footer.format());
   return result;
 }
 
@@ -169,6 +279,7 @@ Footer Mkfoot(const DirOptions& options) {
   result.set_skip_checksums(static_cast<unsigned char>(options.skip_checksums));
   result.set_filter_type(static_cast<unsigned char>(options.filter));
   result.set_mode(static_cast<unsigned char>(options.mode));
+  result.set_format(static_cast<unsigned char>(options.format));
   return result;
 }
 
@@ -183,11 +294,14 @@ void Footer::EncodeTo(std::string* dst) const {
   assert(skip_checksums_ != 0xFF);
   assert(filter_type_ != 0xFF);
   assert(mode_ != 0xFF);
+  assert(format_ == kDirFmtV1 || format_ == kDirFmtV2);
 
+  const uint64_t magic =
+      format_ == kDirFmtV2 ? kDirV2MagicNumber : kTableMagicNumber;
   epoch_index_handle_.EncodeTo(dst);
   dst->resize(BlockHandle::kMaxEncodedLength, 0);  // Padding
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber & 0xFFFFFFFFU));
-  PutFixed32(dst, static_cast<uint32_t>(kTableMagicNumber >> 32));
+  PutFixed32(dst, static_cast<uint32_t>(magic & 0xFFFFFFFFU));
+  PutFixed32(dst, static_cast<uint32_t>(magic >> 32));
   PutFixed32(dst, lg_parts_);
   PutFixed32(dst, num_epochs_);
   PutFixed32(dst, value_size_);
@@ -215,9 +329,10 @@ Status Footer::DecodeFrom(Slice* input) {
              (static_cast<uint64_t>(magic_lo)));
   }
 
-  if (magic != kTableMagicNumber) {
+  if (magic != kTableMagicNumber && magic != kDirV2MagicNumber) {
     return Status::Corruption("Bad dir footer magic number");
   } else {
+    format_ = magic == kDirV2MagicNumber ? kDirFmtV2 : kDirFmtV1;
     lg_parts_ = DecodeFixed32(start + kEncodedLength - 22);
     num_epochs_ = DecodeFixed32(start + kEncodedLength - 18);
     value_size_ = DecodeFixed32(start + kEncodedLength - 14);
@@ -231,6 +346,7 @@ Status Footer::DecodeFrom(Slice* input) {
     switch (mode_) {
       case kDmMultiMap:
       case kDmMultiMapUnordered:
+      case kDmMergedEpochs:
       case kDmUniqueUnordered:
       case kDmUniqueDrop:
       case kDmUniqueKey:
@@ -24,17 +24,44 @@
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
 
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 static const uint32_t kMaxTableNo = 9999;
 static const uint32_t kMaxEpochNo = 9999;
 
+// Magic number for footers of directories in the v2 format. Footers of v1
+// directories use the LevelDb table magic number.
+static const uint64_t kDirV2MagicNumber = 0x7a3c5e9d2f618b04ull;
+
+// Magic number ending the stats block stored in front of the primary footer
+// copy in the dir info file.
+static const uint64_t kDirStatsMagicNumber = 0x3e9b1c7a54d2f086ull;
+
+// Magic number ending the footer of PLAINDB tables that carry a key index.
+// Tables without a key index keep the original two-handle footer.
+static const uint64_t kPdbKeyIndexMagicNumber = 0x5c1f83b2e0a4d697ull;
+
 // Formats used by keys in the meta index blocks.
 extern std::string EpochKey(uint32_t epoch);
 extern std::string EpochTableKey(uint32_t epoch, uint32_t table);
 extern Status ParseEpochKey(const Slice& input, uint32_t* epoch,
                             uint32_t* table);
 
+// Formats used by values in v2 key blocks. Each value is located by its
+// offset within the value block paired with the key block and its size.
+extern void PutValueLocator(std::string* dst, uint32_t offset, uint32_t size);
+extern bool GetValueLocator(Slice* input, uint32_t* offset, uint32_t* size);
+
+// Formats used by the stats block stored in front of the primary footer copy
+// in the dir info file. The block holds one entry per non-empty epoch of each
+// partition and ends with its size, a checksum, and a magic number.
+extern void PutDirStats(std::string* dst, const std::vector<EpochStats>& stats);
+// Decode the stats block ending at the end of "input".
+// Return NotFound if input does not end with a stats block.
+extern Status GetDirStats(const Slice& input, std::vector<EpochStats>* stats);
+
 // Type definition for write ahead log chunks
 enum ChunkType {
   kUnknown = 0x00,  // Useless padding that should be ignored
@@ -127,7 +154,10 @@ class EpochHandle {
   uint32_t num_ents_;
 };
 
-// A special marker representing the completion of an epoch.
+// A special marker representing the completion of an epoch. Epoch stats are
+// kept so that a reader can rebuild the root index from epoch stones alone.
+// Stones written by older writers do not have these stats and decode with
+// them set to invalid values.
 class EpochStone {
  public:
   EpochStone();
@@ -138,6 +168,12 @@ class EpochStone {
   uint32_t id() const { return id_; }
   void set_id(uint32_t id) { id_ = id; }
 
+  uint32_t num_tables() const { return num_tables_; }
+  void set_num_tables(uint32_t t) { num_tables_ = t; }
+
+  uint32_t num_ents() const { return num_ents_; }
+  void set_num_ents(uint32_t n) { num_ents_ = n; }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(Slice* input);
 
@@ -145,6 +181,9 @@ class EpochStone {
   BlockHandle handle_;  // Meta index for the epoch
 
   uint32_t id_;  // Seal Id
+  // Epoch stats
+  uint32_t num_tables_;
+  uint32_t num_ents_;
 };
 
 // Fixed MANIFEST information stored at the end of every log file.
@@ -181,6 +220,10 @@ class Footer {
   unsigned char mode() const { return mode_; }
   void set_mode(unsigned char mode) { mode_ = mode; }
 
+  // The on-disk format, which is encoded as the footer's magic number.
+  unsigned char format() const { return format_; }
+  void set_format(unsigned char f) { format_ = f; }
+
   // The block handle for the root index.
   const BlockHandle& epoch_index_handle() const { return epoch_index_handle_; }
   void set_epoch_index_handle(const BlockHandle& h) { epoch_index_handle_ = h; }
@@ -209,6 +252,7 @@ class Footer {
   unsigned char skip_checksums_;
   unsigned char filter_type_;
   unsigned char mode_;
+  unsigned char format_;
 };
 
 // Override directory options using a specified footer.
@@ -220,6 +264,8 @@ extern std::string DirInfoFileName(const std::string& dirname);
 
 extern std::string DirModeName(DirMode mode);
 
+extern std::string DirFormatName(DirFormat format);
+
 inline TableHandle::TableHandle()
     : filter_offset_(~static_cast<uint64_t>(0) /* Invalid offset */),
       filter_size_(~static_cast<uint64_t>(0) /* Invalid size */),
@@ -237,7 +283,9 @@ inline EpochHandle::EpochHandle()
 }
 
 inline EpochStone::EpochStone()
-    : id_(~static_cast<uint32_t>(0) /* Invalid id */) {
+    : id_(~static_cast<uint32_t>(0) /* Invalid id */),
+      num_tables_(~static_cast<uint32_t>(0) /* Invalid */),
+      num_ents_(~static_cast<uint32_t>(0) /* Invalid */) {
   // Empty
 }
 
@@ -251,7 +299,8 @@ inline Footer::Footer()
       epoch_log_rotation_(0xFF /* Invalid */),
       skip_checksums_(0xFF /* Invalid */),
       filter_type_(0xFF /* Invalid */),
-      mode_(0xFF /* Invalid */) {
+      mode_(0xFF /* Invalid */),
+      format_(0xFF /* Invalid */) {
   // Empty
 }
 
@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 
 namespace pdlfs {
@@ -54,6 +55,7 @@ Compaction::Compaction(Epoch* parent)
       is_forced_(false),
       is_epoch_flush_(false),
       is_final(false),
+      enqueue_micros_(0),
       list_(NULL),
       prev_(this),
       next_(this),
@@ -238,7 +240,7 @@ size_t WriteBuffer::memory_usage() const {
 }
 
 DirCompactor::DirCompactor(const DirOptions& options, DirBuilder* bu)
-    : options_(options), bu_(bu) {}
+    : options_(options), bu_(bu), latency_(NULL) {}
 
 DirCompactor::~DirCompactor() { delete bu_; }
 
@@ -299,14 +301,29 @@ void FilteredDirCompactor<T, U>::Compact(WriteBuffer* buf) {
   U* const bu = static_cast<U*>(bu_);
   IterType* const iter = static_cast<IterType*>(buf->NewIterator());
   T* const ft = filter_;
+  LatencyStats* const latency = latency_;
+  // Filter work is timed separately and excluded from block building
+  uint64_t filter_micros = 0;
+  const uint64_t start = latency != NULL ? GetCurrentTimeMicros() : 0;
   iter->IterType::SeekToFirst();
   if (ft != NULL) {
     ft->Reset(buf->NumEntries());
   }
+  // Keys are handed to the filter in batches so it can hash a batch
+  // of keys before touching its bitmap. Keys point into the write
+  // buffer so they remain valid throughout the compaction.
+  Slice keys[256];
+  size_t n = 0;
   for (; iter->IterType::Valid(); iter->IterType::Next()) {
     Slice key(iter->IterType::key());
     if (ft != NULL) {
-      ft->AddKey(key);
+      keys[n++] = key;
+      if (n == sizeof(keys) / sizeof(keys[0])) {
+        const uint64_t t = latency != NULL ? GetCurrentTimeMicros() : 0;
+        ft->T::AddKeys(keys, n);
+        if (latency != NULL) filter_micros += GetCurrentTimeMicros() - t;
+        n = 0;
+      }
     }
     bu->U::Add(key, iter->IterType::value());
     if (!ok()) {
@@ -320,19 +337,32 @@ void FilteredDirCompactor<T, U>::Compact(WriteBuffer* buf) {
 
   Slice filter_contents;
   if (ft != NULL) {
+    const uint64_t t = latency != NULL ? GetCurrentTimeMicros() : 0;
+    if (n != 0) {
+      ft->T::AddKeys(keys, n);
+    }
     filter_contents = ft->Finish();
+    if (latency != NULL) filter_micros += GetCurrentTimeMicros() - t;
   }
   const ChunkType filter_type = static_cast<ChunkType>(T::chunk_type());
   bu->U::EndTable(filter_contents, filter_type);
   delete iter;
+  if (latency != NULL) {
+    const uint64_t total = GetCurrentTimeMicros() - start;
+    latency->Record(kLatBlockBuild, total - filter_micros);
+    if (ft != NULL) {
+      latency->Record(kLatFilterBuild, filter_micros);
+    }
+  }
 }
 
 DirIndexer::DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
-                       port::CondVar* cv)
+                       port::CondVar* cv, LatencyStats* latency)
     : options_(options),
       bg_cv_(cv),
       mu_(mu),
       part_(part),
+      latency_(latency),
       num_flush_requested_(0),
       num_flush_completed_(0),
       has_bg_compaction_(false),
@@ -482,12 +512,15 @@ Status DirIndexer::Open(LogSink* data, LogSink* indx) {
 
   // To reduce runtime overhead (e.g. c++ virtual function calls)
   // here we want to statically bind to one specific dir
-  // builder type with one specific block format.
-  if (!options_.leveldb_compatible && options_.fixed_kv_length)
+  // builder type with one specific block format. This must agree with
+  // DirBuilder::Open(), which always uses LevelDb blocks in the v2 format.
+  if (options_.format != kDirFmtV2 && !options_.leveldb_compatible &&
+      options_.fixed_kv_length)
     compactor_ = OpenCompactor<SeqDirBuilder<ArrayBlockBuilder> >(bu);
 
   if (compactor_ == NULL)  // Use the default block format
     compactor_ = OpenCompactor<SeqDirBuilder<> >(bu);
+  compactor_->latency_ = latency_;
   // No external I/O so always OK.
   return Status::OK();
 }
@@ -579,6 +612,8 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
   mu_->AssertHeld();
   Status status;
   assert(mem_buf_ != NULL);
+  const bool is_add = !force;
+  uint64_t wait_start = 0;  // Set once an Add() waits for buffer space
   while (true) {
     if (!bg_status_.ok()) {
       status = bg_status_;
@@ -588,6 +623,10 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
       // There is room in current write buffer
       break;
     } else if (imm_buf_ != NULL) {
+      if ((latency_ != NULL || options_.listener != NULL) && is_add &&
+          wait_start == 0) {
+        wait_start = GetCurrentTimeMicros();
+      }
       bg_cv_->Wait();
     } else {
       // Attempt to switch to a new write buffer
@@ -600,6 +639,7 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
       epoch_flush = false;
       if (finalize) c->is_final = true;
       finalize = false;
+      if (options_.listener != NULL) c->enqueue_micros_ = GetCurrentTimeMicros();
       assert(imm_compac_ == NULL);
       imm_compac_ = c;
       c->Ref();
@@ -613,6 +653,20 @@ Status DirIndexer::Prepare(Epoch* epoch, bool force, bool epoch_flush,
     }
   }
 
+  if (wait_start != 0) {
+    const uint64_t now = GetCurrentTimeMicros();
+    if (latency_ != NULL) {
+      latency_->Record(kLatAddWait, now - wait_start);
+    }
+    if (options_.listener != NULL) {
+      StallEvent event;
+      event.type = kWriterStall;
+      event.part = part_;
+      event.micros = now;
+      event.stall_micros = now - wait_start;
+      options_.listener->OnEvent(kWriterStall, &event);
+    }
+  }
   return status;
 }
 
@@ -678,8 +732,11 @@ void DirIndexer::CompactMemtable() {
   DirCompactor* dir = compactor_;
   mu_->Unlock();
   const uint64_t start = GetCurrentTimeMicros();
+  const uint64_t enqueue = c->enqueue_micros_;
+  const uint64_t write_micros = compac_stats_.data_write_micros;
   if (options_.listener != NULL) {
     CompactionEvent event;
+    memset(&event, 0, sizeof(event));
     event.type = kCompactionStart;
     event.micros = start;
     event.part = part_;
@@ -698,7 +755,11 @@ void DirIndexer::CompactMemtable() {
   if (options_.skip_sort) {
     skip_sort = true;  // Forced by user
   }
-  buffer->Finish(skip_sort);
+  {
+    LatencyTimer timer(skip_sort ? NULL : latency_, kLatMemtableSort);
+    buffer->Finish(skip_sort);
+  }
+  const uint64_t sorted = GetCurrentTimeMicros();
   dir->Compact(buffer);
   if (dir->ok()) {
 #if VERBOSE >= 3
@@ -725,7 +786,27 @@ void DirIndexer::CompactMemtable() {
     event.type = kCompactionEnd;
     event.micros = end;
     event.part = part_;
+    event.epoch = ep->seq_;
+    event.num_keys = buffer->NumEntries();
+    event.num_bytes = buffer->CurrentBufferSize();
+    event.queue_micros = enqueue != 0 && start > enqueue ? start - enqueue : 0;
+    event.sort_micros = sorted - start;
+    event.io_micros = compac_stats_.data_write_micros - write_micros;
+    event.build_micros = end - sorted;
+    if (event.build_micros > event.io_micros) {
+      event.build_micros -= event.io_micros;
+    } else {
+      event.build_micros = 0;
+    }
     options_.listener->OnEvent(kCompactionEnd, &event);
+    if (is_epoch_flush && dir->ok()) {
+      EpochEvent ee;
+      ee.type = kEpochSeal;
+      ee.part = part_;
+      ee.micros = end;
+      ee.epoch = ep->seq_;
+      options_.listener->OnEvent(kEpochSeal, &ee);
+    }
   }
 #if VERBOSE >= 3
   Verbose(__LOG_ARGS__, 3, "Compaction done: %d kv pairs (%d us)",
@@ -751,6 +832,18 @@ uint32_t DirIndexer::num_epochs() const {
   }
 }
 
+void DirIndexer::GetEpochStats(std::vector<EpochStats>* result) const {
+  mu_->AssertHeld();
+  if (opened_) {
+    assert(compactor_ != NULL);
+    const std::vector<EpochStats>& stats = compactor_->epoch_stats();
+    for (size_t i = 0; i < stats.size(); i++) {
+      result->push_back(stats[i]);
+      result->back().part = static_cast<uint32_t>(part_);
+    }
+  }
+}
+
 size_t DirIndexer::memory_usage() const {
   mu_->AssertHeld();
   if (opened_) {
@@ -806,15 +899,31 @@ static Status ReadBlock(LogSource* source, const DirOptions& options,
     }
   }
 
-  if (data[n] == kSnappyCompression) {
+  if (data[n] == kSnappyCompression || data[n] == kZstdCompression ||
+      data[n] == kLZ4Compression) {
     size_t ulen = 0;
-    if (!port::Snappy_GetUncompressedLength(data, n, &ulen)) {
+    bool ok;
+    if (data[n] == kSnappyCompression) {
+      ok = port::Snappy_GetUncompressedLength(data, n, &ulen);
+    } else if (data[n] == kZstdCompression) {
+      ok = port::Zstd_GetUncompressedLength(data, n, &ulen);
+    } else {
+      ok = port::Lz4_GetUncompressedLength(data, n, &ulen);
+    }
+    if (!ok) {
       if (buf != tmp) delete[] buf;
       status = Status::Corruption("Cannot compress");
       return status;
     }
     char* ubuf = new char[ulen];
-    if (!port::Snappy_Uncompress(data, n, ubuf)) {
+    if (data[n] == kSnappyCompression) {
+      ok = port::Snappy_Uncompress(data, n, ubuf);
+    } else if (data[n] == kZstdCompression) {
+      ok = port::Zstd_Uncompress(data, n, ubuf);
+    } else {
+      ok = port::Lz4_Uncompress(data, n, ubuf);
+    }
+    if (!ok) {
       if (buf != tmp) delete[] buf;
       delete[] ubuf;
       status = Status::Corruption("Cannot compress");
@@ -845,6 +954,21 @@ static Status ReadBlock(LogSource* source, const DirOptions& options,
   return status;
 }
 
+// Obtain a value from the contents of a v2 value block using the value
+// locator stored in its key block.
+static Status LocateValue(const Slice& value_block, Slice locator,
+                          Slice* result) {
+  uint32_t offset;
+  uint32_t size;
+  if (!GetValueLocator(&locator, &offset, &size) ||
+      uint64_t(offset) + size > value_block.size()) {
+    return Status::Corruption("Bad value locator");
+  } else {
+    *result = Slice(value_block.data() + offset, size);
+    return Status::OK();
+  }
+}
+
 // Retrieve all keys from a given data block.
 Status Dir::Iter(const IterOptions& opts, Slice* input) {
   Status status;
@@ -853,19 +977,60 @@ Status Dir::Iter(const IterOptions& opts, Slice* input) {
   if (!status.ok()) {
     return status;
   }
+  // In the v2 format, values are stored in a separate value block
+  const bool separate_values = options_.format == kDirFmtV2;
+  BlockHandle value_handle;
+  if (separate_values) {
+    status = value_handle.DecodeFrom(input);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   BlockContents contents;
-  status = ReadBlock(data_, options_, handle, &contents, false, opts.file_index,
-                     opts.tmp, opts.tmp_length);
+  {
+    LatencyTimer timer(latency_, kLatDataRead);
+    status = ReadBlock(data_, options_, handle, &contents, false,
+                       opts.file_index, opts.tmp, opts.tmp_length);
+  }
   if (!status.ok()) {
     return status;
   } else {
     opts.stats->seeks++;
   }
 
+  BlockContents value_contents;
+  value_contents.heap_allocated = false;
+  if (separate_values && !opts.keys_only) {
+    {
+      LatencyTimer timer(latency_, kLatDataRead);
+      status = ReadBlock(data_, options_, value_handle, &value_contents, false,
+                         opts.file_index);
+    }
+    if (!status.ok()) {
+      if (contents.heap_allocated) {
+        delete[] contents.data.data();
+      }
+      return status;
+    } else {
+      opts.stats->seeks++;
+    }
+  }
+
   Iterator* const iter = OpenDirBlock(options_, contents);
   iter->SeekToFirst();
+  Slice value;
   for (; iter->Valid(); iter->Next()) {
-    if (opts.saver(opts.arg, iter->key(), iter->value()) == -1) {
+    if (opts.keys_only) {
+      value = Slice();
+    } else if (separate_values) {
+      status = LocateValue(value_contents.data, iter->value(), &value);
+      if (!status.ok()) {
+        break;
+      }
+    } else {
+      value = iter->value();
+    }
+    if (opts.saver(opts.arg, iter->key(), value) == -1) {
       // User does not want to continue
       break;
     }
@@ -876,6 +1041,9 @@ Status Dir::Iter(const IterOptions& opts, Slice* input) {
   }
 
   delete iter;
+  if (value_contents.heap_allocated) {
+    delete[] value_contents.data.data();
+  }
   return status;
 }
 
@@ -892,7 +1060,10 @@ Status Dir::Iter(const IterOptions& opts, const TableHandle& h) {
   // so there is no need to allocate an additional
   // buffer to store the block contents
   const bool cached = true;
-  status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
+  {
+    LatencyTimer timer(latency_, kLatIndexRead);
+    status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
+  }
   if (!status.ok()) {
     return status;
   } else {
@@ -932,9 +1103,21 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
   if (!status.ok()) {
     return status;
   }
+  // In the v2 format, values are stored in a separate value block
+  const bool separate_values = options_.format == kDirFmtV2;
+  BlockHandle value_handle;
+  if (separate_values) {
+    status = value_handle.DecodeFrom(input);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   BlockContents contents;
-  status = ReadBlock(data_, options_, handle, &contents, false, opts.file_index,
-                     opts.tmp, opts.tmp_length);
+  {
+    LatencyTimer timer(latency_, kLatDataRead);
+    status = ReadBlock(data_, options_, handle, &contents, false,
+                       opts.file_index, opts.tmp, opts.tmp_length);
+  }
   if (!status.ok()) {
     return status;
   } else {
@@ -975,9 +1158,20 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
   }
 
   // Collect all results
+  std::string scratch;
+  Slice value;
   for (; iter->Valid(); iter->Next()) {
     if (iter->key() == key) {  // Hit
-      opts.saver(opts.arg, key, iter->value());
+      if (separate_values) {
+        status =
+            FetchValue(opts, value_handle, iter->value(), &scratch, &value);
+        if (!status.ok()) {
+          break;
+        }
+      } else {
+        value = iter->value();
+      }
+      opts.saver(opts.arg, key, value);
       if (IsKeyUnique(options_.mode)) {
         *found = true;
         break;  // Done
@@ -998,9 +1192,58 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
   return status;
 }
 
+Status Dir::FetchValue(const FetchOptions& opts, const BlockHandle& h,
+                       const Slice& locator, std::string* scratch,
+                       Slice* result) {
+  Status status;
+  if (!options_.skip_checksums && options_.verify_checksums) {
+    // Checksums cover the entire value block
+    BlockContents contents;
+    {
+      LatencyTimer timer(latency_, kLatDataRead);
+      status = ReadBlock(data_, options_, h, &contents, false, opts.file_index);
+    }
+    if (status.ok()) {
+      opts.stats->seeks++;
+      status = LocateValue(contents.data, locator, result);
+      if (status.ok()) {
+        scratch->assign(result->data(), result->size());
+        *result = *scratch;
+      }
+      if (contents.heap_allocated) {
+        delete[] contents.data.data();
+      }
+    }
+    return status;
+  }
+
+  Slice input = locator;
+  uint32_t offset;
+  uint32_t size;
+  if (!GetValueLocator(&input, &offset, &size) ||
+      uint64_t(offset) + size > h.size()) {
+    return Status::Corruption("Bad value locator");
+  }
+  scratch->resize(size);
+  {
+    LatencyTimer timer(latency_, kLatDataRead);
+    status = data_->Read(h.offset() + offset, size, result, &(*scratch)[0],
+                         opts.file_index);
+  }
+  if (status.ok()) {
+    if (result->size() != size) {
+      status = Status::Corruption("Truncated value read");
+    } else {
+      opts.stats->seeks++;
+    }
+  }
+  return status;
+}
+
 // Check if a specific key may or must not exist in one or more blocks
 // indexed by the given filter.
 bool Dir::KeyMayMatch(const Slice& key, const BlockHandle& h) {
+  LatencyTimer timer(latency_, kLatFilterCheck);
   Status status;
   BlockContents contents;
   // We always prefetch and cache all filter blocks in memory
@@ -1026,27 +1269,30 @@ bool Dir::KeyMayMatch(const Slice& key, const BlockHandle& h) {
   }
 }
 
-// Retrieve value to a specific key from a given table and call "opts.saver"
-// using the value found. Filter will be consulted if available to avoid
-// unnecessary reads. Return OK on success and a non-OK status on errors.
-Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
-                  const TableHandle& h) {
-  Status status;
-  // Check table key range and the paired filter
+// Check table key range and the paired filter. Return false if the key must
+// not exist in the table so there is no need to read its index block.
+bool Dir::TableMayMatch(const Slice& key, const TableHandle& h) {
   if (key < h.smallest_key() || key > h.largest_key()) {
-    return status;
+    return false;
   } else if (!options_.ignore_filters) {
     BlockHandle filter_handle;
     filter_handle.set_offset(h.filter_offset());
     filter_handle.set_size(h.filter_size());
     if (filter_handle.size() != 0) {  // Filter detected
-      if (!KeyMayMatch(key, filter_handle)) {
-        // Assuming no false negatives
-        return status;
-      }
+      // Assuming no false negatives
+      return KeyMayMatch(key, filter_handle);
     }
   }
 
+  return true;
+}
+
+// Retrieve value to a specific key from a given table and call "opts.saver"
+// using the value found. The table is expected to have passed its filter
+// checks. Return OK on success and a non-OK status on errors.
+Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
+                  const TableHandle& h) {
+  Status status;
   // Load the index block
   BlockContents index_contents;
   BlockHandle index_handle;
@@ -1056,7 +1302,10 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
   // so there is no need to allocate an additional
   // buffer to store the block contents
   const bool cached = true;
-  status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
+  {
+    LatencyTimer timer(latency_, kLatIndexRead);
+    status = ReadBlock(indx_, options_, index_handle, &index_contents, cached);
+  }
   if (!status.ok()) {
     return status;
   } else {
@@ -1112,6 +1361,46 @@ Status Dir::Fetch(const FetchOptions& opts, const Slice& key,
   return status;
 }
 
+namespace {
+// Values of epoch-tagged directories are prefixed with the epochs they were
+// written in. Values outside the requested epoch range are skipped. The rest
+// are passed on without their epoch prefixes.
+struct TaggedSaverState {
+  int (*saver)(void* arg, const Slice& key, const Slice& value);
+  void* arg;
+  uint32_t* epoch;  // Set to the epoch of each value passed on if not NULL
+  uint32_t epoch_start;
+  uint32_t epoch_end;
+  bool keys_only;
+};
+
+int TaggedSaveValue(void* arg, const Slice& key, const Slice& value) {
+  TaggedSaverState* state = reinterpret_cast<TaggedSaverState*>(arg);
+  Slice input = value;
+  uint32_t epoch;
+  if (!GetVarint32(&input, &epoch)) {
+    return 0;  // Skip bad values
+  } else if (epoch < state->epoch_start || epoch >= state->epoch_end) {
+    return 0;
+  }
+  if (state->epoch != NULL) {
+    *state->epoch = epoch;
+  }
+  return state->saver(state->arg, key, state->keys_only ? Slice() : input);
+}
+
+}  // namespace
+
+// Map a given epoch range onto the epochs physically stored. Epoch-tagged
+// directories store all their keys in the first epoch.
+static inline void MapStoredEpochs(DirMode mode, uint32_t* epoch_start,
+                                   uint32_t* epoch_end) {
+  if (IsEpochTagged(mode) && *epoch_start < *epoch_end) {
+    *epoch_start = 0;
+    *epoch_end = 1;
+  }
+}
+
 // List all keys within a given directory epoch.
 // ListContext *ctx may be shared among multiple concurrent lister threads.
 // ListStats *stats is dedicated to the current thread.
@@ -1150,6 +1439,7 @@ Status Dir::DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
     iter->Next();
     if (status.ok()) {
       IterOptions opts;
+      opts.keys_only = ctx->keys_only;
       if (options_.epoch_log_rotation) {
         opts.file_index = epoch;
       } else {
@@ -1160,6 +1450,19 @@ Status Dir::DoList(const BlockHandle& h, uint32_t epoch, ListContext* ctx,
       opts.tmp = ctx->tmp;
       opts.saver = reinterpret_cast<Saver>(ctx->usr_cb);
       opts.arg = ctx->arg_cb;
+      TaggedSaverState tagged;
+      if (IsEpochTagged(options_.mode)) {
+        // Values must be read to obtain their epochs
+        opts.keys_only = false;
+        tagged.saver = opts.saver;
+        tagged.arg = opts.arg;
+        tagged.epoch = NULL;
+        tagged.epoch_start = ctx->epoch_start;
+        tagged.epoch_end = ctx->epoch_end;
+        tagged.keys_only = ctx->keys_only;
+        opts.saver = TaggedSaveValue;
+        opts.arg = &tagged;
+      }
       status = Iter(opts, table_handle);
       if (!status.ok()) {
         break;
@@ -1208,39 +1511,22 @@ int ParaSaveValue(void* arg, const Slice& key, const Slice& value) {
 
 }  // namespace
 
-// Obtain the value to a specific key within a given directory epoch.
+static inline Iterator* NewRtIterator(Block* block) {
+  Iterator* iter = block->NewIterator(BytewiseComparator());
+  iter->SeekToFirst();
+  return iter;
+}
+
+// Obtain the value to a specific key from a list of candidate tables that
+// all belong to a single epoch.
 // GetContext *ctx may be shared among multiple concurrent getter threads.
 // GetStats *stats is dedicated to the current thread.
 // User callback is expected to be thread-safe.
-Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
-                  GetContext* ctx, GetStats* stats) {
+Status Dir::DoGet(const Slice& key, const Candidate* begin,
+                  const Candidate* end, GetContext* ctx, GetStats* stats) {
   Status status;
-  // Load the meta index for the epoch
-  BlockContents meta_index_contents;
-  // We always prefetch and cache all index blocks in memory
-  // so there is no need to allocate an additional
-  // buffer to store the block contents
-  const bool cached = true;
-  status = ReadBlock(indx_, options_, h, &meta_index_contents, cached);
-  if (!status.ok()) {
-    return status;
-  }
-  Block* epoch_index_block = new Block(meta_index_contents);
-  Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
-  iter->SeekToFirst();
-  std::string epoch_table_key;
-  uint32_t table = 0;
-  for (; status.ok(); table++) {
-    epoch_table_key = EpochTableKey(epoch, table);
-    // Try reusing current iterator position if possible
-    if (!iter->Valid() || iter->key() != epoch_table_key) {
-      iter->Seek(epoch_table_key);
-      if (!iter->Valid()) {
-        break;  // EOF
-      } else if (iter->key() != epoch_table_key) {
-        break;  // No such table
-      }
-    }
+  for (const Candidate* c = begin; c != end; ++c) {
+    const uint32_t epoch = c->epoch;
     ParaSaverState arg;
     arg.epoch = epoch;
     arg.offsets = ctx->offsets;
@@ -1248,52 +1534,327 @@ Status Dir::DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
     arg.mu = mu_;
     arg.dst = ctx->dst;
     arg.found = false;
-    TableHandle table_handle;
-    Slice input = iter->value();
-    status = table_handle.DecodeFrom(&input);
-    iter->Next();
-    if (status.ok()) {
-      FetchOptions opts;
-      if (options_.epoch_log_rotation) {
-        opts.file_index = epoch;
-      } else {
-        opts.file_index = 0;
+    FetchOptions opts;
+    if (options_.epoch_log_rotation) {
+      opts.file_index = epoch;
+    } else {
+      opts.file_index = 0;
+    }
+    opts.stats = stats;
+    opts.tmp_length = ctx->tmp_length;
+    opts.tmp = ctx->tmp;
+    if (options_.parallel_reads) {
+      opts.saver = ParaSaveValue;
+      opts.arg = &arg;
+    } else {
+      opts.saver = SaveValue;
+      opts.arg = &arg;
+    }
+    TaggedSaverState tagged;
+    if (IsEpochTagged(options_.mode)) {
+      tagged.saver = opts.saver;
+      tagged.arg = opts.arg;
+      // Parallel read results are later sorted by their original epochs
+      tagged.epoch = &arg.epoch;
+      tagged.epoch_start = ctx->epoch_start;
+      tagged.epoch_end = ctx->epoch_end;
+      tagged.keys_only = false;
+      opts.saver = TaggedSaveValue;
+      opts.arg = &tagged;
+    }
+    status = Fetch(opts, key, c->h);
+    if (!status.ok()) {
+      break;
+    }
+    // Each epoch is stored as a set of tables. If we find one match and
+    // we know keys are unique, we are done.
+    if (arg.found) {
+      if (IsKeyUnique(options_.mode)) {
+        break;
       }
-      opts.stats = stats;
-      opts.tmp_length = ctx->tmp_length;
-      opts.tmp = ctx->tmp;
-      if (options_.parallel_reads) {
-        opts.saver = ParaSaveValue;
-        opts.arg = &arg;
-        status = Fetch(opts, key, table_handle);
-      } else {
-        opts.saver = SaveValue;
-        opts.arg = &arg;
-        status = Fetch(opts, key, table_handle);
+    }
+  }
+
+  return status;
+}
+
+// Check the key ranges and filters of all tables within a given epoch range.
+// Tables that may contain the key are appended to *results in epoch order.
+// If key is NULL, all tables are appended. All index blocks are expected to
+// have been cached in memory so this only costs cpu.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::Probe(const Slice* key, uint32_t epoch_start, uint32_t epoch_end,
+                  std::vector<Candidate>* results) {
+  Status status;
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  std::string epoch_key;
+  std::string epoch_table_key;
+  uint32_t epoch = epoch_start;
+  for (; epoch < epoch_end && status.ok(); epoch++) {
+    epoch_key = EpochKey(epoch);
+    // Try reusing current iterator position if possible
+    if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
+      rt_iter->Seek(epoch_key);
+      if (!rt_iter->Valid()) {
+        break;  // EOF
+      } else if (rt_iter->key() != epoch_key) {
+        continue;  // No such epoch
       }
-      // Each epoch is stored as a set of tables. If we find one match and
-      // we know keys are unique, we are done.
-      if (status.ok() && arg.found) {
-        if (IsKeyUnique(options_.mode)) {
-          break;
+    }
+    BlockHandle h;  // Handle to the table index block
+    Slice input = rt_iter->value();
+    status = h.DecodeFrom(&input);
+    rt_iter->Next();
+    if (!status.ok()) {
+      break;
+    }
+    // Load the meta index for the epoch
+    BlockContents meta_index_contents;
+    // We always prefetch and cache all index blocks in memory
+    // so there is no need to allocate an additional
+    // buffer to store the block contents
+    const bool cached = true;
+    status = ReadBlock(indx_, options_, h, &meta_index_contents, cached);
+    if (!status.ok()) {
+      break;
+    }
+    Block* epoch_index_block = new Block(meta_index_contents);
+    Iterator* const iter = epoch_index_block->NewIterator(BytewiseComparator());
+    iter->SeekToFirst();
+    uint32_t table = 0;
+    for (; status.ok(); table++) {
+      epoch_table_key = EpochTableKey(epoch, table);
+      // Try reusing current iterator position if possible
+      if (!iter->Valid() || iter->key() != epoch_table_key) {
+        iter->Seek(epoch_table_key);
+        if (!iter->Valid()) {
+          break;  // EOF
+        } else if (iter->key() != epoch_table_key) {
+          break;  // No such table
         }
       }
+      Candidate c;
+      input = iter->value();
+      status = c.h.DecodeFrom(&input);
+      iter->Next();
+      if (status.ok() && (key == NULL || TableMayMatch(*key, c.h))) {
+        c.epoch = epoch;
+        results->push_back(c);
+      }
+    }
+
+    if (status.ok()) {
+      status = iter->status();
     }
+
+    delete iter;
+    delete epoch_index_block;
   }
 
   if (status.ok()) {
-    status = iter->status();
+    status = rt_iter->status();
   }
 
-  delete iter;
-  delete epoch_index_block;
+  delete rt_iter;
   return status;
 }
 
-static inline Iterator* NewRtIterator(Block* block) {
-  Iterator* iter = block->NewIterator(BytewiseComparator());
-  iter->SeekToFirst();
-  return iter;
+class Dir::TableCursor {
+ public:
+  TableCursor(Dir* dir, const Candidate& c, size_t seq)
+      : dir_(dir),
+        c_(c),
+        seq_(seq),
+        index_block_(NULL),
+        index_iter_(NULL),
+        iter_(NULL) {
+    value_contents_.data = Slice();
+    value_contents_.heap_allocated = false;
+    value_contents_.cachable = false;
+  }
+
+  ~TableCursor() {
+    ResetBlock();
+    delete index_iter_;
+    delete index_block_;
+  }
+
+  // Position at the first entry of the table.
+  Status SeekToFirst() {
+    BlockContents index_contents;
+    BlockHandle index_handle;
+    index_handle.set_offset(c_.h.index_offset());
+    index_handle.set_size(c_.h.index_size());
+    // All index blocks are cached in memory
+    const bool cached = true;
+    Status status;
+    {
+      LatencyTimer timer(dir_->latency_, kLatIndexRead);
+      status = ReadBlock(dir_->indx_, dir_->options_, index_handle,
+                         &index_contents, cached);
+    }
+    if (status.ok()) {
+      index_block_ = new Block(index_contents);
+      index_iter_ = index_block_->NewIterator(BytewiseComparator());
+      index_iter_->SeekToFirst();
+      status = LoadBlock();
+    }
+    return status;
+  }
+
+  bool Valid() const { return iter_ != NULL && iter_->Valid(); }
+  Slice key() const { return iter_->key(); }
+  uint32_t epoch() const { return c_.epoch; }
+  size_t seq() const { return seq_; }
+
+  Status value(Slice* result) const {
+    if (dir_->options_.format == kDirFmtV2) {
+      return LocateValue(value_contents_.data, iter_->value(), result);
+    } else {
+      *result = iter_->value();
+      return Status::OK();
+    }
+  }
+
+  // REQUIRES: Valid()
+  Status Next() {
+    iter_->Next();
+    if (iter_->Valid()) {
+      return Status::OK();
+    }
+    Status status = iter_->status();
+    if (status.ok()) {
+      index_iter_->Next();
+      status = LoadBlock();
+    }
+    return status;
+  }
+
+ private:
+  void ResetBlock() {
+    delete iter_;
+    iter_ = NULL;
+    if (value_contents_.heap_allocated) {
+      delete[] value_contents_.data.data();
+    }
+    value_contents_.data = Slice();
+    value_contents_.heap_allocated = false;
+  }
+
+  // Load the first non-empty data block at or after the current index entry.
+  Status LoadBlock() {
+    ResetBlock();
+    const DirOptions& options = dir_->options_;
+    const bool separate_values = options.format == kDirFmtV2;
+    const uint32_t file_index = options.epoch_log_rotation ? c_.epoch : 0;
+    Status status;
+    for (; status.ok() && index_iter_->Valid(); index_iter_->Next()) {
+      Slice input = index_iter_->value();
+      BlockHandle handle;
+      BlockHandle value_handle;
+      status = handle.DecodeFrom(&input);
+      if (status.ok() && separate_values) {
+        status = value_handle.DecodeFrom(&input);
+      }
+      if (!status.ok()) {
+        break;
+      }
+      BlockContents contents;
+      {
+        LatencyTimer timer(dir_->latency_, kLatDataRead);
+        status = ReadBlock(dir_->data_, options, handle, &contents, false,
+                           file_index);
+        if (status.ok() && separate_values) {
+          status = ReadBlock(dir_->data_, options, value_handle,
+                             &value_contents_, false, file_index);
+          if (!status.ok() && contents.heap_allocated) {
+            delete[] contents.data.data();
+          }
+        }
+      }
+      if (!status.ok()) {
+        break;
+      }
+      iter_ = OpenDirBlock(options, contents);
+      iter_->SeekToFirst();
+      if (iter_->Valid()) {
+        return status;
+      }
+      status = iter_->status();
+      ResetBlock();
+    }
+    if (status.ok()) {
+      status = index_iter_->status();
+    }
+    return status;
+  }
+
+  Dir* const dir_;
+  const Candidate c_;
+  const size_t seq_;  // Tables written earlier have smaller numbers
+  Block* index_block_;
+  Iterator* index_iter_;
+  Iterator* iter_;  // Iterator over the current data block
+  BlockContents value_contents_;  // Only used in the v2 format
+};
+
+// Order cursors so that the one positioned at the smallest key is at the top
+// of a heap. Ties go to the table written earlier.
+struct Dir::CursorGreater {
+  bool operator()(const TableCursor* a, const TableCursor* b) const {
+    const int r = a->key().compare(b->key());
+    return r > 0 || (r == 0 && a->seq() > b->seq());
+  }
+};
+
+// Merge all tables within a given epoch range using a heap of per-table
+// cursors. Return OK on success, or a non-OK status on errors.
+Status Dir::MergeEpochs(uint32_t epoch_start, uint32_t epoch_end,
+                        EpochSaver saver, void* arg) {
+  if (IsKeyUnOrdered(options_.mode)) {
+    return Status::NotSupported("Keys are not stored in-order");
+  }
+  std::vector<Candidate> tables;
+  Status status =
+      Probe(NULL, epoch_start, std::min(num_eps_, epoch_end), &tables);
+  std::vector<TableCursor*> heap;
+  for (size_t i = 0; status.ok() && i < tables.size(); i++) {
+    TableCursor* const cursor = new TableCursor(this, tables[i], i);
+    status = cursor->SeekToFirst();
+    if (status.ok() && cursor->Valid()) {
+      heap.push_back(cursor);
+    } else {
+      delete cursor;
+    }
+  }
+
+  CursorGreater cmp;
+  std::make_heap(heap.begin(), heap.end(), cmp);
+  Slice value;
+  while (status.ok() && !heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), cmp);
+    TableCursor* const cursor = heap.back();
+    status = cursor->value(&value);
+    if (!status.ok()) {
+      break;
+    }
+    if (saver(arg, cursor->epoch(), cursor->key(), value) == -1) {
+      // User does not want to continue
+      break;
+    }
+    status = cursor->Next();
+    if (status.ok() && cursor->Valid()) {
+      std::push_heap(heap.begin(), heap.end(), cmp);
+    } else {
+      heap.pop_back();
+      delete cursor;
+    }
+  }
+
+  for (size_t i = 0; i < heap.size(); i++) {
+    delete heap[i];
+  }
+  return status;
 }
 
 // List all keys within a given directory epoch.
@@ -1358,55 +1919,27 @@ void Dir::List(uint32_t epoch, ListContext* ctx) {
   }
 }
 
-// Obtain the value to a specific key at a given directory epoch.
+// Obtain the value to a specific key from a list of candidate tables that all
+// belong to a single epoch.
 // GetContext *ctx may be shared among multiple concurrent getter threads.
 // Return OK on success, or a non-OK status on errors.
-void Dir::Get(const Slice& key, uint32_t epoch, GetContext* ctx) {
+void Dir::Get(const Slice& key, const Candidate* begin, const Candidate* end,
+              GetContext* ctx) {
   mu_->AssertHeld();
   if (!ctx->status->ok()) {
+    assert(ctx->num_open_reads > 0);
+    ctx->num_open_reads--;
+    bg_cv_->SignalAll();
     return;
   }
-  Iterator* rt_iter = ctx->rt_iter;
-  if (rt_iter == NULL) {
-    rt_iter = NewRtIterator(rt_);
-  }
   mu_->Unlock();
   GetStats stats;
   stats.table_seeks = 0;  // Number of tables touched
   // Number of data blocks fetched
   stats.seeks = 0;
-  Status status;
-  for (uint32_t dummy = epoch; dummy == epoch; dummy++) {
-    std::string epoch_key = EpochKey(epoch);
-    // Try reusing current iterator position if possible
-    if (!rt_iter->Valid() || rt_iter->key() != epoch_key) {
-      rt_iter->Seek(epoch_key);
-      if (!rt_iter->Valid()) {
-        break;  // EOF
-      } else if (rt_iter->key() != epoch_key) {
-        break;  // No such epoch
-      }
-    }
-    BlockHandle h;
-    Slice input = rt_iter->value();
-    status = h.DecodeFrom(&input);
-    rt_iter->Next();
-    if (status.ok()) {
-      status = DoGet(key, h, epoch, ctx, &stats);
-    } else {
-      // Skip the epoch
-    }
-    break;
-  }
-
-  if (status.ok()) {
-    status = rt_iter->status();
-  }
+  Status status = DoGet(key, begin, end, ctx, &stats);
 
   mu_->Lock();
-  if (rt_iter != ctx->rt_iter) {
-    delete rt_iter;
-  }
   // Increase the total seek count
   ctx->num_table_seeks += stats.table_seeks;
   ctx->num_seeks += stats.seeks;
@@ -1467,6 +2000,13 @@ void Dir::Merge(GetContext* ctx) {
   }
 }
 
+namespace {
+int CountKey(void* arg, const Slice& key, const Slice& value) {
+  ++*reinterpret_cast<size_t*>(arg);
+  return 0;
+}
+}  // namespace
+
 // Count the total num of keys within a given epoch range.
 // Return OK on success, or a non-OK status on errors.
 Status Dir::Count(const CountOptions& opts, size_t* result) {
@@ -1476,6 +2016,12 @@ Status Dir::Count(const CountOptions& opts, size_t* result) {
   std::string epoch_key;
   *result = 0;
 
+  if (IsEpochTagged(options_.mode) && num_eps_ != 0 &&
+      (opts.epoch_start != 0 || opts.epoch_end < num_eps_)) {
+    // Keys of only some of the epochs have to be counted by scanning them
+    return CountByScan(opts.epoch_start, opts.epoch_end, result);
+  }
+
   Iterator* rt_iter = NewRtIterator(rt_);
   if (num_eps_ != 0) {
     uint32_t epoch = opts.epoch_start;
@@ -1488,17 +2034,22 @@ Status Dir::Count(const CountOptions& opts, size_t* result) {
         if (!rt_iter->Valid()) {
           break;  // EOF
         } else if (rt_iter->key() != epoch_key) {
-          break;  // No such epoch
+          continue;  // No such epoch
         }
       }
       EpochHandle h;  // Handle to the epoch
       Slice input = rt_iter->value();
       status = h.DecodeFrom(&input);
       rt_iter->Next();
-      if (status.ok()) {
-        *result += h.num_ents();
-      } else {
+      if (!status.ok()) {
         break;
+      } else if (h.num_ents() != ~static_cast<uint32_t>(0)) {
+        *result += h.num_ents();
+      } else {  // Recovered from a stone that does not carry epoch stats
+        status = CountByScan(epoch, epoch + 1, result);
+        if (!status.ok()) {
+          break;
+        }
       }
     }
   }
@@ -1511,6 +2062,21 @@ Status Dir::Count(const CountOptions& opts, size_t* result) {
   return status;
 }
 
+// Add the num of keys within a given epoch range to *result by scanning them.
+// Return OK on success, or a non-OK status on errors.
+Status Dir::CountByScan(uint32_t epoch_start, uint32_t epoch_end,
+                        size_t* result) {
+  ScanOptions scan_opts;
+  scan_opts.force_serial_reads = true;
+  scan_opts.keys_only = true;
+  scan_opts.epoch_start = epoch_start;
+  scan_opts.epoch_end = epoch_end;
+  Saver saver = CountKey;
+  scan_opts.usr_cb = reinterpret_cast<void*>(saver);
+  scan_opts.arg_cb = result;
+  return Scan(scan_opts, NULL);
+}
+
 // Iterate through all keys stored within a given epoch range.
 // Return OK on success, or a non-OK status on errors.
 Status Dir::Scan(const ScanOptions& opts, ScanStats* stats) {
@@ -1519,6 +2085,7 @@ Status Dir::Scan(const ScanOptions& opts, ScanStats* stats) {
   assert(rt_ != NULL);
 
   ListContext ctx;
+  ctx.keys_only = opts.keys_only;
   ctx.tmp = opts.tmp;  // User-supplied buffer space
   ctx.tmp_length = opts.tmp_length;
   ctx.num_open_lists = 0;  // Number of outstanding list operations
@@ -1535,9 +2102,12 @@ Status Dir::Scan(const ScanOptions& opts, ScanStats* stats) {
   }
   ctx.usr_cb = opts.usr_cb;
   ctx.arg_cb = opts.arg_cb;
+  ctx.epoch_start = opts.epoch_start;
+  ctx.epoch_end = opts.epoch_end;
   if (num_eps_ != 0) {
     uint32_t epoch = opts.epoch_start;
     uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
+    MapStoredEpochs(options_.mode, &epoch, &epoch_end);
     for (; epoch < epoch_end; epoch++) {
       ctx.num_open_lists++;
       BGListItem item;
@@ -1596,31 +2166,56 @@ Status Dir::Read(const ReadOptions& opts, const Slice& key, std::string* dst,
   ctx.num_table_seeks = 0;  // Total number of tables touched
   // Total number of data blocks fetched
   ctx.num_seeks = 0;
-  if (!options_.parallel_reads) {
-    // Pre-create the root iterator for serial reads
-    ctx.rt_iter = NewRtIterator(rt_);
-  } else {
-    ctx.rt_iter = NULL;
-  }
   ctx.dst = dst;
+  ctx.epoch_start = opts.epoch_start;
+  ctx.epoch_end = opts.epoch_end;
+  // Stage 1: check all tables against their filters using the cached
+  // index log. Only tables that survive will be read in the next stage.
+  std::vector<Candidate> candidates;
   if (num_eps_ != 0) {
-    uint32_t epoch = opts.epoch_start;
+    uint32_t epoch_start = opts.epoch_start;
     uint32_t epoch_end = std::min(num_eps_, opts.epoch_end);
-    for (; epoch < epoch_end; epoch++) {
-      ctx.num_open_reads++;
+    MapStoredEpochs(options_.mode, &epoch_start, &epoch_end);
+    mu_->Unlock();
+    status = Probe(&key, epoch_start, epoch_end, &candidates);
+    mu_->Lock();
+  }
+
+  // Stage 2: fetch index and data blocks for the surviving tables. Tables of
+  // the same epoch are read by the same getter so a getter may stop as soon
+  // as it finds a unique key.
+  std::vector<BGGetItem> items;
+  if (status.ok() && !candidates.empty()) {
+    const Candidate* const first = &candidates[0];
+    const Candidate* const last = first + candidates.size();
+    const Candidate* begin = first;
+    while (begin != last) {
+      const Candidate* end = begin + 1;
+      while (end != last && end->epoch == begin->epoch) {
+        ++end;
+      }
       BGGetItem item;
-      item.epoch = epoch;
+      item.begin = begin;
+      item.end = end;
       item.dir = this;
       item.ctx = &ctx;
       item.key = key;
-      if (opts.force_serial_reads || !options_.parallel_reads) {
-        Get(item.key, item.epoch, item.ctx);
+      items.push_back(item);
+      begin = end;
+    }
+    // Items must stay put once scheduled
+    for (size_t i = 0; i < items.size(); i++) {
+      BGGetItem* const item = &items[i];
+      ctx.num_open_reads++;
+      if (opts.force_serial_reads || !options_.parallel_reads ||
+          items.size() == 1) {
+        Get(item->key, item->begin, item->end, item->ctx);
       } else if (options_.reader_pool != NULL) {
-        options_.reader_pool->Schedule(Dir::BGGet, &item);
+        options_.reader_pool->Schedule(Dir::BGGet, item);
       } else if (options_.allow_env_threads) {
-        Env::Default()->Schedule(Dir::BGGet, &item);
+        Env::Default()->Schedule(Dir::BGGet, item);
       } else {
-        Get(item.key, item.epoch, item.ctx);
+        Get(item->key, item->begin, item->end, item->ctx);
       }
       if (!status.ok()) {
         break;
@@ -1633,7 +2228,6 @@ Status Dir::Read(const ReadOptions& opts, const Slice& key, std::string* dst,
     bg_cv_->Wait();
   }
 
-  delete ctx.rt_iter;
   // Merge sort read results
   if (status.ok()) {
     if (stats != NULL) {
@@ -1657,11 +2251,12 @@ void Dir::BGList(void* arg) {
 void Dir::BGGet(void* arg) {
   BGGetItem* item = reinterpret_cast<BGGetItem*>(arg);
   MutexLock ml(item->dir->mu_);
-  item->dir->Get(item->key, item->epoch, item->ctx);
+  item->dir->Get(item->key, item->begin, item->end, item->ctx);
 }
 
 Dir::ScanOptions::ScanOptions()
     : force_serial_reads(false),
+      keys_only(false),
       epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
       usr_cb(NULL),
@@ -1679,8 +2274,10 @@ Dir::ReadOptions::ReadOptions()
 Dir::CountOptions::CountOptions()
     : epoch_start(0), epoch_end(~static_cast<uint32_t>(0)) {}
 
-Dir::Dir(const DirOptions& options, port::Mutex* mu, port::CondVar* bg_cv)
+Dir::Dir(const DirOptions& options, port::Mutex* mu, port::CondVar* bg_cv,
+         LatencyStats* latency)
     : options_(options),
+      latency_(latency),
       num_eps_(0),
       data_(NULL),
       indx_(NULL),
@@ -1722,7 +2319,8 @@ static Status VerifyOptions(const DirOptions& options, const Footer& footer) {
       UnMatch(options.epoch_log_rotation, footer.epoch_log_rotation()) ||
       UnMatch(options.skip_checksums, footer.skip_checksums()) ||
       UnMatch(options.filter, footer.filter_type()) ||
-      UnMatch(options.mode, footer.mode())) {
+      UnMatch(options.mode, footer.mode()) ||
+      UnMatch(options.format, footer.format())) {
     return Status::AssertionFailed("Options does not match footer");
   } else {
     return Status::OK();
@@ -1739,13 +2337,14 @@ Status Dir::Open(LogSource* indx) {
     status = Status::Corruption("Dir index too short to be valid");
   }
 
-  if (!status.ok()) {
-    return status;
-  }
-
   Footer footer;
-  status = footer.DecodeFrom(&input);
+  if (status.ok()) {
+    status = footer.DecodeFrom(&input);
+  }
   if (!status.ok()) {
+    if (options_.recover_partial_logs) {
+      return Recover(indx);
+    }
     return status;
   } else if (options_.paranoid_checks) {
     status = VerifyOptions(options_, footer);
@@ -1754,6 +2353,8 @@ Status Dir::Open(LogSource* indx) {
     }
   }
 
+  // The footer is authoritative on how keys and values are laid out
+  options_.format = static_cast<DirFormat>(footer.format());
   BlockContents contents;
   const BlockHandle& handle = footer.epoch_index_handle();
   status = ReadBlock(indx, options_, handle, &contents, true);
@@ -1773,5 +2374,137 @@ Status Dir::Open(LogSource* indx) {
   return status;
 }
 
+Status Dir::Recover(LogSource* indx) {
+  Status status;
+  BlockBuilder root_block(1);
+  uint32_t num_eps = 0;
+  uint32_t num_stones = 0;
+  LogReader reader(options_, indx);
+  ChunkType type;
+  Slice contents;
+  BlockHandle handle;
+  while (reader.ReadChunk(&type, &contents, &handle)) {
+    if (type != kEpochStone) {
+      continue;
+    }
+    EpochStone stone;
+    status = stone.DecodeFrom(&contents);
+    if (!status.ok()) {
+      break;
+    } else if (stone.id() < num_eps) {
+      status = Status::Corruption("Epoch stones out of order");
+      break;
+    }
+    EpochHandle h;
+    h.set_index_offset(stone.handle().offset());
+    h.set_index_size(stone.handle().size());
+    // Stones written by older writers do not carry epoch stats. These are
+    // kept invalid so that Count() knows to scan such epochs instead.
+    h.set_num_tables(stone.num_tables());
+    h.set_num_ents(stone.num_ents());
+    std::string handle_encoding;
+    h.EncodeTo(&handle_encoding);
+    root_block.Add(EpochKey(stone.id()), handle_encoding);
+    num_eps = stone.id() + 1;
+    num_stones++;
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+#if VERBOSE >= 1
+  Verbose(__LOG_ARGS__, 1,
+          "Recovered %u epochs (%u sealed) from %llu/%llu bytes of index log: "
+          "%s",
+          num_eps, num_stones, static_cast<unsigned long long>(reader.offset()),
+          static_cast<unsigned long long>(indx->Size()),
+          reader.status().ToString().c_str());
+#endif
+  Slice root_contents = root_block.Finish();
+  char* buf = new char[root_contents.size()];
+  memcpy(buf, root_contents.data(), root_contents.size());
+  BlockContents rt;
+  rt.data = Slice(buf, root_contents.size());
+  rt.heap_allocated = true;
+  rt.cachable = false;
+
+  num_eps_ = num_eps;
+  // A user may want to access a prefix of all available epochs
+  if (options_.num_epochs != -1 && options_.num_epochs < int(num_eps_)) {
+    num_eps_ = static_cast<uint32_t>(options_.num_epochs);
+  }
+  rt_ = new Block(rt);
+  indx_ = indx;
+  indx_->Ref();
+
+  return status;
+}
+
+Status Dir::GetDataLimit(uint32_t epoch, uint64_t* result) {
+  *result = 0;
+  Status status;
+  Iterator* const rt_iter = NewRtIterator(rt_);
+  rt_iter->Seek(EpochKey(epoch));
+  if (!rt_iter->Valid() || rt_iter->key() != EpochKey(epoch)) {
+    status = rt_iter->status();
+    delete rt_iter;
+    return status;  // No such epoch
+  }
+  BlockHandle h;  // Handle to the epoch's meta index block
+  Slice input = rt_iter->value();
+  status = h.DecodeFrom(&input);
+  delete rt_iter;
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Index blocks are cached in memory
+  BlockContents meta_index_contents;
+  status = ReadBlock(indx_, options_, h, &meta_index_contents, true);
+  if (!status.ok()) {
+    return status;
+  }
+  Block meta_index_block(meta_index_contents);
+  Iterator* const iter = meta_index_block.NewIterator(BytewiseComparator());
+  iter->SeekToLast();  // The last table holds the last data block
+  if (iter->Valid()) {
+    TableHandle th;
+    input = iter->value();
+    status = th.DecodeFrom(&input);
+    BlockContents index_contents;
+    if (status.ok()) {
+      BlockHandle ih;
+      ih.set_offset(th.index_offset());
+      ih.set_size(th.index_size());
+      status = ReadBlock(indx_, options_, ih, &index_contents, true);
+    }
+    if (status.ok()) {
+      Block index_block(index_contents);
+      Iterator* const idx_iter =
+          index_block.NewIterator(BytewiseComparator());
+      idx_iter->SeekToLast();
+      if (idx_iter->Valid()) {
+        input = idx_iter->value();
+        status = h.DecodeFrom(&input);
+        // The last value block follows the last key block in the v2 format
+        if (status.ok() && options_.format == kDirFmtV2) {
+          status = h.DecodeFrom(&input);
+        }
+        if (status.ok()) {
+          *result = h.offset() + h.size() + kBlockTrailerSize;
+        }
+      } else {
+        status = idx_iter->status();
+      }
+      delete idx_iter;
+    }
+  } else {
+    status = iter->status();
+  }
+
+  delete iter;
+  return status;
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
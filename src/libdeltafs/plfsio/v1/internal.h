@@ -14,6 +14,7 @@
 #include "builder.h"
 #include "format.h"
 #include "io.h"
+#include "latency.h"
 #include "recov.h"
 #include "types.h"
 
@@ -59,6 +60,8 @@ class Compaction {
   bool is_forced_;
   bool is_epoch_flush_;
   bool is_final;
+  // Time the compaction was scheduled. Only set when events are listened.
+  uint64_t enqueue_micros_;
   void Ref() { refs_++; }
   void Unref();
 
@@ -168,8 +171,10 @@ class DirCompactor {
   bool ok() const { return bu_->ok(); }
   Status status() const { return bu_->status_; }
   uint32_t num_epochs() const { return bu_->num_eps_; }
+  const std::vector<EpochStats>& epoch_stats() const { return bu_->ep_stats_; }
   const DirOptions& options_;
   DirBuilder* bu_;
+  LatencyStats* latency_;  // NULL if latencies are not measured
 
  private:
   // No copying allowed
@@ -183,7 +188,7 @@ class DirCompactor {
 class DirIndexer {
  public:
   DirIndexer(const DirOptions& options, size_t part, port::Mutex* mu,
-             port::CondVar* cv);
+             port::CondVar* cv, LatencyStats* latency);
 
   Status Open(LogSink* data, LogSink* indx);
   size_t memory_usage() const;  // Report actual memory usage
@@ -231,6 +236,11 @@ class DirIndexer {
   // Return the number of epochs generated so far.
   uint32_t num_epochs() const;
 
+  // Append the summary stats of all non-empty epochs generated so far to
+  // *result.
+  // REQUIRES: *mu_ has been locked and no on-going compactions.
+  void GetEpochStats(std::vector<EpochStats>* result) const;
+
  private:
   WritableFileStats io_stats_;
   DirOutputStats compac_stats_;
@@ -273,6 +283,7 @@ class DirIndexer {
   size_t buf_reserv_;     // Memory reserved for each write buffer
   size_t tb_bytes_;       // Target table size
   size_t part_;           // Partition index
+  LatencyStats* const latency_;
 
   // State below is protected by mutex_
   uint32_t num_flush_requested_;
@@ -295,9 +306,12 @@ class DirIndexer {
 // Retrieve indexed data from log files.
 class Dir {
  public:
-  Dir(const DirOptions& options, port::Mutex*, port::CondVar*);
+  Dir(const DirOptions& options, port::Mutex*, port::CondVar*,
+      LatencyStats* latency);
 
   // Open a directory reader on top of a given directory index partition.
+  // If options.recover_partial_logs is set, an index log without a valid
+  // footer is recovered up to its last good epoch stone.
   // Return OK on success, or a non-OK status on errors.
   Status Open(LogSource* indx);
 
@@ -341,6 +355,9 @@ class Dir {
   struct ScanOptions {
     ScanOptions();
     bool force_serial_reads;  // Do not fetch data in parallel
+    // Pass empty values to the user callback. Value blocks are not read
+    // for directories in the v2 format.
+    bool keys_only;
     uint32_t epoch_start;
     uint32_t epoch_end;
     // User callback to handle fetched data
@@ -361,6 +378,18 @@ class Dir {
 
   Status Scan(const ScanOptions& opts, ScanStats* stats);
 
+  // Iterate through all keys within a given epoch range in key order. Equal
+  // keys are reported in the order they were written so keys of earlier
+  // epochs come first. For each key obtained, "saver" is called along with
+  // the epoch the key was written in. Only one data block per table is kept
+  // in memory at a time.
+  // REQUIRES: keys are stored in-order and mu_ is not held.
+  // Return OK on success, or a non-OK status on errors.
+  typedef int (*EpochSaver)(void* arg, uint32_t epoch, const Slice& key,
+                            const Slice& value);
+  Status MergeEpochs(uint32_t epoch_start, uint32_t epoch_end,
+                     EpochSaver saver, void* arg);
+
   void InstallDataSource(LogSource* data);
 
   void Ref() { refs_++; }
@@ -381,6 +410,18 @@ class Dir {
 
   typedef int (*Saver)(void* arg, const Slice& key, const Slice& value);
 
+  Status CountByScan(uint32_t epoch_start, uint32_t epoch_end, size_t* result);
+
+  // Replay an index log chunk by chunk and rebuild its root index from the
+  // epoch stones found. Return OK on success, or a non-OK status on errors.
+  Status Recover(LogSource* indx);
+
+  // Obtain the end offset of the last data block of a given epoch in the data
+  // log. Used to detect epochs whose data did not make it to storage.
+  // Set *result to 0 if the epoch is empty.
+  // Return OK on success, or a non-OK status on errors.
+  Status GetDataLimit(uint32_t epoch, uint64_t* result);
+
   struct GetStats;
   struct FetchOptions {
     GetStats* stats;
@@ -404,24 +445,53 @@ class Dir {
   Status Fetch(const FetchOptions& opts, const Slice& key, Slice* input,
                bool* found, bool* exhausted);
 
+  // Read a value from a v2 value block using the value locator stored in its
+  // key block. The value may be stored in *scratch. Only the value itself is
+  // read unless checksums are to be verified.
+  // Return OK on success, or a non-OK status on errors.
+  Status FetchValue(const FetchOptions& opts, const BlockHandle& h,
+                    const Slice& locator, std::string* scratch, Slice* result);
+
   // Return true if the given key matches a specific filter block.
   bool KeyMayMatch(const Slice& key, const BlockHandle& h);
 
+  // Return false if the given key must not exist in a given table as indicated
+  // by the table's key range and filter. Return true otherwise.
+  bool TableMayMatch(const Slice& key, const TableHandle& h);
+
   // Obtain the value to a specific key from a given table.
   // If key is found, "opts.saver" will be called.
   // NOTE: "opts.saver" may be called multiple times.
+  // REQUIRES: TableMayMatch(key, h) has returned true.
   // Return OK on success, or a non-OK status on errors.
   Status Fetch(const FetchOptions& opts, const Slice& key,
                const TableHandle& h);
 
-  // Obtain the value to a specific key within a given directory epoch.
+  // A table that may contain a given key.
+  struct Candidate {
+    uint32_t epoch;
+    TableHandle h;
+  };
+
+  // Check the key ranges and filters of all tables within a given epoch range
+  // and append tables that may contain the key to *results in epoch order.
+  // If key is NULL, all tables are appended.
+  // Only cached index log contents are accessed.
+  // Return OK on success, or a non-OK status on errors.
+  Status Probe(const Slice* key, uint32_t epoch_start, uint32_t epoch_end,
+               std::vector<Candidate>* results);
+
+  // Iterate through all entries of a single table one data block at a time.
+  class TableCursor;
+  struct CursorGreater;
+
+  // Obtain the value to a specific key from a list of candidate tables.
   // GetContext may be shared among multiple concurrent getters.
   // If key is found, value is appended to *ctx->dst.
   // NOTE: a key may appear multiple times within a single epoch.
   // Store an OK status in *ctx->status on success, or a non-OK status on
   // errors.
   struct GetContext {
-    Iterator* rt_iter;  // Only used in serial reads
     std::string* dst;
     int num_open_reads;
     std::vector<uint32_t>* offsets;  // Only used during parallel reads
@@ -432,15 +502,19 @@ class Dir {
     size_t num_table_seeks;  // Total number of tables touched
     // Total number of data blocks fetched
     size_t num_seeks;
+    // Epoch range to keep for epoch-tagged values
+    uint32_t epoch_start;
+    uint32_t epoch_end;
   };
-  void Get(const Slice& key, uint32_t epoch, GetContext* ctx);
+  void Get(const Slice& key, const Candidate* begin, const Candidate* end,
+           GetContext* ctx);
 
   struct GetStats {
     size_t table_seeks;  // Total tables touched for a certain epoch
     // Total data blocks fetched for a certain epoch
     size_t seeks;
   };
-  Status DoGet(const Slice& key, const BlockHandle& h, uint32_t epoch,
+  Status DoGet(const Slice& key, const Candidate* begin, const Candidate* end,
                GetContext* ctx, GetStats* stats);
 
   // Merge results from concurrent getters.
@@ -448,7 +522,9 @@ class Dir {
 
   struct BGGetItem {
     GetContext* ctx;
-    uint32_t epoch;
+    // Candidate tables of a single epoch
+    const Candidate* begin;
+    const Candidate* end;
     Slice key;
     Dir* dir;
   };
@@ -457,6 +533,8 @@ class Dir {
   struct ListStats;
   struct IterOptions {
     ListStats* stats;
+    // Skip values
+    bool keys_only;
     // Log rotation #
     uint32_t file_index;  // For data log only
     // Scratch space for temporary data block storage
@@ -480,6 +558,7 @@ class Dir {
 
   struct ListContext {
     Iterator* rt_iter;  // Only used in serial reads
+    bool keys_only;
     void* usr_cb;
     void* arg_cb;
     int num_open_lists;
@@ -491,6 +570,9 @@ class Dir {
     size_t num_seeks;
     // Total number of records read
     size_t n;
+    // Epoch range to keep for epoch-tagged values
+    uint32_t epoch_start;
+    uint32_t epoch_end;
   };
   void List(uint32_t epoch, ListContext* ctx);
 
@@ -516,8 +598,10 @@ class Dir {
   Dir(const Dir&);
 
   struct STLLessThan;
-  // Constant after construction
-  const DirOptions& options_;
+  // Constant after Open(). A copy of the reader's options with the on-disk
+  // format replaced by the one found in the partition's footer.
+  DirOptions options_;
+  LatencyStats* const latency_;
   uint32_t num_eps_;
   LogSource* data_;
   LogSource* indx_;
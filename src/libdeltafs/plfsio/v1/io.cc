@@ -106,6 +106,67 @@ class RollingLogFile : public WritableFile {
   friend class LogSink;
 };
 
+// Record the latency of each write and sync issued to an underlying file.
+class TimedLogFile : public WritableFile {
+ public:
+  // *base must remain alive during the lifetime of this class. *base will be
+  // implicitly closed and deleted by the destructor of this class.
+  TimedLogFile(LatencyStats* stats, WritableFile* base)
+      : stats_(stats), base_(base) {}
+
+  virtual ~TimedLogFile() {
+    if (base_ != NULL) {
+      base_->Close();
+      delete base_;
+    }
+  }
+
+  virtual Status Append(const Slice& data) {
+    if (base_ == NULL) {
+      return Status::Disconnected(Slice());
+    } else {
+      LatencyTimer timer(stats_, kLatLogWrite);
+      return base_->Append(data);
+    }
+  }
+
+  virtual Status Flush() {
+    if (base_ == NULL) {
+      return Status::Disconnected(Slice());
+    } else {
+      return base_->Flush();
+    }
+  }
+
+  virtual Status Sync() {
+    if (base_ == NULL) {
+      return Status::Disconnected(Slice());
+    } else {
+      LatencyTimer timer(stats_, kLatLogSync);
+      return base_->Sync();
+    }
+  }
+
+  virtual Status Close() {
+    if (base_ != NULL) {
+      Status status = base_->Close();
+      delete base_;
+      base_ = NULL;
+      return status;
+    } else {
+      return Status::OK();
+    }
+  }
+
+ private:
+  // No copying allowed
+  void operator=(const TimedLogFile& t);
+  TimedLogFile(const TimedLogFile&);
+
+  LatencyStats* const stats_;
+  WritableFile* base_;
+};
+
 static std::string Lrank(int rank) {
   char tmp[20];
   if (rank != -1) {
@@ -273,11 +334,13 @@ LogSink::LogOptions::LogOptions()
       type(kDefIoType),
       mu(NULL),
       stats(NULL),
+      latency(NULL),
       env(Env::Default()) {}
 
 // LogSink
 //   BufferedFile
 //   MeasuredWritableFile
+//   TimedLogFile
 //   RollingLogFile
 //   WritableFile (from env_)
 // Return OK on success, or a non-OK status on errors.
@@ -306,6 +369,10 @@ Status LogSink::Open(const LogOptions& opts, const std::string& prefix,
     base = virf;
   }
 
+  if (opts.latency != NULL) {
+    base = new TimedLogFile(opts.latency, base);
+  }
+
   WritableFile* file;
   // Link to external stats for I/O monitoring
   if (opts.stats != NULL) {
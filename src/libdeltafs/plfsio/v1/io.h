@@ -11,6 +11,8 @@
 
 #pragma once
 
+#include "latency.h"
+
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/env_files.h"
 #include "pdlfs-common/port.h"
@@ -83,6 +85,9 @@ class LogSink {
     // Enable i/o stats monitoring
     WritableFileStats* stats;
 
+    // Record write and sync latencies
+    LatencyStats* latency;
+
     // Low-level storage abstraction
     Env* env;
   };
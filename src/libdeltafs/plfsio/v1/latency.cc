@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "latency.h"
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+LatencyStats::Shard::Shard() {
+  for (int i = 0; i < kNumLatencyTypes; i++) {
+    hists[i].Clear();
+    counts[i] = 0;
+    sums[i] = 0;
+  }
+}
+
+LatencyStats::LatencyStats() {}
+
+LatencyStats::~LatencyStats() {}
+
+void LatencyStats::Record(LatencyType type, uint64_t micros) {
+  assert(type < kNumLatencyTypes);
+  uint64_t h = port::PthreadId();
+  h ^= h >> 33;  // Thread ids are often aligned addresses
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  Shard* const s = &shards_[h % kNumShards];
+  MutexLock ml(&s->mu);
+  s->hists[type].Add(static_cast<double>(micros));
+  s->counts[type]++;
+  s->sums[type] += micros;
+}
+
+void LatencyStats::Merge(LatencyType type, Histogram* result) const {
+  assert(type < kNumLatencyTypes);
+  for (int i = 0; i < kNumShards; i++) {
+    const Shard* const s = &shards_[i];
+    MutexLock ml(&s->mu);
+    result->Merge(s->hists[type]);
+  }
+}
+
+uint64_t LatencyStats::Count(LatencyType type) const {
+  assert(type < kNumLatencyTypes);
+  uint64_t result = 0;
+  for (int i = 0; i < kNumShards; i++) {
+    const Shard* const s = &shards_[i];
+    MutexLock ml(&s->mu);
+    result += s->counts[type];
+  }
+  return result;
+}
+
+uint64_t LatencyStats::Sum(LatencyType type) const {
+  assert(type < kNumLatencyTypes);
+  uint64_t result = 0;
+  for (int i = 0; i < kNumShards; i++) {
+    const Shard* const s = &shards_[i];
+    MutexLock ml(&s->mu);
+    result += s->sums[type];
+  }
+  return result;
+}
+
+const char* LatencyStats::Name(LatencyType type) {
+  switch (type) {
+    case kLatAddWait:
+      return "add_wait";
+    case kLatMemtableSort:
+      return "memtable_sort";
+    case kLatBlockBuild:
+      return "block_build";
+    case kLatFilterBuild:
+      return "filter_build";
+    case kLatLogWrite:
+      return "log_write";
+    case kLatLogSync:
+      return "log_sync";
+    case kLatEpochFlush:
+      return "epoch_flush";
+    case kLatFilterCheck:
+      return "filter_check";
+    case kLatIndexRead:
+      return "index_read";
+    case kLatDataRead:
+      return "data_read";
+    default:
+      return "unknown";
+  }
+}
+
+bool LatencyStats::GetProperty(const Slice& property,
+                               std::string* value) const {
+  for (int i = 0; i < kNumLatencyTypes; i++) {
+    const LatencyType type = static_cast<LatencyType>(i);
+    Slice in = property;
+    if (!in.starts_with(Name(type))) {
+      continue;
+    }
+    in.remove_prefix(strlen(Name(type)));
+    if (in.empty()) {
+      Histogram hist;
+      hist.Clear();
+      Merge(type, &hist);
+      *value = hist.ToString();
+      return true;
+    } else if (in[0] != '.') {
+      continue;
+    }
+    in.remove_prefix(1);
+    char tmp[50];
+    if (in == "count") {
+      snprintf(tmp, sizeof(tmp), "%llu",
+               static_cast<unsigned long long>(Count(type)));
+    } else if (in == "sum") {
+      snprintf(tmp, sizeof(tmp), "%llu",
+               static_cast<unsigned long long>(Sum(type)));
+    } else if (in == "avg" || in == "p50" || in == "p99" || in == "p999") {
+      Histogram hist;
+      hist.Clear();
+      Merge(type, &hist);
+      double r;
+      if (Count(type) == 0) {
+        r = 0;
+      } else if (in == "avg") {
+        r = hist.Average();
+      } else if (in == "p50") {
+        r = hist.Median();
+      } else if (in == "p99") {
+        r = hist.Percentile(99);
+      } else {
+        r = hist.Percentile(99.9);
+      }
+      snprintf(tmp, sizeof(tmp), "%.0f", r);
+    } else {
+      return false;
+    }
+    *value = tmp;
+    return true;
+  }
+  return false;
+}
+
+LatencyTimer::LatencyTimer(LatencyStats* stats, LatencyType type)
+    : stats_(stats), type_(type), start_(0) {
+  if (stats_ != NULL) {
+    start_ = Env::Default()->NowMicros();
+  }
+}
+
+LatencyTimer::~LatencyTimer() {
+  if (stats_ != NULL) {
+    stats_->Record(type_, Env::Default()->NowMicros() - start_);
+  }
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
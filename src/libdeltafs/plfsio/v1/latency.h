@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/slice.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace pdlfs {
+namespace plfsio {
+
+// Operations timed by directory writers and readers.
+enum LatencyType {
+  // Time an Add() is blocked waiting for write buffer space.
+  // Only blocked calls are recorded.
+  kLatAddWait,
+  // Time to sort a memtable before compacting it.
+  kLatMemtableSort,
+  // Time to turn a sorted memtable into data and index blocks, including
+  // handing the blocks to the logs.
+  kLatBlockBuild,
+  // Time to build the filter of a memtable.
+  kLatFilterBuild,
+  // Time of each write to the underlying log files.
+  kLatLogWrite,
+  // Time of each sync of the underlying log files.
+  kLatLogSync,
+  // Time of each EpochFlush() call.
+  kLatEpochFlush,
+  // Time to check a key against a table filter.
+  kLatFilterCheck,
+  // Time to read and decode a table index block.
+  kLatIndexRead,
+  // Time to read and decode a data block.
+  kLatDataRead,
+  kNumLatencyTypes
+};
+
+// Record operation latencies, in microseconds, in histograms. Recording
+// threads are spread over a fixed number of independently locked shards so
+// concurrent threads seldom contend with each other. Shards are merged when
+// queried. Implementation is thread-safe.
+class LatencyStats {
+ public:
+  LatencyStats();
+  ~LatencyStats();
+
+  void Record(LatencyType type, uint64_t micros);
+
+  // Merge the samples of a given operation into *result.
+  void Merge(LatencyType type, Histogram* result) const;
+
+  // Return the total number of samples of a given operation.
+  uint64_t Count(LatencyType type) const;
+
+  // Return the sum of the samples of a given operation.
+  uint64_t Sum(LatencyType type) const;
+
+  // Return the name of a given operation, such as "add_wait".
+  static const char* Name(LatencyType type);
+
+  // Answer a property query. Supported properties are "<name>", which
+  // returns the full histogram as a human-readable text, and "<name>.count",
+  // "<name>.sum", "<name>.avg", "<name>.p50", "<name>.p99", and "<name>.p999",
+  // which return a single number. Return false if property is unknown.
+  bool GetProperty(const Slice& property, std::string* value) const;
+
+ private:
+  enum { kNumShards = 8 };
+  struct Shard {
+    Shard();
+    mutable port::Mutex mu;
+    Histogram hists[kNumLatencyTypes];
+    uint64_t counts[kNumLatencyTypes];
+    uint64_t sums[kNumLatencyTypes];
+  };
+  Shard shards_[kNumShards];
+
+  // No copying allowed
+  void operator=(const LatencyStats& ls);
+  LatencyStats(const LatencyStats&);
+};
+
+// Time a scope and record the result when the scope ends. Does nothing if
+// stats is NULL.
+class LatencyTimer {
+ public:
+  LatencyTimer(LatencyStats* stats, LatencyType type);
+  ~LatencyTimer();
+
+ private:
+  LatencyStats* const stats_;
+  const LatencyType type_;
+  uint64_t start_;
+
+  // No copying allowed
+  void operator=(const LatencyTimer& lt);
+  LatencyTimer(const LatencyTimer&);
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include "metrics.h"
+
+#include <stdio.h>
+
+namespace pdlfs {
+namespace plfsio {
+
+void DirMetrics::Add(const std::string& name, uint64_t value) {
+  dir.push_back(Counter(name, value));
+}
+
+void DirMetrics::AddPart(size_t part, const std::string& name,
+                         uint64_t value) {
+  if (part >= parts.size()) {
+    parts.resize(part + 1);
+  }
+  parts[part].push_back(Counter(name, value));
+}
+
+namespace {
+
+void AppendJsonObject(std::string* result,
+                      const DirMetrics::CounterList& counters) {
+  char tmp[30];
+  result->push_back('{');
+  for (size_t i = 0; i < counters.size(); i++) {
+    if (i != 0) result->push_back(',');
+    result->push_back('"');
+    result->append(counters[i].first);
+    result->append("\":");
+    snprintf(tmp, sizeof(tmp), "%llu",
+             static_cast<unsigned long long>(counters[i].second));
+    result->append(tmp);
+  }
+  result->push_back('}');
+}
+
+}  // namespace
+
+std::string DirMetrics::ToJson(int rank) const {
+  std::string result;
+  char tmp[30];
+  snprintf(tmp, sizeof(tmp), "{\"rank\":%d,\"dir\":", rank);
+  result.append(tmp);
+  AppendJsonObject(&result, dir);
+  result.append(",\"parts\":[");
+  for (size_t i = 0; i < parts.size(); i++) {
+    if (i != 0) result.push_back(',');
+    AppendJsonObject(&result, parts[i]);
+  }
+  result.append("]}");
+  return result;
+}
+
+std::string DirMetrics::ToPrometheus(int rank) const {
+  std::string result;
+  char tmp[100];
+  for (size_t i = 0; i < dir.size(); i++) {
+    snprintf(tmp, sizeof(tmp), "{rank=\"%d\"} %llu\n", rank,
+             static_cast<unsigned long long>(dir[i].second));
+    result.append("plfsdir_");
+    result.append(dir[i].first);
+    result.append(tmp);
+  }
+  // Samples of a metric must be grouped together
+  const size_t num_counters = parts.empty() ? 0 : parts[0].size();
+  for (size_t j = 0; j < num_counters; j++) {
+    for (size_t i = 0; i < parts.size(); i++) {
+      if (j >= parts[i].size()) continue;
+      snprintf(tmp, sizeof(tmp), "{rank=\"%d\",part=\"%d\"} %llu\n", rank,
+               static_cast<int>(i),
+               static_cast<unsigned long long>(parts[i][j].second));
+      result.append("plfsdir_");
+      result.append(parts[i][j].first);
+      result.append(tmp);
+    }
+  }
+  return result;
+}
+
+}  // namespace plfsio
+}  // namespace pdlfs
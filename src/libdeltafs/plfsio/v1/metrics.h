@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+// A snapshot of the counters of a directory writer or reader. Counters
+// covering the whole directory are kept in dir. Counters of each memtable
+// partition are kept in parts. All partitions report the same counters in
+// the same order. Counter names only contain lower-case letters, digits,
+// and underscores.
+struct DirMetrics {
+  typedef std::pair<std::string, uint64_t> Counter;
+  typedef std::vector<Counter> CounterList;
+  CounterList dir;
+  std::vector<CounterList> parts;
+
+  void Add(const std::string& name, uint64_t value);
+  void AddPart(size_t part, const std::string& name, uint64_t value);
+
+  // Return all counters as a single JSON object of the form
+  // {"rank":<rank>,"dir":{<name>:<value>,...},"parts":[{...},...]}.
+  std::string ToJson(int rank) const;
+
+  // Return all counters in the Prometheus text exposition format. Each
+  // counter becomes a metric named "plfsdir_<name>" labeled by rank and, for
+  // per-partition counters, by partition.
+  std::string ToPrometheus(int rank) const;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
@@ -11,6 +11,9 @@
 
 #include "pdb.h"
 
+#include <algorithm>
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 
@@ -24,22 +27,34 @@ BufferedBlockWriter::BufferedBlockWriter(const DirOptions& options,
       buf_threshold_(buf_size),
       buf_reserv_(8 + buf_size),
       offset_(0),
-      bbs_(NULL),
+      keyindex_(NULL),
+      wbs_(NULL),
       n_(n) {
   if (n_ < 2) {
     n_ = 2;  // We need at least two buffers
   }
-  bbs_ = new BlockBuf*[n_];  // Allocate a requested amount of block buffers
+  // Number of keys a full write buffer may hold
+  const size_t buf_keys =
+      buf_size / std::max<size_t>(1, options_.key_size + options_.value_size);
+  wbs_ = new WriteBuf*[n_];  // Allocate a requested amount of write buffers
   for (size_t i = 0; i < n_; i++) {
-    bbs_[i] = new BlockBuf(options_, true);  // Force an unordered fmt
-    bbs_[i]->Reserve(buf_reserv_);
-    if (i != 0) {  // bbs_[0] will act as membuf_
-      bufs_.push_back(bbs_[i]);
+    wbs_[i] = new WriteBuf(options_);
+    wbs_[i]->bb.Reserve(buf_reserv_);
+    if (options_.bf_bits_per_key != 0) {
+      wbs_[i]->hashes.reserve(buf_keys);
+    }
+    if (i != 0) {  // wbs_[0] will act as membuf_
+      bufs_.push_back(wbs_[i]);
     }
   }
 
   bloomfilter_.reserve(4 << 20);
-  membuf_ = bbs_[0];
+  membuf_ = wbs_[0];
+  if (options_.pdb_index_keys != 0) {
+    keyindex_ = new KeyIndex(options_, 0);
+    keyindex_->Reset(static_cast<uint32_t>(
+        std::min<size_t>(options_.pdb_index_keys, 0xFFFFFFFFu)));
+  }
 }
 
 // Wait for all outstanding compactions to clear.
@@ -50,9 +65,10 @@ BufferedBlockWriter::~BufferedBlockWriter() {
   }
   mu_.Unlock();
   for (size_t i = 0; i < n_; i++) {
-    delete bbs_[i];
+    delete wbs_[i];
   }
-  delete[] bbs_;
+  delete[] wbs_;
+  delete keyindex_;
 }
 
 // Insert data into the writer.
@@ -89,29 +105,45 @@ Status BufferedBlockWriter::Wait() {
   return __Wait();
 }
 
+// Obtain write pipeline statistics.
+PipelineStats BufferedBlockWriter::GetStats() {
+  MutexLock ml(&mu_);
+  PipelineStats stats;
+  __GetStats(&stats);
+  return stats;
+}
+
 // Finalize the writer. Expected to be called ONLY once.
 Status BufferedBlockWriter::Finish() {
   MutexLock ml(&mu_);
   return __Finish<BufferedBlockWriter>();
 }
 
+// Blocks and their filters are finalized with mu_ unlocked so successive
+// buffers may be compacted concurrently on the compaction pool. Only the final
+// appends to dst_ are serialized in compac_seq order.
 // REQUIRES: mu_ has been LOCKed.
 Status BufferedBlockWriter::Compact(uint32_t const compac_seq, void* immbuf) {
   mu_.AssertHeld();
   assert(dst_);
-  BlockBuf* const bb = static_cast<BlockBuf*>(immbuf);
+  WriteBuf* const wb = static_cast<WriteBuf*>(immbuf);
+  BlockBuf* const bb = &wb->bb;
   // Skip empty buffers
   if (bb->empty() && compac_seq == num_compac_completed_ + 1)
     return Status::OK();
   mu_.Unlock();  // Unlock as compaction is expensive
+  // Blocks are sorted whenever a key index is requested so that readers may
+  // binary search them. The key index itself may later be dropped.
+  const bool sorted = options_.pdb_index_keys != 0;
   Slice block_contents;
   if (!bb->empty()) {
+    if (sorted) bb->Sort();
     block_contents = bb->Finish(kNoCompression);
   }
-  BloomBuilder bf(options_);  // Filter is built only when requested
-  Slice filter_contents;
-  if (!bb->empty() && options_.bf_bits_per_key != 0) {
-    bf.Reset(bb->NumEntries());
+  // Keys are only revisited for the key index
+  std::vector<Slice> keys;
+  if (!bb->empty() && sorted) {
+    keys.reserve(bb->NumEntries());
     BlockContents bc;
     bc.data = block_contents;
     bc.heap_allocated = false;
@@ -120,17 +152,29 @@ Status BufferedBlockWriter::Compact(uint32_t const compac_seq, void* immbuf) {
     IteratorWrapper it(b.NewIterator(NULL));
     it.SeekToFirst();
     for (; it.Valid();) {
-      bf.AddKey(it.key());
+      keys.push_back(it.key());
       it.Next();
     }
+  }
+  BloomBuilder bf(options_);  // Filter is built only when requested
+  Slice filter_contents;
+  if (!wb->hashes.empty()) {
+    bf.Reset(wb->hashes.size());
+    bf.AddHashes(&wb->hashes[0], wb->hashes.size());
     filter_contents = bf.Finish();
   }
   mu_.Lock();  // All writes are serialized through compac_seq
-  assert(num_compac_completed_ < compac_seq);
-  while (compac_seq != num_compac_completed_ + 1) {
-    bg_cv_.Wait();
-  }
+  WaitForTurn(compac_seq);
   mu_.Unlock();
+  const size_t block_id = indexes_.size() / 16;
+  if (keyindex_ != NULL && block_id > kMaxBlocks) {
+    delete keyindex_;  // Block ids no longer fit, fall back to filter scans
+    keyindex_ = NULL;
+  }
+  if (keyindex_ != NULL && !keys.empty()) {
+    std::vector<uint32_t> ids(keys.size(), static_cast<uint32_t>(block_id));
+    keyindex_->AddKeys(&keys[0], &ids[0], keys.size());
+  }
   PutFixed64(&indexes_, bloomfilter_.size());
   if (!filter_contents.empty())
     bloomfilter_.append(filter_contents.data(), filter_contents.size());
@@ -172,6 +216,17 @@ Status BufferedBlockWriter::DumpIndexesAndFilters() {
     }
   }
 
+  if (status.ok()) {
+    Slice keyindex;
+    if (keyindex_ != NULL) keyindex = keyindex_->Finish();
+    keyindex_handle_.set_size(keyindex.size());
+    keyindex_handle_.set_offset(offset_);
+    if (!keyindex.empty()) status = dst_->Append(keyindex);
+    if (status.ok()) {
+      offset_ += keyindex.size();
+    }
+  }
+
   return status;
 }
 
@@ -187,7 +242,13 @@ Status BufferedBlockWriter::Close() {
     std::string footer;
     bloomfilter_handle_.EncodeTo(&footer);
     index_handle_.EncodeTo(&footer);
-    footer.resize(2 * BlockHandle::kMaxEncodedLength);
+    if (keyindex_handle_.size() != 0) {
+      keyindex_handle_.EncodeTo(&footer);
+      footer.resize(3 * BlockHandle::kMaxEncodedLength);
+      PutFixed64(&footer, kPdbKeyIndexMagicNumber);
+    } else {  // Keep the original footer so older readers can open the table
+      footer.resize(2 * BlockHandle::kMaxEncodedLength);
+    }
     status = dst_->Append(footer);
   }
 
@@ -253,33 +314,107 @@ BufferedBlockReader::BufferedBlockReader(const DirOptions& options,
                                          RandomAccessFile* src, uint64_t src_sz)
     : options_(options), src_(src), src_sz_(src_sz) {}
 
+// Return the filter of the i-th data block.
+// REQUIRES: i < NumBlocks().
+Slice BufferedBlockReader::BlockFilter(size_t i) const {
+  const uint64_t bloomoffset = DecodeFixed64(&indexes_[16 * i]);
+  const uint64_t next_bloomoffset = DecodeFixed64(&indexes_[16 * i + 16]);
+  return Slice(bloomfilter_.data() + bloomoffset,
+               next_bloomoffset - bloomoffset);
+}
+
+// Obtain the location of the i-th data block.
+// REQUIRES: i < NumBlocks().
+void BufferedBlockReader::BlockRange(size_t i, uint64_t* offset,
+                                     size_t* n) const {
+  *offset = DecodeFixed64(&indexes_[16 * i + 8]);
+  *n = DecodeFixed64(&indexes_[16 * i + 24]) - *offset;
+}
+
+// Read n bytes of data starting at a specific offset into buf_.
+Status BufferedBlockReader::ReadBlock(uint64_t offset, size_t n,
+                                      Slice* result) {
+  if (buf_.size() < n) buf_.resize(n);  // Reuse space across reads
+  Status status = src_->Read(offset, n, result, &buf_[0]);
+  if (status.ok()) {
+    if (result->size() != n) {
+      status = Status::IOError("Read ret partial data");
+    }
+  }
+  return status;
+}
+
+// Search a block for a specific key. Return true iff the key is found. Keys in
+// sorted blocks are found using binary search; otherwise we use linear search.
+bool BufferedBlockReader::Search(Block* block, const Slice& k,
+                                 std::string* result, bool sorted) {
+  const Comparator* comp = NULL;  // Force linear search
+  if (sorted) comp = BytewiseComparator();
+  IteratorWrapper iter(block->NewIterator(comp));
+  iter.Seek(k);
+  if (iter.Valid() && iter.key() == k) {
+    *result = iter.value().ToString();
+    return true;
+  }
+  return false;
+}
+
+// Search a data block for a specific key. Set *status to a non-OK status on
+// errors. Return true iff the key is found.
 bool BufferedBlockReader::GetFrom(Status* status, const Slice& k,
                                   std::string* result, uint64_t offset,
-                                  size_t n) {
+                                  size_t n, bool sorted) {
   BlockContents contents;
   contents.heap_allocated = false;
   contents.cachable = false;
-  std::string buf;
-  buf.resize(n);
-  *status = src_->Read(offset, n, &contents.data, &buf[0]);
+  *status = ReadBlock(offset, n, &contents.data);
   if (status->ok()) {
-    if (contents.data.size() != n) {
-      *status = Status::IOError("Read ret partial data");
-    }
+    Block block(contents);
+    return Search(&block, k, result, sorted);
   }
 
-  if (status->ok()) {
-    Block block(contents);
-    const Comparator* comp = NULL;  // Force linear search
-    IteratorWrapper iter(block.NewIterator(comp));
-    iter.Seek(k);
-    if (iter.Valid()) {
-      *result = iter.value().ToString();
-      return true;
+  return false;
+}
+
+// Get the value for a specific key using the table's key index. Only blocks
+// that the index points to are read. Their blooms are still checked first to
+// filter out blocks that are pointed to by a fingerprint collision.
+Status BufferedBlockReader::IndexedGet(const Slice& k, std::string* result) {
+  std::vector<uint32_t> ids;
+  Status status = BlockCandidates(k, &ids);
+  uint64_t offset;
+  size_t n;
+  for (size_t i = 0; status.ok() && i < ids.size(); i++) {
+    if (BloomKeyMayMatch(k, BlockFilter(ids[i]))) {
+      BlockRange(ids[i], &offset, &n);
+      if (GetFrom(&status, k, result, offset, n, true)) {
+        break;
+      }
     }
   }
 
-  return false;
+  return status;
+}
+
+// Obtain the ids of all blocks that may contain a specific key according to
+// the table's key index. Ids are sorted and unique.
+// REQUIRES: keyindex_ is not empty.
+Status BufferedBlockReader::BlockCandidates(const Slice& k,
+                                            std::vector<uint32_t>* ids) {
+  ids->clear();
+  if (!CuckooValues(k, keyindex_, ids)) {
+    return Status::OK();  // Key is absent
+  } else if (ids->empty()) {
+    return Status::Corruption("Cannot understand key index");
+  }
+
+  // When keys repeat, the earliest block wins
+  std::sort(ids->begin(), ids->end());
+  ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+  if (ids->back() >= NumBlocks()) {
+    return Status::Corruption("Key index points to a non-existent block");
+  }
+  return Status::OK();
 }
 
 // Get the value for a specific key.
@@ -287,48 +422,226 @@ Status BufferedBlockReader::Get(const Slice& k, std::string* result) {
   Status status = MaybeLoadCache();
   if (!status.ok()) {
     return status;
+  } else if (!keyindex_.empty()) {
+    return IndexedGet(k, result);
   }
 
-  assert(indexes_.size() >= 16);
-  uint64_t bloomoffset = DecodeFixed64(&indexes_[0]);
-  uint64_t offset = DecodeFixed64(&indexes_[8]);
-  uint64_t next_bloomoffset;
-  uint64_t next_offset;
-  const size_t limit = indexes_.size();
-  size_t off = 16;
-  for (; off + 15 < limit; off += 16) {
-    next_bloomoffset = DecodeFixed64(&indexes_[off]);
-    next_offset = DecodeFixed64(&indexes_[off + 8]);
-    Slice bf(bloomfilter_.data() + bloomoffset, next_bloomoffset - bloomoffset);
-    if (BloomKeyMayMatch(k, bf)) {
-      if (GetFrom(&status, k, result, offset, next_offset - offset)) {
+  const size_t num_blocks = NumBlocks();
+  uint64_t offset;
+  size_t n;
+  for (size_t i = 0; i < num_blocks; i++) {
+    if (BloomKeyMayMatch(k, BlockFilter(i))) {
+      BlockRange(i, &offset, &n);
+      if (GetFrom(&status, k, result, offset, n, false)) {
         break;
       } else if (!status.ok()) {
         break;
       }
     }
+  }
+
+  return status;
+}
+
+namespace {
+struct Candidate {  // A data block that may contain a specific key
+  Candidate(uint32_t b, uint32_t k) : block(b), key(k) {}
+  bool operator<(const Candidate& other) const {
+    return block < other.block || (block == other.block && key < other.key);
+  }
+  uint32_t block;
+  uint32_t key;  // Index of the key in the batch
+};
+}  // namespace
+
+// Get the values for a batch of keys. All keys are first checked against
+// the key index or the block filters. Candidate data blocks are then visited
+// in write order, each read at most once.
+Status BufferedBlockReader::MultiGet(const Slice* keys, size_t n,
+                                     std::string* results) {
+  Status status = MaybeLoadCache();
+  if (!status.ok()) {
+    return status;
+  }
+
+  const bool sorted = !keyindex_.empty();
+  std::vector<Candidate> candidates;
+  if (sorted) {
+    std::vector<uint32_t> ids;
+    for (size_t j = 0; status.ok() && j < n; j++) {
+      status = BlockCandidates(keys[j], &ids);
+      for (size_t i = 0; status.ok() && i < ids.size(); i++) {
+        if (BloomKeyMayMatch(keys[j], BlockFilter(ids[i]))) {
+          candidates.push_back(Candidate(ids[i], static_cast<uint32_t>(j)));
+        }
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+  } else {
+    const size_t num_blocks = NumBlocks();
+    for (size_t i = 0; i < num_blocks; i++) {
+      Slice bf = BlockFilter(i);
+      for (size_t j = 0; j < n; j++) {
+        if (BloomKeyMayMatch(keys[j], bf)) {
+          candidates.push_back(Candidate(static_cast<uint32_t>(i),
+                                         static_cast<uint32_t>(j)));
+        }
+      }
+    }
+  }
+
+  std::vector<bool> found(n, false);
+  size_t i = 0;
+  while (status.ok() && i < candidates.size()) {
+    const uint32_t b = candidates[i].block;
+    size_t end = i;
+    bool any = false;  // If the block has any key not yet found
+    for (; end < candidates.size() && candidates[end].block == b; end++) {
+      any = any || !found[candidates[end].key];
+    }
+    if (any) {
+      BlockContents contents;
+      contents.heap_allocated = false;
+      contents.cachable = false;
+      uint64_t offset;
+      size_t size;
+      BlockRange(b, &offset, &size);
+      status = ReadBlock(offset, size, &contents.data);
+      if (status.ok()) {
+        Block block(contents);
+        for (; i < end; i++) {
+          const uint32_t j = candidates[i].key;
+          if (!found[j]) {
+            found[j] = Search(&block, keys[j], &results[j], sorted);
+          }
+        }
+      }
+    }
+    i = end;
+  }
+
+  return status;
+}
+
+// List all entries in write order. Data blocks are read sequentially, with
+// multiple consecutive blocks fetched using a single read of up to
+// options_.read_size bytes.
+Status BufferedBlockReader::Scan(Saver saver, void* arg, size_t* n) {
+  Status status = MaybeLoadCache();
+  *n = 0;
+  if (!status.ok()) {
+    return status;
+  }
+
+  const size_t num_blocks = NumBlocks();
+  size_t i = 0;
+  while (status.ok() && i < num_blocks) {
+    uint64_t start;
+    size_t size;
+    BlockRange(i, &start, &size);
+    size_t end = i + 1;  // Read blocks [i, end) together
+    for (; end < num_blocks; end++) {
+      uint64_t offset;
+      size_t next;
+      BlockRange(end, &offset, &next);
+      if (size + next > options_.read_size) break;
+      size += next;
+    }
+    Slice data;
+    if (size != 0) status = ReadBlock(start, size, &data);
+    for (; status.ok() && i < end; i++) {
+      uint64_t offset;
+      size_t len;
+      BlockRange(i, &offset, &len);
+      if (len == 0) continue;
+      BlockContents contents;
+      contents.data = Slice(data.data() + (offset - start), len);
+      contents.heap_allocated = false;
+      contents.cachable = false;
+      Block block(contents);
+      IteratorWrapper iter(block.NewIterator(NULL));
+      iter.SeekToFirst();
+      for (; iter.Valid(); iter.Next()) {
+        if (saver(arg, iter.key(), iter.value()) == -1) {
+          return status;  // User does not want to continue
+        }
+        ++(*n);
+      }
+      status = iter.status();
+    }
+  }
+
+  return status;
+}
 
-    bloomoffset = next_bloomoffset;
-    offset = next_offset;
+// Obtain the total number of entries stored in the table. Entry sizes are
+// obtained from the first non-empty data block so only a few bytes of the
+// table are read.
+Status BufferedBlockReader::Count(size_t* n) {
+  Status status = MaybeLoadCache();
+  *n = 0;
+  if (!status.ok()) {
+    return status;
+  }
+
+  const size_t num_blocks = NumBlocks();
+  size_t entry_size = 0;
+  uint64_t offset;
+  size_t size;
+  for (size_t i = 0; i < num_blocks; i++) {
+    BlockRange(i, &offset, &size);
+    if (size == 0) {
+      continue;
+    } else if (size < 8) {
+      return Status::Corruption("Data block too short to be valid");
+    } else if (entry_size == 0) {
+      Slice trailer;
+      status = ReadBlock(offset + size - 8, 8, &trailer);
+      if (!status.ok()) {
+        return status;
+      }
+      uint32_t value_size;
+      uint32_t key_size;
+      bool key_column;
+      if (!Block::DecodeTrailer(trailer.data(), &value_size, &key_size,
+                                &key_column)) {
+        return Status::Corruption("Cannot understand block contents");
+      }
+      entry_size = key_size + value_size;
+    }
+    *n += (size - 8) / entry_size;
   }
 
   return status;
 }
 
-Status BufferedBlockReader::LoadIndexesAndFilters(Slice* footer) {
+Status BufferedBlockReader::LoadIndexesAndFilters(Slice* footer,
+                                                  bool has_keyindex) {
   BlockHandle bloomfilter_handle;
   BlockHandle index_handle;
+  BlockHandle keyindex_handle;
   cache_status_ = bloomfilter_handle.DecodeFrom(footer);
   if (cache_status_.ok()) {
     cache_status_ = index_handle.DecodeFrom(footer);
   }
+  if (cache_status_.ok()) {
+    if (has_keyindex) {
+      cache_status_ = keyindex_handle.DecodeFrom(footer);
+    } else {
+      keyindex_handle.set_offset(index_handle.offset() + index_handle.size());
+      keyindex_handle.set_size(0);
+    }
+  }
   if (!cache_status_.ok()) {
     return cache_status_;
   }
 
   uint64_t start = bloomfilter_handle.offset();
   assert(start + bloomfilter_handle.size() == index_handle.offset());
-  size_t totalbytes = bloomfilter_handle.size() + index_handle.size();
+  assert(index_handle.offset() + index_handle.size() ==
+         keyindex_handle.offset());
+  size_t totalbytes = bloomfilter_handle.size() + index_handle.size() +
+                      keyindex_handle.size();
   cache_.resize(totalbytes);
   cache_status_ = src_->Read(start, totalbytes, &cache_contents_, &cache_[0]);
   if (cache_status_.ok()) {
@@ -340,9 +653,11 @@ Status BufferedBlockReader::LoadIndexesAndFilters(Slice* footer) {
     return cache_status_;
   }
 
-  indexes_ = bloomfilter_ = cache_contents_;
+  keyindex_ = indexes_ = bloomfilter_ = cache_contents_;
+  keyindex_.remove_prefix(bloomfilter_handle.size() + index_handle.size());
   indexes_.remove_prefix(bloomfilter_handle.size());
-  bloomfilter_.remove_suffix(index_handle.size());
+  indexes_.remove_suffix(keyindex_handle.size());
+  bloomfilter_.remove_suffix(index_handle.size() + keyindex_handle.size());
   if (indexes_.size() < 16) {
     cache_status_ = Status::Corruption("Indexes too short to be valid");
   }
@@ -358,11 +673,13 @@ Status BufferedBlockReader::MaybeLoadCache() {
     return cache_status_;
   }
 
-  const size_t footer_sz = 2 * BlockHandle::kMaxEncodedLength;
+  // Tables with a key index end with three handles and a magic number.
+  // Otherwise, the footer only has two handles.
+  const size_t footer_sz = 3 * BlockHandle::kMaxEncodedLength + 8;
   std::string footer_stor;
-  footer_stor.resize(footer_sz);
+  footer_stor.resize(std::min<uint64_t>(footer_sz, src_sz_));
   Slice footer;
-  if (src_sz_ < footer_stor.size()) {
+  if (src_sz_ < 2 * BlockHandle::kMaxEncodedLength) {
     cache_status_ = Status::Corruption("Input file too short for a footer");
   } else {
     cache_status_ = src_->Read(src_sz_ - footer_stor.size(), footer_stor.size(),
@@ -375,7 +692,15 @@ Status BufferedBlockReader::MaybeLoadCache() {
   }
 
   if (cache_status_.ok()) {
-    return LoadIndexesAndFilters(&footer);
+    const bool has_keyindex =
+        footer.size() == footer_sz &&
+        DecodeFixed64(footer.data() + footer_sz - 8) == kPdbKeyIndexMagicNumber;
+    if (has_keyindex) {
+      footer.remove_suffix(8);
+    }
+    footer.remove_prefix(footer.size() - (has_keyindex ? 3 : 2) *
+                                              BlockHandle::kMaxEncodedLength);
+    return LoadIndexesAndFilters(&footer, has_keyindex);
   } else {
     return cache_status_;
   }
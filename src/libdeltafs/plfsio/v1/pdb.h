@@ -12,9 +12,12 @@
 #pragma once
 
 #include "builder.h"
+#include "cuckoo.h"
 #include "doublebuf.h"
 #include "filter.h"
 
+#include <vector>
+
 namespace pdlfs {
 namespace plfsio {
 
@@ -27,6 +30,9 @@ class ArrayBlockBuilder;
 
 // Directly write data as formatted data blocks.
 // Incoming key-value pairs are assumed to be fixed sized.
+// If options.pdb_index_keys is not zero, each data block is sorted before
+// written and a key index that maps keys to data blocks is appended to the
+// table along with per-block bloom filters.
 class BufferedBlockWriter : public DoubleBuffering {
  public:
   BufferedBlockWriter(const DirOptions& options, WritableFile* dst,
@@ -43,6 +49,8 @@ class BufferedBlockWriter : public DoubleBuffering {
   Status Flush();
   // Sync data to storage.
   Status Sync();
+  // Obtain write pipeline statistics.
+  PipelineStats GetStats();
 
   // Finalize the writer.
   Status Finish();
@@ -53,6 +61,23 @@ class BufferedBlockWriter : public DoubleBuffering {
   typedef ArrayBlockBuilder BlockBuf;
   typedef ArrayBlock Block;
   typedef BloomBlock BloomBuilder;
+  // Fingerprints are 8 bits and values (block ids) are 24 bits
+  typedef CuckooBlock<8, 24> KeyIndex;
+  static const uint32_t kMaxBlocks = (1u << 24) - 1;
+  // Keys are always stored in rows so that keys collected from a block for
+  // the key index stay valid and readers may search blocks as-is.
+  static DirOptions RowOptions(const DirOptions& options) {
+    DirOptions result = options;
+    result.key_column = false;
+    return result;
+  }
+  // A write buffer. Keys are hashed for the bloom filter as they are
+  // inserted so that compactions need not revisit them.
+  struct WriteBuf {
+    WriteBuf(const DirOptions& options) : bb(RowOptions(options), true) {}
+    BlockBuf bb;  // Always in an unordered, row-oriented fmt
+    std::vector<uint64_t> hashes;
+  };
   const DirOptions& options_;
   WritableFile* const dst_;
   port::Mutex mu_;
@@ -63,6 +88,8 @@ class BufferedBlockWriter : public DoubleBuffering {
   uint64_t offset_;  // Current write offset
   std::string bloomfilter_;
   std::string indexes_;
+  // NULL if key index is disabled or if the table has too many blocks
+  KeyIndex* keyindex_;
 
   friend class DoubleBuffering;
   Status Compact(uint32_t seq, void* buf);
@@ -70,24 +97,30 @@ class BufferedBlockWriter : public DoubleBuffering {
   Status DumpIndexesAndFilters();
   Status Close();
   void ScheduleCompaction(uint32_t seq, void* buf);
-  void Clear(void* buf) { static_cast<BlockBuf*>(buf)->Reset(); }
+  void Clear(void* buf) {
+    static_cast<WriteBuf*>(buf)->bb.Reset();
+    static_cast<WriteBuf*>(buf)->hashes.clear();
+  }
   void AddToBuffer(void* buf, const Slice& k, const Slice& v) {
-    static_cast<BlockBuf*>(buf)->Add(k, v);
+    WriteBuf* const wb = static_cast<WriteBuf*>(buf);
+    if (options_.bf_bits_per_key != 0) wb->hashes.push_back(BloomHash(k));
+    wb->bb.Add(k, v);
   }
   bool HasRoom(const void* buf, const Slice& k, const Slice& v) {
-    return (static_cast<const BlockBuf*>(buf)->CurrentSizeEstimate() +
+    return (static_cast<const WriteBuf*>(buf)->bb.CurrentSizeEstimate() +
                 k.size() + v.size() <=
             buf_threshold_);
   }
   bool IsEmpty(const void* buf) {
-    return static_cast<const BlockBuf*>(buf)->empty();
+    return static_cast<const WriteBuf*>(buf)->bb.empty();
   }
 
   static void BGWork(void*);
 
   BlockHandle bloomfilter_handle_;
   BlockHandle index_handle_;
-  BlockBuf** bbs_;
+  BlockHandle keyindex_handle_;
+  WriteBuf** wbs_;
   size_t n_;
 };
 
@@ -99,6 +132,19 @@ class BufferedBlockReader {
 
   Status Get(const Slice& k, std::string* result);
 
+  // Get the values for a batch of n keys. The value of keys[i] is stored in
+  // results[i], which is left untouched if keys[i] is not found. Each data
+  // block is read at most once.
+  Status MultiGet(const Slice* keys, size_t n, std::string* results);
+
+  // List all entries in write order. Stop early if saver returns -1.
+  // Store the number of entries reported in *n.
+  typedef int (*Saver)(void* arg, const Slice& key, const Slice& value);
+  Status Scan(Saver saver, void* arg, size_t* n);
+
+  // Obtain the total number of entries in the table.
+  Status Count(size_t* n);
+
  private:
   typedef ArrayBlock Block;
   const DirOptions& options_;
@@ -107,14 +153,25 @@ class BufferedBlockReader {
   Status cache_status_;  // OK if cache is ready
   Slice cache_contents_;
   std::string cache_;
-
+  std::string buf_;  // Space for reading data blocks
+
+  // Total number of data blocks, including empty ones.
+  size_t NumBlocks() const { return indexes_.size() / 16 - 1; }
+  Slice BlockFilter(size_t i) const;
+  void BlockRange(size_t i, uint64_t* offset, size_t* n) const;
+  Status ReadBlock(uint64_t offset, size_t n, Slice* result);
+  static bool Search(Block* block, const Slice& k, std::string* result,
+                     bool sorted);
   bool GetFrom(Status* status, const Slice& k, std::string* result,
-               uint64_t off, size_t n);
-  Status LoadIndexesAndFilters(Slice* footer);
+               uint64_t off, size_t n, bool sorted);
+  Status BlockCandidates(const Slice& k, std::vector<uint32_t>* ids);
+  Status IndexedGet(const Slice& k, std::string* result);
+  Status LoadIndexesAndFilters(Slice* footer, bool has_keyindex);
   Status MaybeLoadCache();
 
   Slice bloomfilter_;
   Slice indexes_;
+  Slice keyindex_;  // Empty if the table has no key index
 };
 
 }  // namespace plfsio
@@ -17,6 +17,9 @@
 #include "pdlfs-common/testutil.h"
 #include "pdlfs-common/xxhash.h"
 
+#include <string>
+#include <vector>
+
 #if __cplusplus >= 201103
 #define OVERRIDE override
 #else
@@ -67,6 +70,250 @@ class EmulatedEnv : public EnvWrapper {
 
 }  // namespace
 
+class PdbTest {
+ public:
+  PdbTest()
+      : writer_(NULL), reader_(NULL), dst_(NULL), src_(NULL), pool_(NULL) {
+    fname_ = test::TmpDir() + "/pdb_test.tbl";
+    env_ = Env::Default();
+    options_.key_size = 8;
+    options_.value_size = 8;
+    options_.allow_env_threads = false;
+  }
+
+  ~PdbTest() {
+    delete reader_;
+    delete src_;
+    delete writer_;
+    delete dst_;
+    delete pool_;
+  }
+
+  void OpenWriter(size_t buf_size, size_t n = 2) {
+    ASSERT_OK(env_->NewWritableFile(fname_.c_str(), &dst_));
+    writer_ = new BufferedBlockWriter(options_, dst_, buf_size, n);
+  }
+
+  void Add(uint64_t k, uint64_t v) {
+    char key[8];
+    char val[8];
+    EncodeFixed64(key, k);
+    EncodeFixed64(val, v);
+    ASSERT_OK(writer_->Add(Slice(key, 8), Slice(val, 8)));
+  }
+
+  void Finish() {
+    ASSERT_OK(writer_->Finish());
+    delete writer_;
+    writer_ = NULL;
+    delete dst_;
+    dst_ = NULL;
+  }
+
+  void OpenReader() {
+    uint64_t sz;
+    ASSERT_OK(env_->GetFileSize(fname_.c_str(), &sz));
+    ASSERT_OK(env_->NewRandomAccessFile(fname_.c_str(), &src_));
+    reader_ = new BufferedBlockReader(options_, src_, sz);
+  }
+
+  // Return the value of a key, or -1 if the key is not found.
+  int64_t Get(uint64_t k) {
+    char key[8];
+    EncodeFixed64(key, k);
+    std::string val;
+    Status s = reader_->Get(Slice(key, 8), &val);
+    ASSERT_OK(s);
+    if (val.empty()) return -1;
+    ASSERT_EQ(val.size(), 8);
+    return static_cast<int64_t>(DecodeFixed64(val.data()));
+  }
+
+  static int SaveKey(void* arg, const Slice& key, const Slice& value) {
+    reinterpret_cast<std::vector<uint64_t>*>(arg)->push_back(
+        DecodeFixed64(key.data()));
+    return 0;
+  }
+
+  static int StopAfterTen(void* arg, const Slice& key, const Slice& value) {
+    std::vector<uint64_t>* const keys =
+        reinterpret_cast<std::vector<uint64_t>*>(arg);
+    keys->push_back(DecodeFixed64(key.data()));
+    return keys->size() < 10 ? 0 : -1;
+  }
+
+  // Look up keys [0, 2 * num_keys) in a single batch.
+  void MultiGet(size_t num_keys) {
+    std::vector<std::string> keys(2 * num_keys, std::string(8, 0));
+    std::vector<Slice> slices;
+    for (size_t i = 0; i < keys.size(); i++) {
+      EncodeFixed64(&keys[i][0], i);
+      slices.push_back(keys[i]);
+    }
+    std::vector<std::string> results(keys.size());
+    ASSERT_OK(reader_->MultiGet(&slices[0], slices.size(), &results[0]));
+    for (size_t i = 0; i < num_keys; i++) {
+      ASSERT_EQ(results[i].size(), 8);
+      ASSERT_EQ(DecodeFixed64(results[i].data()), i + 1);
+    }
+    for (size_t i = num_keys; i < keys.size(); i++) {
+      ASSERT_TRUE(results[i].empty());
+    }
+  }
+
+  // Write keys in a scrambled order across many blocks and read them back.
+  void WriteAndRead(size_t num_keys, size_t n = 2) {
+    OpenWriter(16 * 100, n);  // 100 keys per block
+    for (size_t i = 0; i < num_keys; i++) {
+      uint64_t k = (i * 7919) % num_keys;
+      Add(k, k + 1);
+    }
+    Finish();
+    OpenReader();
+    for (size_t i = 0; i < num_keys; i++) {
+      ASSERT_EQ(Get(i), static_cast<int64_t>(i + 1));
+    }
+    for (size_t i = num_keys; i < 2 * num_keys; i++) {
+      ASSERT_EQ(Get(i), -1);
+    }
+  }
+
+  DirOptions options_;
+  std::string fname_;
+  BufferedBlockWriter* writer_;
+  BufferedBlockReader* reader_;
+  WritableFile* dst_;
+  RandomAccessFile* src_;
+  ThreadPool* pool_;
+  Env* env_;
+};
+
+TEST(PdbTest, Empty) {
+  options_.pdb_index_keys = 1024;
+  OpenWriter(4096);
+  Finish();
+  OpenReader();
+  ASSERT_EQ(Get(1), -1);
+  size_t n = 1;
+  ASSERT_OK(reader_->Count(&n));
+  ASSERT_EQ(n, 0);
+  std::vector<uint64_t> keys;
+  ASSERT_OK(reader_->Scan(SaveKey, &keys, &n));
+  ASSERT_EQ(n, 0);
+}
+
+TEST(PdbTest, LinearScan) {
+  WriteAndRead(10000);  //
+}
+
+TEST(PdbTest, KeyIndex) {
+  options_.pdb_index_keys = 10000;
+  WriteAndRead(10000);
+}
+
+TEST(PdbTest, KeyIndexOverflow) {
+  options_.pdb_index_keys = 1000;  // Far less than needed
+  WriteAndRead(10000);
+}
+
+TEST(PdbTest, KeyIndexNoFilter) {
+  options_.pdb_index_keys = 10000;
+  options_.bf_bits_per_key = 0;
+  WriteAndRead(10000);
+}
+
+TEST(PdbTest, ParallelCompactions) {
+  pool_ = ThreadPool::NewFixed(4);
+  options_.compaction_pool = pool_;
+  options_.pdb_index_keys = 10000;
+  WriteAndRead(10000, 8);
+}
+
+// Tables without a key index must keep the original two-handle footer so
+// they stay readable by older readers, and vice versa.
+TEST(PdbTest, NoKeyIndexFooter) {
+  WriteAndRead(1000);
+  uint64_t sz;
+  ASSERT_OK(env_->GetFileSize(fname_.c_str(), &sz));
+  const size_t footer_sz = 2 * BlockHandle::kMaxEncodedLength;
+  ASSERT_TRUE(sz > footer_sz);
+  std::string footer_stor(footer_sz, 0);
+  Slice footer;
+  ASSERT_OK(src_->Read(sz - footer_sz, footer_sz, &footer, &footer_stor[0]));
+  BlockHandle bloomfilter_handle;
+  BlockHandle index_handle;
+  ASSERT_OK(bloomfilter_handle.DecodeFrom(&footer));
+  ASSERT_OK(index_handle.DecodeFrom(&footer));
+  ASSERT_EQ(bloomfilter_handle.offset() + bloomfilter_handle.size(),
+            index_handle.offset());
+  ASSERT_EQ(index_handle.offset() + index_handle.size(), sz - footer_sz);
+  size_t n = 0;
+  ASSERT_OK(reader_->Count(&n));
+  ASSERT_EQ(n, 1000);
+}
+
+TEST(PdbTest, MultiGet) {
+  WriteAndRead(10000);
+  MultiGet(10000);
+}
+
+TEST(PdbTest, IndexedMultiGet) {
+  options_.pdb_index_keys = 10000;
+  WriteAndRead(10000);
+  MultiGet(10000);
+}
+
+TEST(PdbTest, ScanAndCount) {
+  options_.read_size = 4096;  // Force multiple reads
+  OpenWriter(16 * 100);
+  for (uint64_t k = 0; k < 1000; k++) {
+    Add(k, k);
+    if (k % 250 == 0) {
+      ASSERT_OK(writer_->Flush());  // Insert some small blocks
+    }
+  }
+  Finish();
+  OpenReader();
+  size_t n = 0;
+  ASSERT_OK(reader_->Count(&n));
+  ASSERT_EQ(n, 1000);
+  std::vector<uint64_t> keys;
+  ASSERT_OK(reader_->Scan(SaveKey, &keys, &n));
+  ASSERT_EQ(n, 1000);
+  ASSERT_EQ(keys.size(), 1000);
+  for (uint64_t k = 0; k < 1000; k++) {
+    ASSERT_EQ(keys[k], k);  // Write order
+  }
+  keys.clear();
+  ASSERT_OK(reader_->Scan(StopAfterTen, &keys, &n));
+  ASSERT_EQ(n, 9);
+  ASSERT_EQ(keys.size(), 10);
+}
+
+TEST(PdbTest, KeyColumn) {
+  options_.key_column = true;  // Ignored by tables, which store rows
+  options_.pdb_index_keys = 10000;
+  WriteAndRead(1000);
+  size_t n = 0;
+  ASSERT_OK(reader_->Count(&n));
+  ASSERT_EQ(n, 1000);
+}
+
+TEST(PdbTest, DuplicateKeys) {
+  options_.pdb_index_keys = 64;
+  OpenWriter(16 * 4);  // 4 keys per block
+  Add(3, 1);
+  Add(1, 1);
+  Add(3, 2);  // Same block
+  Add(2, 1);
+  Add(1, 2);  // Next block
+  Finish();
+  OpenReader();
+  ASSERT_EQ(Get(1), 1);
+  ASSERT_EQ(Get(2), 1);
+  ASSERT_EQ(Get(3), 1);
+}
+
 // Measure implementation's bandwidth utilization under
 // different configurations.
 class PdbBench {
@@ -92,10 +339,12 @@ class PdbBench {
     bytes_per_sec_ = GetOption("BYTES_PER_SEC", 6000000);
     buf_size_ = GetOption("BUF_SIZE", 4 << 20);
     n_ = GetOption("NUM_BUFS", 4);
+    index_keys_ = GetOption("INDEX_KEYS", 0);
     thread_pool_ = ThreadPool::NewFixed(n_, true /* eager init */);
     options_.bf_bits_per_key = bf_bits_per_key_;
     options_.compaction_pool = thread_pool_;
     options_.cuckoo_frac = -1;
+    options_.pdb_index_keys = index_keys_;
   }
 
   ~PdbBench() {  //
@@ -152,6 +401,7 @@ class PdbBench {
   size_t bf_bits_per_key_;
   size_t buf_size_;
   size_t n_;
+  int index_keys_;
   int mkeys_;
 };
 
@@ -0,0 +1,706 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+// A stand-alone plfsio benchmark suite. Runs without MPI against a local
+// directory or an in-memory Env, and reports one row per benchmark run as
+// CSV or JSON so results can be compared between releases.
+//
+// Sample usage:
+//   plfsio_bench --benchmarks=write,sort,filter,read,batchread,scan
+//       --env=mem --num=1000000 --threads=1,2,4 --lg_parts=0,2 --format=csv
+
+#include "filter.h"
+#include "internal.h"
+#include "types.h"
+#include "v1.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/histogram.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
+#include "pdlfs-common/strutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace pdlfs {
+namespace plfsio {
+
+struct BenchFlags {
+  BenchFlags()
+      : benchmarks("write,sort,filter,read,batchread,scan"),
+        env_name("mem"),
+        dir("/tmp/plfsio_bench"),
+        num(1000000),
+        epochs(1),
+        key_size(8),
+        value_size(32),
+        threads("1,2,4"),
+        lg_parts("0,2"),
+        bg_threads(4),
+        reads(100000),
+        probes(10000),
+        batch_size(64),
+        filters("bloom,bitmap:uncompressed,bitmap:roar,bitmap:fast-vb+,"
+                "bitmap:vb+,bitmap:vb,bitmap:fast-p-f-delta,bitmap:p-f-delta"),
+        format("csv") {}
+
+  std::string benchmarks;  // Comma-separated list of benchmarks to run
+  std::string env_name;    // Name of the Env, such as "mem" or "posix"
+  std::string env_conf;    // Env options, such as "read_micros=500"
+  std::string dir;         // Directory under which all dirs are created
+  std::string conf;        // Extra directory options, as in "k1=v1&k2=v2"
+  int num;                 // Number of keys per epoch
+  int epochs;              // Number of epochs to write
+  int key_size;
+  int value_size;
+  std::string threads;   // Comma-separated list of writer thread counts
+  std::string lg_parts;  // Comma-separated list of lg_parts
+  int bg_threads;        // Background threads for compaction and reads
+  int reads;             // Number of point reads
+  int probes;            // Number of filter probes
+  int batch_size;        // Number of keys per batch read
+  std::string filters;   // Comma-separated list of filters to build
+  std::string format;    // Output format, either "csv" or "json"
+};
+
+// Result of a single benchmark run.
+struct BenchResult {
+  BenchResult() : ops(0), bytes(0), micros(0), p50(0), p99(0), extra(0) {}
+  std::string name;
+  std::string config;  // Parameters of the run, such as "threads=4"
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t micros;
+  double p50;  // Per-op latency in micros, if measured
+  double p99;
+  // Benchmark specific number. Bits per key for filter builds and the false
+  // positive rate for filter probes.
+  double extra;
+};
+
+class BenchReporter {
+ public:
+  explicit BenchReporter(bool json) : json_(json), num_rows_(0) {
+    if (json_) {
+      fprintf(stdout, "[\n");
+    } else {
+      fprintf(stdout,
+              "benchmark,config,ops,bytes,micros,ops_per_sec,mb_per_sec,"
+              "p50_us,p99_us,extra\n");
+    }
+  }
+
+  ~BenchReporter() {
+    if (json_) {
+      fprintf(stdout, "\n]\n");
+    }
+  }
+
+  void Report(const BenchResult& r) {
+    const double secs = r.micros / 1000.0 / 1000.0;
+    const double ops_per_sec = secs > 0 ? r.ops / secs : 0;
+    const double mb_per_sec = secs > 0 ? r.bytes / 1048576.0 / secs : 0;
+    if (json_) {
+      fprintf(stdout,
+              "%s  {\"benchmark\":\"%s\",\"config\":\"%s\",\"ops\":%llu,"
+              "\"bytes\":%llu,\"micros\":%llu,\"ops_per_sec\":%.1f,"
+              "\"mb_per_sec\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+              "\"extra\":%g}",
+              num_rows_ != 0 ? ",\n" : "", r.name.c_str(), r.config.c_str(),
+              static_cast<unsigned long long>(r.ops),
+              static_cast<unsigned long long>(r.bytes),
+              static_cast<unsigned long long>(r.micros), ops_per_sec,
+              mb_per_sec, r.p50, r.p99, r.extra);
+    } else {
+      fprintf(stdout, "%s,%s,%llu,%llu,%llu,%.1f,%.3f,%.3f,%.3f,%g\n",
+              r.name.c_str(), r.config.c_str(),
+              static_cast<unsigned long long>(r.ops),
+              static_cast<unsigned long long>(r.bytes),
+              static_cast<unsigned long long>(r.micros), ops_per_sec,
+              mb_per_sec, r.p50, r.p99, r.extra);
+    }
+    fflush(stdout);
+    num_rows_++;
+  }
+
+ private:
+  const bool json_;
+  int num_rows_;
+};
+
+static std::vector<int> ParseIntList(const std::string& input) {
+  std::vector<std::string> parts;
+  SplitString(&parts, input.c_str(), ',');
+  std::vector<int> result;
+  for (size_t i = 0; i < parts.size(); i++) {
+    result.push_back(atoi(parts[i].c_str()));
+  }
+  return result;
+}
+
+static void SetLatencies(const Histogram& hist, BenchResult* r) {
+  r->p50 = hist.Median();
+  r->p99 = hist.Percentile(99);
+}
+
+class PlfsIoBench {
+ public:
+  PlfsIoBench(const BenchFlags& flags, Env* env)
+      : flags_(flags),
+        env_(env),
+        reporter_(flags.format == "json"),
+        pool_(NULL),
+        has_read_dir_(false) {
+    if (flags_.bg_threads > 0) {
+      pool_ = ThreadPool::NewFixed(flags_.bg_threads);
+    }
+    value_.assign(flags_.value_size, 'x');
+    env_->CreateDir(flags_.dir.c_str());
+  }
+
+  ~PlfsIoBench() { delete pool_; }
+
+  void Run() {
+    std::vector<std::string> names;
+    SplitString(&names, flags_.benchmarks.c_str(), ',');
+    for (size_t i = 0; i < names.size(); i++) {
+      const std::string& name = names[i];
+      if (name == "write") {
+        Write();
+      } else if (name == "sort") {
+        Sort();
+      } else if (name == "filter") {
+        Filters();
+      } else if (name == "read") {
+        Read();
+      } else if (name == "batchread") {
+        BatchRead();
+      } else if (name == "scan") {
+        Scan(false);
+      } else if (name == "keyscan") {
+        Scan(true);
+      } else {
+        fprintf(stderr, "Unknown benchmark '%s'\n", name.c_str());
+      }
+    }
+  }
+
+ private:
+  // Keys are unique 64-bit integers derived from a sequence number and
+  // padded with zeros to the configured key size. Keys shorter than 8 bytes
+  // only keep the leading bytes of the integer.
+  void MakeKey(uint64_t seq, std::string* key) const {
+    char tmp[8];
+    EncodeFixed64(tmp, seq * 0x9e3779b97f4a7c15ull);
+    key->assign(flags_.key_size, 0);
+    memcpy(&(*key)[0], tmp, std::min<size_t>(sizeof(tmp), key->size()));
+  }
+
+  DirOptions MakeOptions(int lg_parts) const {
+    DirOptions options = ParseDirOptions(flags_.conf.c_str());
+    options.key_size = flags_.key_size;
+    options.value_size = flags_.value_size;
+    options.lg_parts = lg_parts;
+    // Each partition needs more than block_batch_size bytes of write buffer
+    const size_t parts = size_t(1) << std::max(lg_parts, 0);
+    if (options.total_memtable_budget <= parts * options.block_batch_size) {
+      options.total_memtable_budget = 2 * parts * options.block_batch_size;
+    }
+    options.compaction_pool = pool_;
+    options.reader_pool = pool_;
+    options.env = env_;
+    return options;
+  }
+
+  struct WriteState {
+    explicit WriteState(DirWriter* w) : writer(w), cv(&mu), num_running(0) {}
+    DirWriter* writer;
+    port::Mutex mu;
+    port::CondVar cv;
+    int num_running;  // Protected by mu
+    Status status;    // Protected by mu
+  };
+
+  struct WriteTask {
+    const PlfsIoBench* bench;
+    WriteState* state;
+    uint64_t start;  // First key sequence number
+    uint64_t limit;
+    int epoch;
+  };
+
+  static void WriteBody(void* arg) {
+    WriteTask* const t = reinterpret_cast<WriteTask*>(arg);
+    std::string key;
+    Status s;
+    for (uint64_t seq = t->start; seq < t->limit && s.ok(); seq++) {
+      t->bench->MakeKey(seq, &key);
+      s = t->state->writer->Add(key, t->bench->value_, t->epoch);
+    }
+    MutexLock ml(&t->state->mu);
+    if (t->state->status.ok()) t->state->status = s;
+    t->state->num_running--;
+    t->state->cv.SignalAll();
+  }
+
+  // Write all epochs to a new directory using a given number of threads.
+  // Return the time it took.
+  uint64_t WriteDir(const std::string& dirname, int lg_parts, int threads) {
+    const DirOptions options = MakeOptions(lg_parts);
+    DestroyDir(dirname, options);
+    DirWriter* writer;
+    Status s = DirWriter::Open(options, dirname, &writer);
+    if (!s.ok()) {
+      fprintf(stderr, "Cannot open dir '%s': %s\n", dirname.c_str(),
+              s.ToString().c_str());
+      exit(1);
+    }
+    WriteState state(writer);
+    std::vector<WriteTask> tasks(threads);
+    const uint64_t start = env_->NowMicros();
+    for (int e = 0; e < flags_.epochs && s.ok(); e++) {
+      const uint64_t base = static_cast<uint64_t>(e) * flags_.num;
+      state.num_running = threads;
+      for (int i = 0; i < threads; i++) {
+        tasks[i].bench = this;
+        tasks[i].state = &state;
+        tasks[i].start = base + uint64_t(flags_.num) * i / threads;
+        tasks[i].limit = base + uint64_t(flags_.num) * (i + 1) / threads;
+        tasks[i].epoch = e;
+        env_->StartThread(WriteBody, &tasks[i]);
+      }
+      {
+        MutexLock ml(&state.mu);
+        while (state.num_running != 0) state.cv.Wait();
+        s = state.status;
+      }
+      if (s.ok()) s = writer->EpochFlush(e);
+    }
+    if (s.ok()) s = writer->Finish();
+    const uint64_t micros = env_->NowMicros() - start;
+    delete writer;
+    if (!s.ok()) {
+      fprintf(stderr, "Cannot write dir '%s': %s\n", dirname.c_str(),
+              s.ToString().c_str());
+      exit(1);
+    }
+    return micros;
+  }
+
+  // Ingestion throughput as a function of writer threads and lg_parts.
+  void Write() {
+    const std::vector<int> threads = ParseIntList(flags_.threads);
+    const std::vector<int> parts = ParseIntList(flags_.lg_parts);
+    for (size_t i = 0; i < parts.size(); i++) {
+      for (size_t j = 0; j < threads.size(); j++) {
+        if (threads[j] <= 0) continue;
+        BenchResult r;
+        r.name = "write";
+        char tmp[100];
+        snprintf(tmp, sizeof(tmp), "threads=%d lg_parts=%d", threads[j],
+                 parts[i]);
+        r.config = tmp;
+        r.micros = WriteDir(flags_.dir + "/write", parts[i], threads[j]);
+        r.ops = uint64_t(flags_.num) * flags_.epochs;
+        r.bytes = r.ops * (flags_.key_size + flags_.value_size);
+        reporter_.Report(r);
+      }
+    }
+  }
+
+  void Sort() {
+    DirOptions options = MakeOptions(0);
+    WriteBuffer buf(options);
+    buf.Reserve(size_t(flags_.num) * (flags_.key_size + flags_.value_size));
+    std::string key;
+    for (int i = 0; i < flags_.num; i++) {
+      MakeKey(i, &key);
+      buf.Add(key, value_);
+    }
+    BenchResult r;
+    r.name = "sort";
+    r.config = "memtable";
+    const uint64_t start = env_->NowMicros();
+    buf.Finish(false);
+    r.micros = env_->NowMicros() - start;
+    r.ops = flags_.num;
+    r.bytes = buf.CurrentBufferSize();
+    reporter_.Report(r);
+  }
+
+  template <typename T, bool (*KeyMayMatch)(const Slice&, const Slice&)>
+  void RunFilter(const std::string& label, const DirOptions& options) {
+    // Keys are distinct bm_key_bits-bit integers. The first n keys are
+    // inserted. Half the probes look for inserted keys and the other half
+    // for keys following them, which are used to measure false positives.
+    const uint32_t mask = (options.bm_key_bits >= 32)
+                              ? ~uint32_t(0)
+                              : (uint32_t(1) << options.bm_key_bits) - 1;
+    const uint32_t n = std::min(uint32_t(flags_.num), (mask >> 1) + 1);
+    std::vector<std::string> keys(2 * size_t(n));
+    for (uint32_t i = 0; i < 2 * n; i++) {
+      keys[i].resize(4);
+      EncodeFixed32(&keys[i][0], (i * 2654435761u) & mask);
+    }
+    T ft(options, 0);
+    BenchResult r;
+    r.name = "filter_build";
+    r.config = label;
+    uint64_t start = env_->NowMicros();
+    ft.Reset(n);
+    for (uint32_t i = 0; i < n; i++) {
+      ft.AddKey(keys[i]);
+    }
+    const std::string contents = ft.Finish().ToString();
+    r.micros = env_->NowMicros() - start;
+    r.ops = n;
+    r.bytes = contents.size();
+    r.extra = 8.0 * contents.size() / n;  // Bits per key
+    reporter_.Report(r);
+
+    r = BenchResult();
+    r.name = "filter_probe";
+    r.config = label;
+    const uint32_t m = std::max(1u, std::min(n, uint32_t(flags_.probes / 2)));
+    uint64_t false_positives = 0;
+    start = env_->NowMicros();
+    for (uint32_t i = 0; i < m; i++) {
+      KeyMayMatch(keys[i], contents);
+      if (KeyMayMatch(keys[n + i], contents)) false_positives++;
+    }
+    r.micros = env_->NowMicros() - start;
+    r.ops = 2 * m;
+    r.extra = double(false_positives) / m;  // False positive rate
+    reporter_.Report(r);
+  }
+
+  // Build, probe, space, and false positive rate of every filter format.
+  void Filters() {
+    std::vector<std::string> specs;
+    SplitString(&specs, flags_.filters.c_str(), ',');
+    for (size_t i = 0; i < specs.size(); i++) {
+      const std::string& spec = specs[i];
+      DirOptions options = MakeOptions(0);
+      if (spec == "bloom") {
+        RunFilter<BloomBlock, BloomKeyMayMatch>(spec, options);
+        continue;
+      }
+      const std::string conf = "bm_fmt=" + spec.substr(spec.find(':') + 1);
+      options.bm_fmt = ParseDirOptions(conf.c_str()).bm_fmt;
+      switch (options.bm_fmt) {
+#define BM_RUN(fmt, T)                                                \
+  case fmt:                                                           \
+    RunFilter<BitmapBlock<T>, BitmapKeyMustMatch>(spec, options); \
+    break
+        BM_RUN(kFmtUncompressed, UncompressedFormat);
+        BM_RUN(kFmtRoaring, RoaringFormat);
+        BM_RUN(kFmtFastVarintPlus, FastVbPlusFormat);
+        BM_RUN(kFmtVarintPlus, VbPlusFormat);
+        BM_RUN(kFmtVarint, VbFormat);
+        BM_RUN(kFmtFastPfDelta, FastPfDeltaFormat);
+        BM_RUN(kFmtPfDelta, PfDeltaFormat);
+#undef BM_RUN
+      }
+    }
+  }
+
+  // Write a directory for the read benchmarks unless it has been written.
+  DirReader* OpenReadDir() {
+    const std::vector<int> parts = ParseIntList(flags_.lg_parts);
+    const int lg_parts = parts.empty() ? 0 : parts[0];
+    const std::string dirname = flags_.dir + "/read";
+    if (!has_read_dir_) {
+      WriteDir(dirname, lg_parts, 1);
+      has_read_dir_ = true;
+    }
+    DirReader* reader;
+    Status s = DirReader::Open(MakeOptions(-1), dirname, &reader);
+    if (!s.ok()) {
+      fprintf(stderr, "Cannot open dir '%s': %s\n", dirname.c_str(),
+              s.ToString().c_str());
+      exit(1);
+    }
+    return reader;
+  }
+
+  // Point reads. Half the reads look for keys that do not exist.
+  void Read() {
+    DirReader* const reader = OpenReadDir();
+    const uint64_t total = uint64_t(flags_.num) * flags_.epochs;
+    Histogram hist;
+    hist.Clear();
+    BenchResult r;
+    r.name = "read";
+    r.config = "point";
+    std::string key;
+    std::string dst;
+    DirReader::ReadOp op;
+    Random rnd(301);
+    const uint64_t start = env_->NowMicros();
+    for (int i = 0; i < flags_.reads; i++) {
+      uint64_t seq = rnd.Next() % total;
+      if (i & 1) seq += total;  // Miss
+      MakeKey(seq, &key);
+      dst.clear();
+      const uint64_t t = env_->NowMicros();
+      Status s = reader->Read(op, key, &dst);
+      hist.Add(double(env_->NowMicros() - t));
+      if (!s.ok()) {
+        fprintf(stderr, "Read error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+      r.bytes += dst.size();
+    }
+    r.micros = env_->NowMicros() - start;
+    r.ops = flags_.reads;
+    SetLatencies(hist, &r);
+    reporter_.Report(r);
+    delete reader;
+  }
+
+  struct BatchState {
+    BatchState() : cv(&mu), num_running(0), bytes(0) {}
+    port::Mutex mu;
+    port::CondVar cv;
+    int num_running;  // Protected by mu
+    uint64_t bytes;   // Protected by mu
+    Status status;    // Protected by mu
+  };
+
+  struct BatchTask {
+    DirReader* reader;
+    BatchState* state;
+    std::vector<std::string> keys;
+  };
+
+  static void BatchBody(void* arg) {
+    BatchTask* const t = reinterpret_cast<BatchTask*>(arg);
+    DirReader::ReadOp op;
+    op.no_parallel_reads = true;  // Parallelism comes from the batch
+    std::string dst;
+    uint64_t bytes = 0;
+    Status s;
+    for (size_t i = 0; i < t->keys.size() && s.ok(); i++) {
+      dst.clear();
+      s = t->reader->Read(op, t->keys[i], &dst);
+      bytes += dst.size();
+    }
+    MutexLock ml(&t->state->mu);
+    if (t->state->status.ok()) t->state->status = s;
+    t->state->bytes += bytes;
+    t->state->num_running--;
+    t->state->cv.SignalAll();
+  }
+
+  // Batches of existing keys read concurrently by the background threads.
+  void BatchRead() {
+    DirReader* const reader = OpenReadDir();
+    const uint64_t total = uint64_t(flags_.num) * flags_.epochs;
+    const int workers = std::max(1, flags_.bg_threads);
+    const int num_batches = std::max(1, flags_.reads / flags_.batch_size);
+    Histogram hist;
+    hist.Clear();
+    BenchResult r;
+    r.name = "batchread";
+    char tmp[100];
+    snprintf(tmp, sizeof(tmp), "batch_size=%d workers=%d", flags_.batch_size,
+             workers);
+    r.config = tmp;
+    Random rnd(301);
+    std::vector<BatchTask> tasks(workers);
+    const uint64_t start = env_->NowMicros();
+    for (int b = 0; b < num_batches; b++) {
+      BatchState state;
+      for (int w = 0; w < workers; w++) {
+        tasks[w].reader = reader;
+        tasks[w].state = &state;
+        tasks[w].keys.clear();
+      }
+      for (int i = 0; i < flags_.batch_size; i++) {
+        std::vector<std::string>* const keys = &tasks[i % workers].keys;
+        keys->resize(keys->size() + 1);
+        MakeKey(rnd.Next() % total, &keys->back());
+      }
+      const uint64_t t = env_->NowMicros();
+      state.num_running = workers;
+      for (int w = 0; w < workers; w++) {
+        env_->StartThread(BatchBody, &tasks[w]);
+      }
+      MutexLock ml(&state.mu);
+      while (state.num_running != 0) state.cv.Wait();
+      hist.Add(double(env_->NowMicros() - t));
+      if (!state.status.ok()) {
+        fprintf(stderr, "Read error: %s\n", state.status.ToString().c_str());
+        exit(1);
+      }
+      r.bytes += state.bytes;
+    }
+    r.micros = env_->NowMicros() - start;
+    r.ops = uint64_t(num_batches) * flags_.batch_size;
+    SetLatencies(hist, &r);  // Per batch
+    reporter_.Report(r);
+    delete reader;
+  }
+
+  static int CountKey(void* arg, const Slice& key, const Slice& value) {
+    uint64_t* const bytes = reinterpret_cast<uint64_t*>(arg);
+    *bytes += key.size() + value.size();
+    return 0;
+  }
+
+  // Full scans of all epochs. Key-only scans skip value blocks in
+  // directories written in the v2 format.
+  void Scan(bool keys_only) {
+    DirReader* const reader = OpenReadDir();
+    BenchResult r;
+    r.name = keys_only ? "keyscan" : "scan";
+    r.config = "all_epochs";
+    size_t n = 0;
+    DirReader::ScanOp op;
+    op.keys_only = keys_only;
+    op.n = &n;
+    const uint64_t start = env_->NowMicros();
+    Status s = reader->Scan(op, CountKey, &r.bytes);
+    r.micros = env_->NowMicros() - start;
+    if (!s.ok()) {
+      fprintf(stderr, "Scan error: %s\n", s.ToString().c_str());
+      exit(1);
+    }
+    r.ops = n;
+    reporter_.Report(r);
+    delete reader;
+  }
+
+  const BenchFlags flags_;
+  Env* const env_;
+  BenchReporter reporter_;
+  ThreadPool* pool_;
+  std::string value_;
+  bool has_read_dir_;
+};
+
+}  // namespace plfsio
+}  // namespace pdlfs
+
+static void BM_Usage(const char* prog) {
+  const pdlfs::plfsio::BenchFlags defaults;
+  fprintf(stderr,
+          "Usage: %s [--flag=value ...]\n\n"
+          "  --benchmarks   comma-separated list of: write, sort, filter,\n"
+          "                 read, batchread, scan, keyscan (default: all\n"
+          "                 but keyscan)\n"
+          "  --env          env name, such as mem or posix (default: %s)\n"
+          "  --env_conf     env options to emulate storage latency with the\n"
+          "                 mem env, such as \"read_micros=500&read_bw=1g\"\n"
+          "  --dir          parent directory of all dirs (default: %s)\n"
+          "  --conf         extra dir options, such as \"bf_bits_per_key=10\"\n"
+          "  --num          keys per epoch (default: %d)\n"
+          "  --epochs       number of epochs (default: %d)\n"
+          "  --key_size     key size in bytes, at least 8 (default: %d)\n"
+          "  --value_size   value size in bytes (default: %d)\n"
+          "  --threads      writer thread counts to try (default: %s)\n"
+          "  --lg_parts     lg_parts values to try (default: %s)\n"
+          "  --bg_threads   background threads (default: %d)\n"
+          "  --reads        number of point reads (default: %d)\n"
+          "  --probes       number of filter probes (default: %d)\n"
+          "  --batch_size   keys per batch read (default: %d)\n"
+          "  --filters      filters to test, as bloom or bitmap:<bm_fmt>\n"
+          "  --format       csv or json (default: %s)\n",
+          prog, defaults.env_name.c_str(), defaults.dir.c_str(), defaults.num,
+          defaults.epochs, defaults.key_size, defaults.value_size,
+          defaults.threads.c_str(), defaults.lg_parts.c_str(),
+          defaults.bg_threads, defaults.reads, defaults.probes,
+          defaults.batch_size,
+          defaults.format.c_str());
+}
+
+int main(int argc, char* argv[]) {
+  pdlfs::plfsio::BenchFlags flags;
+  for (int i = 1; i < argc; i++) {
+    pdlfs::Slice arg(argv[i]);
+    if (!arg.starts_with("--") || arg.size() < 3) {
+      BM_Usage(argv[0]);
+      return 1;
+    }
+    arg.remove_prefix(2);
+    const char* const eq = strchr(arg.data(), '=');
+    if (eq == NULL) {
+      BM_Usage(argv[0]);
+      return 1;
+    }
+    const std::string name(arg.data(), eq - arg.data());
+    const std::string value(eq + 1);
+    const int num = atoi(value.c_str());
+    if (name == "benchmarks") {
+      flags.benchmarks = value;
+    } else if (name == "env") {
+      flags.env_name = value;
+    } else if (name == "env_conf") {
+      flags.env_conf = value;
+    } else if (name == "dir") {
+      flags.dir = value;
+    } else if (name == "conf") {
+      flags.conf = value;
+    } else if (name == "num" && num > 0) {
+      flags.num = num;
+    } else if (name == "epochs" && num > 0) {
+      flags.epochs = num;
+    } else if (name == "key_size" && num >= 8) {
+      flags.key_size = num;
+    } else if (name == "value_size" && num >= 0) {
+      flags.value_size = num;
+    } else if (name == "threads") {
+      flags.threads = value;
+    } else if (name == "lg_parts") {
+      flags.lg_parts = value;
+    } else if (name == "bg_threads" && num >= 0) {
+      flags.bg_threads = num;
+    } else if (name == "reads" && num >= 0) {
+      flags.reads = num;
+    } else if (name == "probes" && num > 0) {
+      flags.probes = num;
+    } else if (name == "batch_size" && num > 0) {
+      flags.batch_size = num;
+    } else if (name == "filters") {
+      flags.filters = value;
+    } else if (name == "format" && (value == "csv" || value == "json")) {
+      flags.format = value;
+    } else {
+      BM_Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  bool is_system;
+  pdlfs::Env* const env =
+      pdlfs::Env::Open(flags.env_name.c_str(), flags.env_conf.c_str(),
+                       &is_system);
+  if (env == NULL) {
+    fprintf(stderr, "Cannot open env '%s'\n", flags.env_name.c_str());
+    return 1;
+  }
+  {
+    pdlfs::plfsio::PlfsIoBench bench(flags, env);
+    bench.Run();
+  }
+  if (!is_system) {
+    delete env;
+  }
+  return 0;
+}
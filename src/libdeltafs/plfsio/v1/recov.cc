@@ -34,19 +34,31 @@ Status LogWriter::Write(ChunkType chunk_type, const Slice& block_contents,
       break;
 
     case kSnappyCompression:
-      if (port::Snappy_Compress(block_contents.data(), block_contents.size(),
-                                &compressed_) &&
-          (options_.force_compression ||
-           compressed_.size() <
-               block_contents.size() - (block_contents.size() / 8u))) {
+    case kZstdCompression:
+    case kLZ4Compression: {
+      bool ok;
+      if (compre_type == kSnappyCompression) {
+        ok = port::Snappy_Compress(block_contents.data(),
+                                   block_contents.size(), &compressed_);
+      } else if (compre_type == kZstdCompression) {
+        ok = port::Zstd_Compress(block_contents.data(), block_contents.size(),
+                                 &compressed_);
+      } else {
+        ok = port::Lz4_Compress(block_contents.data(), block_contents.size(),
+                                &compressed_);
+      }
+      if (ok && (options_.force_compression ||
+                 compressed_.size() <
+                     block_contents.size() - (block_contents.size() / 8u))) {
         raw_contents = compressed_;
       } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
+        // Compression not supported, or compressed less than 12.5%, so just
         // store uncompressed form
         raw_contents = block_contents;
         compre_type = kNoCompression;
       }
       break;
+    }
   }
   status = LogRaw(chunk_type, compre_type, raw_contents, handle);
   compressed_.clear();
@@ -144,5 +156,79 @@ Status LogWriter::LogRaw(ChunkType chunk_type, CompressionType compre_type,
   return status;
 }
 
+LogReader::LogReader(const DirOptions& options, LogSource* src)
+    : options_(options), offset_(0), src_(src) {
+  assert(src_ != NULL);
+  src_->Ref();
+}
+
+LogReader::~LogReader() { src_->Unref(); }
+
+bool LogReader::ReadChunk(ChunkType* type, Slice* contents,
+                          BlockHandle* handle) {
+  status_ = Status::OK();
+  const uint64_t size = src_->Size();
+  if (offset_ >= size) {
+    return false;  // End of log
+  } else if (offset_ + kChunkHeaderSize > size) {
+    status_ = Status::Corruption("Truncated chunk header");
+    return false;
+  }
+
+  char tmp[kChunkHeaderSize];
+  Slice header;
+  status_ = src_->Read(offset_, kChunkHeaderSize, &header, tmp);
+  if (status_.ok() && header.size() != kChunkHeaderSize) {
+    status_ = Status::Corruption("Truncated chunk header");
+  }
+  if (!status_.ok()) {
+    return false;
+  }
+
+  const ChunkType chunk_type =
+      static_cast<ChunkType>(static_cast<unsigned char>(header[0]));
+  const size_t n = DecodeFixed32(header.data() + 1);
+  // Special chunks do not have a block trailer
+  const bool special = chunk_type == kEpochStone || chunk_type == kFooter;
+  const size_t m = special ? n : n + kBlockTrailerSize;
+  if (offset_ + kChunkHeaderSize + m > size) {
+    status_ = Status::Corruption("Truncated chunk");
+    return false;
+  }
+
+  Slice data;
+  scratch_.resize(m + 1);
+  status_ = src_->Read(offset_ + kChunkHeaderSize, m, &data, &scratch_[0]);
+  if (status_.ok() && data.size() != m) {
+    status_ = Status::Corruption("Truncated chunk");
+  }
+  if (!status_.ok()) {
+    return false;
+  }
+
+  if (!options_.skip_checksums) {
+    uint32_t crc = crc32c::Value(data.data(), n);
+    if (!special) {
+      crc = crc32c::Extend(crc, data.data() + n, 1);  // Cover the block type
+      if (crc32c::Unmask(DecodeFixed32(data.data() + n + 1)) != crc) {
+        status_ = Status::Corruption("Block checksum mismatch");
+        return false;
+      }
+    }
+    crc = crc32c::Extend(crc, header.data(), 5);
+    if (crc32c::Unmask(DecodeFixed32(header.data() + 5)) != crc) {
+      status_ = Status::Corruption("Chunk checksum mismatch");
+      return false;
+    }
+  }
+
+  *type = chunk_type;
+  *contents = Slice(data.data(), n);
+  handle->set_offset(offset_ + kChunkHeaderSize);
+  handle->set_size(n);
+  offset_ += kChunkHeaderSize + m;
+  return true;
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -28,6 +28,7 @@ namespace plfsio {
 static const size_t kChunkHeaderSize = 9;
 
 class LogSink;
+class LogSource;
 
 // Write blocks as log chunks that can be repaired and replayed by a future
 // reader. Each log chunk has the following format:
@@ -80,5 +81,41 @@ class LogWriter {
   LogSink* sink_;
 };
 
+// Read back log chunks written by a LogWriter, one chunk at a time. Chunks are
+// verified against their checksums unless checksums are skipped by the
+// options. Reading stops at the first chunk that is truncated or fails
+// verification, which is normally where the writer stopped writing.
+class LogReader {
+ public:
+  LogReader(const DirOptions& options, LogSource* src);
+  ~LogReader();
+
+  // Read the next chunk. For regular chunks, *handle is set to the location of
+  // the chunk's block contents, and *contents is set to the block contents
+  // without the trailer. For special chunks such as epoch stones, *contents
+  // is set to the chunk's contents. *contents remains valid until the next
+  // call. Return false if there are no more good chunks.
+  bool ReadChunk(ChunkType* type, Slice* contents, BlockHandle* handle);
+
+  // Return the log offset right after the last good chunk.
+  uint64_t offset() const { return offset_; }
+
+  // Return the reason why the last ReadChunk() call returned false. OK if the
+  // end of the log has been reached.
+  const Status& status() const { return status_; }
+
+ private:
+  const DirOptions& options_;
+
+  // No copying allowed
+  void operator=(const LogReader&);
+  LogReader(const LogReader&);
+
+  uint64_t offset_;  // Log offset of the next chunk
+  std::string scratch_;
+  Status status_;
+  LogSource* src_;
+};
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -22,6 +22,15 @@ namespace plfsio {
 
 IoStats::IoStats() : index_bytes(0), index_ops(0), data_bytes(0), data_ops(0) {}
 
+EpochStats::EpochStats()
+    : epoch(0),
+      part(0),
+      num_keys(0),
+      num_tables(0),
+      key_bytes(0),
+      value_bytes(0),
+      data_bytes(0) {}
+
 DirOptions::DirOptions()
     : total_memtable_budget(4 << 20),
       memtable_util(0.97),
@@ -29,6 +38,8 @@ DirOptions::DirOptions()
       leveldb_compatible(true),
       skip_sort(false),
       fixed_kv_length(false),
+      key_column(false),
+      format(kDirFmtV1),
       key_size(8),
       value_size(32),
       filter(kFtBloomFilter),
@@ -39,6 +50,7 @@ DirOptions::DirOptions()
       cuckoo_seed(301),
       cuckoo_max_moves(500),
       cuckoo_frac(0.95),
+      pdb_index_keys(0),
       block_size(32 << 10),
       block_util(0.996),
       block_padding(true),
@@ -55,6 +67,7 @@ DirOptions::DirOptions()
       parallel_reads(false),
       paranoid_checks(false),
       ignore_filters(false),
+      recover_partial_logs(false),
       compression(kNoCompression),
       index_compression(kNoCompression),
       force_compression(false),
@@ -62,6 +75,7 @@ DirOptions::DirOptions()
       skip_checksums(false),
       measure_reads(true),
       measure_writes(true),
+      measure_latencies(false),
       num_epochs(-1),
       lg_parts(-1),
       listener(NULL),
@@ -137,11 +151,31 @@ bool ParseFilterType(const Slice& key, const Slice& value, FilterType* result) {
   }
 }
 
+bool ParseDirFormat(const Slice& key, const Slice& value, DirFormat* result) {
+  if (value == "v1") {
+    *result = kDirFmtV1;
+    return true;
+  } else if (value == "v2") {
+    *result = kDirFmtV2;
+    return true;
+  } else {
+    Warn(__LOG_ARGS__, "Unknown dir format: %s=%s, option ignored",
+         key.c_str(), value.c_str());
+    return false;
+  }
+}
+
 bool ParseCompressionType(const Slice& key, const Slice& value,
                           CompressionType* result) {
   if (value.starts_with("snappy")) {
     *result = kSnappyCompression;
     return true;
+  } else if (value.starts_with("zstd")) {
+    *result = kZstdCompression;
+    return true;
+  } else if (value.starts_with("lz4")) {
+    *result = kLZ4Compression;
+    return true;
   } else if (value.starts_with("no")) {
     *result = kNoCompression;
     return true;
@@ -166,6 +200,7 @@ DirOptions ParseDirOptions(const char* input) {
       continue;
     }
     FilterType filter_type;
+    DirFormat format;
     BitmapFormat bm_fmt;
     CompressionType compression_type;
     Slice conf_key = conf_pair[0];
@@ -252,10 +287,26 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.ignore_filters = flag;
       }
+    } else if (conf_key == "recover_partial_logs") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.recover_partial_logs = flag;
+      }
+    } else if (conf_key == "measure_latencies") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.measure_latencies = flag;
+      }
     } else if (conf_key == "fixed_kv") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.fixed_kv_length = flag;
       }
+    } else if (conf_key == "key_column") {
+      if (ParseBool(conf_key, conf_value, &flag)) {
+        result.key_column = flag;
+      }
+    } else if (conf_key == "format") {
+      if (ParseDirFormat(conf_key, conf_value, &format)) {
+        result.format = format;
+      }
     } else if (conf_key == "leveldb_compatible") {
       if (ParseBool(conf_key, conf_value, &flag)) {
         result.leveldb_compatible = flag;
@@ -272,6 +323,10 @@ DirOptions ParseDirOptions(const char* input) {
       if (ParseInteger(conf_key, conf_value, &num)) {
         result.bf_bits_per_key = num;
       }
+    } else if (conf_key == "pdb_index_keys") {
+      if (ParseInteger(conf_key, conf_value, &num)) {
+        result.pdb_index_keys = num;
+      }
     } else if (conf_key == "bm_fmt") {
       if (ParseBitmapFormat(conf_key, conf_value, &bm_fmt)) {
         result.bm_fmt = bm_fmt;
@@ -38,6 +38,24 @@ struct IoStats {
   uint64_t data_ops;
 };
 
+// Summary of the keys a single directory partition stores for an epoch.
+struct EpochStats {
+  EpochStats();
+
+  uint32_t epoch;
+  uint32_t part;  // Partition index
+  uint64_t num_keys;
+  uint32_t num_tables;
+  // Total size of the keys and values inserted
+  uint64_t key_bytes;
+  uint64_t value_bytes;
+  // Total size of data blocks on storage
+  uint64_t data_bytes;
+  // Smallest and largest keys of the epoch
+  std::string min_key;
+  std::string max_key;
+};
+
 // Directory semantics
 enum DirMode {
   // Each epoch is structured as a set of ordered multi-maps.
@@ -46,6 +64,9 @@ enum DirMode {
   kDmMultiMap = 0x00,
   // Duplicated keys. Stored out-of-order.
   kDmMultiMapUnordered = 0x10,
+  // All epochs of another directory merged into a single ordered multi-map.
+  // Each value is prefixed with the epoch it was originally written in
+  kDmMergedEpochs = 0x20,
   // Unique, un-ordered keys.
   kDmUniqueUnordered = 0x90,
   // Duplicated key insertions are silently discarded
@@ -54,6 +75,17 @@ enum DirMode {
   kDmUniqueKey = 0x80
 };
 
+// Directory on-disk formats. Readers pick up the format of an existing
+// directory from its footer.
+enum DirFormat {
+  // Keys and values are stored together in data blocks
+  kDirFmtV1 = 0x01,
+  // Keys are stored in key blocks along with the location of their values.
+  // Values are stored in a value block right after each key block so that
+  // key-only reads do not have to fetch any values.
+  kDirFmtV2 = 0x02
+};
+
 // Directory filter types. Bitmap-based filters are optimized
 // for workloads with compact key spaces.
 enum FilterType {
@@ -115,6 +147,18 @@ struct DirOptions {
   // Default: false
   bool fixed_kv_length;
 
+  // Store the keys of fixed-sized blocks as a separate column of integers,
+  // which allows faster key searches within a block. Only applies to 8 and
+  // 16-byte keys. Readers recognize the block layout automatically.
+  // Default: false
+  bool key_column;
+
+  // On-disk format for newly written directories. Directories in the v2
+  // format always store keys in LevelDb compatible key blocks and do not use
+  // the compaction pool to compress blocks.
+  // Default: kDirFmtV1
+  DirFormat format;
+
   // Estimated key size.
   // If not known, keep the default.
   // Default: 8 bytes
@@ -154,10 +198,12 @@ struct DirOptions {
   size_t bm_key_bits;
 
   // Random seed for a cuckoo hash filter
+  // Not used by the current breadth-first cuckoo insertion scheme.
   // Default: 301
   uint32_t cuckoo_seed;
 
-  // Max cuckoo movements allowed
+  // Max number of cuckoo buckets to explore when searching for a path of
+  // displacements that frees up a slot for a new key
   // Default: 500
   int cuckoo_max_moves;
 
@@ -165,6 +211,14 @@ struct DirOptions {
   // Default 0.95
   double cuckoo_frac;
 
+  // Expected number of keys per PLAINDB table. If not zero, data blocks are
+  // sorted by key and a per-table cuckoo key index is built to map each key
+  // to the data block that stores it. Point lookups then only read candidate
+  // blocks and use binary search inside each block.
+  // Keys exceeding this number are indexed by auxiliary tables.
+  // Default: 0 (no key index)
+  size_t pdb_index_keys;
+
   // Approximate size of user data packed per data block.
   // Note that block is used both as the packaging format and as the logical I/O
   // unit for reading and writing the underlying data log objects.
@@ -224,7 +278,8 @@ struct DirOptions {
   // Thread pool used to run concurrent background compaction jobs.
   // If set to NULL, Env::Default() may be used to schedule jobs if permitted.
   // Otherwise, the caller's thread context will be used directly to serve
-  // compactions.
+  // compactions. If compression is enabled, data blocks are also compressed
+  // concurrently on this pool.
   // Default: NULL
   ThreadPool* compaction_pool;
 
@@ -237,6 +292,7 @@ struct DirOptions {
   ThreadPool* reader_pool;
 
   // Number of bytes to read when loading the indexes.
+  // Also used as the read-ahead size when scanning PLAINDB tables.
   // Default: 8MB
   size_t read_size;
 
@@ -253,7 +309,16 @@ struct DirOptions {
   // Default: false
   bool ignore_filters;
 
-  // Compression type to be applied to data blocks.
+  // Allow opening directories whose writer did not finish, such as after a
+  // crash. Index logs without a valid footer are replayed chunk by chunk
+  // and their root indexes are rebuilt from the last good epoch stone. All
+  // partitions are then truncated to the epochs sealed by every partition.
+  // lg_parts must be specified if the directory's info file is missing.
+  // Default: false
+  bool recover_partial_logs;
+
+  // Compression type to be applied to data blocks. Snappy, Zstd, and LZ4
+  // are available if compiled in. Blocks are written uncompressed otherwise.
   // Default: kNoCompression
   CompressionType compression;
 
@@ -282,6 +347,11 @@ struct DirOptions {
   // Default: true
   bool measure_writes;
 
+  // True if operation latencies should be recorded in histograms. This adds
+  // clock reads to every filter check and log append.
+  // Default: false
+  bool measure_latencies;
+
   // Number of epochs to read during the read phase.
   // If set to -1, will use the value obtained from the footer.
   // Ignored in the write phase.
@@ -330,5 +400,13 @@ extern DirOptions ParseDirOptions(const char* conf);
 // Be very careful using this method.
 extern Status DestroyDir(const std::string& dirname, const DirOptions& options);
 
+// Merge all epochs of the source directory into a new directory at "dst"
+// whose partitions each hold a single sorted run of keys. The original epoch
+// of each key is kept so the new directory answers the same queries as the
+// source. Partitions are merged in parallel using "options.reader_pool".
+// Return OK on success, or a non-OK status on errors.
+extern Status MergeDir(const std::string& src, const std::string& dst,
+                       const DirOptions& options);
+
 }  // namespace plfsio
 }  // namespace pdlfs
@@ -10,6 +10,7 @@
  */
 
 #include "v1.h"
+#include "events.h"
 #include "filter.h"
 #include "internal.h"
 #include "types.h"
@@ -20,6 +21,9 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/strutil.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -53,6 +57,7 @@ struct DirWriter::Rep {
   Epoch* epoch_;   // Current epoch
   bool finished_;  // If Finish() has been called
   WritableFileStats io_stats_;
+  LatencyStats* latency_;  // NULL if latencies are not measured
   const DirOutputStats** compac_stats_;
   DirIndexer** idxers_;
   LogSink* data_;
@@ -68,12 +73,16 @@ DirWriter::Rep::Rep(const DirOptions& o, const std::string& d)
       part_mask_(~static_cast<uint32_t>(0)),
       epoch_(NULL),
       finished_(false),
+      latency_(NULL),
       compac_stats_(NULL),
       idxers_(NULL),
       data_(NULL),
       env_(options_.env) {
   epoch_ = new Epoch(0, &mutex_);
   epoch_->Ref();
+  if (options_.measure_latencies) {
+    latency_ = new LatencyStats;
+  }
 }
 
 DirWriter::Rep::~Rep() {
@@ -89,6 +98,7 @@ DirWriter::Rep::~Rep() {
   if (data_ != NULL) {
     data_->Unref();
   }
+  delete latency_;
 }
 
 Status DirWriter::Rep::EnsureDataPadding(LogSink* sink, size_t footer_size) {
@@ -122,6 +132,13 @@ Status DirWriter::Rep::MaybeRotateLogs(Epoch* ep) {
     // Prepare for the next epoch
     status = data_->Lrotate(1 + ep->seq_);
     data_->Unlock();
+    if (status.ok() && options_.listener != NULL) {
+      LogRotationEvent event;
+      event.type = kLogRotation;
+      event.micros = Env::Default()->NowMicros();
+      event.index = 1 + ep->seq_;
+      options_.listener->OnEvent(kLogRotation, &event);
+    }
     mutex_.Lock();
   }
 
@@ -204,10 +221,18 @@ Status DirWriter::Rep::Finalize() {
     }
   }
 
-  // Write out our primary footer copy
+  // Write out our primary footer copy. It is preceded by a stats block
+  // summarizing each epoch of each partition written by this rank.
   if (status.ok()) {
     if (options_.rank == 0) {  // Rank 0 does the writing
-      status = InstallDirInfo(ftdata);
+      std::vector<EpochStats> stats;
+      for (uint32_t i = 0; i < num_parts_; i++) {
+        idxers_[i]->GetEpochStats(&stats);
+      }
+      std::string dir_info;
+      PutDirStats(&dir_info, stats);
+      dir_info.append(ftdata);
+      status = InstallDirInfo(dir_info);
     }
   }
 
@@ -360,6 +385,7 @@ Status DirWriter::Finish() {
 Status DirWriter::EpochFlush(int epoch) {
   Status status;
   Rep* const r = rep_;
+  LatencyTimer timer(r->latency_, kLatEpochFlush);
   MutexLock ml(&r->mutex_);
   while (true) {
     if (r->finished_) {
@@ -501,6 +527,65 @@ Status DirWriter::Sync() {
   return status;
 }
 
+bool DirWriter::GetProperty(const Slice& property, std::string* value) const {
+  Rep* const r = rep_;
+  Slice in = property;
+  if (in.starts_with("latency.") && r->latency_ != NULL) {
+    in.remove_prefix(strlen("latency."));
+    return r->latency_->GetProperty(in, value);
+  }
+  return false;
+}
+
+namespace {
+
+void AddLatencyMetrics(const LatencyStats* latency, DirMetrics* result) {
+  for (int i = 0; i < kNumLatencyTypes; i++) {
+    const LatencyType type = static_cast<LatencyType>(i);
+    const std::string prefix =
+        std::string("latency_") + LatencyStats::Name(type);
+    result->Add(prefix + "_count", latency->Count(type));
+    result->Add(prefix + "_sum", latency->Sum(type));
+  }
+}
+
+}  // namespace
+
+void DirWriter::GetMetrics(DirMetrics* result) const {
+  Rep* const r = rep_;
+  MutexLock ml(&r->mutex_);
+  result->Add("epoch", r->epoch_ != NULL ? r->epoch_->seq_ : 0);
+  result->Add("num_parts", r->num_parts_);
+  result->Add("data_log_bytes", r->io_stats_.TotalBytes());
+  result->Add("data_log_ops", r->io_stats_.TotalOps());
+  result->Add("data_log_memory_usage", r->data_->memory_usage());
+  for (size_t i = 0; i < r->num_parts_; i++) {
+    const DirOutputStats* const stats = r->compac_stats_[i];
+    const DirIndexer* const idxer = r->idxers_[i];
+    result->AddPart(i, "num_keys", stats->total_num_keys_);
+    result->AddPart(i, "num_dropped_keys", stats->total_num_dropped_keys_);
+    result->AddPart(i, "num_data_blocks", stats->total_num_blocks_);
+    result->AddPart(i, "num_sstables", stats->total_num_tables_);
+    result->AddPart(i, "key_bytes", stats->key_size);
+    result->AddPart(i, "value_bytes", stats->value_size);
+    result->AddPart(i, "data_bytes", stats->final_data_size);
+    result->AddPart(i, "raw_data_bytes", stats->data_size);
+    result->AddPart(i, "index_bytes", stats->final_index_size);
+    result->AddPart(i, "raw_index_bytes", stats->index_size);
+    result->AddPart(i, "filter_bytes", stats->final_filter_size);
+    result->AddPart(i, "raw_filter_bytes", stats->filter_size);
+    result->AddPart(i, "meta_index_bytes", stats->final_meta_index_size);
+    result->AddPart(i, "data_write_micros", stats->data_write_micros);
+    result->AddPart(i, "index_log_bytes", idxer->io_stats_.TotalBytes());
+    result->AddPart(i, "index_log_ops", idxer->io_stats_.TotalOps());
+    result->AddPart(i, "memory_usage",
+                    idxer->memory_usage() + idxer->indx_->memory_usage());
+  }
+  if (r->latency_ != NULL) {
+    AddLatencyMetrics(r->latency_, result);
+  }
+}
+
 IoStats DirWriter::TEST_iostats() const {
   Rep* const r = rep_;
   MutexLock ml(&r->mutex_);
@@ -727,6 +812,22 @@ std::string FilterOptions(const DirOptions& options) {
       return "Unk";
   }
 }
+
+// Return the name of a compression type.
+const char* CompressionName(CompressionType type) {
+  switch (type) {
+    case kNoCompression:
+      return "None";
+    case kSnappyCompression:
+      return "Snappy";
+    case kZstdCompression:
+      return "Zstd";
+    case kLZ4Compression:
+      return "LZ4";
+    default:
+      return "Unk";
+  }
+}
 }  // namespace
 #endif
 
@@ -751,6 +852,7 @@ Status DirWriter::TryOpen(Rep* rep) {
   io_opts.type = kDefIoType;
   if (options->epoch_log_rotation) io_opts.rotation = kRotationExtCtrl;
   if (options->measure_writes) io_opts.stats = &rep->io_stats_;
+  io_opts.latency = rep->latency_;
   io_opts.mu = &rep->io_mutex_;
   io_opts.min_buf = options->min_data_buffer;
   io_opts.max_buf = options->data_buffer;
@@ -758,13 +860,14 @@ Status DirWriter::TryOpen(Rep* rep) {
   status = LogSink::Open(io_opts, rep->dirname_, &data[0]);
   if (status.ok()) {
     for (size_t i = 0; i < num_parts; i++) {
-      diridxers[i] =
-          new DirIndexer(rep->options_, i, &rep->mutex_, &rep->bg_cv_);
+      diridxers[i] = new DirIndexer(rep->options_, i, &rep->mutex_,
+                                    &rep->bg_cv_, rep->latency_);
       LogSink::LogOptions idx_opts;
       idx_opts.rank = my_rank;
       idx_opts.sub_partition = static_cast<int>(i);
       idx_opts.type = kIdxIoType;
       if (options->measure_writes) idx_opts.stats = &diridxers[i]->io_stats_;
+      idx_opts.latency = rep->latency_;
       idx_opts.mu = NULL;
       idx_opts.min_buf = options->min_index_buffer;
       idx_opts.max_buf = options->index_buffer;
@@ -830,6 +933,10 @@ Status DirWriter::Open(const DirOptions& _opts, const std::string& dirname,
           int(options.skip_sort) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.fixed_kv_length -> %s",
           int(options.fixed_kv_length) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_column -> %s",
+          int(options.key_column) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.format -> %s",
+          DirFormatName(options.format).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.key_size -> %s",
           PrettySize(options.key_size).c_str());
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.value_size -> %s",
@@ -861,15 +968,17 @@ Status DirWriter::Open(const DirOptions& _opts, const std::string& dirname,
               ? options.compaction_pool->ToDebugString().c_str()
               : "None");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.compression -> %s",
-          options.compression == kSnappyCompression ? "Snappy" : "None");
+          CompressionName(options.compression));
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.index_compression -> %s",
-          options.index_compression == kSnappyCompression ? "Snappy" : "None");
+          CompressionName(options.index_compression));
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.force_compression -> %s",
           int(options.force_compression) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_checksums -> %s",
           int(options.skip_checksums) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_writes -> %s",
           int(options.measure_writes) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_latencies -> %s",
+          int(options.measure_latencies) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.epoch_log_rotation -> %s",
           int(options.epoch_log_rotation) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.allow_env_threads -> %s",
@@ -902,18 +1011,47 @@ class DirReaderImpl : public DirReader {
   virtual Status Count(const CountOp& op, size_t* result);
   virtual Status Read(const ReadOp& op, const Slice& fid, std::string* dst);
   virtual Status Scan(const ScanOp& op, ScanSaver, void*);
+  virtual Status Merge(MergeSaver, void*);
+  virtual Status GetEpochStats(std::vector<EpochStats>* result);
+  virtual Status GetNumEpochs(uint32_t* result);
+  virtual bool GetProperty(const Slice& property, std::string* value) const;
+  virtual void GetMetrics(DirMetrics* result) const;
 
   virtual IoStats TEST_iostats() const;
 
  private:
   Status OpenDir(size_t part);
+  struct BGOpenItem {
+    DirReaderImpl* impl;
+    size_t part;
+    Status* status;
+    int* num_open;
+  };
+  static void BGOpen(void*);
+  Status MergePartition(size_t part, MergeSaver, void*);
+  struct BGMergeItem {
+    DirReaderImpl* impl;
+    size_t part;
+    MergeSaver saver;
+    void* arg;
+    Status* status;
+    int* num_open;
+  };
+  static void BGMerge(void*);
+  Status Recover();
+  bool PartitionMayMatch(uint32_t part, uint32_t epoch_start,
+                         uint32_t epoch_end, const Slice* key) const;
   RandomAccessFileStats io_stats_;
+  LatencyStats* latency_;  // NULL if latencies are not measured
   friend class DirReader;
 
   DirOptions options_;
   const std::string name_;
   uint32_t num_parts_;
   uint32_t part_mask_;
+  // Epoch stats loaded from the dir info file. Constant after open.
+  std::vector<EpochStats> stats_;
+  bool has_stats_;
 
   mutable port::Mutex mutex_;
   port::CondVar cond_cv_;
@@ -927,9 +1065,12 @@ DirReaderImpl::DirReaderImpl(const DirOptions& opts, const std::string& name)
       name_(name),
       num_parts_(0),
       part_mask_(~static_cast<uint32_t>(0)),
+      has_stats_(false),
       cond_cv_(&mutex_),
       dirs_(NULL),
-      data_(NULL) {}
+      data_(NULL) {
+  latency_ = options_.measure_latencies ? new LatencyStats : NULL;
+}
 
 DirReaderImpl::~DirReaderImpl() {
   MutexLock ml(&mutex_);
@@ -942,6 +1083,7 @@ DirReaderImpl::~DirReaderImpl() {
   if (data_ != NULL) {
     data_->Unref();
   }
+  delete latency_;
 }
 
 // Open a directory partition if it has not been opened before.
@@ -954,7 +1096,7 @@ Status DirReaderImpl::OpenDir(size_t part) {
   if (dirs_[part] == NULL) {
     mutex_.Unlock();  // Unlock when reading dir indexes
     LogSource* indx = NULL;
-    Dir* dir = new Dir(options_, &mutex_, &cond_cv_);
+    Dir* dir = new Dir(options_, &mutex_, &cond_cv_, latency_);
     dir->Ref();
     LogSource::LogOptions idx_opts;
     idx_opts.type = kIdxIoType;
@@ -982,6 +1124,162 @@ Status DirReaderImpl::OpenDir(size_t part) {
   return status;
 }
 
+void DirReaderImpl::BGOpen(void* arg) {
+  BGOpenItem* const item = reinterpret_cast<BGOpenItem*>(arg);
+  DirReaderImpl* const impl = item->impl;
+  MutexLock ml(&impl->mutex_);
+  *item->status = impl->OpenDir(item->part);
+  assert(*item->num_open > 0);
+  --*item->num_open;
+  impl->cond_cv_.SignalAll();
+}
+
+// Open all partitions of a directory that may not have been finished by its
+// writer. Index logs are replayed in parallel whenever possible. Epochs whose
+// data blocks are not all found in the data log are dropped. All partitions
+// are then truncated to the epochs available in every partition so that
+// the directory appears as if its writer stopped at an epoch boundary.
+// Return OK on success, or a non-OK status on errors.
+// REQUIRES: mutex_ is locked.
+Status DirReaderImpl::Recover() {
+  mutex_.AssertHeld();
+  Status status;
+  std::vector<Status> statuses(num_parts_);
+  std::vector<BGOpenItem> items(num_parts_);
+  int num_open = 0;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    BGOpenItem* const item = &items[part];
+    item->impl = this;
+    item->part = part;
+    item->status = &statuses[part];
+    item->num_open = &num_open;
+    num_open++;
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->Schedule(DirReaderImpl::BGOpen, item);
+    } else if (options_.allow_env_threads) {
+      Env::Default()->Schedule(DirReaderImpl::BGOpen, item);
+    } else {
+      statuses[part] = OpenDir(part);
+      num_open--;
+    }
+  }
+
+  // Wait for all outstanding opens to conclude
+  while (num_open > 0) {
+    cond_cv_.Wait();
+  }
+
+  uint32_t num_eps = ~static_cast<uint32_t>(0);
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = statuses[part];
+    if (!status.ok()) {
+      return status;
+    }
+    Dir* const dir = dirs_[part];
+    assert(dir != NULL);
+    uint32_t n = dir->num_eps_;
+    while (n != 0) {
+      uint64_t limit;
+      status = dir->GetDataLimit(n - 1, &limit);
+      if (!status.ok()) {
+        return status;
+      }
+      const size_t file_index = options_.epoch_log_rotation ? n - 1 : 0;
+      if (limit <= data_->Size(file_index)) {
+        break;
+      }
+      // Epoch data not fully persisted
+      Warn(__LOG_ARGS__, "Dropping epoch %u of partition %u: data not found",
+           n - 1, part);
+      n--;
+    }
+    num_eps = std::min(num_eps, n);
+  }
+
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    dirs_[part]->num_eps_ = std::min(dirs_[part]->num_eps_, num_eps);
+  }
+#if VERBOSE >= 1
+  Verbose(__LOG_ARGS__, 1, "Dfs.plfsdir.recovered_epochs -> %u",
+          num_parts_ != 0 ? num_eps : 0);
+#endif
+
+  return status;
+}
+
+Status DirReaderImpl::GetEpochStats(std::vector<EpochStats>* result) {
+  if (!has_stats_) {
+    return Status::NotFound("No epoch stats");
+  }
+  for (size_t i = 0; i < stats_.size(); i++) {
+    if (stats_[i].epoch < uint32_t(options_.num_epochs)) {
+      result->push_back(stats_[i]);
+    }
+  }
+  return Status::OK();
+}
+
+// Return false if epoch stats show that a partition holds no keys within a
+// given epoch range, or that none of its epochs within the range may contain
+// the given key. Return true otherwise.
+bool DirReaderImpl::PartitionMayMatch(uint32_t part, uint32_t epoch_start,
+                                      uint32_t epoch_end,
+                                      const Slice* key) const {
+  if (!has_stats_) {
+    return true;
+  }
+  epoch_end = std::min(epoch_end, uint32_t(options_.num_epochs));
+  if (IsEpochTagged(options_.mode)) {
+    if (epoch_start >= epoch_end) {
+      return false;
+    }
+    // All keys are stored in the first epoch
+    epoch_start = 0;
+    epoch_end = 1;
+  }
+  for (size_t i = 0; i < stats_.size(); i++) {
+    const EpochStats& s = stats_[i];
+    if (s.part != part || s.epoch < epoch_start || s.epoch >= epoch_end) {
+      continue;
+    } else if (s.num_keys == 0) {
+      continue;
+    } else if (key == NULL ||
+               (*key >= Slice(s.min_key) && *key <= Slice(s.max_key))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Obtain the max number of epochs found in all partitions.
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::GetNumEpochs(uint32_t* result) {
+  Status status;
+  MutexLock ml(&mutex_);
+
+  *result = 0;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = OpenDir(part);
+    if (!status.ok()) {
+      break;
+    }
+    assert(dirs_[part] != NULL);
+    *result = std::max(*result, dirs_[part]->num_eps_);
+  }
+
+  return status;
+}
+
+bool DirReaderImpl::GetProperty(const Slice& property,
+                                std::string* value) const {
+  Slice in = property;
+  if (in.starts_with("latency.") && latency_ != NULL) {
+    in.remove_prefix(strlen("latency."));
+    return latency_->GetProperty(in, value);
+  }
+  return false;
+}
+
 // Perform a count operation on all partitions.
 // Return OK on success, or a non-OK status on errors.
 Status DirReaderImpl::Count(const CountOp& op, size_t* result) {
@@ -990,6 +1288,19 @@ Status DirReaderImpl::Count(const CountOp& op, size_t* result) {
   size_t subtotal;
 
   *result = 0;
+  if (has_stats_ && !IsEpochTagged(options_.mode)) {
+    // Answer from epoch stats without opening any partitions
+    const uint32_t epoch_end =
+        std::min(op.epoch_end, uint32_t(options_.num_epochs));
+    for (size_t i = 0; i < stats_.size(); i++) {
+      const EpochStats& s = stats_[i];
+      if (s.epoch >= op.epoch_start && s.epoch < epoch_end) {
+        *result += static_cast<size_t>(s.num_keys);
+      }
+    }
+    return status;
+  }
+
   for (uint32_t part = 0; part < num_parts_; part++) {
     status = OpenDir(part);
     if (status.ok()) {
@@ -1026,6 +1337,9 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
   stats.n = 0;
 
   for (uint32_t part = 0; part < num_parts_; part++) {
+    if (!PartitionMayMatch(part, op.epoch_start, op.epoch_end, NULL)) {
+      continue;  // Skip partitions with no keys within the epoch range
+    }
     status = OpenDir(part);
     if (status.ok()) {
       assert(dirs_[part] != NULL);
@@ -1035,6 +1349,7 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
       opts.epoch_start = op.epoch_start;
       opts.epoch_end = op.epoch_end;
       opts.force_serial_reads = op.no_parallel_reads;
+      opts.keys_only = op.keys_only;
       Dir::Saver dir_saver = static_cast<Dir::Saver>(saver);
       opts.usr_cb = reinterpret_cast<void*>(dir_saver);
       opts.arg_cb = arg;
@@ -1066,6 +1381,77 @@ Status DirReaderImpl::Scan(const ScanOp& op, ScanSaver saver, void* arg) {
   return status;
 }
 
+// Merge all epochs of a directory partition.
+// Return OK on success, or a non-OK status on errors.
+// REQUIRES: mutex_ is locked.
+Status DirReaderImpl::MergePartition(size_t part, MergeSaver saver,
+                                     void* arg) {
+  mutex_.AssertHeld();
+  Status status = OpenDir(part);
+  if (status.ok()) {
+    assert(dirs_[part] != NULL);
+    Dir* const dir = dirs_[part];
+    dir->Ref();
+    mutex_.Unlock();  // Unlock when merging tables
+    status = dir->MergeEpochs(0, dir->num_eps_, saver, arg);
+    mutex_.Lock();
+    dir->Unref();
+  }
+  return status;
+}
+
+void DirReaderImpl::BGMerge(void* arg) {
+  BGMergeItem* const item = reinterpret_cast<BGMergeItem*>(arg);
+  DirReaderImpl* const impl = item->impl;
+  MutexLock ml(&impl->mutex_);
+  *item->status = impl->MergePartition(item->part, item->saver, item->arg);
+  assert(*item->num_open > 0);
+  --*item->num_open;
+  impl->cond_cv_.SignalAll();
+}
+
+// Merge all partitions, in parallel whenever possible.
+// Return OK on success, or a non-OK status on errors.
+Status DirReaderImpl::Merge(MergeSaver saver, void* arg) {
+  Status status;
+  MutexLock ml(&mutex_);
+  std::vector<Status> statuses(num_parts_);
+  std::vector<BGMergeItem> items(num_parts_);
+  int num_open = 0;
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    BGMergeItem* const item = &items[part];
+    item->impl = this;
+    item->part = part;
+    item->saver = saver;
+    item->arg = arg;
+    item->status = &statuses[part];
+    item->num_open = &num_open;
+    num_open++;
+    if (options_.reader_pool != NULL) {
+      options_.reader_pool->Schedule(DirReaderImpl::BGMerge, item);
+    } else if (options_.allow_env_threads) {
+      Env::Default()->Schedule(DirReaderImpl::BGMerge, item);
+    } else {
+      statuses[part] = MergePartition(part, saver, arg);
+      num_open--;
+    }
+  }
+
+  // Wait for all outstanding merges to conclude
+  while (num_open > 0) {
+    cond_cv_.Wait();
+  }
+
+  for (uint32_t part = 0; part < num_parts_; part++) {
+    status = statuses[part];
+    if (!status.ok()) {
+      break;
+    }
+  }
+
+  return status;
+}
+
 // Perform a read operation for a key.
 // Return OK on success, or a non-OK status on errors.
 Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
@@ -1078,8 +1464,13 @@ Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
   stats.total_table_seeks = 0;
   stats.total_seeks = 0;
 
-  status = OpenDir(part);
-  if (status.ok()) {
+  // Skip the partition if epoch stats show that it cannot hold the key
+  const bool may_match =
+      PartitionMayMatch(part, op.epoch_start, op.epoch_end, &fid);
+  if (may_match) {
+    status = OpenDir(part);
+  }
+  if (status.ok() && may_match) {
     assert(dirs_[part] != NULL);
     Dir* const dir = dirs_[part];
     dir->Ref();
@@ -1107,6 +1498,23 @@ Status DirReaderImpl::Read(const ReadOp& op, const Slice& fid,
   return status;
 }
 
+void DirReaderImpl::GetMetrics(DirMetrics* result) const {
+  MutexLock ml(&mutex_);
+  result->Add("num_parts", num_parts_);
+  result->Add("data_log_bytes", io_stats_.TotalBytes());
+  result->Add("data_log_ops", io_stats_.TotalOps());
+  for (size_t i = 0; i < num_parts_; i++) {
+    const Dir* const dir = dirs_[i];  // NULL if not yet opened
+    result->AddPart(i, "index_log_bytes",
+                    dir != NULL ? dir->io_stats_.TotalBytes() : 0);
+    result->AddPart(i, "index_log_ops",
+                    dir != NULL ? dir->io_stats_.TotalOps() : 0);
+  }
+  if (latency_ != NULL) {
+    AddLatencyMetrics(latency_, result);
+  }
+}
+
 IoStats DirReaderImpl::TEST_iostats() const {
   MutexLock ml(&mutex_);
   IoStats result;
@@ -1151,6 +1559,7 @@ DirReader::ScanOp::ScanOp()
     : epoch_start(0),
       epoch_end(~static_cast<uint32_t>(0)),
       no_parallel_reads(false),
+      keys_only(false),
       table_seeks(NULL),
       seeks(NULL),
       n(NULL) {}
@@ -1211,6 +1620,10 @@ static DirOptions MaybeRewriteOptions(  // Only a subset of options are checked
   if (result.mode != origin.mode)
     Warn(__LOG_ARGS__, "Dfs.plfsdir.mode -> %s (was %s)",
          DirModeName(result.mode).c_str(), DirModeName(origin.mode).c_str());
+  if (result.format != origin.format)
+    Warn(__LOG_ARGS__, "Dfs.plfsdir.format -> %s (was %s)",
+         DirFormatName(result.format).c_str(),
+         DirFormatName(origin.format).c_str());
   if (result.num_epochs != origin.num_epochs)
     Warn(__LOG_ARGS__, "Dfs.plfsdir.num_epochs -> %d (was %d)",
          result.num_epochs, origin.num_epochs);
@@ -1256,12 +1669,16 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
           int(options.paranoid_checks) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.ignore_filters -> %s",
           int(options.ignore_filters) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.recover_partial_logs -> %s",
+          int(options.recover_partial_logs) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.verify_checksums -> %s",
           int(options.verify_checksums) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.skip_checksums -> %s",
           int(options.skip_checksums) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_reads -> %s",
           int(options.measure_reads) ? "Yes" : "No");
+  Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.measure_latencies -> %s",
+          int(options.measure_latencies) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.epoch_log_rotation -> %s",
           int(options.epoch_log_rotation) ? "Yes" : "No");
   Verbose(__LOG_ARGS__, 2, "Dfs.plfsdir.allow_env_threads -> %s",
@@ -1285,27 +1702,55 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
       options.paranoid_checks) {  // Skip the footer unless we need more info
     status = ReadFileToString(env, DirInfoFileName(dirname).c_str(), &dir_info);
     if (!status.ok()) {
-      return status;
+      // The dir info file is only written when a writer finishes. Without it,
+      // user options are trusted as long as we know the number of partitions.
+      if (options.recover_partial_logs && options.lg_parts != -1) {
+        status = Status::OK();
+        dir_info.clear();
+      } else {
+        return status;
+      }
     } else if (dir_info.size() < Footer::kEncodedLength) {
       return Status::Corruption("Truncated dir info");
     }
-    // Get rid of the padding
-    Slice input = dir_info;
-    if (input.size() > Footer::kEncodedLength) {
-      input.remove_prefix(input.size() - Footer::kEncodedLength);
+    if (!dir_info.empty()) {
+      // Get rid of the padding
+      Slice input = dir_info;
+      if (input.size() > Footer::kEncodedLength) {
+        input.remove_prefix(input.size() - Footer::kEncodedLength);
+      }
+      status = footer.DecodeFrom(&input);
+      if (!status.ok()) {
+        return status;
+      }
+
+      // Rewrite potentially ill-specified options
+      options = MaybeRewriteOptions(options, footer);
+      num_parts = 1u << options.lg_parts;
     }
-    status = footer.DecodeFrom(&input);
-    if (!status.ok()) {
+  }
+
+  // The footer may be preceded by a stats block. Stats only cover the
+  // partitions of rank 0, which is the one writing the dir info file.
+  std::vector<EpochStats> stats;
+  bool has_stats = false;
+  if (dir_info.size() > Footer::kEncodedLength && my_rank == 0 &&
+      !options.recover_partial_logs) {
+    Slice input(dir_info.data(), dir_info.size() - Footer::kEncodedLength);
+    status = GetDirStats(input, &stats);
+    if (status.ok()) {
+      has_stats = true;
+    } else if (status.IsNotFound() || !options.paranoid_checks) {
+      status = Status::OK();  // Fall back to partition indexes
+    } else {
       return status;
     }
-
-    // Rewrite potentially ill-specified options
-    options = MaybeRewriteOptions(options, footer);
-    num_parts = 1u << options.lg_parts;
   }
 
   LogSource* data = NULL;
   DirReaderImpl* impl = new DirReaderImpl(options, dirname);
+  impl->stats_.swap(stats);
+  impl->has_stats_ = has_stats;
   LogSource::LogOptions io_opts;
   io_opts.rank = my_rank;
   io_opts.type = kDefIoType;
@@ -1316,6 +1761,8 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
   status = LogSource::Open(io_opts, dirname, &data);
   if (!status.ok()) {
     // Error
+  } else if (options.recover_partial_logs) {
+    // The data log may not have a footer
   } else if (data->Size(data->LastFileIndex()) < Footer::kEncodedLength) {
     status = Status::Corruption("Data log too short to be valid");
   } else if (options.paranoid_checks) {
@@ -1340,6 +1787,13 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
     impl->data_ = data;
     impl->data_->Ref();
 
+    if (options.recover_partial_logs) {
+      MutexLock ml(&impl->mutex_);
+      status = impl->Recover();
+    }
+  }
+
+  if (status.ok()) {
     *result = impl;
   } else {
     delete impl;
@@ -1352,5 +1806,113 @@ Status DirReader::Open(const DirOptions& _opts, const std::string& dirname,
   return status;
 }
 
+namespace {
+struct MergeState {
+  DirWriter* writer;
+  port::Mutex mu;
+  Status status;  // The first error seen
+};
+
+// Insert a merged key into the destination directory with its value prefixed
+// by its original epoch.
+int AddMergedKey(void* arg, uint32_t epoch, const Slice& key,
+                 const Slice& value) {
+  MergeState* const state = reinterpret_cast<MergeState*>(arg);
+  std::string tagged_value;
+  PutVarint32(&tagged_value, epoch);
+  tagged_value.append(value.data(), value.size());
+  Status s = state->writer->Add(key, tagged_value, 0);
+  if (!s.ok()) {
+    MutexLock ml(&state->mu);
+    if (state->status.ok()) {
+      state->status = s;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+}  // namespace
+
+// The destination directory keeps the partitioning of the source directory.
+// Keys of each source partition therefore all go to the same destination
+// partition in order, and every memtable flush there produces a table that
+// does not overlap with the previous ones. The result is one sorted run per
+// partition whose per-table filters act as a single partitioned filter.
+Status MergeDir(const std::string& src, const std::string& dst,
+                const DirOptions& _opts) {
+  DirOptions options = SanitizeReadOptions(_opts);
+  Env* const env = options.env;
+  std::string dir_info;
+  Status status =
+      ReadFileToString(env, DirInfoFileName(src).c_str(), &dir_info);
+  if (!status.ok()) {
+    return status;
+  } else if (dir_info.size() < Footer::kEncodedLength) {
+    return Status::Corruption("Truncated dir info");
+  }
+  Footer footer;
+  Slice input = dir_info;
+  input.remove_prefix(input.size() - Footer::kEncodedLength);
+  status = footer.DecodeFrom(&input);
+  if (!status.ok()) {
+    return status;
+  }
+  options = ApplyFooter(options, footer);
+  if (IsEpochTagged(options.mode)) {
+    return Status::NotSupported("Dir already merged", src);
+  } else if (IsKeyUnOrdered(options.mode)) {
+    return Status::NotSupported("Keys are not stored in-order", src);
+  } else if (env->FileExists(DirInfoFileName(dst).c_str())) {
+    return Status::AlreadyExists(dst);
+  }
+
+  DirOptions dst_options = options;
+  dst_options.mode = kDmMergedEpochs;
+  // Values are no longer of a fixed size once prefixed by their epochs
+  dst_options.fixed_kv_length = false;
+  dst_options.skip_sort = true;  // Keys are inserted in-order
+  dst_options.epoch_log_rotation = false;
+  // Keys are inserted by the threads that merge source partitions. These may
+  // be all the threads of a pool shared with the writer, and an insert
+  // waiting for a compaction queued behind them would never return. Compact
+  // in the inserting thread instead.
+  dst_options.compaction_pool = NULL;
+  dst_options.allow_env_threads = false;
+  DirReader* reader = NULL;
+  DirWriter* writer = NULL;
+  status = DirReader::Open(options, src, &reader);
+  if (status.ok()) {
+    status = DirWriter::Open(dst_options, dst, &writer);
+  }
+  if (status.ok()) {
+    MergeState state;
+    state.writer = writer;
+    status = reader->Merge(AddMergedKey, &state);
+    if (status.ok()) {
+      status = state.status;
+    }
+  }
+  uint32_t num_eps = 0;
+  if (status.ok()) {
+    status = reader->GetNumEpochs(&num_eps);
+  }
+  // Keep the number of epochs of the source directory
+  for (uint32_t epoch = 0; status.ok() && epoch < num_eps; epoch++) {
+    status = writer->EpochFlush(int(epoch));
+  }
+  if (status.ok()) {
+    status = writer->Finish();
+  }
+
+  const bool dst_created = writer != NULL;
+  delete writer;
+  delete reader;
+  if (!status.ok() && dst_created) {
+    DestroyDir(dst, dst_options);
+  }
+  return status;
+}
+
 }  // namespace plfsio
 }  // namespace pdlfs
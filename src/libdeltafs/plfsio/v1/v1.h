@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include "metrics.h"
 #include "types.h"
 
 namespace pdlfs {
@@ -66,6 +67,17 @@ class DirWriter {
   // Return the total amount of memory reserved by this directory.
   uint64_t TEST_total_memory_usage() const;
 
+  // Obtain the value of a directory property. "latency.<op>" returns the
+  // latency histogram of a writer operation, such as "latency.add_wait".
+  // See LatencyStats::GetProperty() for the supported suffixes.
+  // Return false if the property is unknown or not measured.
+  bool GetProperty(const Slice& property, std::string* value) const;
+
+  // Append a snapshot of all writer counters to *result. This includes the
+  // output and I/O stats of each memtable partition, memory usage, and the
+  // number and total time of each measured operation.
+  void GetMetrics(DirMetrics* result) const;
+
   // Open an I/O writer against a specified plfs-style directory.
   // Return OK on success, or a non-OK status on errors.
   static Status Open(const DirOptions& options, const std::string& dirname,
@@ -153,6 +165,9 @@ class DirReader {
     uint32_t epoch_start;
     uint32_t epoch_end;
     bool no_parallel_reads;
+    // Pass empty values to the saver. Directories in the v2 format then
+    // only read their key blocks.
+    bool keys_only;
     size_t* table_seeks;
     size_t* seeks;
     size_t* n;
@@ -163,6 +178,36 @@ class DirReader {
   // Return OK on success, or a non-OK status on errors.
   virtual Status Scan(const ScanOp& op, ScanSaver, void*) = 0;
 
+  typedef int (*MergeSaver)(void* arg, uint32_t epoch, const Slice& key,
+                             const Slice& value);
+  // Merge all epochs of each partition into a single key-ordered stream.
+  // For each partition, the saver is called in key order along with the epoch
+  // each key was written in. Equal keys are reported in epoch order.
+  // Different partitions may be merged concurrently. Only one data block per
+  // table is buffered in memory.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status Merge(MergeSaver, void*) = 0;
+
+  // Obtain the summary stats of every non-empty epoch of each partition from
+  // the stats block stored with the directory's footer. This costs no index
+  // reads and allows callers to estimate query costs up front.
+  // Return NotFound if the directory has no usable stats block.
+  virtual Status GetEpochStats(std::vector<EpochStats>* result) = 0;
+
+  // Obtain the number of epochs stored in the directory. For directories
+  // recovered from partial logs, this is the number of epochs available in
+  // every partition.
+  // Return OK on success, or a non-OK status on errors.
+  virtual Status GetNumEpochs(uint32_t* result) = 0;
+
+  // Obtain the value of a directory property. "latency.<op>" returns the
+  // latency histogram of a reader operation, such as "latency.data_read".
+  // Return false if the property is unknown or not measured.
+  virtual bool GetProperty(const Slice& property, std::string* value) const = 0;
+
+  // Append a snapshot of all reader counters to *result.
+  virtual void GetMetrics(DirMetrics* result) const = 0;
+
   // Return the aggregated I/O stats accumulated so far.
   virtual IoStats TEST_iostats() const = 0;
 
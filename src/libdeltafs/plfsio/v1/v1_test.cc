@@ -14,6 +14,8 @@
 #include "internal.h"
 #include "v1.h"
 
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/histogram.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
@@ -153,6 +155,70 @@ class PlfsIoTest {
     ASSERT_OK(s);
   }
 
+  // Stop writing without calling Finish() as if the writer had crashed.
+  void Abandon() {
+    ASSERT_OK(writer_->Wait());
+    delete writer_;
+    writer_ = NULL;
+  }
+
+  // Remove the last n bytes from all directory files whose names contain a
+  // given pattern.
+  void Truncate(const char* pattern, size_t n) {
+    std::vector<std::string> names;
+    ASSERT_OK(options_.env->GetChildren(dirname_.c_str(), &names));
+    for (size_t i = 0; i < names.size(); i++) {
+      if (names[i].find(pattern) != std::string::npos) {
+        const std::string fname = dirname_ + "/" + names[i];
+        std::string contents;
+        ASSERT_OK(ReadFileToString(options_.env, fname.c_str(), &contents));
+        contents.resize(contents.size() - std::min(n, contents.size()));
+        ASSERT_OK(WriteStringToFile(options_.env, contents, fname.c_str()));
+      }
+    }
+  }
+
+  // Re-encode the last epoch stone of the index log without epoch stats as if
+  // it had been written by an older writer.
+  void DropLastStoneStats() {
+    std::vector<std::string> names;
+    ASSERT_OK(options_.env->GetChildren(dirname_.c_str(), &names));
+    for (size_t i = 0; i < names.size(); i++) {
+      if (names[i].find(".idx") == std::string::npos) continue;
+      const std::string fname = dirname_ + "/" + names[i];
+      std::string contents;
+      ASSERT_OK(ReadFileToString(options_.env, fname.c_str(), &contents));
+      size_t last = std::string::npos;
+      size_t off = 0;
+      while (off + kChunkHeaderSize <= contents.size()) {
+        const unsigned char type = static_cast<unsigned char>(contents[off]);
+        const size_t n = DecodeFixed32(&contents[off + 1]);
+        if (type == kEpochStone) last = off;
+        off += kChunkHeaderSize + n;
+        if (type != kEpochStone && type != kFooter) off += kBlockTrailerSize;
+      }
+      ASSERT_TRUE(last != std::string::npos);
+      Slice input(&contents[last + kChunkHeaderSize],
+                  DecodeFixed32(&contents[last + 1]));
+      EpochStone stone;
+      ASSERT_OK(stone.DecodeFrom(&input));
+      stone.set_num_tables(~static_cast<uint32_t>(0));
+      stone.set_num_ents(~static_cast<uint32_t>(0));
+      std::string encoding;
+      stone.EncodeTo(&encoding);
+      char header[kChunkHeaderSize];
+      header[0] = static_cast<char>(kEpochStone);
+      EncodeFixed32(header + 1, static_cast<uint32_t>(encoding.size()));
+      uint32_t crc = crc32c::Value(encoding.data(), encoding.size());
+      crc = crc32c::Extend(crc, header, 5);
+      EncodeFixed32(header + 5, crc32c::Mask(crc));
+      contents.resize(last);
+      contents.append(header, sizeof(header));
+      contents.append(encoding);
+      ASSERT_OK(WriteStringToFile(options_.env, contents, fname.c_str()));
+    }
+  }
+
   void MakeEpoch() {
     if (writer_ == NULL) OpenWriter();
     ASSERT_OK(writer_->EpochFlush(epoch_));
@@ -198,6 +264,29 @@ class PlfsIoTest {
     return tmp;
   }
 
+  // Scan keys only and return all keys found separated by commas.
+  std::string ScanKeys(int epoch) {
+    std::string tmp;
+    SaverState state;
+    state.tmp = &tmp;
+    DirReader::ScanOp op;
+    op.SetEpoch(epoch);
+    op.keys_only = true;
+    if (writer_ != NULL) Finish();
+    if (reader_ == NULL) OpenReader();
+    ASSERT_OK(reader_->Scan(op, SaveKey, &state));
+    return tmp;
+  }
+
+  static int SaveKey(void* arg, const Slice& key, const Slice& value) {
+    SaverState* st = reinterpret_cast<SaverState*>(arg);
+    MutexLock ml(&st->mu);
+    ASSERT_TRUE(value.empty());
+    if (!st->tmp->empty()) st->tmp->push_back(',');
+    st->tmp->append(key.data(), key.size());
+    return 0;
+  }
+
   std::string Read(const Slice& key) {
     std::string tmp;
     DirReader::ReadOp op;
@@ -207,6 +296,31 @@ class PlfsIoTest {
     return tmp;
   }
 
+  // Merge enough keys to fill every write buffer of the merged directory more
+  // than once and check a sample of them.
+  void MergeManyKeys() {
+    char tmp[20];
+    for (int epoch = 0; epoch < 2; epoch++) {
+      for (int i = epoch; i < 20000; i += 2) {
+        snprintf(tmp, sizeof(tmp), "k%07d", i);
+        Append(tmp, std::string(100, static_cast<char>('a' + epoch)));
+      }
+      MakeEpoch();
+    }
+    Finish();
+    const std::string src = dirname_;
+    dirname_ = src + "_merged";
+    DestroyDir(dirname_, options_);
+    ASSERT_OK(MergeDir(src, dirname_, options_));
+    for (int i = 0; i < 20000; i += 1000) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      ASSERT_EQ(Read(tmp), std::string(100, static_cast<char>('a' + i % 2)));
+    }
+    delete reader_;
+    reader_ = NULL;
+    DestroyDir(dirname_, options_);
+  }
+
   DirOptions options_;
   std::string dirname_;
   DirWriter* writer_;
@@ -269,6 +383,31 @@ TEST(PlfsIoTest, MultiEpoch) {
   ASSERT_EQ(Count(3), 0);
 }
 
+TEST(PlfsIoTest, ParallelReads) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4);
+  options_.parallel_reads = true;
+  options_.reader_pool = pool;
+  char tmp[10];
+  std::string all;
+  std::string expected;
+  for (int i = 0; i < 64; i++) {
+    snprintf(tmp, sizeof(tmp), "v%02d", i);
+    Append("k0", tmp);  // Present in every epoch
+    all.append(tmp);
+    if (i % 8 == 0) {   // Present in a few epochs
+      Append("k1", tmp);
+      expected.append(tmp);
+    }
+    MakeEpoch();
+  }
+  ASSERT_EQ(Read("k1"), expected);
+  ASSERT_EQ(Read("k0"), all);
+  ASSERT_TRUE(Read("k2").empty());
+  delete reader_;
+  reader_ = NULL;
+  delete pool;
+}
+
 TEST(PlfsIoTest, ArrayBlockFmt) {
   options_.leveldb_compatible = false;
   options_.fixed_kv_length = true;
@@ -295,6 +434,141 @@ TEST(PlfsIoTest, ArrayBlockFmt) {
   ASSERT_EQ(Count(3), 0);
 }
 
+TEST(PlfsIoTest, KeyColumnFmt) {
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.key_column = true;
+  options_.value_size = 2;
+  options_.key_size = 8;
+  char tmp[20];
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", 2 * i);
+    Append(tmp, "v0");
+    expected.append("v0");
+  }
+  MakeEpoch();
+  Append("k0000007", "v1");
+  Append("k0000008", "v2");
+  MakeEpoch();
+  ASSERT_EQ(Read("k0000000"), "v0");
+  ASSERT_EQ(Read("k0000198"), "v0");
+  ASSERT_EQ(Read("k0000008"), "v0v2");
+  ASSERT_EQ(Read("k0000007"), "v1");
+  ASSERT_TRUE(Read("k0000003").empty());
+  ASSERT_TRUE(Read("k0000199").empty());
+  ASSERT_TRUE(Read("k000000").empty());
+  ASSERT_TRUE(Read("k00000080").empty());
+  ASSERT_EQ(Scan(0), expected);
+  ASSERT_EQ(Scan(1), "v1v2");
+  ASSERT_EQ(Count(0), 100);
+  ASSERT_EQ(Count(1), 2);
+}
+
+TEST(PlfsIoTest, UnorderedWithKeyColumnFmt) {
+  options_.mode = kDmUniqueUnordered;
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.key_column = true;
+  options_.value_size = 2;
+  options_.key_size = 16;
+  Append("k000000000000002", "v2");
+  Append("k000000000000001", "v1");
+  MakeEpoch();
+  Append("k000000000000001", "v3");
+  Append("k000000000000002", "v4");
+  MakeEpoch();
+  ASSERT_EQ(Read("k000000000000001"), "v1v3");
+  ASSERT_EQ(Read("k000000000000002"), "v2v4");
+  ASSERT_TRUE(Read("k000000000000003").empty());
+  ASSERT_EQ(Scan(0), "v2v1");
+  ASSERT_EQ(Scan(1), "v3v4");
+}
+
+TEST(PlfsIoTest, V2Fmt) {
+  options_.format = kDirFmtV2;
+  options_.block_size = 4 << 10;  // Force multiple key blocks per table
+  char tmp[20];
+  std::string expected;
+  for (int i = 0; i < 500; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    const std::string value(100, static_cast<char>('a' + i % 26));
+    Append(tmp, value);
+    expected.append(value);
+  }
+  MakeEpoch();
+  Append("k0000007", "v1");
+  Append("k0000008", "v2");
+  MakeEpoch();
+  Finish();
+  // Readers pick up the format from the footer
+  options_.format = kDirFmtV1;
+  ASSERT_EQ(Read("k0000000"), std::string(100, 'a'));
+  ASSERT_EQ(Read("k0000499"), std::string(100, 'a' + 499 % 26));
+  ASSERT_EQ(Read("k0000007"), std::string(100, 'h') + "v1");
+  ASSERT_TRUE(Read("k0000500").empty());
+  ASSERT_TRUE(Read("k00000070").empty());
+  IoStats before = reader_->TEST_iostats();
+  ASSERT_EQ(Scan(0), expected);
+  IoStats after = reader_->TEST_iostats();
+  const uint64_t scan_bytes = after.data_bytes - before.data_bytes;
+  ASSERT_EQ(ScanKeys(1), "k0000007,k0000008");
+  ASSERT_EQ(Scan(1), "v1v2");
+  before = reader_->TEST_iostats();
+  ASSERT_EQ(ScanKeys(0).size(), 500 * 9 - 1);
+  after = reader_->TEST_iostats();
+  const uint64_t key_scan_bytes = after.data_bytes - before.data_bytes;
+  ASSERT_TRUE(key_scan_bytes * 4 < scan_bytes);
+  ASSERT_EQ(Count(0), 500);
+  ASSERT_EQ(Count(1), 2);
+  // The format is still picked up when the dir info file is never read
+  delete reader_;
+  reader_ = NULL;
+  options_.lg_parts = 0;
+  options_.num_epochs = 2;
+  options_.paranoid_checks = false;
+  ASSERT_EQ(Read("k0000007"), std::string(100, 'h') + "v1");
+  ASSERT_EQ(Read("k0000499"), std::string(100, 'a' + 499 % 26));
+  ASSERT_EQ(Scan(1), "v1v2");
+  ASSERT_EQ(ScanKeys(1), "k0000007,k0000008");
+}
+
+TEST(PlfsIoTest, V2FmtMultiMap) {
+  options_.format = kDirFmtV2;
+  options_.mode = kDmMultiMap;
+  options_.verify_checksums = false;  // Read values alone
+  Append("k1", "v1");
+  Append("k1", "v2");
+  Append("k2", "v3");
+  MakeEpoch();
+  Append("k1", "v4");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v2v4");
+  ASSERT_EQ(Read("k2"), "v3");
+  ASSERT_TRUE(Read("k3").empty());
+  ASSERT_EQ(Scan(0), "v1v2v3");
+  ASSERT_EQ(ScanKeys(0), "k1,k1,k2");
+}
+
+// Key blocks are always LevelDb blocks in the v2 format, even when fixed-sized
+// array blocks are otherwise requested.
+TEST(PlfsIoTest, V2FmtFixedKv) {
+  options_.format = kDirFmtV2;
+  options_.leveldb_compatible = false;
+  options_.fixed_kv_length = true;
+  options_.value_size = 2;
+  options_.key_size = 2;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Count(1), 1);
+}
+
 TEST(PlfsIoTest, Unordered) {
   options_.mode = kDmUniqueUnordered;
   Append("k2", "v2");
@@ -369,6 +643,45 @@ TEST(PlfsIoTest, Snappy1) {
   ASSERT_EQ(Count(3), 0);
 }
 
+// Blocks are written uncompressed if zstd or lz4 is not compiled in.
+TEST(PlfsIoTest, Zstd) {
+  options_.compression = kZstdCompression;
+  options_.index_compression = kZstdCompression;
+  options_.force_compression = true;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k2", "v4");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_EQ(Read("k2"), "v2v4");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 2);
+}
+
+TEST(PlfsIoTest, LZ4) {
+  options_.compression = kLZ4Compression;
+  options_.index_compression = kLZ4Compression;
+  options_.force_compression = true;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k2", "v4");
+  MakeEpoch();
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_TRUE(Read("k1.1").empty());
+  ASSERT_EQ(Read("k2"), "v2v4");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 2);
+}
+
 TEST(PlfsIoTest, Snappy2) {
   options_.index_compression = kSnappyCompression;
   options_.force_compression = true;
@@ -393,6 +706,39 @@ TEST(PlfsIoTest, Snappy2) {
   ASSERT_EQ(Count(3), 0);
 }
 
+// Data blocks are compressed on the compaction pool.
+TEST(PlfsIoTest, ParallelCompression) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3, true);
+  options_.compaction_pool = pool;
+  options_.compression = kSnappyCompression;
+  options_.force_compression = true;
+  options_.block_size = 4 << 10;
+  options_.block_batch_size = 16 << 10;
+  const std::string dummy_val(32, 'x');
+  const int batch_size = 8 << 10;
+  char tmp[10];
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i += 2) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    Append(Slice(tmp), dummy_val);
+  }
+  MakeEpoch();
+  for (int i = 0; i < batch_size; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(Slice(tmp)).size(), dummy_val.size() * (2 - i % 2)) << tmp;
+  }
+  ASSERT_TRUE(Read("kx").empty());
+  ASSERT_EQ(Count(0), batch_size);
+  ASSERT_EQ(Count(1), batch_size / 2);
+  delete reader_;
+  reader_ = NULL;
+  delete pool;
+}
+
 TEST(PlfsIoTest, LargeBatch) {
   const std::string dummy_val(32, 'x');
   const int batch_size = 64 << 10;
@@ -459,6 +805,154 @@ TEST(PlfsIoTest, LogRotation) {
   Finish();
 }
 
+TEST(PlfsIoTest, Latencies) {
+  options_.measure_latencies = true;
+  std::string val;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  ASSERT_OK(writer_->Wait());
+  ASSERT_TRUE(writer_->GetProperty("latency.epoch_flush.count", &val));
+  ASSERT_EQ(val, "1");
+  ASSERT_TRUE(writer_->GetProperty("latency.memtable_sort.count", &val));
+  ASSERT_EQ(val, "1");
+  ASSERT_TRUE(writer_->GetProperty("latency.block_build.count", &val));
+  ASSERT_EQ(val, "1");
+  ASSERT_TRUE(writer_->GetProperty("latency.filter_build.count", &val));
+  ASSERT_EQ(val, "1");
+  ASSERT_TRUE(writer_->GetProperty("latency.log_write.count", &val));
+  ASSERT_TRUE(writer_->GetProperty("latency.add_wait.p99", &val));
+  ASSERT_EQ(val, "0");
+  ASSERT_TRUE(writer_->GetProperty("latency.block_build", &val));
+  ASSERT_TRUE(!val.empty());
+  ASSERT_TRUE(!writer_->GetProperty("latency.block_build.p42", &val));
+  ASSERT_TRUE(!writer_->GetProperty("latency.unknown", &val));
+  Finish();
+  ASSERT_EQ(Read("k1"), "v1");
+  // Stay within [k1, k2] so epoch stats do not skip the filter check
+  ASSERT_TRUE(Read("k15").empty());
+  ASSERT_TRUE(reader_->GetProperty("latency.filter_check.count", &val));
+  ASSERT_EQ(val, "2");
+  ASSERT_TRUE(reader_->GetProperty("latency.index_read.count", &val));
+  ASSERT_EQ(val, "1");
+  ASSERT_TRUE(reader_->GetProperty("latency.data_read.count", &val));
+  ASSERT_EQ(val, "1");
+}
+
+TEST(PlfsIoTest, EventTrace) {
+  const std::string fname = test::TmpDir() + "/plfsio_test_events";
+  EventTraceListener* lis;
+  ASSERT_OK(EventTraceListener::Open(Env::Default(), fname, &lis));
+  options_.listener = lis;
+  options_.lg_parts = 0;
+  options_.epoch_log_rotation = true;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k3", "v3");
+  MakeEpoch();
+  Finish();
+  delete lis;
+  std::vector<EventRecord> records;
+  ASSERT_OK(ReadEventTrace(Env::Default(), fname, &records));
+  int compactions = 0;
+  int seals = 0;
+  int rotations = 0;
+  uint64_t keys = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (records[i].type == kCompactionEnd) {
+      keys += records[i].args[0];
+      compactions++;
+    } else if (records[i].type == kEpochSeal) {
+      ASSERT_EQ(records[i].epoch, seals);
+      seals++;
+    } else if (records[i].type == kLogRotation) {
+      rotations++;
+    }
+  }
+  ASSERT_EQ(keys, 3);
+  ASSERT_TRUE(compactions >= 2);
+  ASSERT_TRUE(seals >= 2);
+  ASSERT_EQ(rotations, 2);
+  const std::string summary = SummarizeEventTrace(records);
+  ASSERT_TRUE(summary.find("Compactions: ") != std::string::npos);
+  fprintf(stderr, "%s", summary.c_str());
+  Env::Default()->DeleteFile(fname.c_str());
+}
+
+TEST(PlfsIoTest, Recovery) {
+  options_.lg_parts = 0;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k2", "v4");
+  MakeEpoch();
+  Append("k1", "v5");
+  Abandon();
+  DirReader* reader;
+  ASSERT_TRUE(!DirReader::Open(options_, dirname_, &reader).ok());
+  options_.recover_partial_logs = true;
+  ASSERT_EQ(Read("k1"), "v1v3");
+  ASSERT_EQ(Read("k2"), "v2v4");
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 2);
+  ASSERT_EQ(Count(2), 0);
+}
+
+// The last epoch stone is incomplete.
+TEST(PlfsIoTest, RecoveryFromTruncatedIndex) {
+  options_.lg_parts = 0;
+  Append("k1", "v1");
+  MakeEpoch();
+  Append("k1", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  MakeEpoch();
+  Abandon();
+  Truncate(".idx", 1);
+  options_.recover_partial_logs = true;
+  ASSERT_EQ(Read("k1"), "v1v2");
+  ASSERT_EQ(Count(2), 0);
+}
+
+// Epochs whose data blocks are missing are dropped.
+// Epochs sealed by older writers have no stats and have to be counted by
+// scanning their keys.
+TEST(PlfsIoTest, RecoveryFromOldStones) {
+  options_.lg_parts = 0;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k2", "v4");
+  Append("k3", "v5");
+  MakeEpoch();
+  Abandon();
+  DropLastStoneStats();
+  options_.recover_partial_logs = true;
+  ASSERT_EQ(Read("k3"), "v5");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 3);
+  size_t total;
+  ASSERT_OK(reader_->Count(DirReader::CountOp(), &total));
+  ASSERT_EQ(total, 5);
+}
+
+TEST(PlfsIoTest, RecoveryFromTruncatedData) {
+  options_.lg_parts = 1;
+  Append("k1", "v1");
+  Append("k2", "v2");
+  MakeEpoch();
+  Abandon();
+  Truncate(".dat", ~static_cast<size_t>(0));
+  options_.recover_partial_logs = true;
+  ASSERT_TRUE(Read("k1").empty());
+  ASSERT_EQ(Count(0), 0);
+}
+
 TEST(PlfsIoTest, MultiMap) {
   options_.mode = kDmMultiMap;
   Append("k1", "v1");
@@ -477,6 +971,170 @@ TEST(PlfsIoTest, MultiMap) {
   ASSERT_EQ(Read("k1"), "v1v2v4v5v6v7v9");
 }
 
+TEST(PlfsIoTest, EpochStats) {
+  options_.lg_parts = 1;
+  Append("k1", "v1");
+  Append("k2", "v22");
+  Append("k3", "v333");
+  MakeEpoch();
+  MakeEpoch();
+  Append("k2", "v4");
+  MakeEpoch();
+  Finish();
+  OpenReader();
+  std::vector<EpochStats> stats;
+  ASSERT_OK(reader_->GetEpochStats(&stats));
+  uint64_t num_keys[3] = {0, 0, 0};
+  uint64_t value_bytes = 0;
+  for (size_t i = 0; i < stats.size(); i++) {
+    ASSERT_TRUE(stats[i].epoch < 3);
+    ASSERT_TRUE(stats[i].part < 2);
+    ASSERT_TRUE(stats[i].num_keys != 0);
+    ASSERT_TRUE(stats[i].data_bytes != 0);
+    ASSERT_TRUE(stats[i].min_key <= stats[i].max_key);
+    ASSERT_EQ(stats[i].key_bytes, 2 * stats[i].num_keys);
+    num_keys[stats[i].epoch] += stats[i].num_keys;
+    value_bytes += stats[i].value_bytes;
+    if (stats[i].epoch == 2) {
+      ASSERT_EQ(stats[i].min_key, "k2");
+      ASSERT_EQ(stats[i].max_key, "k2");
+    }
+  }
+  ASSERT_EQ(num_keys[0], 3);
+  ASSERT_EQ(num_keys[1], 0);
+  ASSERT_EQ(num_keys[2], 1);
+  ASSERT_EQ(value_bytes, 11);
+  size_t total;
+  ASSERT_OK(reader_->Count(DirReader::CountOp(), &total));
+  ASSERT_EQ(total, 4);
+  ASSERT_EQ(Count(1), 0);
+  // Keys out of the range of their partitions are skipped without any reads
+  const IoStats before = reader_->TEST_iostats();
+  ASSERT_TRUE(Read("k0").empty());
+  ASSERT_TRUE(Read("k4").empty());
+  const IoStats after = reader_->TEST_iostats();
+  ASSERT_EQ(after.index_bytes, before.index_bytes);
+  ASSERT_EQ(after.data_bytes, before.data_bytes);
+  ASSERT_EQ(Read("k2"), "v22v4");
+  ASSERT_EQ(Scan(2), "v4");
+  delete reader_;
+  reader_ = NULL;
+  // Directories without stats fall back to their partition indexes
+  const std::string fname = DirInfoFileName(dirname_);
+  std::string dir_info;
+  ASSERT_OK(ReadFileToString(options_.env, fname.c_str(), &dir_info));
+  dir_info = dir_info.substr(dir_info.size() - Footer::kEncodedLength);
+  ASSERT_OK(WriteStringToFile(options_.env, dir_info, fname.c_str()));
+  OpenReader();
+  stats.clear();
+  ASSERT_TRUE(reader_->GetEpochStats(&stats).IsNotFound());
+  ASSERT_OK(reader_->Count(DirReader::CountOp(), &total));
+  ASSERT_EQ(total, 4);
+  ASSERT_EQ(Read("k2"), "v22v4");
+}
+
+TEST(PlfsIoTest, MergeEpochs) {
+  options_.mode = kDmMultiMap;
+  options_.fixed_kv_length = true;  // Values are no longer fixed once merged
+  options_.key_size = 2;
+  options_.value_size = 2;
+  Append("k1", "v1");
+  Append("k3", "v2");
+  MakeEpoch();
+  Append("k1", "v3");
+  Append("k1", "v4");
+  Append("k2", "v5");
+  MakeEpoch();
+  MakeEpoch();
+  Append("k3", "v6");
+  MakeEpoch();
+  Finish();
+  const std::string src = dirname_;
+  dirname_ = src + "_merged";
+  DestroyDir(dirname_, options_);
+  ASSERT_OK(MergeDir(src, dirname_, options_));
+  ASSERT_TRUE(MergeDir(src, dirname_, options_).IsAlreadyExists());
+  ASSERT_EQ(Read("k1"), "v1v3v4");
+  ASSERT_EQ(Read("k2"), "v5");
+  ASSERT_EQ(Read("k3"), "v2v6");
+  ASSERT_TRUE(Read("k4").empty());
+  ASSERT_EQ(Scan(0), "v1v2");
+  ASSERT_EQ(Scan(1), "v3v4v5");
+  ASSERT_TRUE(Scan(2).empty());
+  ASSERT_EQ(Scan(3), "v6");
+  ASSERT_EQ(Count(0), 2);
+  ASSERT_EQ(Count(1), 3);
+  ASSERT_EQ(Count(2), 0);
+  ASSERT_EQ(Count(3), 1);
+  size_t total;
+  ASSERT_OK(reader_->Count(DirReader::CountOp(), &total));
+  ASSERT_EQ(total, 6);
+  uint32_t num_eps;
+  ASSERT_OK(reader_->GetNumEpochs(&num_eps));
+  ASSERT_EQ(num_eps, 4);
+  DirReader::ReadOp op;
+  op.epoch_start = 1;
+  op.epoch_end = 4;
+  std::string tmp;
+  ASSERT_OK(reader_->Read(op, "k3", &tmp));
+  ASSERT_EQ(tmp, "v6");
+  // Merged directories cannot be merged again
+  ASSERT_TRUE(MergeDir(dirname_, src + "_remerged", options_).IsNotSupported());
+  DestroyDir(dirname_, options_);
+}
+
+TEST(PlfsIoTest, MergeManyTables) {
+  options_.allow_env_threads = true;  // Merge partitions in parallel
+  options_.lg_parts = 1;
+  options_.total_memtable_budget = 64 << 10;
+  options_.block_size = 4 << 10;
+  char tmp[20];
+  for (int epoch = 0; epoch < 3; epoch++) {
+    for (int i = epoch; i < 3000; i += 2) {
+      snprintf(tmp, sizeof(tmp), "k%07d", i);
+      Append(tmp, std::string(16, static_cast<char>('a' + epoch)));
+    }
+    MakeEpoch();
+  }
+  Finish();
+  OpenReader();
+  std::vector<std::string> expected;
+  for (int i = 0; i < 3000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    expected.push_back(Read(tmp));
+  }
+  const size_t expected_count = Count(1);
+  delete reader_;
+  reader_ = NULL;
+  const std::string src = dirname_;
+  dirname_ = src + "_merged";
+  DestroyDir(dirname_, options_);
+  ASSERT_OK(MergeDir(src, dirname_, options_));
+  for (int i = 0; i < 3000; i++) {
+    snprintf(tmp, sizeof(tmp), "k%07d", i);
+    ASSERT_EQ(Read(tmp), expected[i]);
+  }
+  ASSERT_EQ(Count(1), expected_count);
+  DestroyDir(dirname_, options_);
+}
+
+// Partitions are merged by reader threads that also insert merged keys into
+// the destination directory. Such inserts must not wait for compactions that
+// are scheduled behind the merges in the same pool.
+TEST(PlfsIoTest, MergeWithSharedPool) {
+  ThreadPool* const pool = ThreadPool::NewFixed(2);
+  options_.reader_pool = pool;
+  options_.compaction_pool = pool;
+  options_.lg_parts = 1;
+  MergeManyKeys();
+  delete pool;
+}
+
+TEST(PlfsIoTest, MergeWithEnvThreads) {
+  options_.allow_env_threads = true;
+  MergeManyKeys();
+}
+
 namespace {
 
 class WriteLock {
@@ -662,6 +1320,41 @@ class PlfsIoBench {
     }
   }
 
+  static CompressionType GetCompressionType(CompressionType deftype) {
+    const char* env = getenv("COMPRESSION");
+    if (env == NULL) {
+      return deftype;
+    } else if (env[0] == 0) {
+      return deftype;
+    } else if (strcmp(env, "none") == 0) {
+      return kNoCompression;
+    } else if (strcmp(env, "snappy") == 0) {
+      return kSnappyCompression;
+    } else if (strcmp(env, "zstd") == 0) {
+      return kZstdCompression;
+    } else if (strcmp(env, "lz4") == 0) {
+      return kLZ4Compression;
+    } else {
+      fprintf(stderr, "Bad COMPRESSION: %s\n", env);
+      exit(1);
+    }
+  }
+
+  static const char* ToString(CompressionType type) {
+    switch (type) {
+      case kNoCompression:
+        return "None";
+      case kSnappyCompression:
+        return "Snappy";
+      case kZstdCompression:
+        return "Zstd";
+      case kLZ4Compression:
+        return "LZ4";
+      default:
+        return "Unknown";
+    }
+  }
+
   static int GetOption(const char* key, int defval) {
     const char* env = getenv(key);
     if (env == NULL) {
@@ -766,10 +1459,10 @@ class PlfsIoBench {
     options_.skip_sort = ordered_keys_ != 0;
     options_.leveldb_compatible = GetOption("LEVELDB_FMT", true) != 0;
     options_.fixed_kv_length = GetOption("FIXED_KV", true) != 0;
-    options_.compression =
-        GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression;
-    options_.index_compression =
-        GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression;
+    options_.key_column = GetOption("KEY_COLUMN", false) != 0;
+    options_.compression = GetCompressionType(
+        GetOption("SNAPPY", false) ? kSnappyCompression : kNoCompression);
+    options_.index_compression = options_.compression;
     options_.force_compression = true;
     options_.total_memtable_budget =
         static_cast<size_t>(GetOption("MEMTABLE_SIZE", 48) << 20);
@@ -1122,8 +1815,8 @@ class PlfsIoBench {
     fprintf(stderr,
             "             Input Keys: pre-generated=%s, pre-sorted=%s\n",
             keys_.empty() ? "No" : "Yes", ordered_keys_ ? "Yes" : "No");
-    fprintf(stderr, "     Snappy Compression: %s\n",
-            options_.index_compression == kSnappyCompression ? "Yes" : "No");
+    fprintf(stderr, "            Compression: %s\n",
+            ToString(options_.compression));
     fprintf(stderr, "            Blk Padding: %s\n",
             options_.block_padding ? "Yes" : "No");
     fprintf(stderr, "                 TB Fmt: %s\n",
@@ -1540,6 +2233,126 @@ class PlfsQuBench : protected PlfsIoBench {
   Histo seeks_;
 };
 
+// Measure compression ratio and speed of each compression type on data
+// blocks formatted as VPIC particle records.
+class PlfsZipBench {
+ public:
+  PlfsZipBench() {
+    block_size_ =
+        static_cast<size_t>(PlfsIoBench::GetOption("BLOCK_SIZE", 32) << 10);
+    num_blocks_ = PlfsIoBench::GetOption("NUM_BLOCKS", 256);
+    options_.key_size = 8;
+    options_.value_size = 32;  // Matches the particles made below
+    options_.fixed_kv_length = true;
+  }
+
+  // A VPIC particle: position offsets within a cell, a cell index,
+  // momentum, and a statistical weight. Cells are visited in order and
+  // momenta are drawn from a narrow distribution.
+  static void MakeParticle(Random* rnd, uint64_t id, std::string* value) {
+    float fs[7];
+    const int32_t cell = static_cast<int32_t>(id / 64);
+    for (int i = 0; i < 3; i++) fs[i] = rnd->Uniform(1 << 20) / float(1 << 20);
+    for (int i = 3; i < 6; i++) {
+      fs[i] = (rnd->Uniform(1 << 16) - (1 << 15)) / float(1 << 19);
+    }
+    fs[6] = 1.0f;  // Weights are uniform in most runs
+    value->assign(reinterpret_cast<char*>(fs), 3 * sizeof(float));
+    value->append(reinterpret_cast<const char*>(&cell), sizeof(cell));
+    value->append(reinterpret_cast<char*>(fs + 3), 4 * sizeof(float));
+  }
+
+  void LogAndApply() {
+    Random rnd(301);
+    std::vector<std::string> blocks;
+    std::string key;
+    std::string value;
+    uint64_t id = 0;
+    const size_t entry_size = options_.key_size + options_.value_size;
+    for (int i = 0; i < num_blocks_; i++) {
+      ArrayBlockBuilder builder(options_, true);
+      while (builder.CurrentSizeEstimate() + entry_size <= block_size_) {
+        key.clear();
+        PutFixed64(&key, id);
+        MakeParticle(&rnd, id, &value);
+        builder.Add(key, value);
+        id++;
+      }
+      blocks.push_back(builder.Finish().ToString());
+    }
+
+    fprintf(stderr, "Blocks: %d x %d KB, %llu particles\n", num_blocks_,
+            int(block_size_ >> 10), static_cast<unsigned long long>(id));
+    const CompressionType types[] = {kSnappyCompression, kZstdCompression,
+                                     kLZ4Compression};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      Run(types[i], blocks);
+    }
+  }
+
+ private:
+  static bool Compress(CompressionType type, const Slice& input,
+                       std::string* output) {
+    switch (type) {
+      case kSnappyCompression:
+        return port::Snappy_Compress(input.data(), input.size(), output);
+      case kZstdCompression:
+        return port::Zstd_Compress(input.data(), input.size(), output);
+      case kLZ4Compression:
+        return port::Lz4_Compress(input.data(), input.size(), output);
+      default:
+        return false;
+    }
+  }
+
+  static bool Uncompress(CompressionType type, const Slice& input,
+                         char* output) {
+    switch (type) {
+      case kSnappyCompression:
+        return port::Snappy_Uncompress(input.data(), input.size(), output);
+      case kZstdCompression:
+        return port::Zstd_Uncompress(input.data(), input.size(), output);
+      case kLZ4Compression:
+        return port::Lz4_Uncompress(input.data(), input.size(), output);
+      default:
+        return false;
+    }
+  }
+
+  void Run(CompressionType type, const std::vector<std::string>& blocks) {
+    const char* const name = PlfsIoBench::ToString(type);
+    std::vector<std::string> compressed(blocks.size());
+    uint64_t raw_bytes = 0;
+    uint64_t bytes = 0;
+    Env* const env = Env::Default();
+    uint64_t start = env->NowMicros();
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (!Compress(type, blocks[i], &compressed[i])) {
+        fprintf(stderr, "%8s: not supported\n", name);
+        return;
+      }
+      raw_bytes += blocks[i].size();
+      bytes += compressed[i].size();
+    }
+    const uint64_t compress_micros = env->NowMicros() - start;
+    std::string buf(block_size_, 0);
+    start = env->NowMicros();
+    for (size_t i = 0; i < compressed.size(); i++) {
+      ASSERT_TRUE(Uncompress(type, compressed[i], &buf[0]));
+    }
+    const uint64_t uncompress_micros = env->NowMicros() - start;
+    fprintf(stderr,
+            "%8s: ratio %.3f, compress %.1f MB/s, uncompress %.1f MB/s\n",
+            name, 1.0 * raw_bytes / bytes,
+            1.0 * raw_bytes / std::max<uint64_t>(1, compress_micros),
+            1.0 * raw_bytes / std::max<uint64_t>(1, uncompress_micros));
+  }
+
+  DirOptions options_;
+  size_t block_size_;
+  int num_blocks_;
+};
+
 }  // namespace plfsio
 }  // namespace pdlfs
 
@@ -1551,7 +2364,9 @@ class PlfsQuBench : protected PlfsIoBench {
 #endif
 
 static void BM_Usage() {
-  fprintf(stderr, "Use --bench=io or --bench=qu to select a benchmark.\n");
+  fprintf(stderr,
+          "Use --bench=io, --bench=qu, or --bench=zip to select a "
+          "benchmark.\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "== workload confs\n");
   fprintf(stderr, "LINK_SPEED\n");
@@ -1561,6 +2376,7 @@ static void BM_Usage() {
   fprintf(stderr, "ORDERED_KEYS\n");
   fprintf(stderr, "LEVELDB_FMT\n");
   fprintf(stderr, "FIXED_KV\n");
+  fprintf(stderr, "KEY_COLUMN\n");
   fprintf(stderr, "VALUE_SIZE\n");
   fprintf(stderr, "KEY_SIZE\n");
   fprintf(stderr, "\n");
@@ -1577,6 +2393,7 @@ static void BM_Usage() {
   fprintf(stderr, "BLOCK_UTIL\n");
   fprintf(stderr, "BLOCK_PADDING\n");
   fprintf(stderr, "SNAPPY\n");
+  fprintf(stderr, "COMPRESSION (none, snappy, zstd, lz4)\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "== plfsdir filter options\n");
   fprintf(stderr, "FT_TYPE (bf, bmp, r, fvbp, fpfd)\n");
@@ -1597,6 +2414,9 @@ static void BM_LogAndApply(const char* bm) {
   } else if (strcmp(bm, "qu") == 0) {
     pdlfs::plfsio::PlfsQuBench bench;
     bench.LogAndApply();
+  } else if (strcmp(bm, "zip") == 0) {
+    pdlfs::plfsio::PlfsZipBench bench;
+    bench.LogAndApply();
   } else {
     BM_Usage();
   }